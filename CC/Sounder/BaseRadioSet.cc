@@ -357,9 +357,9 @@ void BaseRadioSet::init(BaseRadioContext* context) {
   MLPD_TRACE("Deleting context for tid: %d\n", i);
 
   auto channels = Utils::strToChannels(_cfg->bs_channel());
-  SoapySDR::Kwargs args;
+  SoapySDR::Kwargs args = SoapySDR::KwargsFromString(_cfg->sdr_args());
   if (kUseSoapyUHD == false) {
-    args["driver"] = "iris";
+    args["driver"] = _cfg->sdr_driver();
     args["serial"] = _cfg->bs_sdr_ids().at(c).at(i);
   } else {
     args["driver"] = "uhd";
@@ -266,10 +266,10 @@ void ClientRadioSet::init(ClientRadioContext* context) {
   auto channels = Utils::strToChannels(_cfg->cl_channel());
   MLPD_TRACE("ClientRadioSet setting up radio: %d : %zu\n", (i + 1),
              _cfg->num_cl_sdrs());
-  SoapySDR::Kwargs args;
+  SoapySDR::Kwargs args = SoapySDR::KwargsFromString(_cfg->sdr_args());
   args["timeout"] = "1000000";
   if (kUseSoapyUHD == false) {
-    args["driver"] = "iris";
+    args["driver"] = _cfg->sdr_driver();
     args["serial"] = _cfg->cl_sdr_ids().at(i);
   } else {
     args["driver"] = "uhd";
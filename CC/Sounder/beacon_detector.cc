@@ -0,0 +1,202 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Streaming beacon detection on the samples of one client radio
+---------------------------------------------------------------------
+*/
+
+#include "include/beacon_detector.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "include/logger.h"
+
+static constexpr float kSampleScale = 1.f / SHRT_MAX;
+
+BeaconDetector::BeaconDetector(
+    const std::vector<std::complex<float>>& sequence, size_t max_push,
+    bool fixed_point)
+    : correlator_(sequence),
+      taps_(sequence.size()),
+      fixed_point_(fixed_point),
+      power_shift_(0),
+      power_unit_(1) {
+  if (fixed_point == true) {
+    // A sample times a sequence value is at most 2 * 2^15 * seq_max per
+    // component, and taps_ of them have to fit an int32
+    const int64_t seq_max =
+        std::min<int64_t>(SHRT_MAX, INT32_MAX / (2 * 32768 * this->taps_));
+    if (seq_max < 1) {
+      throw std::invalid_argument(
+          "BeaconDetector: sequence too long for fixed point");
+    }
+    float amplitude = 0;
+    for (const auto& value : sequence) {
+      amplitude = std::max(
+          {amplitude, std::abs(value.real()), std::abs(value.imag())});
+    }
+    if (amplitude == 0) {
+      throw std::invalid_argument("BeaconDetector: all zero sequence");
+    }
+    const float seq_scale = seq_max / amplitude;
+    for (const auto& value : sequence) {
+      this->seq_re_.push_back(std::lround(value.real() * seq_scale));
+      this->seq_im_.push_back(std::lround(value.imag() * seq_scale));
+    }
+    while ((size_t{1} << this->power_shift_) < this->taps_) {
+      this->power_shift_++;
+    }
+    const double corr_unit = static_cast<double>(SHRT_MAX) * seq_scale;
+    this->power_unit_ =
+        corr_unit * corr_unit / static_cast<double>(1ull << this->power_shift_);
+    MLPD_INFO("Fixed point beacon detection, sequence of %zu scaled to %ld\n",
+              this->taps_, static_cast<long>(seq_max));
+  }
+  this->Reserve(max_push);
+  this->Reset();
+}
+
+void BeaconDetector::Reserve(size_t count) {
+  const size_t taps = this->taps_;
+  if (this->fixed_point_ == true) {
+    if (this->sample_re_.size() >= taps - 1 + count) return;
+    this->sample_re_.resize(taps - 1 + count);
+    this->sample_im_.resize(taps - 1 + count);
+    this->corr_re_.resize(count);
+    this->corr_im_.resize(count);
+    this->fixed_power_.resize(taps + count);
+  } else {
+    if (this->samples_.size() >= taps - 1 + count) return;
+    this->samples_.resize(taps - 1 + count);
+    this->corr_.resize(taps - 1 + count);
+    this->power_.resize(taps + count);
+  }
+}
+
+void BeaconDetector::Reset() {
+  const size_t taps = this->taps_;
+  if (this->fixed_point_ == true) {
+    std::fill(this->sample_re_.begin(), this->sample_re_.begin() + taps - 1,
+              0);
+    std::fill(this->sample_im_.begin(), this->sample_im_.begin() + taps - 1,
+              0);
+    std::fill(this->fixed_power_.begin(), this->fixed_power_.begin() + taps,
+              0);
+  } else {
+    std::fill(this->samples_.begin(), this->samples_.begin() + taps - 1, 0);
+    std::fill(this->power_.begin(), this->power_.begin() + taps, 0);
+  }
+}
+
+ssize_t BeaconDetector::Push(const std::complex<int16_t>* samples,
+                             size_t count, float corr_scale) {
+  this->Reserve(count);
+  return this->fixed_point_ ? this->PushFixed(samples, count, corr_scale)
+                            : this->PushFloat(samples, count, corr_scale);
+}
+
+ssize_t BeaconDetector::PushFloat(const std::complex<int16_t>* samples,
+                                  size_t count, float corr_scale) {
+  const size_t taps = this->taps_;
+  const int16_t* in = reinterpret_cast<const int16_t*>(samples);
+  float* x = reinterpret_cast<float*>(this->samples_.data() + taps - 1);
+  for (size_t i = 0; i < 2 * count; i++) x[i] = in[i] * kSampleScale;
+
+  // Output taps - 1 + i is the correlation ending at sample i
+  const size_t length = taps - 1 + count;
+  this->correlator_.Correlate(this->samples_.data(), length,
+                              this->corr_.data(), length);
+  const float* corr = reinterpret_cast<const float*>(this->corr_.data());
+  float* power = this->power_.data() + taps;
+  for (size_t i = 0; i < count; i++) {
+    const float re = corr[2 * (taps - 1 + i)];
+    const float im = corr[2 * (taps - 1 + i) + 1];
+    power[i] = re * re + im * im;
+  }
+
+  // Running threshold, restarted every call so that rounding can not pile up
+  ssize_t sync_index = -1;
+  const float* p = this->power_.data();
+  double thresh = 0;
+  for (size_t i = 0; i < taps; i++) thresh += p[i];
+  for (size_t i = 0; i < count; i++) {
+    const float peak = corr_scale * p[taps + i] * p[i];
+    if (peak > std::max(thresh, 0.0)) {
+      sync_index = static_cast<ssize_t>(i);
+      break;
+    }
+    thresh += p[taps + i] - p[i];
+  }
+
+  // Keep the tails for the next call
+  std::memmove(this->samples_.data(), this->samples_.data() + count,
+               (taps - 1) * sizeof(std::complex<float>));
+  std::memmove(this->power_.data(), this->power_.data() + count,
+               taps * sizeof(float));
+  return sync_index;
+}
+
+ssize_t BeaconDetector::PushFixed(const std::complex<int16_t>* samples,
+                                  size_t count, float corr_scale) {
+  const size_t taps = this->taps_;
+  const int16_t* in = reinterpret_cast<const int16_t*>(samples);
+  int16_t* x_re = this->sample_re_.data() + taps - 1;
+  int16_t* x_im = this->sample_im_.data() + taps - 1;
+  for (size_t i = 0; i < count; i++) {
+    x_re[i] = in[2 * i];
+    x_im[i] = in[2 * i + 1];
+  }
+
+  // Correlation ending at sample i, one tap over all samples at a time
+  int32_t* c_re = this->corr_re_.data();
+  int32_t* c_im = this->corr_im_.data();
+  std::fill(c_re, c_re + count, 0);
+  std::fill(c_im, c_im + count, 0);
+  for (size_t j = 0; j < taps; j++) {
+    const int32_t seq_re = this->seq_re_[j];
+    const int32_t seq_im = this->seq_im_[j];
+    const int16_t* s_re = this->sample_re_.data() + j;
+    const int16_t* s_im = this->sample_im_.data() + j;
+    for (size_t i = 0; i < count; i++) {
+      c_re[i] += s_re[i] * seq_re + s_im[i] * seq_im;
+      c_im[i] += s_im[i] * seq_re - s_re[i] * seq_im;
+    }
+  }
+  uint64_t* power = this->fixed_power_.data() + taps;
+  for (size_t i = 0; i < count; i++) {
+    const int64_t re = c_re[i];
+    const int64_t im = c_im[i];
+    power[i] = static_cast<uint64_t>(re * re + im * im) >> this->power_shift_;
+  }
+
+  // The threshold is exact, the test is
+  //   corr_scale p[k] p[k - M] / unit^2 > sum / unit
+  ssize_t sync_index = -1;
+  const uint64_t* p = this->fixed_power_.data();
+  uint64_t thresh = 0;
+  for (size_t i = 0; i < taps; i++) thresh += p[i];
+  for (size_t i = 0; i < count; i++) {
+    const double peak = static_cast<double>(corr_scale) *
+                        static_cast<double>(p[taps + i]) *
+                        static_cast<double>(p[i]);
+    if (peak > this->power_unit_ * static_cast<double>(thresh)) {
+      sync_index = static_cast<ssize_t>(i);
+      break;
+    }
+    thresh += p[taps + i] - p[i];
+  }
+
+  std::memmove(this->sample_re_.data(), this->sample_re_.data() + count,
+               (taps - 1) * sizeof(int16_t));
+  std::memmove(this->sample_im_.data(), this->sample_im_.data() + count,
+               (taps - 1) * sizeof(int16_t));
+  std::memmove(this->fixed_power_.data(), this->fixed_power_.data() + count,
+               taps * sizeof(uint64_t));
+  return sync_index;
+}
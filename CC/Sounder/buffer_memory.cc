@@ -0,0 +1,147 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Sample buffer allocation: hugetlb pages when the kernel has them,
+ placed on the NUMA node of the consuming rx core, faulted in and
+ locked before the capture starts.
+---------------------------------------------------------------------
+*/
+
+#include "include/buffer_memory.h"
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "include/logger.h"
+
+// Memory policy modes from <numaif.h>, which needs libnuma headers
+static constexpr int kMpolDefault = 0;
+static constexpr int kMpolPreferred = 1;
+static constexpr size_t kPageSize1G = 1UL << 30;
+static constexpr size_t kPageSize2M = 1UL << 21;
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/* Sets the calling thread's allocation policy; node < 0 restores the default.
+ * The policy is in effect while the buffer is faulted in, which for hugetlb
+ * mappings is the only point the node can be chosen without risking SIGBUS on
+ * a node that has no free hugepages left: MPOL_PREFERRED falls back instead */
+static bool SetNodePolicy(int node) {
+  unsigned long mask = 0;
+  if (node >= 0) {
+    if (node >= static_cast<int>(sizeof(mask) * 8)) return false;
+    mask = 1UL << node;
+  }
+  const long ret =
+      syscall(SYS_set_mempolicy, node >= 0 ? kMpolPreferred : kMpolDefault,
+              node >= 0 ? &mask : nullptr, node >= 0 ? sizeof(mask) * 8 : 0);
+  return ret == 0;
+}
+
+void BufferMemory::Allocate(size_t bytes, HugePageMode mode, int numa_node) {
+  Free();
+  if (bytes == 0) return;
+
+  std::vector<size_t> page_sizes;
+  if ((mode == kHugePageAuto && bytes >= kPageSize1G) || mode == kHugePage1G) {
+    page_sizes.push_back(kPageSize1G);
+  }
+  if (mode != kHugePageNone) {
+    page_sizes.push_back(kPageSize2M);
+  }
+  page_sizes.push_back(sysconf(_SC_PAGESIZE));
+
+  if (numa_node >= 0 && SetNodePolicy(numa_node) == false) {
+    MLPD_WARN("BufferMemory: cannot prefer NUMA node %d: %s\n", numa_node,
+              std::strerror(errno));
+    numa_node = -1;
+  }
+
+  void* mem = MAP_FAILED;
+  for (size_t page : page_sizes) {
+    const size_t len = (bytes + page - 1) / page * page;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (page == kPageSize1G) {
+      flags |= MAP_HUGETLB | MAP_HUGE_1GB | MAP_POPULATE;
+    } else if (page == kPageSize2M) {
+      flags |= MAP_HUGETLB | MAP_HUGE_2MB | MAP_POPULATE;
+    }
+    mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+      MLPD_INFO("BufferMemory: no %zu kB pages for %zu bytes: %s\n",
+                page / 1024, bytes, std::strerror(errno));
+      continue;
+    }
+    if ((flags & MAP_HUGETLB) == 0) {
+      // Ask for transparent hugepages before the first touch, then prefault
+      madvise(mem, len, MADV_HUGEPAGE);
+      std::memset(mem, 0, len);
+    }
+    mapped_size_ = len;
+    page_size_ = page;
+    break;
+  }
+  if (numa_node >= 0) SetNodePolicy(-1);
+  if (mem == MAP_FAILED) {
+    throw std::runtime_error("BufferMemory: cannot map sample buffer");
+  }
+  data_ = static_cast<char*>(mem);
+  size_ = bytes;
+
+  if (mlock(data_, mapped_size_) != 0) {
+    MLPD_WARN(
+        "BufferMemory: mlock of %zu bytes failed (%s), raise "
+        "RLIMIT_MEMLOCK to keep sample buffers resident\n",
+        mapped_size_, std::strerror(errno));
+  }
+  MLPD_INFO("BufferMemory: %zu bytes in %zu kB pages, NUMA node %d\n", size_,
+            page_size_ / 1024, numa_node);
+}
+
+void BufferMemory::Free(void) {
+  if (data_ == nullptr) return;
+  munmap(data_, mapped_size_);
+  data_ = nullptr;
+  size_ = 0;
+  mapped_size_ = 0;
+  page_size_ = 0;
+}
+
+int BufferMemory::NumaNodeOfCore(int core) {
+  if (core < 0) return -1;
+  const std::string path =
+      "/sys/devices/system/cpu/cpu" + std::to_string(core);
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) return -1;
+  int node = -1;
+  while (struct dirent* entry = readdir(dir)) {
+    if (std::strncmp(entry->d_name, "node", 4) == 0 &&
+        std::isdigit(static_cast<unsigned char>(entry->d_name[4]))) {
+      node = std::atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+HugePageMode BufferMemory::ParseMode(const std::string& mode) {
+  if (mode == "auto") return kHugePageAuto;
+  if (mode == "1G") return kHugePage1G;
+  if (mode == "2M") return kHugePage2M;
+  if (mode == "none") return kHugePageNone;
+  throw std::invalid_argument("Unknown buffer_hugepages value: " + mode);
+}
@@ -0,0 +1,351 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Implementation of the recorder chunk compression pipeline
+---------------------------------------------------------------------
+*/
+
+#include "include/chunk_compressor.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "include/logger.h"
+
+// Rows gathered per dataset before the oldest is submitted incomplete
+static constexpr size_t kOpenRows = 2;
+// Chunks waiting for or in compression per worker
+static constexpr size_t kInFlightPerThread = 4;
+// filter_mask bit of the codec, which follows the shuffle filter
+static constexpr uint32_t kCodecSkipped = 1 << 1;
+
+#ifdef USE_ZSTD
+static constexpr H5Z_filter_t kZstdFilterId = 32015;
+
+// Same framing as the zstd filter of hdf5plugin: one zstd frame per chunk
+static size_t ZstdFilter(unsigned int flags, size_t cd_nelmts,
+                         const unsigned int cd_values[], size_t nbytes,
+                         size_t* buf_size, void** buf) {
+  size_t out_size;
+  void* out;
+  size_t ret;
+  if ((flags & H5Z_FLAG_REVERSE) != 0) {
+    const unsigned long long size = ZSTD_getFrameContentSize(*buf, nbytes);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {
+      return 0;
+    }
+    out_size = size;
+    out = H5allocate_memory(out_size, false);
+    if (out == nullptr) return 0;
+    ret = ZSTD_decompress(out, out_size, *buf, nbytes);
+  } else {
+    const int level = cd_nelmts > 0 ? static_cast<int>(cd_values[0]) : 1;
+    out_size = ZSTD_compressBound(nbytes);
+    out = H5allocate_memory(out_size, false);
+    if (out == nullptr) return 0;
+    ret = ZSTD_compress(out, out_size, *buf, nbytes, level);
+  }
+  if (ZSTD_isError(ret) != 0) {
+    H5free_memory(out);
+    return 0;
+  }
+  H5free_memory(*buf);
+  *buf = out;
+  *buf_size = out_size;
+  return ret;
+}
+#endif
+
+namespace Sounder {
+ChunkCompressor::ChunkCompressor(Hdf5Lib* hdf5, Hdf5Codec codec, int level,
+                                 size_t threads)
+    : hdf5_(hdf5),
+      codec_(codec),
+      level_(level),
+      max_in_flight_(kInFlightPerThread * std::max<size_t>(threads, 1)),
+      raw_bytes_(0),
+      stored_bytes_(0),
+      stop_(false) {
+  if (codec == kCodecNone) {
+    throw std::invalid_argument("ChunkCompressor: no codec given");
+  }
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+    this->workers_.emplace_back(&ChunkCompressor::WorkerLoop, this);
+  }
+}
+
+ChunkCompressor::~ChunkCompressor() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->stop_ = true;
+  }
+  this->work_cond_.notify_all();
+  for (auto& worker : this->workers_) worker.join();
+}
+
+void ChunkCompressor::RegisterFilters(void) {
+#ifdef USE_ZSTD
+  if (H5Zfilter_avail(kZstdFilterId) > 0) return;
+  static const H5Z_class2_t kZstdClass = {
+      H5Z_CLASS_T_VERS, kZstdFilterId, 1, 1, "zstd", nullptr, nullptr,
+      ZstdFilter};
+  if (H5Zregister(&kZstdClass) < 0) {
+    throw std::runtime_error("ChunkCompressor: cannot register zstd filter");
+  }
+#endif
+}
+
+size_t ChunkCompressor::AddDataset(
+    const std::string& name, const std::array<hsize_t, kDsDimsNum>& dims,
+    const std::array<hsize_t, kDsDimsNum>& chunk) {
+  Dataset ds;
+  ds.name = name;
+  ds.dims = dims;
+  ds.chunk = chunk;
+  ds.frame_samples = dims[1] * dims[2] * dims[3] * dims[4];
+  // A single frame per row is what the write combiner holds anyway
+  const size_t row_bytes = chunk[0] * ds.frame_samples * sizeof(short);
+  if (chunk[0] > 1 && row_bytes > kMaxRowBytes) {
+    throw std::invalid_argument(
+        "ChunkCompressor: rows of " + std::to_string(chunk[0]) +
+        " frames of " + name + " take " + std::to_string(row_bytes >> 20) +
+        " MB, more than " + std::to_string(kMaxRowBytes >> 20) +
+        " MB; use a smaller first chunk dimension");
+  }
+  ds.written_until = 0;
+  ds.written_any = false;
+  this->datasets_.push_back(std::move(ds));
+  return this->datasets_.size() - 1;
+}
+
+ChunkCompressor::Row* ChunkCompressor::OpenRow(Dataset& ds, size_t ds_id,
+                                               hsize_t row) {
+  for (auto& open : ds.open) {
+    if (open.row == row) return &open;
+  }
+  if (ds.written_any == true && row <= ds.written_until) {
+    // The caller writes through the filter pipeline, which must not be
+    // overtaken by a direct write of the same chunk still in compression
+    this->Collect(true);
+    return nullptr;
+  }
+  if (ds.open.size() >= kOpenRows) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < ds.open.size(); i++) {
+      if (ds.open[i].row < ds.open[oldest].row) oldest = i;
+    }
+    this->Submit(ds, ds_id, oldest);
+  }
+  Row new_row;
+  new_row.row = row;
+  new_row.frames = 0;
+  new_row.last_frame = row * ds.chunk[0];
+  if (this->spare_rows_.empty() == false) {
+    new_row.samples = std::move(this->spare_rows_.back());
+    this->spare_rows_.pop_back();
+  }
+  new_row.samples.assign(ds.chunk[0] * ds.frame_samples, 0);
+  ds.open.push_back(std::move(new_row));
+  return &ds.open.back();
+}
+
+bool ChunkCompressor::AddFrame(size_t ds_id, hsize_t frame_id,
+                               const short* samples) {
+  Dataset& ds = this->datasets_.at(ds_id);
+  Row* cur = this->OpenRow(ds, ds_id, frame_id / ds.chunk[0]);
+  if (cur == nullptr) return false;
+  cur->last_frame = std::max(cur->last_frame, frame_id);
+  std::memcpy(cur->samples.data() + (frame_id % ds.chunk[0]) * ds.frame_samples,
+              samples, ds.frame_samples * sizeof(short));
+  if (++cur->frames == ds.chunk[0]) {
+    this->Submit(ds, ds_id, cur - ds.open.data());
+  }
+  return true;
+}
+
+bool ChunkCompressor::AddPacket(size_t ds_id, hsize_t frame_id,
+                                hsize_t cell_id, hsize_t slot,
+                                hsize_t antenna, const short* data) {
+  Dataset& ds = this->datasets_.at(ds_id);
+  if (cell_id >= ds.dims[1] || slot >= ds.dims[2] || antenna >= ds.dims[3]) {
+    return false;
+  }
+  Row* cur = this->OpenRow(ds, ds_id, frame_id / ds.chunk[0]);
+  if (cur == nullptr) return false;
+  cur->last_frame = std::max(cur->last_frame, frame_id);
+  const size_t iq = ds.dims[4];
+  const size_t index =
+      (((frame_id % ds.chunk[0]) * ds.dims[1] + cell_id) * ds.dims[2] + slot) *
+          ds.dims[3] +
+      antenna;
+  std::memcpy(cur->samples.data() + index * iq, data, iq * sizeof(short));
+  return true;
+}
+
+void ChunkCompressor::Submit(Dataset& ds, size_t ds_id, size_t row) {
+  Row cur = std::move(ds.open[row]);
+  if (row != ds.open.size() - 1) ds.open[row] = std::move(ds.open.back());
+  ds.open.pop_back();
+  if (ds.written_any == false || cur.row > ds.written_until) {
+    ds.written_until = cur.row;
+  }
+  ds.written_any = true;
+
+  // Chunks cover the whole row in dimension 0 and tile the others; edge
+  // chunks are stored full size with the part outside the dataset zero
+  const auto& dims = ds.dims;
+  const auto& chunk = ds.chunk;
+  const size_t chunk_samples =
+      chunk[0] * chunk[1] * chunk[2] * chunk[3] * chunk[4];
+  for (hsize_t c0 = 0; c0 < dims[1]; c0 += chunk[1]) {
+    for (hsize_t s0 = 0; s0 < dims[2]; s0 += chunk[2]) {
+      for (hsize_t a0 = 0; a0 < dims[3]; a0 += chunk[3]) {
+        for (hsize_t q0 = 0; q0 < dims[4]; q0 += chunk[4]) {
+          auto job = std::make_unique<Job>();
+          job->ds_id = ds_id;
+          job->offset = {cur.row * chunk[0], c0, s0, a0, q0};
+          job->last_frame = cur.last_frame;
+          job->raw.assign(chunk_samples, 0);
+          job->done = false;
+          const size_t run = std::min(chunk[4], dims[4] - q0);
+          for (hsize_t f = 0; f < chunk[0]; f++) {
+            for (hsize_t c = 0; c < chunk[1] && c0 + c < dims[1]; c++) {
+              for (hsize_t s = 0; s < chunk[2] && s0 + s < dims[2]; s++) {
+                for (hsize_t a = 0; a < chunk[3] && a0 + a < dims[3]; a++) {
+                  const size_t src =
+                      (((f * dims[1] + c0 + c) * dims[2] + s0 + s) * dims[3] +
+                       a0 + a) *
+                          dims[4] +
+                      q0;
+                  const size_t dst =
+                      (((f * chunk[1] + c) * chunk[2] + s) * chunk[3] + a) *
+                      chunk[4];
+                  std::memcpy(job->raw.data() + dst, cur.samples.data() + src,
+                              run * sizeof(short));
+                }
+              }
+            }
+          }
+          // Bound the memory held by chunks the workers have not done yet
+          while (this->in_flight_.size() >= this->max_in_flight_) {
+            this->WriteFront();
+          }
+          Job* queued = job.get();
+          this->in_flight_.push_back(std::move(job));
+          {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->queue_.push_back(queued);
+          }
+          this->work_cond_.notify_one();
+        }
+      }
+    }
+  }
+  this->spare_rows_.push_back(std::move(cur.samples));
+}
+
+void ChunkCompressor::WriteFront(void) {
+  Job& job = *this->in_flight_.front();
+  if (job.done.load(std::memory_order_acquire) == false) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->done_cond_.wait(lock, [&job] { return job.done.load(); });
+  }
+  const std::string& name = this->datasets_.at(job.ds_id).name;
+  this->hdf5_->extendDataset(name, job.last_frame);
+  this->hdf5_->writeChunk(name, job.offset, job.filter_mask, job.out.data(),
+                          job.out.size());
+  this->raw_bytes_ += job.raw.size() * sizeof(short);
+  this->stored_bytes_ += job.out.size();
+  this->in_flight_.pop_front();
+}
+
+void ChunkCompressor::Collect(bool wait) {
+  while (this->in_flight_.empty() == false &&
+         (wait == true ||
+          this->in_flight_.front()->done.load(std::memory_order_acquire))) {
+    this->WriteFront();
+  }
+}
+
+void ChunkCompressor::FlushAll(void) {
+  for (size_t ds_id = 0; ds_id < this->datasets_.size(); ds_id++) {
+    Dataset& ds = this->datasets_[ds_id];
+    while (ds.open.empty() == false) {
+      this->Submit(ds, ds_id, ds.open.size() - 1);
+    }
+  }
+  this->Collect(true);
+  if (this->raw_bytes_ > 0) {
+    MLPD_INFO("Chunk compressor: %zu MB of samples stored in %zu MB\n",
+              this->raw_bytes_ >> 20, this->stored_bytes_ >> 20);
+  }
+}
+
+void ChunkCompressor::Compress(Job& job) const {
+  // Byte shuffle as the HDF5 shuffle filter does it for 2-byte elements
+  const size_t count = job.raw.size();
+  const size_t bytes = count * sizeof(short);
+  thread_local std::vector<unsigned char> shuffled;
+  shuffled.resize(bytes);
+  const unsigned char* raw =
+      reinterpret_cast<const unsigned char*>(job.raw.data());
+  for (size_t i = 0; i < count; i++) {
+    shuffled[i] = raw[2 * i];
+    shuffled[count + i] = raw[2 * i + 1];
+  }
+
+  size_t stored = 0;
+  if (this->codec_ == kCodecDeflate) {
+    uLongf len = compressBound(bytes);
+    job.out.resize(len);
+    if (compress2(reinterpret_cast<Bytef*>(job.out.data()), &len,
+                  shuffled.data(), bytes, this->level_) == Z_OK) {
+      stored = len;
+    }
+  }
+#ifdef USE_ZSTD
+  if (this->codec_ == kCodecZstd) {
+    job.out.resize(ZSTD_compressBound(bytes));
+    const size_t len = ZSTD_compress(job.out.data(), job.out.size(),
+                                     shuffled.data(), bytes, this->level_);
+    if (ZSTD_isError(len) == 0) stored = len;
+  }
+#endif
+  if (stored > 0 && stored < bytes) {
+    job.out.resize(stored);
+    job.filter_mask = 0;
+  } else {
+    // Incompressible: keep the shuffled bytes, as the optional codec would
+    job.out.assign(shuffled.begin(), shuffled.end());
+    job.filter_mask = kCodecSkipped;
+  }
+}
+
+void ChunkCompressor::WorkerLoop(void) {
+  while (true) {
+    Job* job;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex_);
+      this->work_cond_.wait(
+          lock, [this] { return this->stop_ || !this->queue_.empty(); });
+      if (this->stop_ == true) return;
+      job = this->queue_.front();
+      this->queue_.pop_front();
+    }
+    this->Compress(*job);
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      job->done.store(true, std::memory_order_release);
+    }
+    this->done_cond_.notify_all();
+  }
+}
+};  // namespace Sounder
@@ -0,0 +1,212 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ AVX2 / FMA versions of the comms kernels
+---------------------------------------------------------------------
+*/
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#include <cstring>
+
+#include "include/comms-kernels.h"
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+//single-precision
+static constexpr size_t kPackedSp = 8;
+// complex short int
+static constexpr size_t kPackedCs = 8;
+// short int
+static constexpr size_t kPackedSi = 16;
+
+AVX2_TARGET static inline __m256i MultCs16(__m256i data1, __m256i data2,
+                                           bool conj) {
+  const __m256i neg0 = _mm256_set1_epi32(0xFFFF0000);
+  const __m256i neg1 = _mm256_set1_epi32(0x00010000);
+  const __m256i mix = _mm256_set1_epi32(0x0000FFFF);
+
+  __m256i temp0 = _mm256_xor_si256(data2, neg0);
+  temp0 = _mm256_add_epi32(temp0, neg1);
+
+  __m256i temp1 = _mm256_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
+  temp1 = _mm256_shufflelo_epi16(temp1, 0xb1);
+
+  __m256i re = _mm256_madd_epi16(data1, conj ? data2 : temp0);
+  __m256i im = _mm256_madd_epi16(data1, temp1);
+
+  re = _mm256_srai_epi32(re, 15);
+  im = _mm256_srai_epi32(im, 15);
+
+  re = _mm256_and_si256(re, mix);
+  im = _mm256_and_si256(im, mix);
+  im = _mm256_slli_epi32(im, 0x10);
+
+  return _mm256_or_si256(re, im);
+}
+
+AVX2_TARGET static inline __m256 MultCf32(__m256 data1, __m256 data2,
+                                          bool conj) {
+  // https://stackoverflow.com/questions/39509746
+  const __m256 neg0 =
+      _mm256_setr_ps(1.0, -1.0, 1.0, -1.0, 1.0, -1.0, 1.0, -1.0);
+  const __m256 neg1 = _mm256_set_ps(1.0, -1.0, 1.0, -1.0, 1.0, -1.0, 1.0, -1.0);
+  __m256 prod0 = _mm256_mul_ps(data1, data2);  // q1*q2, i1*i2, ...
+
+  /* Step 2: Negate the imaginary elements of vec2 */
+  data2 = _mm256_mul_ps(data2, conj ? neg0 : neg1);
+
+  /* Step 3: Switch the real and imaginary elements of vec2 */
+  data2 = _mm256_permute_ps(data2, 0xb1);
+
+  /* Step 4: Multiply vec1 and the modified vec2 */
+  __m256 prod1 = _mm256_mul_ps(data1, data2);  // i2*q1, -i1*q2, ...
+
+  /* Horizontally add the elements in vec3 and vec4 */
+  __m256 res = conj ? _mm256_hadd_ps(prod0, prod1)
+                    : _mm256_hsub_ps(prod0, prod1);
+  return _mm256_permute_ps(res, 0xd8);
+}
+
+AVX2_TARGET static void ComplexMultCf32(const float* f, const float* g,
+                                        float* out, size_t count, bool conj) {
+  const size_t vec_end = (2 * count) - (2 * count) % kPackedSp;
+  for (size_t i = 0; i < vec_end; i += kPackedSp) {
+    const __m256 res =
+        MultCf32(_mm256_loadu_ps(f + i), _mm256_loadu_ps(g + i), conj);
+    _mm256_storeu_ps(out + i, res);
+  }
+  kScalarCommsKernels.complex_mult_cf32(f + vec_end, g + vec_end,
+                                        out + vec_end, count - vec_end / 2,
+                                        conj);
+}
+
+AVX2_TARGET static void ComplexMultCs16(const int16_t* f, const int16_t* g,
+                                        int16_t* out, size_t count,
+                                        bool conj) {
+  const size_t vec_end = count - count % kPackedCs;
+  for (size_t i = 0; i < vec_end; i += kPackedCs) {
+    const __m256i data0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(f + 2 * i));
+    const __m256i data1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(g + 2 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                        MultCs16(data0, data1, conj));
+  }
+  kScalarCommsKernels.complex_mult_cs16(f + 2 * vec_end, g + 2 * vec_end,
+                                        out + 2 * vec_end, count - vec_end,
+                                        conj);
+}
+
+AVX2_TARGET static void Abs2Cf32(const float* in, float* out, size_t count) {
+  const __m256i perm0 =
+      _mm256_set_epi32(0x7, 0x6, 0x3, 0x2, 0x5, 0x4, 0x1, 0x0);
+  const size_t vec_end = count - count % kPackedSp;
+  for (size_t i = 0; i < vec_end; i += kPackedSp) {
+    // low index go to high bit of __m256 variable apparently
+    const __m256 data1 = _mm256_loadu_ps(in + 2 * i);
+    const __m256 data2 = _mm256_loadu_ps(in + 2 * i + kPackedSp);
+    __m256 res = _mm256_hadd_ps(_mm256_mul_ps(data1, data1),
+                                _mm256_mul_ps(data2, data2));
+    res = _mm256_permutevar8x32_ps(res, perm0);
+    _mm256_storeu_ps(out + i, res);
+  }
+  kScalarCommsKernels.abs2_cf32(in + 2 * vec_end, out + vec_end,
+                                count - vec_end);
+}
+
+AVX2_TARGET static void Abs2Cs16(const int16_t* in, int32_t* out,
+                                 size_t count) {
+  const size_t vec_end = count - count % kPackedCs;
+  for (size_t i = 0; i < vec_end; i += kPackedCs) {
+    const __m256i data0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 2 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_madd_epi16(data0, data0));
+  }
+  kScalarCommsKernels.abs2_cs16(in + 2 * vec_end, out + vec_end,
+                                count - vec_end);
+}
+
+AVX2_TARGET static void CorrelateCf32(const float* in, const float* seq,
+                                      size_t taps, float* out, size_t count) {
+  const __m256 ones = _mm256_set1_ps(1.f);
+  const size_t vec_end = count - count % (kPackedSp / 2);
+  for (size_t i = 0; i < vec_end; i += kPackedSp / 2) {
+    // x * re in one sum, swapped x * im in the other
+    __m256 acc_re = _mm256_setzero_ps();
+    __m256 acc_im = _mm256_setzero_ps();
+    for (size_t j = 0; j < taps; j++) {
+      const __m256 data = _mm256_loadu_ps(in + 2 * (i + j));
+      acc_re = _mm256_fmadd_ps(data, _mm256_broadcast_ss(seq + 2 * j), acc_re);
+      acc_im = _mm256_fmadd_ps(_mm256_permute_ps(data, 0xb1),
+                               _mm256_broadcast_ss(seq + 2 * j + 1), acc_im);
+    }
+    _mm256_storeu_ps(out + 2 * i, _mm256_fmsubadd_ps(ones, acc_re, acc_im));
+  }
+  kScalarCommsKernels.correlate_cf32(in + 2 * vec_end, seq, taps,
+                                     out + 2 * vec_end, count - vec_end);
+}
+
+AVX2_TARGET static void CorrelateCs16(const int16_t* in, const int16_t* seq,
+                                      size_t taps, int16_t* out,
+                                      size_t count) {
+  const size_t vec_end = count - count % kPackedCs;
+  for (size_t i = 0; i < vec_end; i += kPackedCs) {
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t j = 0; j < taps; j++) {
+      int32_t seq_value;
+      std::memcpy(&seq_value, seq + 2 * j, sizeof(seq_value));
+      const __m256i data = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(in + 2 * (i + j)));
+      const __m256i prod = MultCs16(data, _mm256_set1_epi32(seq_value), true);
+      acc = _mm256_adds_epi16(acc, prod);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i), acc);
+  }
+  kScalarCommsKernels.correlate_cs16(in + 2 * vec_end, seq, taps,
+                                     out + 2 * vec_end, count - vec_end);
+}
+
+AVX2_TARGET static void CorrelateF32(const float* in, const float* seq,
+                                     size_t taps, float* out, size_t count) {
+  const size_t vec_end = count - count % kPackedSp;
+  for (size_t i = 0; i < vec_end; i += kPackedSp) {
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t j = 0; j < taps; j++) {
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(in + i + j),
+                            _mm256_broadcast_ss(seq + j), acc);
+    }
+    _mm256_storeu_ps(out + i, acc);
+  }
+  kScalarCommsKernels.correlate_f32(in + vec_end, seq, taps, out + vec_end,
+                                    count - vec_end);
+}
+
+AVX2_TARGET static void CorrelateS16(const int16_t* in, const int16_t* seq,
+                                     size_t taps, int16_t* out, size_t count) {
+  const size_t vec_end = count - count % kPackedSi;
+  for (size_t i = 0; i < vec_end; i += kPackedSi) {
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t j = 0; j < taps; j++) {
+      const __m256i data =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + j));
+      acc = _mm256_adds_epi16(
+          acc, _mm256_mulhi_epi16(data, _mm256_set1_epi16(seq[j])));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), acc);
+  }
+  kScalarCommsKernels.correlate_s16(in + vec_end, seq, taps, out + vec_end,
+                                    count - vec_end);
+}
+
+const CommsKernels kAvx2CommsKernels = {
+    SimdLevel::kAvx2, ComplexMultCf32, ComplexMultCs16,
+    Abs2Cf32,         Abs2Cs16,        CorrelateCf32,
+    CorrelateCs16,    CorrelateF32,    CorrelateS16};
+
+#endif
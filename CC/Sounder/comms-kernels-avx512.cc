@@ -0,0 +1,208 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ AVX-512 (F + BW) versions of the comms kernels, tails are masked
+---------------------------------------------------------------------
+*/
+
+#if defined(__x86_64__)
+
+// GCC 12 warns about the _mm512_undefined_* inside some intrinsics when they
+// are expanded in a target attribute function. The warning points into the
+// intrinsic headers, so only they are exempt.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+#include <cstring>
+
+#include "include/comms-kernels.h"
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,fma")))
+
+static constexpr size_t kPackedSp = 16;
+static constexpr size_t kPackedCs = 16;
+static constexpr size_t kPackedSi = 32;
+
+static inline __mmask16 Mask16(size_t count) {
+  return static_cast<__mmask16>((1u << count) - 1);
+}
+
+static inline __mmask32 Mask32(size_t count) {
+  return static_cast<__mmask32>((1ull << count) - 1);
+}
+
+// Same steps as the AVX2 version, 16 values at a time
+AVX512_TARGET static inline __m512i MultCs16(__m512i data1, __m512i data2,
+                                             bool conj) {
+  const __m512i neg0 = _mm512_set1_epi32(0xFFFF0000);
+  const __m512i neg1 = _mm512_set1_epi32(0x00010000);
+  const __m512i mix = _mm512_set1_epi32(0x0000FFFF);
+
+  __m512i temp0 = _mm512_xor_si512(data2, neg0);
+  temp0 = _mm512_add_epi32(temp0, neg1);
+
+  __m512i temp1 = _mm512_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
+  temp1 = _mm512_shufflelo_epi16(temp1, 0xb1);
+
+  __m512i re = _mm512_madd_epi16(data1, conj ? data2 : temp0);
+  __m512i im = _mm512_madd_epi16(data1, temp1);
+
+  re = _mm512_and_si512(_mm512_srai_epi32(re, 15), mix);
+  im = _mm512_slli_epi32(_mm512_srai_epi32(im, 15), 0x10);
+  return _mm512_or_si512(re, im);
+}
+
+// f * g is f * re(g) -/+ swapped f * im(g) on the real/imaginary lanes
+AVX512_TARGET static inline __m512 MultCf32(__m512 f, __m512 g, bool conj) {
+  const __m512 swapped = _mm512_mul_ps(_mm512_permute_ps(f, 0xb1),
+                                       _mm512_movehdup_ps(g));
+  return conj ? _mm512_fmsubadd_ps(f, _mm512_moveldup_ps(g), swapped)
+              : _mm512_fmaddsub_ps(f, _mm512_moveldup_ps(g), swapped);
+}
+
+AVX512_TARGET static void ComplexMultCf32(const float* f, const float* g,
+                                          float* out, size_t count,
+                                          bool conj) {
+  size_t i = 0;
+  for (; i + kPackedSp <= 2 * count; i += kPackedSp) {
+    const __m512 res =
+        MultCf32(_mm512_loadu_ps(f + i), _mm512_loadu_ps(g + i), conj);
+    _mm512_storeu_ps(out + i, res);
+  }
+  if (i < 2 * count) {
+    const __mmask16 mask = Mask16(2 * count - i);
+    const __m512 res = MultCf32(_mm512_maskz_loadu_ps(mask, f + i),
+                                _mm512_maskz_loadu_ps(mask, g + i), conj);
+    _mm512_mask_storeu_ps(out + i, mask, res);
+  }
+}
+
+AVX512_TARGET static void ComplexMultCs16(const int16_t* f, const int16_t* g,
+                                          int16_t* out, size_t count,
+                                          bool conj) {
+  size_t i = 0;
+  for (; i + kPackedCs <= count; i += kPackedCs) {
+    const __m512i res =
+        MultCs16(_mm512_loadu_si512(f + 2 * i), _mm512_loadu_si512(g + 2 * i),
+                 conj);
+    _mm512_storeu_si512(out + 2 * i, res);
+  }
+  if (i < count) {
+    const __mmask16 mask = Mask16(count - i);
+    const __m512i res = MultCs16(_mm512_maskz_loadu_epi32(mask, f + 2 * i),
+                                 _mm512_maskz_loadu_epi32(mask, g + 2 * i),
+                                 conj);
+    _mm512_mask_storeu_epi32(out + 2 * i, mask, res);
+  }
+}
+
+AVX512_TARGET static void Abs2Cf32(const float* in, float* out, size_t count) {
+  // The even lanes of both halves
+  const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18,
+                                         20, 22, 24, 26, 28, 30);
+  size_t i = 0;
+  for (; i + kPackedSp <= count; i += kPackedSp) {
+    __m512 lo = _mm512_loadu_ps(in + 2 * i);
+    __m512 hi = _mm512_loadu_ps(in + 2 * i + kPackedSp);
+    lo = _mm512_mul_ps(lo, lo);
+    hi = _mm512_mul_ps(hi, hi);
+    lo = _mm512_add_ps(lo, _mm512_permute_ps(lo, 0xb1));
+    hi = _mm512_add_ps(hi, _mm512_permute_ps(hi, 0xb1));
+    _mm512_storeu_ps(out + i, _mm512_permutex2var_ps(lo, even, hi));
+  }
+  kScalarCommsKernels.abs2_cf32(in + 2 * i, out + i, count - i);
+}
+
+AVX512_TARGET static void Abs2Cs16(const int16_t* in, int32_t* out,
+                                   size_t count) {
+  size_t i = 0;
+  for (; i + kPackedCs <= count; i += kPackedCs) {
+    const __m512i data = _mm512_loadu_si512(in + 2 * i);
+    _mm512_storeu_si512(out + i, _mm512_madd_epi16(data, data));
+  }
+  if (i < count) {
+    const __mmask16 mask = Mask16(count - i);
+    const __m512i data = _mm512_maskz_loadu_epi32(mask, in + 2 * i);
+    _mm512_mask_storeu_epi32(out + i, mask, _mm512_madd_epi16(data, data));
+  }
+}
+
+AVX512_TARGET static void CorrelateCf32(const float* in, const float* seq,
+                                        size_t taps, float* out,
+                                        size_t count) {
+  const __m512 ones = _mm512_set1_ps(1.f);
+  for (size_t i = 0; i < count; i += kPackedSp / 2) {
+    const size_t outputs =
+        count - i < kPackedSp / 2 ? count - i : kPackedSp / 2;
+    const __mmask16 mask = Mask16(2 * outputs);
+    __m512 acc_re = _mm512_setzero_ps();
+    __m512 acc_im = _mm512_setzero_ps();
+    for (size_t j = 0; j < taps; j++) {
+      const __m512 data = _mm512_maskz_loadu_ps(mask, in + 2 * (i + j));
+      acc_re = _mm512_fmadd_ps(data, _mm512_set1_ps(seq[2 * j]), acc_re);
+      acc_im = _mm512_fmadd_ps(_mm512_permute_ps(data, 0xb1),
+                               _mm512_set1_ps(seq[2 * j + 1]), acc_im);
+    }
+    _mm512_mask_storeu_ps(out + 2 * i, mask,
+                          _mm512_fmsubadd_ps(ones, acc_re, acc_im));
+  }
+}
+
+AVX512_TARGET static void CorrelateCs16(const int16_t* in, const int16_t* seq,
+                                        size_t taps, int16_t* out,
+                                        size_t count) {
+  for (size_t i = 0; i < count; i += kPackedCs) {
+    const __mmask16 mask =
+        Mask16(count - i < kPackedCs ? count - i : kPackedCs);
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t j = 0; j < taps; j++) {
+      int32_t seq_value;
+      std::memcpy(&seq_value, seq + 2 * j, sizeof(seq_value));
+      const __m512i data = _mm512_maskz_loadu_epi32(mask, in + 2 * (i + j));
+      acc = _mm512_adds_epi16(
+          acc, MultCs16(data, _mm512_set1_epi32(seq_value), true));
+    }
+    _mm512_mask_storeu_epi32(out + 2 * i, mask, acc);
+  }
+}
+
+AVX512_TARGET static void CorrelateF32(const float* in, const float* seq,
+                                       size_t taps, float* out, size_t count) {
+  for (size_t i = 0; i < count; i += kPackedSp) {
+    const __mmask16 mask =
+        Mask16(count - i < kPackedSp ? count - i : kPackedSp);
+    __m512 acc = _mm512_setzero_ps();
+    for (size_t j = 0; j < taps; j++) {
+      acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, in + i + j),
+                            _mm512_set1_ps(seq[j]), acc);
+    }
+    _mm512_mask_storeu_ps(out + i, mask, acc);
+  }
+}
+
+AVX512_TARGET static void CorrelateS16(const int16_t* in, const int16_t* seq,
+                                       size_t taps, int16_t* out,
+                                       size_t count) {
+  for (size_t i = 0; i < count; i += kPackedSi) {
+    const __mmask32 mask =
+        Mask32(count - i < kPackedSi ? count - i : kPackedSi);
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t j = 0; j < taps; j++) {
+      const __m512i data = _mm512_maskz_loadu_epi16(mask, in + i + j);
+      acc = _mm512_adds_epi16(
+          acc, _mm512_mulhi_epi16(data, _mm512_set1_epi16(seq[j])));
+    }
+    _mm512_mask_storeu_epi16(out + i, mask, acc);
+  }
+}
+
+const CommsKernels kAvx512CommsKernels = {
+    SimdLevel::kAvx512, ComplexMultCf32, ComplexMultCs16,
+    Abs2Cf32,           Abs2Cs16,        CorrelateCf32,
+    CorrelateCs16,      CorrelateF32,    CorrelateS16};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Kernel selection and the portable versions of the kernels
+---------------------------------------------------------------------
+*/
+
+#include "include/comms-kernels.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "include/logger.h"
+
+static constexpr char kSimdEnv[] = "SOUNDER_SIMD";
+
+// Q15 result of a 32 bit multiply-add, wrapping like the SIMD versions
+static inline int16_t Q15(int64_t sum) {
+  return static_cast<int16_t>(
+      static_cast<int32_t>(static_cast<uint32_t>(sum)) >> 15);
+}
+
+static inline int16_t Negate16(int16_t value) {
+  return static_cast<int16_t>(-static_cast<int32_t>(value));
+}
+
+static inline int16_t AddSat16(int16_t a, int16_t b) {
+  const int32_t sum = static_cast<int32_t>(a) + b;
+  return static_cast<int16_t>(sum > INT16_MAX   ? INT16_MAX
+                              : sum < INT16_MIN ? INT16_MIN
+                                                : sum);
+}
+
+static void ComplexMultCf32(const float* f, const float* g, float* out,
+                            size_t count, bool conj) {
+  const float sign = conj ? -1.f : 1.f;
+  for (size_t i = 0; i < 2 * count; i += 2) {
+    const float g_im = sign * g[i + 1];
+    const float re = f[i] * g[i] - f[i + 1] * g_im;
+    out[i + 1] = f[i] * g_im + f[i + 1] * g[i];
+    out[i] = re;
+  }
+}
+
+static void ComplexMultCs16(const int16_t* f, const int16_t* g, int16_t* out,
+                            size_t count, bool conj) {
+  for (size_t i = 0; i < 2 * count; i += 2) {
+    const int16_t g_im = conj ? Negate16(g[i + 1]) : g[i + 1];
+    const int16_t g_im_re = conj ? g[i + 1] : Negate16(g[i + 1]);
+    const int16_t re = Q15(static_cast<int64_t>(f[i]) * g[i] +
+                           static_cast<int64_t>(f[i + 1]) * g_im_re);
+    out[i + 1] = Q15(static_cast<int64_t>(f[i]) * g_im +
+                     static_cast<int64_t>(f[i + 1]) * g[i]);
+    out[i] = re;
+  }
+}
+
+static void Abs2Cf32(const float* in, float* out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = in[2 * i] * in[2 * i] + in[2 * i + 1] * in[2 * i + 1];
+  }
+}
+
+static void Abs2Cs16(const int16_t* in, int32_t* out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t re = static_cast<uint32_t>(in[2 * i] * in[2 * i]);
+    const uint32_t im = static_cast<uint32_t>(in[2 * i + 1] * in[2 * i + 1]);
+    out[i] = static_cast<int32_t>(re + im);
+  }
+}
+
+static void CorrelateCf32(const float* in, const float* seq, size_t taps,
+                          float* out, size_t count) {
+  std::memset(out, 0, 2 * count * sizeof(float));
+  for (size_t j = 0; j < taps; j++) {
+    const float re = seq[2 * j];
+    const float im = seq[2 * j + 1];
+    const float* x = in + 2 * j;
+    for (size_t i = 0; i < 2 * count; i += 2) {
+      out[i] += x[i] * re + x[i + 1] * im;
+      out[i + 1] += x[i + 1] * re - x[i] * im;
+    }
+  }
+}
+
+static void CorrelateCs16(const int16_t* in, const int16_t* seq, size_t taps,
+                          int16_t* out, size_t count) {
+  std::memset(out, 0, 2 * count * sizeof(int16_t));
+  for (size_t j = 0; j < taps; j++) {
+    const int16_t re = seq[2 * j];
+    const int16_t im = seq[2 * j + 1];
+    const int16_t neg_im = Negate16(im);
+    const int16_t* x = in + 2 * j;
+    for (size_t i = 0; i < 2 * count; i += 2) {
+      const int16_t p_re = Q15(static_cast<int64_t>(x[i]) * re +
+                               static_cast<int64_t>(x[i + 1]) * im);
+      const int16_t p_im = Q15(static_cast<int64_t>(x[i]) * neg_im +
+                               static_cast<int64_t>(x[i + 1]) * re);
+      out[i] = AddSat16(out[i], p_re);
+      out[i + 1] = AddSat16(out[i + 1], p_im);
+    }
+  }
+}
+
+static void CorrelateF32(const float* in, const float* seq, size_t taps,
+                         float* out, size_t count) {
+  std::memset(out, 0, count * sizeof(float));
+  for (size_t j = 0; j < taps; j++) {
+    for (size_t i = 0; i < count; i++) out[i] += in[i + j] * seq[j];
+  }
+}
+
+static void CorrelateS16(const int16_t* in, const int16_t* seq, size_t taps,
+                         int16_t* out, size_t count) {
+  std::memset(out, 0, count * sizeof(int16_t));
+  for (size_t j = 0; j < taps; j++) {
+    for (size_t i = 0; i < count; i++) {
+      const int32_t product = static_cast<int32_t>(in[i + j]) * seq[j];
+      out[i] = AddSat16(out[i], static_cast<int16_t>(product >> 16));
+    }
+  }
+}
+
+const CommsKernels kScalarCommsKernels = {
+    SimdLevel::kScalar, ComplexMultCf32, ComplexMultCs16,
+    Abs2Cf32,           Abs2Cs16,        CorrelateCf32,
+    CorrelateCs16,      CorrelateF32,    CorrelateS16};
+
+SimdLevel CommsKernels::Detect() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return SimdLevel::kAvx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SimdLevel::kAvx2;
+  }
+#endif
+  return SimdLevel::kScalar;
+}
+
+const char* CommsKernels::Name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kAvx512:
+      return "avx512";
+    case SimdLevel::kAvx2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+const CommsKernels* CommsKernels::ForLevel(SimdLevel level) {
+  if (level > Detect()) return nullptr;
+  switch (level) {
+#if defined(__x86_64__)
+    case SimdLevel::kAvx512:
+      return &kAvx512CommsKernels;
+    case SimdLevel::kAvx2:
+      return &kAvx2CommsKernels;
+#endif
+    default:
+      return &kScalarCommsKernels;
+  }
+}
+
+static const CommsKernels& SelectKernels() {
+  const SimdLevel detected = CommsKernels::Detect();
+  SimdLevel level = detected;
+  const char* forced = std::getenv(kSimdEnv);
+  if (forced != nullptr && forced[0] != '\0') {
+    bool known = false;
+    for (SimdLevel l : {SimdLevel::kScalar, SimdLevel::kAvx2,
+                        SimdLevel::kAvx512}) {
+      if (std::strcmp(forced, CommsKernels::Name(l)) == 0) {
+        known = true;
+        if (l > detected) {
+          MLPD_WARN("%s=%s is not supported by this CPU, using %s\n", kSimdEnv,
+                    forced, CommsKernels::Name(detected));
+        } else {
+          level = l;
+        }
+      }
+    }
+    if (known == false) {
+      MLPD_WARN("Unknown %s=%s (scalar, avx2 or avx512), using %s\n",
+                kSimdEnv, forced, CommsKernels::Name(detected));
+    }
+  }
+  MLPD_INFO("Comms kernels: %s, CPU supports %s\n", CommsKernels::Name(level),
+            CommsKernels::Name(detected));
+  return *CommsKernels::ForLevel(level);
+}
+
+const CommsKernels& CommsKernels::Get() {
+  static const CommsKernels& kernels = SelectKernels();
+  return kernels;
+}
@@ -21,13 +21,105 @@
 
 #include <limits.h>
 
+#include <memory>
+#include <new>
 #include <queue>
+#include <stdexcept>
 
 #include "include/constants.h"
+#include "include/correlator.h"
 #include "include/utils.h"
 
 static constexpr float kShortMaxFloat = SHRT_MAX;
 
+// muFFT plans and scratch buffers of one thread. Planning a transform costs
+// more than running it at our sizes, so every thread plans a size only once.
+class FftPlanCache {
+ public:
+  ~FftPlanCache() {
+    for (auto& entry : plans_) mufft_free_plan_1d(entry.plan);
+    for (auto* buffer : scratch_) mufft_free(buffer);
+  }
+
+  mufft_plan_1d* Plan(size_t n, int direction, unsigned flags) {
+    for (const auto& entry : plans_) {
+      if (entry.n == n && entry.direction == direction &&
+          entry.flags == flags) {
+        return entry.plan;
+      }
+    }
+    mufft_plan_1d* plan = mufft_create_plan_1d_c2c(n, direction, flags);
+    if (plan == nullptr) {
+      throw std::invalid_argument("No FFT plan of size " + std::to_string(n));
+    }
+    plans_.push_back({n, direction, flags, plan});
+    return plan;
+  }
+
+  /* Aligned scratch buffer 0 or 1 of at least n samples */
+  std::complex<float>* Scratch(size_t which, size_t n) {
+    if (scratch_size_ < n) {
+      for (auto*& buffer : scratch_) {
+        mufft_free(buffer);
+        buffer = static_cast<std::complex<float>*>(
+            mufft_alloc(n * sizeof(std::complex<float>)));
+        if (buffer == nullptr) throw std::bad_alloc();
+      }
+      scratch_size_ = n;
+    }
+    return scratch_[which];
+  }
+
+ private:
+  struct Entry {
+    size_t n;
+    int direction;
+    unsigned flags;
+    mufft_plan_1d* plan;
+  };
+  // A handful of sizes per thread, a linear search is fastest
+  std::vector<Entry> plans_;
+  std::complex<float>* scratch_[2] = {nullptr, nullptr};
+  size_t scratch_size_ = 0;
+};
+
+static thread_local FftPlanCache fft_plan_cache;
+
+// Correlators of the references a thread searched for most recently
+static constexpr size_t kCachedCorrelators = 8;
+static thread_local std::vector<std::unique_ptr<Correlator>> correlators;
+
+std::vector<std::complex<float>> CommsLib::correlate(
+    const std::vector<std::complex<float>>& iq,
+    const std::vector<std::complex<float>>& ref, size_t out_len) {
+  auto found = std::find_if(
+      correlators.begin(), correlators.end(),
+      [&ref](const std::unique_ptr<Correlator>& c) { return c->Matches(ref); });
+  if (found == correlators.end()) {
+    if (correlators.size() == kCachedCorrelators) {
+      correlators.erase(correlators.begin());
+    }
+    correlators.push_back(std::make_unique<Correlator>(ref));
+    found = correlators.end() - 1;
+  }
+  std::vector<std::complex<float>> out(out_len);
+  (*found)->Correlate(iq.data(), iq.size(), out.data(), out_len);
+  return out;
+}
+
+std::vector<float> CommsLib::moving_sum(const std::vector<float>& in,
+                                        size_t window) {
+  std::vector<float> out(in.size());
+  // Accumulated in double, the sum never drifts off over long windows
+  double sum = 0;
+  for (size_t i = 0; i < in.size(); i++) {
+    out[i] = sum;
+    sum += in[i];
+    if (i >= window) sum -= in[i - window];
+  }
+  return out;
+}
+
 int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen) {
   /*
      * Find 802.11-based LTS (Long Training Sequence)
@@ -39,41 +131,41 @@ int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen) {
      */
 
   float lts_thresh = 0.8;
-  std::vector<std::vector<float>> lts_seq;
   int best_peak;
 
-  // Original LTS sequence
-  lts_seq = CommsLib::getSequence(LTS_SEQ, seqLen);
-
-  // Re-arrange into complex vector, flip, and compute conjugate
+  // Last symbol of the LTS sequence, generated once per thread
   const size_t lts_symbol_len = Consts::kFftSize_80211;
-  std::vector<std::complex<float>> lts_sym(lts_symbol_len);
-  std::vector<std::complex<float>> lts_sym_conj(lts_sym.size());
-  for (size_t i = 0; i < lts_sym.size(); i++) {
-    // lts_seq is a 2x160 matrix (real/imag by seqLen=160 elements)
-    // grab one symbol and flip around
-    lts_sym[i] = std::complex<float>(lts_seq[0][seqLen - 1 - i],
-                                     lts_seq[1][seqLen - 1 - i]);
-    // conjugate
-    lts_sym_conj[i] = std::conj(lts_sym[i]);
+  static thread_local int lts_seq_len = -1;
+  static thread_local std::vector<std::complex<float>> lts_sym;
+  if (lts_seq_len != seqLen) {
+    std::vector<std::vector<float>> lts_seq =
+        CommsLib::getSequence(LTS_SEQ, seqLen);
+    lts_sym.resize(lts_symbol_len);
+    for (size_t i = 0; i < lts_symbol_len; i++) {
+      // lts_seq is a 2x160 matrix (real/imag by seqLen=160 elements)
+      lts_sym[i] = std::complex<float>(lts_seq[0][seqLen - lts_symbol_len + i],
+                                       lts_seq[1][seqLen - lts_symbol_len + i]);
+    }
+    lts_seq_len = seqLen;
   }
 
   // Equivalent to numpy's sign function
   auto iq_sign = CommsLib::csign(iq);
 
-  // Convolution
-  auto lts_corr = CommsLib::convolve(iq_sign, lts_sym_conj);
+  // Correlation, all iq.size() + lts_symbol_len - 1 lags
+  auto lts_corr = CommsLib::correlate(iq_sign, lts_sym,
+                                      iq_sign.size() + lts_symbol_len - 1);
   std::vector<float> lts_corr_abs(lts_corr.size());
   std::transform(lts_corr.begin(), lts_corr.end(), lts_corr_abs.begin(),
                  computeAbs);
   double lts_limit =
       lts_thresh * *std::max_element(lts_corr_abs.begin(), lts_corr_abs.end());
 
-  // Find all peaks, and pairs that are lts_sym.size() samples apart
+  // Find all peaks, and pairs that are lts_symbol_len samples apart
   std::queue<int> valid_peaks;
-  for (size_t i = lts_sym.size(); i < lts_corr.size(); i++) {
+  for (size_t i = lts_symbol_len; i < lts_corr.size(); i++) {
     if (lts_corr_abs[i] > lts_limit &&
-        lts_corr_abs[i - lts_sym.size()] > lts_limit)
+        lts_corr_abs[i - lts_symbol_len] > lts_limit)
       valid_peaks.push(i);
   }
 
@@ -90,18 +182,15 @@ int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen) {
 size_t CommsLib::find_pilot_seq(const std::vector<std::complex<float>>& iq,
                                 const std::vector<std::complex<float>>& pilot,
                                 size_t seq_len) {
-  // Re-arrange into complex vector, flip, and compute conjugate
-  std::vector<std::complex<float>> pilot_conj;
-  for (size_t i = 0; i < seq_len; i++) {
-    // conjugate
-    pilot_conj.push_back(std::conj(pilot[seq_len - i - 1]));
-  }
+  const std::vector<std::complex<float>> pilot_seq(pilot.begin(),
+                                                   pilot.begin() + seq_len);
 
   // Equivalent to numpy's sign function
   auto iq_sign = CommsLib::csign(iq);
 
-  // Convolution
-  auto pilot_corr = CommsLib::convolve(iq_sign, pilot_conj);
+  // Correlation, all iq.size() + seq_len - 1 lags
+  auto pilot_corr =
+      CommsLib::correlate(iq_sign, pilot_seq, iq_sign.size() + seq_len - 1);
 
   std::vector<float> pilot_corr_abs(pilot_corr.size());
   for (size_t i = 0; i < pilot_corr_abs.size(); i++)
@@ -412,28 +501,55 @@ std::vector<size_t> CommsLib::getPilotScIndex(size_t fftSize, size_t DataScNum,
   return pilot_sc;
 }
 
-std::vector<std::complex<float>> CommsLib::IFFT(
-    const std::vector<std::complex<float>>& in, int fftSize, float scale,
-    bool normalize, bool fft_shift) {
-  std::vector<std::complex<float>> out(in.size());
+mufft_plan_1d* CommsLib::getFftPlan(size_t n, int direction,
+                                    unsigned flags) {
+  return fft_plan_cache.Plan(n, direction, flags);
+}
 
-  void* fft_in = mufft_alloc(fftSize * sizeof(std::complex<float>));
-  void* fft_out = mufft_alloc(fftSize * sizeof(std::complex<float>));
-  mufft_plan_1d* mufftplan =
-      mufft_create_plan_1d_c2c(fftSize, MUFFT_INVERSE, MUFFT_FLAG_CPU_ANY);
+void CommsLib::FFT(const std::complex<float>* in, std::complex<float>* out,
+                   size_t n, size_t batch) {
+  mufft_plan_1d* plan = fft_plan_cache.Plan(n, MUFFT_FORWARD,
+                                            MUFFT_FLAG_CPU_ANY);
+  for (size_t b = 0; b < batch; b++) {
+    mufft_execute_plan_1d(plan, out + b * n, in + b * n);
+  }
+}
 
+void CommsLib::IFFT(const std::complex<float>* in, std::complex<float>* out,
+                    size_t n, size_t batch) {
+  mufft_plan_1d* plan = fft_plan_cache.Plan(n, MUFFT_INVERSE,
+                                            MUFFT_FLAG_CPU_ANY);
+  for (size_t b = 0; b < batch; b++) {
+    mufft_execute_plan_1d(plan, out + b * n, in + b * n);
+  }
+}
+
+// Input of a single transform in the scratch buffer, swapping the halves of
+// the spectrum for fft_shift
+static std::complex<float>* LoadFftInput(
+    const std::vector<std::complex<float>>& in, size_t fftSize,
+    bool fft_shift) {
+  std::complex<float>* fft_in = fft_plan_cache.Scratch(0, fftSize);
   if (fft_shift) {
-    std::vector<std::complex<float>> in_freq_shifted;
-    in_freq_shifted.insert(in_freq_shifted.end(), in.begin() + fftSize / 2,
-                           in.end());
-    in_freq_shifted.insert(in_freq_shifted.end(), in.begin(),
-                           in.begin() + fftSize / 2);
-    memcpy(fft_in, in_freq_shifted.data(),
-           fftSize * sizeof(std::complex<float>));
+    const size_t half = fftSize / 2;
+    std::memcpy(fft_in, in.data() + half,
+                (fftSize - half) * sizeof(std::complex<float>));
+    std::memcpy(fft_in + fftSize - half, in.data(),
+                half * sizeof(std::complex<float>));
   } else {
-    memcpy(fft_in, in.data(), fftSize * sizeof(std::complex<float>));
+    std::memcpy(fft_in, in.data(), fftSize * sizeof(std::complex<float>));
   }
-  mufft_execute_plan_1d(mufftplan, fft_out, fft_in);
+  return fft_in;
+}
+
+std::vector<std::complex<float>> CommsLib::IFFT(
+    const std::vector<std::complex<float>>& in, int fftSize, float scale,
+    bool normalize, bool fft_shift) {
+  std::vector<std::complex<float>> out(in.size());
+
+  const std::complex<float>* fft_in = LoadFftInput(in, fftSize, fft_shift);
+  std::complex<float>* fft_out = fft_plan_cache.Scratch(1, fftSize);
+  CommsLib::IFFT(fft_in, fft_out, fftSize);
   memcpy(out.data(), fft_out, fftSize * sizeof(std::complex<float>));
   float max_val = 1;
   if (normalize) {
@@ -446,10 +562,6 @@ std::vector<std::complex<float>> CommsLib::IFFT(
             << std::endl;
 #endif
   for (int i = 0; i < fftSize; i++) out[i] = (out[i] / max_val) * scale;
-
-  mufft_free_plan_1d(mufftplan);
-  mufft_free(fft_in);
-  mufft_free(fft_out);
   return out;
 }
 
@@ -457,89 +569,63 @@ std::vector<std::complex<float>> CommsLib::FFT(
     const std::vector<std::complex<float>>& in, int fftSize, bool fft_shift) {
   std::vector<std::complex<float>> out(in.size());
 
-  void* fft_in = mufft_alloc(fftSize * sizeof(std::complex<float>));
-  void* fft_out = mufft_alloc(fftSize * sizeof(std::complex<float>));
-  mufft_plan_1d* mufftplan =
-      mufft_create_plan_1d_c2c(fftSize, MUFFT_FORWARD, MUFFT_FLAG_CPU_ANY);
+  const std::complex<float>* fft_in = LoadFftInput(in, fftSize, fft_shift);
+  std::complex<float>* fft_out = fft_plan_cache.Scratch(1, fftSize);
+  CommsLib::FFT(fft_in, fft_out, fftSize);
+  memcpy(out.data(), fft_out, fftSize * sizeof(std::complex<float>));
+  return out;
+}
 
-  if (fft_shift) {
-    std::vector<std::complex<float>> in_freq_shifted;
-    in_freq_shifted.insert(in_freq_shifted.end(), in.begin() + fftSize / 2,
-                           in.end());
-    in_freq_shifted.insert(in_freq_shifted.end(), in.begin(),
-                           in.begin() + fftSize / 2);
-    memcpy(fft_in, in_freq_shifted.data(),
-           fftSize * sizeof(std::complex<float>));
-  } else {
-    memcpy(fft_in, in.data(), fftSize * sizeof(std::complex<float>));
+// Symbol i has real part levels[i / M] and imaginary part levels[i % M]
+static std::vector<std::complex<float>> MakeConstellation(
+    const std::vector<float>& levels) {
+  const size_t m = levels.size();
+  std::vector<std::complex<float>> table(m * m);
+  for (size_t i = 0; i < m * m; i++) {
+    table[i] = std::complex<float>(levels[i / m], levels[i % m]);
   }
-  mufft_execute_plan_1d(mufftplan, fft_out, fft_in);
-  memcpy(out.data(), fft_out, fftSize * sizeof(std::complex<float>));
+  return table;
+}
 
-  mufft_free_plan_1d(mufftplan);
-  mufft_free(fft_in);
-  mufft_free(fft_out);
-  return out;
+const std::vector<std::complex<float>>& CommsLib::getConstellation(
+    int type) {
+  static const std::vector<std::complex<float>> kNone;
+  if (type == QPSK) {
+    static const float scale = 1 / sqrt(2);
+    static const std::vector<std::complex<float>> qpsk =
+        MakeConstellation({-scale, scale});
+    return qpsk;
+  } else if (type == QAM16) {
+    static const float scale = 1 / sqrt(10);
+    static const std::vector<std::complex<float>> qam16 =
+        MakeConstellation({-3 * scale, -1 * scale, 3 * scale, scale});
+    return qam16;
+  } else if (type == QAM64) {
+    static const float scale = 1 / sqrt(42);
+    static const std::vector<std::complex<float>> qam64 =
+        MakeConstellation({-7 * scale, -5 * scale, -3 * scale, -1 * scale,
+                           scale, 3 * scale, 5 * scale, 7 * scale});
+    return qam64;
+  }
+  return kNone;
 }
 
 std::vector<std::complex<float>> CommsLib::modulate(std::vector<uint8_t> in,
                                                     int type) {
   std::vector<std::complex<float>> out(in.size());
-  if (type == QPSK) {
-    float qpsk_table[2][4];  // = init_qpsk();
-    float scale = 1 / sqrt(2);
-    float mod_qpsk[2] = {-scale, scale};
-    for (int i = 0; i < 4; i++) {
-      qpsk_table[0][i] = mod_qpsk[i / 2];
-      qpsk_table[1][i] = mod_qpsk[i % 2];
-    }
-    for (size_t i = 0; i < in.size(); i++) {
-      if (in[i] < 4u)
-        out[i] =
-            std::complex<float>(qpsk_table[0][in[i]], qpsk_table[1][in[i]]);
-      else {
-        std::cout << "Error: No compatible input vector!" << std::endl;
-        break;
-      }
-    }
-  } else if (type == QAM16) {
-    float qam16_table[2][16];  //= init_qam16();
-    float scale = 1 / sqrt(10);
-    float mod_16qam[4] = {-3 * scale, -1 * scale, 3 * scale, scale};
-    for (int i = 0; i < 16; i++) {
-      qam16_table[0][i] = mod_16qam[i / 4];
-      qam16_table[1][i] = mod_16qam[i % 4];
-    }
-    for (size_t i = 0; i < in.size(); i++) {
-      if (in[i] < 16u)
-        out[i] =
-            std::complex<float>(qam16_table[0][in[i]], qam16_table[1][in[i]]);
-      else {
-        std::cout << "Error: No compatible input vector!" << std::endl;
-        break;
-      }
-    }
-  } else if (type == QAM64) {
-    float qam64_table[2][64];  // = init_qam64();
-    float scale = 1 / sqrt(42);
-    float mod_64qam[8] = {-7 * scale, -5 * scale, -3 * scale, -1 * scale,
-                          scale,      3 * scale,  5 * scale,  7 * scale};
-    for (int i = 0; i < 64; i++) {
-      qam64_table[0][i] = mod_64qam[i / 8];
-      qam64_table[1][i] = mod_64qam[i % 8];
-    }
-    for (size_t i = 0; i < in.size(); i++) {
-      if (in[i] < 64u)
-        out[i] =
-            std::complex<float>(qam64_table[0][in[i]], qam64_table[1][in[i]]);
-      else {
-        std::cout << "Error: No compatible input vector!" << std::endl;
-        break;
-      }
-    }
-  } else {
+  const std::vector<std::complex<float>>& table = getConstellation(type);
+  if (table.empty() == true) {
     // Not Supported
     std::cout << "Modulation Type " << type << " not supported!" << std::endl;
+    return out;
+  }
+  for (size_t i = 0; i < in.size(); i++) {
+    if (in[i] < table.size()) {
+      out[i] = table[in[i]];
+    } else {
+      std::cout << "Error: No compatible input vector!" << std::endl;
+      break;
+    }
   }
   return out;
 }
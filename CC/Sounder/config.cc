@@ -22,6 +22,32 @@ static size_t kMaxSupportedFFTSize = 2048;
 static size_t kMinSupportedFFTSize = 64;
 static size_t kMaxSupportedCPSize = 128;
 
+// "auto", "auto_read", "packet" or an explicit chunk shape
+static Hdf5ChunkConf ParseChunkConf(const json& chunk, double cache_mb) {
+  Hdf5ChunkConf conf;
+  conf.cache_bytes = static_cast<size_t>(cache_mb * (1 << 20));
+  if (chunk.is_array() == true) {
+    conf.mode = Hdf5ChunkConf::kChunkExplicit;
+    conf.dims = chunk.get<std::vector<size_t>>();
+    if (conf.dims.size() != kDsDimsNum ||
+        std::find(conf.dims.begin(), conf.dims.end(), 0) != conf.dims.end()) {
+      throw std::invalid_argument(
+          "error hdf5_chunk config: a chunk shape needs 5 non-zero sizes!\n");
+    }
+  } else if (chunk == "auto") {
+    conf.mode = Hdf5ChunkConf::kChunkAuto;
+  } else if (chunk == "auto_read") {
+    conf.mode = Hdf5ChunkConf::kChunkAutoRead;
+  } else if (chunk == "packet") {
+    conf.mode = Hdf5ChunkConf::kChunkPacket;
+  } else {
+    throw std::invalid_argument(
+        "error hdf5_chunk config: not any of auto/auto_read/packet or a "
+        "chunk shape!\n");
+  }
+  return conf;
+}
+
 Config::Config(const std::string& jsonfile, const std::string& directory,
                const bool bs_only, const bool client_only, const bool calibrate)
     : directory_(directory) {
@@ -70,6 +96,200 @@ Config::Config(const std::string& jsonfile, const std::string& directory,
     throw std::invalid_argument("error channel config: not any of A/B/AB!\n");
   cl_sdr_ch_ = (cl_channel_ == "AB") ? 2 : 1;
 
+  // "sounder_sim" selects the simulated device module (see sounder_sim.cc)
+  sdr_driver_ = tddConf.value("sdr_driver", "iris");
+  sdr_args_ = tddConf.value("sdr_args", "");
+
+  // What the rx threads do when the recorders fall behind
+  std::string overload = tddConf.value("overload_policy", "abort");
+  if (overload == "abort") {
+    overload_policy_ = kOverloadAbort;
+  } else if (overload == "drop_newest") {
+    overload_policy_ = kOverloadDropNewest;
+  } else if (overload == "drop_oldest_unrecorded") {
+    overload_policy_ = kOverloadDropOldest;
+  } else if (overload == "decimate_frames") {
+    overload_policy_ = kOverloadDecimateFrames;
+  } else {
+    throw std::invalid_argument(
+        "error overload_policy config: not any of abort/drop_newest/"
+        "drop_oldest_unrecorded/decimate_frames!\n");
+  }
+  std::string layout = tddConf.value("buffer_layout", "packet");
+  if (layout == "packet") {
+    buffer_layout_ = kLayoutPacket;
+  } else if (layout == "frame") {
+    buffer_layout_ = kLayoutFrame;
+  } else {
+    throw std::invalid_argument(
+        "error buffer_layout config: not any of packet/frame!\n");
+  }
+  // Frame blocks are owned per frame, single packets cannot be revoked
+  if (buffer_layout_ == kLayoutFrame &&
+      overload_policy_ == kOverloadDropOldest) {
+    throw std::invalid_argument(
+        "error overload_policy config: drop_oldest_unrecorded needs "
+        "buffer_layout packet!\n");
+  }
+  // Either setting is one value for all datasets or an object with
+  // per dataset name entries and an optional "default"
+  const auto chunk = tddConf.value("hdf5_chunk", json("auto"));
+  const auto cache = tddConf.value("hdf5_chunk_cache_mb", json(0));
+  auto per_dataset = [](const json& j, const std::string& name,
+                        const json& fallback) {
+    return j.is_object() == true ? j.value(name, fallback) : j;
+  };
+  const json default_chunk = per_dataset(chunk, "default", json("auto"));
+  const json default_cache = per_dataset(cache, "default", json(0));
+  hdf5_chunk_[""] = ParseChunkConf(default_chunk, default_cache.get<double>());
+  for (const json* j : {&chunk, &cache}) {
+    if (j->is_object() == false) continue;
+    for (const auto& item : j->items()) {
+      const std::string& name = item.key();
+      if (name == "default" || hdf5_chunk_.count(name) > 0) continue;
+      hdf5_chunk_[name] =
+          ParseChunkConf(per_dataset(chunk, name, default_chunk),
+                         per_dataset(cache, name, default_cache).get<double>());
+    }
+  }
+
+  // Recorders write whole frames per dataset, see WriteCombiner
+  write_combiner_ = tddConf.value("write_combiner", true);
+  write_combiner_timeout_ = std::chrono::milliseconds(
+      tddConf.value("write_combiner_timeout_ms", 100));
+  // Numbered trace file segments, cut at whichever limit is set and hit
+  trace_segment_frames_ = tddConf.value("trace_segment_frames", 0);
+  trace_segment_mb_ = tddConf.value("trace_segment_mb", 0);
+  trace_segment_seconds_ = tddConf.value("trace_segment_seconds", 0);
+  // Per recorder thread, 0 writes from the recorder thread itself
+  record_staging_mb_ = tddConf.value("record_staging_mb", 64);
+  // Recordings are flushed in the background, 0 only flushes at the end
+  hdf5_flush_interval_ = std::chrono::milliseconds(
+      tddConf.value("hdf5_flush_interval_ms", 1000));
+  // Compressed sample datasets: none/deflate/zstd, see ChunkCompressor
+  const std::string codec = tddConf.value("hdf5_compression", "none");
+  if (codec == "none") {
+    hdf5_compression_ = kCodecNone;
+  } else if (codec == "deflate") {
+    hdf5_compression_ = kCodecDeflate;
+  } else if (codec == "zstd") {
+#ifdef USE_ZSTD
+    hdf5_compression_ = kCodecZstd;
+#else
+    MLPD_WARN("Built without zstd, recording with deflate instead\n");
+    hdf5_compression_ = kCodecDeflate;
+#endif
+  } else {
+    throw std::invalid_argument(
+        "error hdf5_compression config: not any of none/deflate/zstd!\n");
+  }
+  hdf5_compression_level_ = tddConf.value("hdf5_compression_level", 1);
+  hdf5_compression_threads_ = tddConf.value("hdf5_compression_threads", 2);
+  if (hdf5_compression_ != kCodecNone) {
+    if (hdf5_compression_threads_ == 0) {
+      throw std::invalid_argument(
+          "error hdf5_compression_threads config: needs at least 1!\n");
+    }
+    // Chunks are compressed from the frame blocks of the combiner
+    if (write_combiner_ == false) {
+      MLPD_WARN("hdf5_compression turns write_combiner on\n");
+      write_combiner_ = true;
+    }
+  }
+  // hdf5, or raw files for sounder-convert, see RawTraceWriter
+  const std::string record_format = tddConf.value("record_format", "hdf5");
+  if (record_format == "hdf5") {
+    record_raw_ = false;
+  } else if (record_format == "raw") {
+    record_raw_ = true;
+  } else {
+    throw std::invalid_argument(
+        "error record_format config: not any of hdf5/raw!\n");
+  }
+  raw_prealloc_mb_ = tddConf.value("raw_prealloc_mb", 1024);
+  if (record_raw_ == true &&
+      (trace_segment_frames_ > 0 || trace_segment_mb_ > 0 ||
+       trace_segment_seconds_ > 0)) {
+    MLPD_WARN("Raw recordings are not segmented, trace_segment_* ignored\n");
+    trace_segment_frames_ = 0;
+    trace_segment_mb_ = 0;
+    trace_segment_seconds_ = 0;
+  }
+  // LS channel estimates of the pilots as they arrive, see CsiExtractor
+  csi_extraction_ = tddConf.value("csi_extraction", false);
+  csi_thread_num_ = tddConf.value("csi_thread_num", 2);
+  record_pilot_samples_ = tddConf.value("record_pilot_samples", true);
+  if (csi_extraction_ == true &&
+      (record_raw_ == true || internal_measurement_ == true)) {
+    MLPD_WARN("csi_extraction needs client pilots recorded to HDF5, off\n");
+    csi_extraction_ = false;
+  }
+  if (csi_extraction_ == true && csi_thread_num_ == 0) {
+    throw std::invalid_argument(
+        "error csi_thread_num config: needs at least 1!\n");
+  }
+  if (csi_extraction_ == false && record_pilot_samples_ == false) {
+    MLPD_WARN("record_pilot_samples is only off with csi_extraction\n");
+    record_pilot_samples_ = true;
+  }
+  // Packets of the base station left out before they are dispatched, see
+  // RecordFilter. Antennas are counted within their cell, frame windows are
+  // [first, last] pairs.
+  record_antennas_ =
+      tddConf.value("record_antennas", std::vector<size_t>());
+  record_slots_.clear();
+  for (const std::string& type : tddConf.value(
+           "record_slots",
+           std::vector<std::string>{"pilot", "uplink", "noise"})) {
+    if (type == "pilot") {
+      record_slots_ += 'P';
+    } else if (type == "uplink") {
+      record_slots_ += 'U';
+    } else if (type == "noise") {
+      record_slots_ += 'N';
+    } else {
+      throw std::invalid_argument(
+          "error record_slots config: " + type +
+          " is none of pilot/uplink/noise!\n");
+    }
+  }
+  record_frame_interval_ = tddConf.value("record_frame_interval", 1);
+  if (record_frame_interval_ == 0) {
+    throw std::invalid_argument(
+        "error record_frame_interval config: needs at least 1!\n");
+  }
+  record_frame_windows_.clear();
+  for (const auto& window :
+       tddConf.value("record_frame_windows", json::array())) {
+    const auto bounds = window.get<std::vector<size_t>>();
+    if (bounds.size() != 2 || bounds.at(0) > bounds.at(1)) {
+      throw std::invalid_argument(
+          "error record_frame_windows config: needs [first, last] pairs!\n");
+    }
+    record_frame_windows_.emplace_back(bounds.at(0), bounds.at(1));
+  }
+  std::sort(record_frame_windows_.begin(), record_frame_windows_.end());
+  record_filtered_ = record_antennas_.empty() == false ||
+                     record_slots_.size() < 3 || record_frame_interval_ > 1 ||
+                     record_frame_windows_.empty() == false;
+  if (record_filtered_ == true && internal_measurement_ == true) {
+    MLPD_WARN("record filters do not apply to internal measurements, off\n");
+    record_antennas_.clear();
+    record_slots_ = "PUN";
+    record_frame_interval_ = 1;
+    record_frame_windows_.clear();
+    record_filtered_ = false;
+  }
+  // Shared memory object of recent packets for live readers, "" for none
+  live_tap_ = tddConf.value("live_tap", "");
+  live_tap_mb_ = tddConf.value("live_tap_mb", 64);
+  if (live_tap_.empty() == false && live_tap_.front() != '/') {
+    live_tap_.insert(0, "/");
+  }
+  // Page size of the sample buffers: auto/1G/2M/none
+  buffer_hugepages_ =
+      BufferMemory::ParseMode(tddConf.value("buffer_hugepages", "auto"));
+
   auto serials_file = tddConf.value("serial_file", "./files/topology.json");
   loadTopology(serials_file, bs_only, client_only, calibrate);
   std::cout << "Topology: "
@@ -185,6 +405,7 @@ Config::Config(const std::string& jsonfile, const std::string& directory,
   cl_power_ramp_hi_ = tddConf.value("ue_ramp_max_gain", 42);
   frame_mode_ = tddConf.value("frame_mode", "continuous_resync");
   hw_framer_ = tddConf.value("ue_hw_framer", false);
+  beacon_fixed_point_ = tddConf.value("beacon_fixed_point", false);
   auto tx_advance = tddConf.value("tx_advance", json::array());
   if (tx_advance.empty() == true) {
     tx_advance_.resize(num_cl_sdrs_, 250);
@@ -207,6 +428,10 @@ Config::Config(const std::string& jsonfile, const std::string& directory,
   }
   ul_data_frame_num_ = tddConf.value("ul_data_frame_num", 1);
   dl_data_frame_num_ = tddConf.value("dl_data_frame_num", 1);
+  // 0 seeds the data generator randomly, see DataGenerator
+  data_gen_seed_ = tddConf.value("data_gen_seed", uint64_t{0});
+  // 0 uses every core
+  data_gen_threads_ = tddConf.value("data_gen_threads", 0);
 
   // Help verify whether gain exceeds max value
   struct compare {
@@ -312,9 +537,19 @@ Config::Config(const std::string& jsonfile, const std::string& directory,
             : 0);
     reader_thread_num_ = (client_present_ && ul_slot_per_frame_ > 0) +
                          (bs_present_ && dl_slot_per_frame_ > 0);
+    // rx threads hand record work straight to the recorders
+    direct_record_ = tddConf.value("direct_record", false);
+    // The rings hold one entry per buffer slot, a revoked slot would
+    // leave its entry queued and overflow them
+    if (direct_record_ == true && overload_policy_ == kOverloadDropOldest) {
+      throw std::invalid_argument(
+          "error overload_policy config: drop_oldest_unrecorded can not be "
+          "used with direct_record!\n");
+    }
   } else {
     recorder_thread_num_ = 0;
     reader_thread_num_ = 0;
+    direct_record_ = false;
   }
 
   // Multi-threading settings
@@ -966,6 +1201,12 @@ size_t Config::getNumRecordedSdrs() {
   return ret;
 }
 
+const Hdf5ChunkConf& Config::hdf5_chunk(const std::string& dataset) const {
+  auto it = this->hdf5_chunk_.find(dataset);
+  return it != this->hdf5_chunk_.end() ? it->second
+                                       : this->hdf5_chunk_.at("");
+}
+
 Config::~Config() {}
 
 int Config::getClientId(size_t radio_id, size_t slot_id) {
@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Cross-correlation with a fixed reference sequence, by overlap-save FFT
+ or directly, whichever is cheaper for the length asked for
+---------------------------------------------------------------------
+*/
+
+#include "include/correlator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "include/comms-lib.h"
+
+// Overlap-save blocks hold at least this many reference lengths, so that
+// most of every block is output
+static constexpr size_t kBlockTaps = 4;
+static constexpr size_t kMinBlock = 64;
+
+static std::complex<float>* AllocSamples(size_t count) {
+  auto* samples = static_cast<std::complex<float>*>(
+      mufft_alloc(count * sizeof(std::complex<float>)));
+  if (samples == nullptr) throw std::bad_alloc();
+  return samples;
+}
+
+Correlator::Correlator(const std::vector<std::complex<float>>& ref)
+    : ref_(ref), block_(kMinBlock), log2_block_(6) {
+  if (ref.empty() == true) {
+    throw std::invalid_argument("Correlator: empty reference");
+  }
+  while (this->block_ < kBlockTaps * ref.size()) {
+    this->block_ *= 2;
+    this->log2_block_++;
+  }
+  this->spectrum_ = AllocSamples(this->block_);
+  this->time_ = AllocSamples(this->block_);
+  this->freq_ = AllocSamples(this->block_);
+
+  // h[i] = conj(ref[M - 1 - i]): the correlation is the convolution with h
+  const size_t taps = ref.size();
+  std::fill(this->time_, this->time_ + this->block_, 0);
+  for (size_t i = 0; i < taps; i++) {
+    this->time_[i] = std::conj(ref[taps - 1 - i]);
+  }
+  CommsLib::FFT(this->time_, this->spectrum_, this->block_);
+  const float scale = 1.f / this->block_;
+  for (size_t i = 0; i < this->block_; i++) this->spectrum_[i] *= scale;
+}
+
+Correlator::~Correlator() {
+  mufft_free(this->spectrum_);
+  mufft_free(this->time_);
+  mufft_free(this->freq_);
+}
+
+bool Correlator::Matches(const std::vector<std::complex<float>>& ref) const {
+  return ref.size() == this->ref_.size() &&
+         std::memcmp(ref.data(), this->ref_.data(),
+                     ref.size() * sizeof(std::complex<float>)) == 0;
+}
+
+bool Correlator::UsesFft(size_t out_len) const {
+  // Complex multiply-adds: M per output directly, per block two transforms
+  // of L log2(L) / 2 butterflies and the spectrum product
+  const size_t step = this->block_ - this->taps() + 1;
+  const size_t blocks = (out_len + step - 1) / step;
+  return blocks * this->block_ * (this->log2_block_ + 1) <
+         out_len * this->taps();
+}
+
+void Correlator::Correlate(const std::complex<float>* x, size_t n,
+                           std::complex<float>* out, size_t out_len) {
+  if (this->UsesFft(out_len) == true) {
+    this->CorrelateFft(x, n, out, out_len);
+  } else {
+    this->CorrelateDirect(x, n, out, out_len);
+  }
+}
+
+void Correlator::CorrelateDirect(const std::complex<float>* x, size_t n,
+                                 std::complex<float>* out,
+                                 size_t out_len) const {
+  const size_t taps = this->taps();
+  std::fill(out, out + out_len, 0);
+  const float* in = reinterpret_cast<const float*>(x);
+  float* acc = reinterpret_cast<float*>(out);
+  // One tap over all outputs at a time, which vectorizes
+  for (size_t j = 0; j < taps; j++) {
+    const float re = this->ref_[j].real();
+    const float im = this->ref_[j].imag();
+    // Output k reads sample k + j - (M - 1)
+    const size_t first = taps - 1 - j;
+    const size_t last = std::min(out_len, n + first);
+    for (size_t k = first; k < last; k++) {
+      const size_t s = k - first;
+      acc[2 * k] += in[2 * s] * re + in[2 * s + 1] * im;
+      acc[2 * k + 1] += in[2 * s + 1] * re - in[2 * s] * im;
+    }
+  }
+}
+
+void Correlator::CorrelateFft(const std::complex<float>* x, size_t n,
+                              std::complex<float>* out, size_t out_len) {
+  const size_t history = this->taps() - 1;
+  const size_t step = this->block_ - history;
+  for (size_t start = 0; start < out_len; start += step) {
+    // Block i holds sample start - (M - 1) + i
+    const size_t lead = start < history ? history - start : 0;
+    const size_t first = start + lead - history;
+    const size_t count =
+        first < n ? std::min(n - first, this->block_ - lead) : 0;
+    std::fill(this->time_, this->time_ + lead, 0);
+    std::memcpy(this->time_ + lead, x + first,
+                count * sizeof(std::complex<float>));
+    std::fill(this->time_ + lead + count, this->time_ + this->block_, 0);
+
+    CommsLib::FFT(this->time_, this->freq_, this->block_);
+    float* freq = reinterpret_cast<float*>(this->freq_);
+    const float* spectrum = reinterpret_cast<const float*>(this->spectrum_);
+    for (size_t i = 0; i < 2 * this->block_; i += 2) {
+      const float re = freq[i] * spectrum[i] - freq[i + 1] * spectrum[i + 1];
+      freq[i + 1] = freq[i] * spectrum[i + 1] + freq[i + 1] * spectrum[i];
+      freq[i] = re;
+    }
+    CommsLib::IFFT(this->freq_, this->time_, this->block_);
+    // The first M - 1 outputs of the block wrapped around
+    std::memcpy(out + start, this->time_ + history,
+                std::min(step, out_len - start) * sizeof(std::complex<float>));
+  }
+}
@@ -0,0 +1,140 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Online least-squares channel estimates of the client pilots
+---------------------------------------------------------------------
+*/
+
+#include "include/csi_extractor.h"
+
+#include <stdexcept>
+
+#include "include/comms-lib.h"
+#include "include/logger.h"
+
+namespace Sounder {
+// Jobs a worker takes at once, all transformed with the same plan
+static constexpr size_t kCsiBatch = 16;
+static constexpr std::chrono::microseconds kCsiIdleWait(100);
+static constexpr float kSampleScale = 1.f / 32768;
+
+CsiExtractor::CsiExtractor(Config* cfg, size_t threads, size_t max_jobs)
+    : fft_size_(cfg->fft_size()),
+      cp_size_(cfg->cp_size()),
+      prefix_(cfg->prefix()),
+      symbols_(cfg->symbol_per_slot()),
+      jobs_(max_jobs),
+      free_(max_jobs),
+      todo_(max_jobs),
+      done_(max_jobs),
+      in_flight_(0),
+      running_(true) {
+  if (this->prefix_ + this->symbols_ * (this->fft_size_ + this->cp_size_) >
+      cfg->samps_per_slot()) {
+    throw std::invalid_argument(
+        "CsiExtractor: the pilot symbols do not fit into a slot");
+  }
+  // pilot_sym_f() and data_ind() count subcarriers from the lowest
+  // frequency, FFT bins from DC
+  const auto& pilot_f = cfg->pilot_sym_f();
+  for (size_t sc : cfg->data_ind()) {
+    const std::complex<float> pilot(pilot_f.at(0).at(sc), pilot_f.at(1).at(sc));
+    if (std::norm(pilot) == 0) {
+      throw std::invalid_argument("CsiExtractor: no pilot on subcarrier " +
+                                  std::to_string(sc));
+    }
+    this->bins_.push_back((sc + this->fft_size_ / 2) % this->fft_size_);
+    this->inv_pilot_.push_back(1.f / (pilot * static_cast<float>(symbols_)));
+  }
+  for (Job& job : this->jobs_) {
+    job.samples.resize(2 * cfg->samps_per_slot());
+    job.csi.resize(2 * this->bins_.size());
+    this->free_.enqueue(&job);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    this->threads_.emplace_back(&CsiExtractor::DoExtraction, this, i);
+  }
+  MLPD_INFO("CSI of %zu subcarriers on %zu threads\n", this->bins_.size(),
+            threads);
+}
+
+CsiExtractor::~CsiExtractor() {
+  this->running_.store(false, std::memory_order_release);
+  for (auto& thread : this->threads_) thread.join();
+}
+
+CsiExtractor::Job* CsiExtractor::Acquire(void) {
+  Job* job;
+  return this->free_.try_dequeue(job) ? job : nullptr;
+}
+
+void CsiExtractor::Submit(Job* job) {
+  this->in_flight_.fetch_add(1, std::memory_order_relaxed);
+  this->todo_.enqueue(job);
+}
+
+size_t CsiExtractor::Collect(Job** jobs, size_t max_jobs) {
+  return this->done_.try_dequeue_bulk(jobs, max_jobs);
+}
+
+void CsiExtractor::Release(Job* job) {
+  this->free_.enqueue(job);
+  this->in_flight_.fetch_sub(1, std::memory_order_release);
+}
+
+void CsiExtractor::DoExtraction(size_t tid) {
+  // All symbols of a slot back to back, transformed in one batch
+  const size_t samples = this->symbols_ * this->fft_size_;
+  auto* in = static_cast<std::complex<float>*>(
+      mufft_alloc(samples * sizeof(std::complex<float>)));
+  auto* out = static_cast<std::complex<float>*>(
+      mufft_alloc(samples * sizeof(std::complex<float>)));
+  if (in == nullptr || out == nullptr) {
+    MLPD_ERROR("CSI thread %zu: no FFT buffers\n", tid);
+    throw std::runtime_error("CsiExtractor: cannot allocate FFT buffers");
+  }
+  // Plans ahead of the first pilot
+  CommsLib::getFftPlan(this->fft_size_, MUFFT_FORWARD);
+  const size_t subcarriers = this->bins_.size();
+
+  Job* batch[kCsiBatch];
+  while (true) {
+    const size_t count = this->todo_.try_dequeue_bulk(batch, kCsiBatch);
+    if (count == 0) {
+      if (this->running_.load(std::memory_order_acquire) == false) break;
+      std::this_thread::sleep_for(kCsiIdleWait);
+      continue;
+    }
+    for (size_t j = 0; j < count; j++) {
+      Job* job = batch[j];
+      for (size_t s = 0; s < this->symbols_; s++) {
+        // Past the cyclic prefix of symbol s
+        const short* iq =
+            job->samples.data() +
+            2 * (this->prefix_ + s * (this->fft_size_ + this->cp_size_) +
+                 this->cp_size_);
+        std::complex<float>* sym = in + s * this->fft_size_;
+        for (size_t n = 0; n < this->fft_size_; n++) {
+          sym[n] = std::complex<float>(iq[2 * n] * kSampleScale,
+                                       iq[2 * n + 1] * kSampleScale);
+        }
+      }
+      CommsLib::FFT(in, out, this->fft_size_, this->symbols_);
+      for (size_t i = 0; i < subcarriers; i++) {
+        std::complex<float> sum(0, 0);
+        for (size_t s = 0; s < this->symbols_; s++) {
+          sum += out[s * this->fft_size_ + this->bins_[i]];
+        }
+        const std::complex<float> h = sum * this->inv_pilot_[i];
+        job->csi[2 * i] = h.real();
+        job->csi[2 * i + 1] = h.imag();
+      }
+    }
+    this->done_.enqueue_bulk(batch, count);
+  }
+  mufft_free(in);
+  mufft_free(out);
+}
+};  // namespace Sounder
@@ -1,35 +1,183 @@
 /*
  Copyright (c) 2018-2022, Rice University
  RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
- 
+
 ---------------------------------------------------------------------
- Generates uplink and downlink data bits and the corresponding 
+ Generates uplink and downlink data bits and the corresponding
  modulated data in both frequency- and time-domain data.
 ---------------------------------------------------------------------
 */
 
 #include "include/data_generator.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
 #include "include/comms-lib.h"
 #include "include/constants.h"
+#include "include/logger.h"
 #include "include/utils.h"
 
-void DataGenerator::GenerateData(const std::string& directory) {
-  srand(time(NULL));
+// A job writes about this much time-domain data, and every thread gets a
+// few jobs so that radios with more slots do not leave the others idle
+static constexpr size_t kJobBytes = 16 * 1024 * 1024;
+static constexpr size_t kJobsPerThread = 4;
+
+static inline uint64_t SplitMix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static int ModType(const std::string& modulation) {
+  return modulation == "64QAM"
+             ? CommsLib::QAM64
+             : (modulation == "16QAM" ? CommsLib::QAM16 : CommsLib::QPSK);
+}
+
+static void WriteAt(int fd, const void* data, size_t bytes, size_t offset) {
+  const char* buffer = static_cast<const char*>(data);
+  size_t done = 0;
+  while (done < bytes) {
+    const ssize_t n = pwrite(fd, buffer + done, bytes - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      throw std::runtime_error(std::string("DataGenerator: write failed: ") +
+                               std::strerror(errno));
+    }
+    done += n;
+  }
+}
+
+void DataGenerator::OpenFiles(const std::string& directory,
+                              const std::string& tag, RadioFiles& files) {
+  const size_t symbols = cfg_->symbol_per_slot();
+  const size_t slot_count = files.slots * files.channels;
+  const std::string kinds[3] = {"bits", "frequency-domain data",
+                                "time-domain data"};
+  const std::string names[3] = {"_data_b_", "_data_f_", "_data_t_"};
+  const size_t frame_bytes[3] = {
+      slot_count * symbols * cfg_->symbol_data_subcarrier_num(),
+      slot_count * symbols * cfg_->fft_size() * sizeof(float) * 2,
+      slot_count * cfg_->samps_per_slot() * sizeof(int16_t) * 2};
+  int* fds[3] = {&files.fd_b, &files.fd_f, &files.fd_t};
+  for (size_t k = 0; k < 3; k++) {
+    const std::string filename =
+        directory + (files.downlink ? "/dl" : "/ul") + names[k] + tag;
+    std::printf("Saving %s %s to %s\n", files.downlink ? "DL" : "UL",
+                kinds[k].c_str(), filename.c_str());
+    const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot create " + filename + ": " +
+                               std::strerror(errno));
+    }
+    *fds[k] = fd;
+    // Full size up front, the workers write their frames in place
+    const size_t bytes = files.frames * frame_bytes[k];
+    if (bytes > 0 && fallocate(fd, 0, 0, bytes) != 0 &&
+        ftruncate(fd, bytes) != 0) {
+      throw std::runtime_error("Cannot size " + filename + ": " +
+                               std::strerror(errno));
+    }
+  }
+}
+
+void DataGenerator::WriteFrames(const RadioFiles& files,
+                                OfdmModulator& modulator, int mod_type,
+                                size_t first_frame, size_t frames) {
+  const size_t fft_size = cfg_->fft_size();
+  const size_t symbols = cfg_->symbol_per_slot();
+  const size_t samps = cfg_->samps_per_slot();
+  // Bits records are ofdm_data_num bytes per symbol, the values past the
+  // data subcarriers stay zero
+  const size_t bits_stride = cfg_->symbol_data_subcarrier_num();
+  const size_t data_num = modulator.data_per_symbol();
+  if (data_num > bits_stride || modulator.slot_samples() != samps) {
+    throw std::runtime_error("DataGenerator: slot layout does not match");
+  }
+  const bool dl_pilots = files.downlink && cfg_->dl_pilots_en();
+
+  const size_t slot_count = files.slots * files.channels;
+  const size_t frame_bits = slot_count * symbols * bits_stride;
+  const size_t frame_freq = slot_count * symbols * fft_size;
+  const size_t frame_time = slot_count * samps;
+  std::vector<uint8_t> bits(frames * frame_bits, 0);
+  std::vector<std::complex<float>> freq(frames * frame_freq, 0);
+  std::vector<std::complex<int16_t>> time(frames * frame_time, 0);
+  if (dl_pilots == true) {
+    // The same for every slot
+    const size_t lts_len = std::min(fft_size, Consts::kFftSize_80211);
+    const size_t pilot_len = std::min(samps, cfg_->pilot_ci16().size());
+    for (size_t slot = 0; slot < frames * slot_count; slot++) {
+      for (size_t s = 0; s < symbols; s++) {
+        std::copy(Consts::lts_seq, Consts::lts_seq + lts_len,
+                  freq.begin() + (slot * symbols + s) * fft_size);
+      }
+      std::copy(cfg_->pilot_ci16().begin(),
+                cfg_->pilot_ci16().begin() + pilot_len,
+                time.begin() + slot * samps);
+    }
+  }
+
+  // Value n of the radio is the top bits of a hash of key + n
+  const int value_shift = 64 - mod_type;
+  uint64_t counter = first_frame * slot_count * symbols * data_num;
+  for (size_t f = 0; f < frames; f++) {
+    for (size_t slot = 0; slot < slot_count; slot++) {
+      const size_t index = f * slot_count + slot;
+      uint8_t* slot_bits = bits.data() + index * symbols * bits_stride;
+      for (size_t s = 0; s < symbols; s++) {
+        for (size_t c = 0; c < data_num; c++) {
+          slot_bits[s * bits_stride + c] =
+              SplitMix64(files.key + counter++) >> value_shift;
+        }
+      }
+      if (dl_pilots == true) continue;
+      const size_t saturated = modulator.Modulate(
+          slot_bits, bits_stride, freq.data() + index * symbols * fft_size,
+          time.data() + index * samps);
+      if (saturated > 0) {
+        std::printf(
+            "Saturation detected in frame %zu slot %zu channel %zu, %zu "
+            "samples\n",
+            first_frame + f, slot / files.channels, slot % files.channels,
+            saturated);
+      }
+    }
+  }
+  WriteAt(files.fd_b, bits.data(), bits.size(), first_frame * frame_bits);
+  WriteAt(files.fd_f, freq.data(), freq.size() * sizeof(float) * 2,
+          first_frame * frame_freq * sizeof(float) * 2);
+  WriteAt(files.fd_t, time.data(), time.size() * sizeof(int16_t) * 2,
+          first_frame * frame_time * sizeof(int16_t) * 2);
+}
 
-  const size_t lts_seq_len = Consts::kFftSize_80211;
-  std::vector<std::complex<float>> lts_freq(Consts::lts_seq,
-                                            Consts::lts_seq + lts_seq_len);
-  std::vector<std::complex<float>> prefix_zpad_t(cfg_->prefix(), 0);
-  std::vector<std::complex<float>> postfix_zpad_t(cfg_->postfix(), 0);
+void DataGenerator::OpenAllFiles(const std::string& directory, uint64_t seed,
+                                 std::vector<RadioFiles>& radio_files) {
   for (size_t i = 0; i < cfg_->num_cl_sdrs(); i++) {
     if (cfg_->cl_ul_slots().at(i).size() > 0) {
-      int mod_type = cfg_->cl_data_mod() == "64QAM"
-                         ? CommsLib::QAM64
-                         : (cfg_->cl_data_mod() == "16QAM" ? CommsLib::QAM16
-                                                           : CommsLib::QPSK);
-      int mod_order = 1 << mod_type;
-
+      // Frame * UL Slots * Channel * Samples
+      RadioFiles files = {false,
+                          cfg_->ul_data_frame_num(),
+                          cfg_->cl_ul_slots().at(i).size(),
+                          cfg_->cl_sdr_ch(),
+                          SplitMix64(seed ^ SplitMix64(i)),
+                          -1,
+                          -1,
+                          -1};
+      radio_files.push_back(files);
       std::string filename_tag =
           cfg_->cl_data_mod() + "_" +
           std::to_string(cfg_->symbol_data_subcarrier_num()) + "_" +
@@ -38,90 +186,23 @@ void DataGenerator::GenerateData(const std::string& directory) {
           std::to_string(cfg_->cl_ul_slots()[i].size()) + "_" +
           std::to_string(cfg_->ul_data_frame_num()) + "_" + cfg_->cl_channel() +
           "_" + std::to_string(i) + ".bin";
-
-      std::string filename_ul_data_b = directory + "/ul_data_b_" + filename_tag;
-      std::printf("Saving UL data bits for radio %zu to %s\n", i,
-                  filename_ul_data_b.c_str());
-      FILE* fp_tx_b = std::fopen(filename_ul_data_b.c_str(), "wb");
-      std::string filename_ul_data_f = directory + "/ul_data_f_" + filename_tag;
-      std::printf("Saving UL frequency-domain data for radio %zu to %s\n", i,
-                  filename_ul_data_f.c_str());
-      FILE* fp_tx_f = std::fopen(filename_ul_data_f.c_str(), "wb");
-      std::string filename_ul_data_t = directory + "/ul_data_t_" + filename_tag;
-      std::printf("Saving UL time-domain data for radio %zu to %s\n", i,
-                  filename_ul_data_t.c_str());
-      FILE* fp_tx_t = std::fopen(filename_ul_data_t.c_str(), "wb");
-      // Frame * UL Slots * Channel * Samples
-      for (size_t f = 0; f < cfg_->ul_data_frame_num(); f++) {
-        for (size_t u = 0; u < cfg_->cl_ul_slots().at(i).size(); u++) {
-          for (size_t h = 0; h < cfg_->cl_sdr_ch(); h++) {
-            std::vector<std::complex<float>> data_freq_dom;
-            std::vector<std::complex<float>> data_time_dom;
-            data_time_dom.insert(data_time_dom.begin(), prefix_zpad_t.begin(),
-                                 prefix_zpad_t.end());
-            for (size_t s = 0; s < cfg_->symbol_per_slot(); s++) {
-              std::vector<uint8_t> data_bits;
-              for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                data_bits.push_back((uint8_t)(rand() % mod_order));
-              }
-              std::fwrite(data_bits.data(), cfg_->symbol_data_subcarrier_num(),
-                          sizeof(uint8_t), fp_tx_b);
-              std::vector<std::complex<float>> mod_data =
-                  CommsLib::modulate(data_bits, mod_type);
-              std::vector<std::complex<float>> ofdm_sym(cfg_->fft_size(), 0);
-              size_t sc = 0;
-              for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                sc = cfg_->data_ind()[c];
-                ofdm_sym[sc] = mod_data[c];
-              }
-              for (size_t c = 0; c < cfg_->pilot_sc().size(); c++) {
-                sc = cfg_->pilot_sc_ind().at(c);
-                ofdm_sym[sc] = cfg_->pilot_sc().at(c);
-              }
-              auto tx_sym = CommsLib::IFFT(ofdm_sym, cfg_->fft_size(),
-                                           1.f / cfg_->fft_size(), false, true);
-              tx_sym.insert(tx_sym.begin(), tx_sym.end() - cfg_->cp_size(),
-                            tx_sym.end());  // add CP
-              data_time_dom.insert(data_time_dom.end(), tx_sym.begin(),
-                                   tx_sym.end());
-              data_freq_dom.insert(data_freq_dom.end(), ofdm_sym.begin(),
-                                   ofdm_sym.end());
-            }
-            data_time_dom.insert(data_time_dom.end(), postfix_zpad_t.begin(),
-                                 postfix_zpad_t.end());
-            for (size_t id = 0; id < data_time_dom.size(); id++) {
-              data_time_dom.at(id) *= cfg_->tx_scale();
-              if (data_time_dom.at(id).real() > 1.f ||
-                  data_time_dom.at(id).imag() > 1.f) {
-                std::printf(
-                    "Saturation detected in frame %zu slot %zu channel %zu "
-                    "sample %zu\n",
-                    f, u, h, id);
-              }
-            }
-            auto data_time_dom_ci16 = Utils::cfloat_to_cint16(data_time_dom);
-            std::fwrite(data_freq_dom.data(),
-                        cfg_->fft_size() * cfg_->symbol_per_slot(),
-                        sizeof(float) * 2, fp_tx_f);
-            std::fwrite(data_time_dom_ci16.data(), cfg_->samps_per_slot(),
-                        sizeof(int16_t) * 2, fp_tx_t);
-          }
-        }
-      }
-      std::fclose(fp_tx_b);
-      std::fclose(fp_tx_f);
-      std::fclose(fp_tx_t);
+      this->OpenFiles(directory, filename_tag, radio_files.back());
     }
   }
 
   // Generate Downlink Data
   if (cfg_->dl_slot_per_frame() > 0) {
-    int mod_type =
-        cfg_->data_mod() == "64QAM"
-            ? CommsLib::QAM64
-            : (cfg_->data_mod() == "16QAM" ? CommsLib::QAM16 : CommsLib::QPSK);
-    int mod_order = 1 << mod_type;
     for (size_t i = 0; i < cfg_->num_bs_sdrs_all(); i++) {
+      // Frame * DL Slots * Antennas * Samples
+      RadioFiles files = {true,
+                          cfg_->dl_data_frame_num(),
+                          cfg_->dl_slot_per_frame(),
+                          cfg_->bs_sdr_ch(),
+                          SplitMix64(seed ^ SplitMix64((1ull << 32) | i)),
+                          -1,
+                          -1,
+                          -1};
+      radio_files.push_back(files);
       std::string filename_tag =
           cfg_->data_mod() + "_" +
           std::to_string(cfg_->symbol_data_subcarrier_num()) + "_" +
@@ -130,76 +211,104 @@ void DataGenerator::GenerateData(const std::string& directory) {
           std::to_string(cfg_->dl_slot_per_frame()) + "_" +
           std::to_string(cfg_->dl_data_frame_num()) + "_" + cfg_->bs_channel() +
           "_" + std::to_string(i) + ".bin";
+      this->OpenFiles(directory, filename_tag, radio_files.back());
+    }
+  }
+}
 
-      std::string filename_dl_data_b = directory + "/dl_data_b_" + filename_tag;
-      std::printf("Saving DL data bits to %s\n", filename_dl_data_b.c_str());
-      FILE* fp_tx_b = std::fopen(filename_dl_data_b.c_str(), "wb");
-      std::string filename_dl_data_f = directory + "/dl_data_f_" + filename_tag;
-      std::printf("Saving DL frequency-domain data to %s\n",
-                  filename_dl_data_f.c_str());
-      FILE* fp_tx_f = std::fopen(filename_dl_data_f.c_str(), "wb");
-      std::string filename_dl_data_t = directory + "/dl_data_t_" + filename_tag;
-      std::printf("Saving DL time-domain data to %s\n",
-                  filename_dl_data_t.c_str());
-      FILE* fp_tx_t = std::fopen(filename_dl_data_t.c_str(), "wb");
-      // Frame * DL Slots * Antennas * Samples
-      for (size_t f = 0; f < cfg_->dl_data_frame_num(); f++) {
-        for (size_t u = 0; u < cfg_->dl_slot_per_frame(); u++) {
-          for (size_t h = 0; h < cfg_->bs_sdr_ch(); h++) {
-            std::vector<std::complex<float>> data_freq_dom;
-            std::vector<std::complex<float>> data_time_dom;
-            data_time_dom.insert(data_time_dom.begin(), prefix_zpad_t.begin(),
-                                 prefix_zpad_t.end());
-            for (size_t s = 0; s < cfg_->symbol_per_slot(); s++) {
-              std::vector<uint8_t> data_bits;
-              for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                data_bits.push_back((uint8_t)(rand() % mod_order));
-              }
-              std::fwrite(data_bits.data(), cfg_->symbol_data_subcarrier_num(),
-                          sizeof(uint8_t), fp_tx_b);
-              std::vector<std::complex<float>> mod_data =
-                  CommsLib::modulate(data_bits, mod_type);
-              std::vector<std::complex<float>> ofdm_sym(cfg_->fft_size(), 0);
-              size_t sc = 0;
-              for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                sc = cfg_->data_ind()[c];
-                ofdm_sym[sc] = mod_data[c];
-              }
-              for (size_t c = 0; c < cfg_->pilot_sc().size(); c++) {
-                sc = cfg_->pilot_sc_ind().at(c);
-                ofdm_sym[sc] = cfg_->pilot_sc().at(c);
-              }
-              auto tx_sym = CommsLib::IFFT(ofdm_sym, cfg_->fft_size(),
-                                           1.f / cfg_->fft_size(), false, true);
-              tx_sym.insert(tx_sym.begin(), tx_sym.end() - cfg_->cp_size(),
-                            tx_sym.end());  // add CP
-              data_time_dom.insert(data_time_dom.end(), tx_sym.begin(),
-                                   tx_sym.end());
-              if (cfg_->dl_pilots_en() == false) {
-                data_freq_dom.insert(data_freq_dom.end(), ofdm_sym.begin(),
-                                     ofdm_sym.end());
-              } else {
-                data_freq_dom.insert(data_freq_dom.end(), lts_freq.begin(),
-                                     lts_freq.end());
-              }
-            }
-            data_time_dom.insert(data_time_dom.end(), postfix_zpad_t.begin(),
-                                 postfix_zpad_t.end());
-            auto data_time_dom_ci16 =
-                cfg_->dl_pilots_en() ? cfg_->pilot_ci16()
-                                     : Utils::cfloat_to_cint16(data_time_dom);
-
-            std::fwrite(data_freq_dom.data(),
-                        cfg_->fft_size() * cfg_->symbol_per_slot(),
-                        sizeof(float) * 2, fp_tx_f);
-            std::fwrite(data_time_dom_ci16.data(), cfg_->samps_per_slot(),
-                        sizeof(int16_t) * 2, fp_tx_t);
-          }
+void DataGenerator::CloseFiles(std::vector<RadioFiles>& radio_files) {
+  for (auto& files : radio_files) {
+    for (int* fd : {&files.fd_b, &files.fd_f, &files.fd_t}) {
+      if (*fd >= 0) close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void DataGenerator::GenerateData(const std::string& directory) {
+  uint64_t seed = cfg_->data_gen_seed();
+  if (seed == 0) {
+    std::random_device rd;
+    seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  std::printf("Data generator seed %" PRIu64
+              ", set data_gen_seed to repeat this data\n",
+              seed);
+
+  std::vector<RadioFiles> radio_files;
+  try {
+    this->OpenAllFiles(directory, seed, radio_files);
+  } catch (...) {
+    // The files opened before the one that failed
+    CloseFiles(radio_files);
+    throw;
+  }
+
+  // Ranges of frames of every radio
+  size_t threads = cfg_->data_gen_threads();
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<Job> jobs;
+  const size_t radio_jobs =
+      radio_files.empty()
+          ? 1
+          : (threads * kJobsPerThread + radio_files.size() - 1) /
+                radio_files.size();
+  for (size_t r = 0; r < radio_files.size(); r++) {
+    const RadioFiles& files = radio_files[r];
+    const size_t frame_bytes = files.slots * files.channels *
+                               cfg_->samps_per_slot() * sizeof(int16_t) * 2;
+    size_t job_frames = (files.frames + radio_jobs - 1) / radio_jobs;
+    job_frames = std::min(job_frames, kJobBytes / std::max<size_t>(
+                                                      frame_bytes, 1));
+    job_frames = std::max<size_t>(job_frames, 1);
+    for (size_t f = 0; f < files.frames; f += job_frames) {
+      jobs.push_back({r, f, std::min(job_frames, files.frames - f)});
+    }
+  }
+  threads = std::max<size_t>(std::min(threads, jobs.size()), 1);
+  MLPD_INFO("Generating %zu jobs on %zu threads\n", jobs.size(), threads);
+
+  // No tx_scale on the downlink
+  const int ul_mod_type = ModType(cfg_->cl_data_mod());
+  const int dl_mod_type = ModType(cfg_->data_mod());
+  std::atomic<size_t> next_job(0);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&]() {
+    std::unique_ptr<OfdmModulator> ul_modulator;
+    std::unique_ptr<OfdmModulator> dl_modulator;
+    try {
+      for (size_t j = next_job++; j < jobs.size(); j = next_job++) {
+        const Job& job = jobs[j];
+        const RadioFiles& files = radio_files[job.radio_files];
+        std::unique_ptr<OfdmModulator>& modulator =
+            files.downlink ? dl_modulator : ul_modulator;
+        if (modulator == nullptr) {
+          modulator = std::make_unique<OfdmModulator>(
+              cfg_->fft_size(), cfg_->cp_size(), cfg_->symbol_per_slot(),
+              cfg_->prefix(), cfg_->postfix(), cfg_->data_ind(),
+              cfg_->pilot_sc_ind(), cfg_->pilot_sc(),
+              files.downlink ? dl_mod_type : ul_mod_type,
+              files.downlink ? 1.f : cfg_->tx_scale());
         }
+        this->WriteFrames(files, *modulator,
+                          files.downlink ? dl_mod_type : ul_mod_type,
+                          job.first_frame, job.frames);
       }
-      std::fclose(fp_tx_b);
-      std::fclose(fp_tx_f);
-      std::fclose(fp_tx_t);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (error == nullptr) error = std::current_exception();
+      // Let the others run out of jobs
+      next_job = jobs.size();
     }
-  }
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; t++) workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers) thread.join();
+
+  CloseFiles(radio_files);
+  if (error != nullptr) std::rethrow_exception(error);
 }
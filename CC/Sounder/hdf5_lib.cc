@@ -10,12 +10,18 @@
 #include "include/hdf5_lib.h"
 
 #include <cassert>
+#include <stdexcept>
 
 #include "include/logger.h"
 #include "include/utils.h"
 
 static constexpr bool kPrintDataSetInfo = false;
-static constexpr int kDsExtendStep = 400;
+// Datasets grow by at least kDsExtendStep frames, else by their own size
+static constexpr hsize_t kDsExtendStep = 400;
+// Hash table size of a configured chunk cache, a prime as HDF5 recommends
+static constexpr size_t kChunkCacheSlots = 12421;
+// Registered id of the zstd filter, the one hdf5plugin reads
+static constexpr H5Z_filter_t kZstdFilterId = 32015;
 
 namespace Sounder {
 Hdf5Lib::Hdf5Lib(H5std_string hdf5_name, H5std_string group_name)
@@ -45,7 +51,9 @@ void Hdf5Lib::closeFile() {
 }
 int Hdf5Lib::createDataset(H5std_string dataset_name,
                            std::array<hsize_t, kDsDimsNum> tot_dims,
-                           std::array<hsize_t, kDsDimsNum> chunk_dims) {
+                           std::array<hsize_t, kDsDimsNum> chunk_dims,
+                           size_t chunk_cache_bytes,
+                           const H5::PredType& type) {
   const std::string ds_name("/" + this->group_name_ + "/" + dataset_name);
   std::array<hsize_t, kDsDimsNum> max_ds_dims = tot_dims;
   max_ds_dims.at(0) = H5S_UNLIMITED;
@@ -55,8 +63,25 @@ int Hdf5Lib::createDataset(H5std_string dataset_name,
     H5::Exception::dontPrint();
 
     ds_prop.setChunk(kDsDimsNum, chunk_dims.data());
-    this->file_->createDataSet(ds_name, H5::PredType::STD_I16BE, ds_dataspace,
-                               ds_prop);
+    if (this->max_prim_dim_size != 0 && this->codec_ == kCodecNone) {
+      // Reserve the file space of the whole recording now, not while
+      // frames arrive; filtered chunks only get their size when written
+      tot_dims.at(0) = this->max_prim_dim_size + 1;
+      ds_dataspace.setExtentSimple(kDsDimsNum, tot_dims.data(),
+                                   max_ds_dims.data());
+      ds_prop.setAllocTime(H5D_ALLOC_TIME_EARLY);
+    }
+    if (this->codec_ != kCodecNone) {
+      ds_prop.setShuffle();
+      if (this->codec_ == kCodecDeflate) {
+        ds_prop.setDeflate(this->codec_level_);
+      } else {
+        const unsigned int level = this->codec_level_;
+        ds_prop.setFilter(kZstdFilterId, H5Z_FLAG_OPTIONAL, 1, &level);
+      }
+    }
+    // Little-endian like the samples in memory, so writes need no swap
+    this->file_->createDataSet(ds_name, type, ds_dataspace, ds_prop);
     ds_prop.close();
   }
   // catch failure caused by the H5File operations
@@ -80,6 +105,7 @@ int Hdf5Lib::createDataset(H5std_string dataset_name,
   prop_list_.push_back(ds_prop);
   dataspace_.push_back(ds_dataspace);
   dims_.push_back(tot_dims);
+  chunk_cache_.push_back(chunk_cache_bytes);
   datasets_.emplace_back(std::unique_ptr<H5::DataSet>(nullptr));
   size_t map_size = ds_name_id.size();
   ds_name_id[dataset_name] = map_size;
@@ -89,12 +115,19 @@ int Hdf5Lib::createDataset(H5std_string dataset_name,
 void Hdf5Lib::openDataset() {
   MLPD_TRACE("Open HDF5 file: %s\n", this->hdf5_name_.c_str());
   this->file_->openFile(this->hdf5_name_, H5F_ACC_RDWR);
+  this->open_ = true;
   for (size_t i = 0; i < dataset_str_.size(); i++) {
     std::string ds_name("/" + this->group_name_ + "/" +
                         this->dataset_str_.at(i));
     try {
-      datasets_.at(i) =
-          std::make_unique<H5::DataSet>(this->file_->openDataSet(ds_name));
+      H5::DSetAccPropList access;
+      if (this->chunk_cache_.at(i) > 0) {
+        // Whole chunks stay cached until every frame in them is written
+        access.setChunkCache(kChunkCacheSlots, this->chunk_cache_.at(i),
+                             H5D_CHUNK_CACHE_W0_DEFAULT);
+      }
+      datasets_.at(i) = std::make_unique<H5::DataSet>(
+          this->file_->openDataSet(ds_name, access));
       H5::DataSpace filespace(datasets_.at(i)->getSpace());
       prop_list_.at(i).copy(datasets_.at(i)->getCreatePlist());
       if (kPrintDataSetInfo == true) {
@@ -135,12 +168,14 @@ void Hdf5Lib::removeDataset(std::string dataset_name) {
 void Hdf5Lib::closeDataset() {
   MLPD_TRACE("Close HD5F file: %s\n", this->hdf5_name_.c_str());
 
-  if (this->file_ != nullptr) {
+  if (this->file_ != nullptr && this->open_ == true) {
     for (size_t i = 0; i < dataset_str_.size(); i++) {
       assert(datasets_.at(i) != nullptr);
       try {
         H5::Exception::dontPrint();
-        this->extendDataset(dataset_str_.at(i), this->target_prim_dim_size);
+        // Drop the frames extendDataset() added ahead of time
+        dims_.at(i).at(0) = this->frames_written_;
+        this->datasets_.at(i)->extend(dims_.at(i).data());
         this->prop_list_.at(i).close();
         this->datasets_.at(i)->close();
       }
@@ -152,16 +187,36 @@ void Hdf5Lib::closeDataset() {
       this->datasets_.at(i).reset();
     }
     this->file_->close();
+    this->open_ = false;
     MLPD_INFO("Saving HD5F: %llu frames saved on CPU %d\n",
-              this->target_prim_dim_size, sched_getcpu());
+              this->frames_written_, sched_getcpu());
+  }
+}
+
+void Hdf5Lib::setFlushInterval(std::chrono::milliseconds interval) {
+  this->flush_interval_ = interval;
+  this->next_flush_ = std::chrono::steady_clock::now() + interval;
+}
+
+void Hdf5Lib::flushIfDue(void) {
+  if (this->flush_interval_.count() == 0 || this->open_ == false) return;
+  const auto now = std::chrono::steady_clock::now();
+  if (now < this->next_flush_) return;
+  this->next_flush_ = now + this->flush_interval_;
+  if (H5Fflush(this->file_->getId(), H5F_SCOPE_LOCAL) < 0) {
+    MLPD_WARN("Flushing %s failed\n", this->hdf5_name_.c_str());
   }
 }
 
 bool Hdf5Lib::extendDataset(std::string dataset_name, size_t prim_dim_size) {
   const std::string ds_name("/" + this->group_name_ + "/" + dataset_name);
   const size_t ds_id = ds_name_id[dataset_name];
+  this->frames_written_ =
+      std::max<hsize_t>(this->frames_written_, prim_dim_size + 1);
   if (dims_.at(ds_id).at(0) <= prim_dim_size) {
-    hsize_t new_dim_size = dims_.at(ds_id).at(0) + kDsExtendStep;
+    // Doubling keeps the number of extends logarithmic in the frames
+    hsize_t new_dim_size =
+        std::max(dims_.at(ds_id).at(0) * 2, prim_dim_size + kDsExtendStep);
     if (this->max_prim_dim_size != 0) {
       new_dim_size = std::min(new_dim_size, max_prim_dim_size + 1);
     }
@@ -181,7 +236,23 @@ herr_t Hdf5Lib::writeDataset(std::string dataset_name,
                              std::array<hsize_t, kDsDimsNum> target_id,
                              std::array<hsize_t, kDsDimsNum> wrt_dim,
                              short* wrt_data) {
-  const std::string ds_name("/" + this->group_name_ + "/" + dataset_name);
+  return this->writeHyperslab(dataset_name, target_id, wrt_dim, wrt_data,
+                              H5::PredType::NATIVE_INT16);
+}
+
+herr_t Hdf5Lib::writeDataset(std::string dataset_name,
+                             std::array<hsize_t, kDsDimsNum> target_id,
+                             std::array<hsize_t, kDsDimsNum> wrt_dim,
+                             const float* wrt_data) {
+  return this->writeHyperslab(dataset_name, target_id, wrt_dim, wrt_data,
+                              H5::PredType::NATIVE_FLOAT);
+}
+
+herr_t Hdf5Lib::writeHyperslab(const std::string& dataset_name,
+                               const std::array<hsize_t, kDsDimsNum>& target_id,
+                               const std::array<hsize_t, kDsDimsNum>& wrt_dim,
+                               const void* wrt_data,
+                               const H5::PredType& mem_type) {
   const size_t ds_id = ds_name_id[dataset_name];
   herr_t ret = 0;
   // Select a hyperslab in extended portion of the dataset
@@ -191,8 +262,7 @@ herr_t Hdf5Lib::writeDataset(std::string dataset_name,
     filespace.selectHyperslab(H5S_SELECT_SET, wrt_dim.data(), target_id.data());
     // define memory space
     H5::DataSpace memspace(kDsDimsNum, wrt_dim.data(), NULL);
-    this->datasets_.at(ds_id)->write(wrt_data, H5::PredType::NATIVE_INT16,
-                                     memspace, filespace);
+    this->datasets_.at(ds_id)->write(wrt_data, mem_type, memspace, filespace);
     filespace.close();
   }
   // catch failure caused by the DataSet operations
@@ -229,6 +299,22 @@ herr_t Hdf5Lib::writeDataset(std::string dataset_name,
   return ret;
 }
 
+herr_t Hdf5Lib::writeChunk(std::string dataset_name,
+                           const std::array<hsize_t, kDsDimsNum>& offset,
+                           uint32_t filter_mask, const void* data,
+                           size_t bytes) {
+  const size_t ds_id = ds_name_id[dataset_name];
+  const herr_t ret =
+      H5Dwrite_chunk(this->datasets_.at(ds_id)->getId(), H5P_DEFAULT,
+                     filter_mask, offset.data(), bytes, data);
+  if (ret < 0) {
+    MLPD_ERROR("%s: failed to write chunk at frame %llu\n",
+               dataset_name.c_str(), offset.at(0));
+    throw std::runtime_error("Hdf5Lib: direct chunk write failed");
+  }
+  return ret;
+}
+
 std::vector<short> Hdf5Lib::readDataset(
     std::string dataset_name, std::array<hsize_t, kDsDimsNum> target_id,
     std::array<hsize_t, kDsDimsNum> read_dim) {
@@ -381,4 +467,17 @@ void Hdf5Lib::write_attribute(const char name[],
   for (size_t i = 0; i < size; ++i) cStrArray[i] = val[i].c_str();
   att.write(strdatatype, cStrArray);
 }
+
+// Small fixed size 1-D dataset in the group, for data that may outgrow the
+// 64 KiB attribute limit
+void Hdf5Lib::write_dataset(const char name[],
+                            const std::vector<uint8_t>& val) {
+  hsize_t dims[] = {val.size()};
+  H5::DataSpace ds = H5::DataSpace(1, dims);
+  H5::DataSet dataset =
+      this->group_->createDataSet(name, H5::PredType::STD_U8LE, ds);
+  if (val.empty() == false) {
+    dataset.write(val.data(), H5::PredType::NATIVE_UINT8);
+  }
+}
 };  // namespace Sounder
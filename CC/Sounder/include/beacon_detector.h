@@ -0,0 +1,79 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Streaming beacon detection on the samples of one client radio
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_BEACON_DETECTOR_H_
+#define SOUNDER_BEACON_DETECTOR_H_
+
+#include <sys/types.h>
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "correlator.h"
+
+/* Same test as CommsLib::find_beacon_avx(), run on a stream: the beacon,
+ * two repetitions of a sequence of M samples, ends at sample k if
+ *
+ *   corr_scale * |c[k]|^2 |c[k - M]|^2 > sum of |c[i]|^2, k - M <= i < k
+ *
+ * with c the correlation with the sequence. The detector keeps the last
+ * samples and correlation powers of the stream, so every sample is
+ * correlated once and a beacon split over two Push() calls is found in
+ * the second. Reset() when the stream has a gap, e.g. after samples were
+ * discarded to align to the frame. One object per radio, not thread safe.
+ *
+ * With fixed_point the samples stay int16 and the sequence is quantized
+ * to the most bits for which the int32 correlation can not overflow, 8
+ * bits for M = 128. Powers and their running sum are integers, only the
+ * final comparison is done in floating point. */
+class BeaconDetector {
+ public:
+  BeaconDetector(const std::vector<std::complex<float>>& sequence,
+                 size_t max_push, bool fixed_point = false);
+
+  /* Returns where in samples[0, count) the first beacon found ends, or -1 */
+  ssize_t Push(const std::complex<int16_t>* samples, size_t count,
+               float corr_scale);
+  void Reset();
+
+  /* Samples it takes to find a beacon that ended right before them */
+  inline size_t history(void) const { return 2 * taps_; }
+  inline bool fixed_point(void) const { return fixed_point_; }
+
+ private:
+  void Reserve(size_t count);
+  ssize_t PushFloat(const std::complex<int16_t>* samples, size_t count,
+                    float corr_scale);
+  ssize_t PushFixed(const std::complex<int16_t>* samples, size_t count,
+                    float corr_scale);
+
+  Correlator correlator_;
+  const size_t taps_;
+  const bool fixed_point_;
+  // The last taps_ - 1 samples, then the ones pushed
+  std::vector<std::complex<float>> samples_;
+  std::vector<std::complex<float>> corr_;
+  // The last taps_ correlation powers, then the ones of the samples pushed
+  std::vector<float> power_;
+
+  std::vector<int16_t> seq_re_;
+  std::vector<int16_t> seq_im_;
+  std::vector<int16_t> sample_re_;
+  std::vector<int16_t> sample_im_;
+  std::vector<int32_t> corr_re_;
+  std::vector<int32_t> corr_im_;
+  // |c|^2 >> power_shift_, so that taps_ of them add up in 64 bits
+  std::vector<uint64_t> fixed_power_;
+  size_t power_shift_;
+  // Fixed point power of a float power of 1
+  double power_unit_;
+};
+
+#endif /* SOUNDER_BEACON_DETECTOR_H_ */
@@ -0,0 +1,53 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Page-aligned, prefaulted and locked memory for the sample buffers
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_BUFFER_MEMORY_H_
+#define SOUNDER_BUFFER_MEMORY_H_
+
+#include <cstddef>
+#include <string>
+
+enum HugePageMode {
+  kHugePageAuto = 0,  // 1 GB pages for buffers of >= 1 GB, else 2 MB
+  kHugePage1G = 1,
+  kHugePage2M = 2,
+  kHugePageNone = 3  // regular pages, transparent hugepages if enabled
+};
+
+/// Owns one mmap'ed region. Allocate() falls back from the requested
+/// hugepage size to smaller pages whenever the kernel has none to give, so
+/// it only fails if plain anonymous memory is not available either.
+class BufferMemory {
+ public:
+  BufferMemory() = default;
+  ~BufferMemory() { Free(); }
+  BufferMemory(const BufferMemory&) = delete;
+  BufferMemory& operator=(const BufferMemory&) = delete;
+
+  /* numa_node < 0 leaves the placement to the kernel */
+  void Allocate(size_t bytes, HugePageMode mode, int numa_node);
+  void Free(void);
+
+  inline char* data(void) { return this->data_; }
+  inline const char* data(void) const { return this->data_; }
+  inline size_t size(void) const { return this->size_; }
+  /* Page size actually used, 0 if nothing is allocated */
+  inline size_t page_size(void) const { return this->page_size_; }
+
+  /* NUMA node of a cpu core, -1 if unknown */
+  static int NumaNodeOfCore(int core);
+  static HugePageMode ParseMode(const std::string& mode);
+
+ private:
+  char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t mapped_size_ = 0;
+  size_t page_size_ = 0;
+};
+
+#endif /* SOUNDER_BUFFER_MEMORY_H_ */
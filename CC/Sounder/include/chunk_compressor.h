@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Compresses the frame blocks of a recorder chunk by chunk on a worker
+ pool and stores the result with direct chunk writes
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_CHUNK_COMPRESSOR_H_
+#define SOUNDER_CHUNK_COMPRESSOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hdf5_lib.h"
+
+namespace Sounder {
+/* Frames are gathered into rows of chunk[0] frames. A complete row (or
+ * the oldest one once a third row starts) is cut into its chunks, which
+ * the workers shuffle and compress with the filters Hdf5Lib put on the
+ * dataset. The owning thread stores finished chunks in Collect(), so the
+ * HDF5 library is never entered from the workers. Data for rows that were
+ * written already is refused and goes through the regular filtered write. */
+class ChunkCompressor {
+ public:
+  // Bytes of one row of a dataset; there are up to two open per dataset
+  static constexpr size_t kMaxRowBytes = 64 << 20;
+
+  ChunkCompressor(Hdf5Lib* hdf5, Hdf5Codec codec, int level, size_t threads);
+  ~ChunkCompressor();
+
+  /* Throws std::invalid_argument if chunk[0] frames go over kMaxRowBytes */
+  size_t AddDataset(const std::string& name,
+                    const std::array<hsize_t, kDsDimsNum>& dims,
+                    const std::array<hsize_t, kDsDimsNum>& chunk);
+
+  /* Takes the [cell][slot][antenna][IQ] block of one frame. False if its
+   * row was written already. */
+  bool AddFrame(size_t ds_id, hsize_t frame_id, const short* samples);
+  /* Patches one packet into its row. False if the row was written. */
+  bool AddPacket(size_t ds_id, hsize_t frame_id, hsize_t cell_id,
+                 hsize_t slot, hsize_t antenna, const short* data);
+
+  /* Writes the compressed chunks, all submitted ones if wait is set */
+  void Collect(bool wait);
+  /* Submits every row being gathered and writes all chunks */
+  void FlushAll(void);
+  inline bool pending(void) const { return this->in_flight_.empty() == false; }
+
+  /* Makes the zstd filter known to this process' HDF5 library */
+  static void RegisterFilters(void);
+
+ private:
+  struct Row {
+    hsize_t row;
+    size_t frames;
+    hsize_t last_frame;
+    std::vector<short> samples;
+  };
+  struct Dataset {
+    std::string name;
+    std::array<hsize_t, kDsDimsNum> dims;
+    std::array<hsize_t, kDsDimsNum> chunk;
+    size_t frame_samples;
+    std::vector<Row> open;
+    // Highest row submitted, later data up to it is refused
+    hsize_t written_until;
+    bool written_any;
+  };
+  struct Job {
+    size_t ds_id;
+    std::array<hsize_t, kDsDimsNum> offset;
+    hsize_t last_frame;
+    std::vector<short> raw;
+    std::vector<char> out;
+    uint32_t filter_mask;
+    std::atomic<bool> done;
+  };
+
+  /* Row of a dataset, opened if new; nullptr once it was submitted */
+  Row* OpenRow(Dataset& ds, size_t ds_id, hsize_t row);
+  void Submit(Dataset& ds, size_t ds_id, size_t row);
+  /* Waits for the oldest chunk and stores it */
+  void WriteFront(void);
+  void Compress(Job& job) const;
+  void WorkerLoop(void);
+
+  Hdf5Lib* hdf5_;
+  const Hdf5Codec codec_;
+  const int level_;
+  const size_t max_in_flight_;
+  std::vector<Dataset> datasets_;
+  std::vector<std::vector<short>> spare_rows_;
+  // Submission order, only touched by the owning thread
+  std::deque<std::unique_ptr<Job>> in_flight_;
+  size_t raw_bytes_;
+  size_t stored_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  std::deque<Job*> queue_;
+  bool stop_;
+  std::vector<std::thread> workers_;
+};
+};  // namespace Sounder
+
+#endif /* SOUNDER_CHUNK_COMPRESSOR_H_ */
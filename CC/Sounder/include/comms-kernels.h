@@ -0,0 +1,61 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Vector kernels behind the CommsLib *_avx functions, one table per
+ instruction set level, the one to use picked at runtime
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_COMMS_KERNELS_H_
+#define SOUNDER_COMMS_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+enum class SimdLevel { kScalar = 0, kAvx2 = 1, kAvx512 = 2 };
+
+/* Complex values are interleaved re, im and count is in complex values.
+ * cs16 products are Q15: (a * b) >> 15 truncated to 16 bits. Every level
+ * computes the same outputs, bit exact for the integer kernels. The SIMD
+ * levels are built with function target attributes, so the rest of the
+ * binary does not need -march to have them. */
+struct CommsKernels {
+  SimdLevel level;
+
+  // out[i] = f[i] * g[i], or f[i] * conj(g[i])
+  void (*complex_mult_cf32)(const float* f, const float* g, float* out,
+                            size_t count, bool conj);
+  void (*complex_mult_cs16)(const int16_t* f, const int16_t* g, int16_t* out,
+                            size_t count, bool conj);
+  // out[i] = |in[i]|^2
+  void (*abs2_cf32)(const float* in, float* out, size_t count);
+  void (*abs2_cs16)(const int16_t* in, int32_t* out, size_t count);
+  // out[i] = sum_j in[i + j] * conj(seq[j]), j < taps; in holds
+  // count + taps - 1 values. cs16 sums saturate at each tap.
+  void (*correlate_cf32)(const float* in, const float* seq, size_t taps,
+                         float* out, size_t count);
+  void (*correlate_cs16)(const int16_t* in, const int16_t* seq, size_t taps,
+                         int16_t* out, size_t count);
+  // Real versions, the s16 one sums the high halves of the products
+  void (*correlate_f32)(const float* in, const float* seq, size_t taps,
+                        float* out, size_t count);
+  void (*correlate_s16)(const int16_t* in, const int16_t* seq, size_t taps,
+                        int16_t* out, size_t count);
+
+  /* The kernels of the best level this CPU has, chosen on the first call.
+   * SOUNDER_SIMD=scalar|avx2|avx512 in the environment forces a lower one */
+  static const CommsKernels& Get();
+  /* nullptr if the level is not built in or this CPU does not have it */
+  static const CommsKernels* ForLevel(SimdLevel level);
+  static SimdLevel Detect();
+  static const char* Name(SimdLevel level);
+};
+
+extern const CommsKernels kScalarCommsKernels;
+#if defined(__x86_64__)
+extern const CommsKernels kAvx2CommsKernels;
+extern const CommsKernels kAvx512CommsKernels;
+#endif
+
+#endif /* SOUNDER_COMMS_KERNELS_H_ */
@@ -60,6 +60,9 @@ class CommsLib {
   static std::vector<std::vector<float>> getSequence(size_t type,
                                                      size_t seq_len = 0);
   static std::vector<std::complex<float>> modulate(std::vector<uint8_t>, int);
+  /// QAM symbol of every value below 2^type, empty if type is not one of
+  /// ModulationOrder. Built once.
+  static const std::vector<std::complex<float>>& getConstellation(int type);
   static std::vector<size_t> getDataSc(
       size_t fftSize, size_t DataScNum,
       size_t PilotScOffset = kDefaultPilotScOffset);
@@ -75,7 +78,26 @@ class CommsLib {
   static std::vector<std::complex<float>> IFFT(
       const std::vector<std::complex<float>>&, int, float scale = 0.5,
       bool normalize = true, bool fft_shift = false);
-
+  /// Transforms batch blocks of n samples, block b from in + b * n to
+  /// out + b * n. Both buffers must be aligned for muFFT (mufft_alloc) and
+  /// must not overlap. The inverse transform is not scaled.
+  static void FFT(const std::complex<float>* in, std::complex<float>* out,
+                  size_t n, size_t batch = 1);
+  static void IFFT(const std::complex<float>* in, std::complex<float>* out,
+                   size_t n, size_t batch = 1);
+  /// Plan of the calling thread, created on its first use and kept until
+  /// the thread exits; callers must not free it
+  static mufft_plan_1d* getFftPlan(size_t n, int direction,
+                                   unsigned flags = MUFFT_FLAG_CPU_ANY);
+
+  /// out_len values of the correlation of iq with ref, see Correlator. The
+  /// calling thread keeps the correlators of its last few references.
+  static std::vector<std::complex<float>> correlate(
+      const std::vector<std::complex<float>>& iq,
+      const std::vector<std::complex<float>>& ref, size_t out_len);
+  /// out[i] is the sum of in[i - window] to in[i - 1]
+  static std::vector<float> moving_sum(const std::vector<float>& in,
+                                       size_t window);
   static int findLTS(const std::vector<std::complex<float>>& iq, int seqLen);
   static size_t find_pilot_seq(const std::vector<std::complex<float>>& iq,
                                const std::vector<std::complex<float>>& pilot,
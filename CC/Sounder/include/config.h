@@ -15,8 +15,25 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <map>
 #include <vector>
 
+#include "macros.h"
+
+// Chunking of one recorded HDF5 dataset ("hdf5_chunk", "hdf5_chunk_cache_mb")
+struct Hdf5ChunkConf {
+  enum Mode {
+    kChunkAuto = 0,      // ~1 MB of whole frames, for writing
+    kChunkAutoRead = 1,  // ~1 MB of one antenna's time series, for reading
+    kChunkPacket = 2,    // one packet per chunk
+    kChunkExplicit = 3   // dims as configured
+  };
+  Mode mode = kChunkAuto;
+  std::vector<size_t> dims;  // kChunkExplicit only, one entry per dimension
+  size_t cache_bytes = 0;    // raw data chunk cache, 0 sizes it to the chunks
+};
+
 class Config {
  public:
   Config(const std::string&, const std::string&, const bool, const bool,
@@ -71,6 +88,10 @@ class Config {
   inline size_t dl_data_frame_num(void) const {
     return this->dl_data_frame_num_;
   }
+  inline uint64_t data_gen_seed(void) const { return this->data_gen_seed_; }
+  inline size_t data_gen_threads(void) const {
+    return this->data_gen_threads_;
+  }
   inline bool beam_sweep(void) const { return this->beam_sweep_; }
   inline size_t beacon_channel(void) const { return this->beacon_ch_; }
   inline size_t beacon_ant(void) const { return this->beacon_ant_; }
@@ -100,6 +121,10 @@ class Config {
   inline double rate(void) const { return this->rate_; }
   inline int tx_advance(size_t id) const { return this->tx_advance_.at(id); }
   inline float corr_scale(size_t id) const { return this->corr_scale_.at(id); }
+  // Client beacon search on the int16 samples, see BeaconDetector
+  inline bool beacon_fixed_point(void) const {
+    return this->beacon_fixed_point_;
+  }
   inline size_t cl_sdr_ch(void) const { return this->cl_sdr_ch_; }
   inline size_t bs_sdr_ch(void) const { return this->bs_sdr_ch_; }
 
@@ -109,6 +134,8 @@ class Config {
   inline const std::string& frame_mode(void) const { return this->frame_mode_; }
   inline const std::string& bs_channel(void) const { return this->bs_channel_; }
   inline const std::string& trace_file(void) const { return this->trace_file_; }
+  inline const std::string& sdr_driver(void) const { return this->sdr_driver_; }
+  inline const std::string& sdr_args(void) const { return this->sdr_args_; }
   inline const std::string& cl_channel(void) const { return this->cl_channel_; }
   inline const std::string& beacon_seq(void) const { return this->beacon_seq_; }
   inline const std::string& pilot_seq(void) const { return this->pilot_seq_; }
@@ -218,6 +245,69 @@ class Config {
   inline size_t reader_thread_num(void) const {
     return this->reader_thread_num_;
   }
+  inline bool direct_record(void) const { return this->direct_record_; }
+  inline OverloadPolicy overload_policy(void) const {
+    return this->overload_policy_;
+  }
+  inline bool write_combiner(void) const { return this->write_combiner_; }
+  inline std::chrono::milliseconds write_combiner_timeout(void) const {
+    return this->write_combiner_timeout_;
+  }
+  const Hdf5ChunkConf& hdf5_chunk(const std::string& dataset) const;
+  inline size_t trace_segment_frames(void) const {
+    return this->trace_segment_frames_;
+  }
+  inline size_t trace_segment_mb(void) const {
+    return this->trace_segment_mb_;
+  }
+  inline size_t trace_segment_seconds(void) const {
+    return this->trace_segment_seconds_;
+  }
+  inline size_t record_staging_mb(void) const {
+    return this->record_staging_mb_;
+  }
+  inline bool record_raw(void) const { return this->record_raw_; }
+  inline size_t raw_prealloc_mb(void) const { return this->raw_prealloc_mb_; }
+  inline std::chrono::milliseconds hdf5_flush_interval(void) const {
+    return this->hdf5_flush_interval_;
+  }
+  inline bool csi_extraction(void) const { return this->csi_extraction_; }
+  inline size_t csi_thread_num(void) const { return this->csi_thread_num_; }
+  inline bool record_pilot_samples(void) const {
+    return this->record_pilot_samples_;
+  }
+  inline const std::vector<size_t>& record_antennas(void) const {
+    return this->record_antennas_;
+  }
+  inline const std::string& record_slots(void) const {
+    return this->record_slots_;
+  }
+  inline size_t record_frame_interval(void) const {
+    return this->record_frame_interval_;
+  }
+  inline const std::vector<std::pair<size_t, size_t>>& record_frame_windows(
+      void) const {
+    return this->record_frame_windows_;
+  }
+  /* Any of the record_* filters is set, see RecordFilter */
+  inline bool record_filtered(void) const { return this->record_filtered_; }
+  inline const std::string& live_tap(void) const { return this->live_tap_; }
+  inline size_t live_tap_mb(void) const { return this->live_tap_mb_; }
+  inline Hdf5Codec hdf5_compression(void) const {
+    return this->hdf5_compression_;
+  }
+  inline int hdf5_compression_level(void) const {
+    return this->hdf5_compression_level_;
+  }
+  inline size_t hdf5_compression_threads(void) const {
+    return this->hdf5_compression_threads_;
+  }
+  inline BufferLayout buffer_layout(void) const {
+    return this->buffer_layout_;
+  }
+  inline HugePageMode buffer_hugepages(void) const {
+    return this->buffer_hugepages_;
+  }
 
   inline const std::vector<std::string>& hub_ids(void) const {
     return this->hub_ids_;
@@ -338,6 +428,8 @@ class Config {
   size_t bs_sdr_ch_;
   std::vector<std::vector<std::string>> bs_sdr_ids_;
   std::vector<std::string> hub_ids_;
+  std::string sdr_driver_;  // SoapySDR driver key of the Iris-type devices
+  std::string sdr_args_;    // Extra SoapySDR device args, "key=val,..."
   std::vector<std::string> calib_ids_;
   std::vector<std::complex<float>> gold_cf32_;
   std::vector<uint32_t> beacon_;
@@ -357,9 +449,12 @@ class Config {
   std::string frame_mode_;
   bool bs_hw_framer_;
   bool hw_framer_;
+  bool beacon_fixed_point_;
   size_t max_frame_;
   size_t ul_data_frame_num_;
   size_t dl_data_frame_num_;
+  uint64_t data_gen_seed_;
+  size_t data_gen_threads_;
   std::vector<std::vector<size_t>>
       pilot_slots_;  // Accessed through getClientId
   std::vector<std::vector<size_t>> noise_slots_;
@@ -425,6 +520,34 @@ class Config {
   size_t cl_rx_thread_num_;
   size_t recorder_thread_num_;
   size_t reader_thread_num_;
+  bool direct_record_;
+  OverloadPolicy overload_policy_;
+  // Per dataset name, "" holds the default
+  std::map<std::string, Hdf5ChunkConf> hdf5_chunk_;
+  bool write_combiner_;
+  std::chrono::milliseconds write_combiner_timeout_;
+  size_t trace_segment_frames_;
+  size_t trace_segment_mb_;
+  size_t trace_segment_seconds_;
+  size_t record_staging_mb_;
+  std::chrono::milliseconds hdf5_flush_interval_;
+  bool record_raw_;
+  size_t raw_prealloc_mb_;
+  bool csi_extraction_;
+  size_t csi_thread_num_;
+  bool record_pilot_samples_;
+  std::vector<size_t> record_antennas_;
+  std::string record_slots_;
+  size_t record_frame_interval_;
+  std::vector<std::pair<size_t, size_t>> record_frame_windows_;
+  bool record_filtered_;
+  std::string live_tap_;
+  size_t live_tap_mb_;
+  Hdf5Codec hdf5_compression_;
+  int hdf5_compression_level_;
+  size_t hdf5_compression_threads_;
+  BufferLayout buffer_layout_;
+  HugePageMode buffer_hugepages_;
 };
 
 #endif /* CONFIG_HEADER */
@@ -0,0 +1,56 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Cross-correlation with a fixed reference sequence, by overlap-save FFT
+ or directly, whichever is cheaper for the length asked for
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_CORRELATOR_H_
+#define SOUNDER_CORRELATOR_H_
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+/* Output k is the correlation with the reference ending at sample k:
+ *
+ *   out[k] = sum_j x[k - M + 1 + j] * conj(ref[j]),  j < M = ref.size()
+ *
+ * with x zero outside [0, n), so n + M - 1 outputs are the full
+ * correlation. The FFT path runs overlap-save blocks of block_size()
+ * samples against the reference spectrum computed once up front. An
+ * object keeps its own scratch buffers: one per thread. */
+class Correlator {
+ public:
+  explicit Correlator(const std::vector<std::complex<float>>& ref);
+  ~Correlator();
+  Correlator(const Correlator&) = delete;
+  Correlator& operator=(const Correlator&) = delete;
+
+  void Correlate(const std::complex<float>* x, size_t n,
+                 std::complex<float>* out, size_t out_len);
+
+  /* True if out_len outputs are cheaper by FFT than directly */
+  bool UsesFft(size_t out_len) const;
+  bool Matches(const std::vector<std::complex<float>>& ref) const;
+  inline size_t taps(void) const { return ref_.size(); }
+  inline size_t block_size(void) const { return block_; }
+
+ private:
+  void CorrelateDirect(const std::complex<float>* x, size_t n,
+                       std::complex<float>* out, size_t out_len) const;
+  void CorrelateFft(const std::complex<float>* x, size_t n,
+                    std::complex<float>* out, size_t out_len);
+
+  const std::vector<std::complex<float>> ref_;
+  size_t block_;
+  size_t log2_block_;
+  // FFT of the time reversed, conjugated reference, scaled by 1 / block_
+  std::complex<float>* spectrum_;
+  std::complex<float>* time_;
+  std::complex<float>* freq_;
+};
+
+#endif /* SOUNDER_CORRELATOR_H_ */
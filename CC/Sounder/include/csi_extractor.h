@@ -0,0 +1,75 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Online least-squares channel estimates of the client pilots
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_CSI_EXTRACTOR_H_
+#define SOUNDER_CSI_EXTRACTOR_H_
+
+#include <atomic>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "concurrentqueue.h"
+#include "config.h"
+#include "frame_buffer.h"
+
+namespace Sounder {
+/* A recorder Acquire()s a job, copies a pilot packet into it and
+ * Submit()s it. Worker threads take batches of jobs, drop the cyclic
+ * prefixes, FFT all OFDM symbols of the slot in one batch and
+ * divide the data subcarriers by the pilot (Config::pilot_sym_f()),
+ * averaged over the symbols of the slot. The thread writing the recording
+ * Collect()s finished jobs and hands them back with Release(). */
+class CsiExtractor {
+ public:
+  struct Job {
+    PacketHeader header;
+    size_t client;   // pilot slot of the frame
+    size_t antenna;  // within the recorder
+    std::vector<short> samples;
+    // re, im per data subcarrier (Config::data_ind())
+    std::vector<float> csi;
+  };
+
+  CsiExtractor(Config* cfg, size_t threads, size_t max_jobs);
+  ~CsiExtractor();
+
+  /* nullptr while all jobs are in use */
+  Job* Acquire(void);
+  void Submit(Job* job);
+  size_t Collect(Job** jobs, size_t max_jobs);
+  void Release(Job* job);
+
+  /* Jobs submitted and not yet released */
+  inline size_t in_flight(void) const {
+    return this->in_flight_.load(std::memory_order_acquire);
+  }
+  inline size_t subcarriers(void) const { return this->bins_.size(); }
+
+ private:
+  void DoExtraction(size_t tid);
+
+  const size_t fft_size_;
+  const size_t cp_size_;
+  const size_t prefix_;
+  const size_t symbols_;
+  // FFT output bin and 1 / pilot of each data subcarrier
+  std::vector<size_t> bins_;
+  std::vector<std::complex<float>> inv_pilot_;
+
+  std::vector<Job> jobs_;
+  moodycamel::ConcurrentQueue<Job*> free_;
+  moodycamel::ConcurrentQueue<Job*> todo_;
+  moodycamel::ConcurrentQueue<Job*> done_;
+  std::atomic<size_t> in_flight_;
+  std::atomic<bool> running_;
+  std::vector<std::thread> threads_;
+};
+};  // namespace Sounder
+
+#endif /* SOUNDER_CSI_EXTRACTOR_H_ */
@@ -6,11 +6,19 @@
 #ifndef DATA_GENERATOR_H_
 #define DATA_GENERATOR_H_
 
+#include <cstdint>
 #include <random>
 #include <string>
+#include <vector>
 
 #include "config.h"
+#include "ofdm_modulator.h"
 
+/* Every radio has its own random stream: value n of its bits file is a
+ * hash of the seed, the radio and n. The files are the same for a given
+ * data_gen_seed whatever the number of threads, which run ranges of
+ * frames of all radios and write them in place into files sized up
+ * front. */
 class DataGenerator {
  public:
   // The profile of the input information bits
@@ -19,6 +27,34 @@ class DataGenerator {
   void GenerateData(const std::string& directory);
 
  private:
+  // The three files of one radio and the slots of each of its frames
+  struct RadioFiles {
+    bool downlink;
+    size_t frames;
+    size_t slots;
+    size_t channels;
+    uint64_t key;
+    int fd_b;
+    int fd_f;
+    int fd_t;
+  };
+  struct Job {
+    size_t radio_files;
+    size_t first_frame;
+    size_t frames;
+  };
+
+  void OpenFiles(const std::string& directory, const std::string& tag,
+                 RadioFiles& files);
+  /* The files of every UL client and DL radio, those opened stay in
+   * radio_files if one fails */
+  void OpenAllFiles(const std::string& directory, uint64_t seed,
+                    std::vector<RadioFiles>& radio_files);
+  static void CloseFiles(std::vector<RadioFiles>& radio_files);
+  /* Frames [first_frame, first_frame + frames) of one radio */
+  void WriteFrames(const RadioFiles& files, OfdmModulator& modulator,
+                   int mod_type, size_t first_frame, size_t frames);
+
   Config* cfg_;
 };
 #endif
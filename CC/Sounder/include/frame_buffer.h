@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Frame-major rx sample buffer (buffer_layout "frame"): the packets of
+ the last num_frames frames of all BS rx threads, each frame one
+ contiguous [slot][antenna][IQ] block with 64-byte aligned payloads.
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_FRAME_BUFFER_H_
+#define SOUNDER_FRAME_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "buffer_memory.h"
+
+// Packet metadata, kept apart from the payloads in the frame layout
+struct PacketHeader {
+  uint32_t frame_id;
+  uint32_t slot_id;
+  uint32_t cell_id;
+  uint32_t ant_id;
+};
+
+/* Packet (frame, slot, ant) lives at index ((frame % num_frames) * slots +
+ * slot) * antennas + ant, both in the header array and in the payload
+ * block, where it starts at index * payload_stride() bytes. ant counts the
+ * antennas of all cells, those of cell c start after the antennas of the
+ * cells before it (Config::n_bs_sdrs_agg()).
+ *
+ * Ownership is per frame block: state_[b] packs the frame that currently
+ * owns block b (frame + 1, 0 for none) with the number of its packets that
+ * were reserved but not yet released. Rx threads Reserve() each packet of
+ * the owning frame; a newer frame takes the block over once the count is
+ * zero, so packets of the old frame that arrive after that are refused and
+ * handled by the overload policy like a full buffer. The same packet must
+ * not be reserved twice for one frame. Consumers read header and payload
+ * and then Release() (release store) the frame id they read. */
+class FrameBuffer {
+ public:
+  static constexpr size_t kPayloadAlign = 64;
+
+  FrameBuffer(size_t num_frames, size_t slots, size_t antennas,
+              size_t payload_bytes, HugePageMode hugepages, int numa_node)
+      : num_frames_(num_frames),
+        slots_(slots),
+        antennas_(antennas),
+        payload_stride_((payload_bytes + kPayloadAlign - 1) / kPayloadAlign *
+                        kPayloadAlign),
+        headers_(new PacketHeader[num_frames * slots * antennas]),
+        state_(new std::atomic<uint64_t>[num_frames]) {
+    if (slots * antennas > kCountMask) {
+      throw std::invalid_argument("FrameBuffer: frame has too many packets");
+    }
+    payload_.Allocate(num_frames * frame_bytes(), hugepages, numa_node);
+    for (size_t i = 0; i < num_frames; i++) {
+      state_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  inline size_t index(size_t frame_id, size_t slot_id, size_t ant_id) const {
+    return ((frame_id % num_frames_) * slots_ + slot_id) * antennas_ + ant_id;
+  }
+  inline bool contains(size_t slot_id, size_t ant_id) const {
+    return slot_id < slots_ && ant_id < antennas_;
+  }
+  inline short* payload(size_t index) {
+    return reinterpret_cast<short*>(payload_.data() +
+                                    index * payload_stride_);
+  }
+  inline PacketHeader& header(size_t index) { return headers_[index]; }
+
+  /* First byte of the [slot][antenna] block of frame_id, frame_bytes() long
+   * and only meaningful while the caller holds packets of that frame */
+  inline const char* frame_block(size_t frame_id) const {
+    return payload_.data() + (frame_id % num_frames_) * frame_bytes();
+  }
+  inline size_t frame_bytes(void) const {
+    return slots_ * antennas_ * payload_stride_;
+  }
+  inline size_t payload_stride(void) const { return payload_stride_; }
+  inline size_t num_frames(void) const { return num_frames_; }
+  inline size_t size(void) const { return num_frames_ * slots_ * antennas_; }
+
+  /* Rx threads: false if the block is still held by an older frame or was
+   * already taken over by a newer one */
+  inline bool Reserve(size_t frame_id, size_t count = 1) {
+    std::atomic<uint64_t>& state = state_[frame_id % num_frames_];
+    const uint64_t tag = static_cast<uint64_t>(frame_id + 1) << kCountBits;
+    uint64_t cur = state.load(std::memory_order_acquire);
+    while (true) {
+      uint64_t next;
+      if ((cur & ~kCountMask) == tag) {
+        next = cur + count;
+      } else if ((cur & kCountMask) == 0 && cur < tag) {
+        next = tag + count;
+      } else {
+        return false;
+      }
+      if (state.compare_exchange_weak(cur, next, std::memory_order_acq_rel,
+                                      std::memory_order_acquire) == true) {
+        return true;
+      }
+    }
+  }
+
+  /* Consumers: gives back count packets of frame_id */
+  inline void Release(size_t frame_id, size_t count = 1) {
+    state_[frame_id % num_frames_].fetch_sub(count, std::memory_order_release);
+  }
+
+ private:
+  static constexpr unsigned kCountBits = 24;
+  static constexpr uint64_t kCountMask = (1ULL << kCountBits) - 1;
+
+  const size_t num_frames_;
+  const size_t slots_;
+  const size_t antennas_;
+  const size_t payload_stride_;
+  BufferMemory payload_;
+  std::unique_ptr<PacketHeader[]> headers_;
+  std::unique_ptr<std::atomic<uint64_t>[]> state_;
+};
+
+#endif /* SOUNDER_FRAME_BUFFER_H_ */
@@ -12,6 +12,7 @@ Copyright (c) 2018-2022
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <complex>
 #include <map>
 #include <memory>
@@ -25,25 +26,49 @@ class Hdf5Lib {
   Hdf5Lib(H5std_string file_name, H5std_string group_name);
   ~Hdf5Lib();
   void closeFile();
+  /* type is the file type, samples are int16 and CSI is float */
   int createDataset(std::string dataset_name,
                     std::array<hsize_t, kDsDimsNum> tot_dims,
-                    std::array<hsize_t, kDsDimsNum> chunk_dims);
+                    std::array<hsize_t, kDsDimsNum> chunk_dims,
+                    size_t chunk_cache_bytes = 0,
+                    const H5::PredType& type = H5::PredType::STD_I16LE);
   void removeDataset(std::string dataset_name);
   void openDataset();
+  /* Trims the datasets to the frames written and closes the file; later
+   * calls do nothing */
   void closeDataset();
+  /* Grows the dataset geometrically until frame prim_dim_size fits */
   bool extendDataset(std::string dataset_name, size_t prim_dim_size);
   herr_t writeDataset(std::string dataset_name,
                       std::array<hsize_t, kDsDimsNum> target_id,
                       std::array<hsize_t, kDsDimsNum> wrt_dim, short* wrt_data);
+  herr_t writeDataset(std::string dataset_name,
+                      std::array<hsize_t, kDsDimsNum> target_id,
+                      std::array<hsize_t, kDsDimsNum> wrt_dim,
+                      const float* wrt_data);
+  /* Stores one chunk that was filtered by the caller, see ChunkCompressor.
+   * filter_mask has bit i set for each pipeline filter i skipped. */
+  herr_t writeChunk(std::string dataset_name,
+                    const std::array<hsize_t, kDsDimsNum>& offset,
+                    uint32_t filter_mask, const void* data, size_t bytes);
   std::vector<short> readDataset(std::string dataset_name,
                                  std::array<hsize_t, kDsDimsNum> target_id,
                                  std::array<hsize_t, kDsDimsNum> read_dim);
-  void setTargetPrimaryDimSize(hsize_t dim_size) {
-    target_prim_dim_size = dim_size;
-  }
-  hsize_t getTargetPrimaryDimSize() { return target_prim_dim_size; }
+  /* Largest frame id recorded, 0 if unknown. Datasets created afterwards
+   * are allocated for all frames up front unless they are compressed. */
   void setMaxPrimaryDimSize(hsize_t dim_size) { max_prim_dim_size = dim_size; }
   hsize_t getMaxPrimaryDimSize() { return max_prim_dim_size; }
+  /* Filter pipeline of the datasets created afterwards: shuffle and then
+   * the codec, both optional so chunks may be stored unfiltered */
+  void setCompression(Hdf5Codec codec, int level) {
+    codec_ = codec;
+    codec_level_ = level;
+  }
+  /* Makes flushIfDue() flush the open file every interval, 0 never */
+  void setFlushInterval(std::chrono::milliseconds interval);
+  /* Flushes the file if the interval has passed. Called by the writing
+   * thread between frames, so no write is in progress. */
+  void flushIfDue(void);
   void write_attribute(const char name[], double val);
   void write_attribute(const char name[], const std::vector<double>& val);
   void write_attribute(const char name[],
@@ -55,6 +80,7 @@ class Hdf5Lib {
   void write_attribute(const char name[], const std::vector<size_t>& val);
   void write_attribute(const char name[], const std::string& val);
   void write_attribute(const char name[], const std::vector<std::string>& val);
+  void write_dataset(const char name[], const std::vector<uint8_t>& val);
 
  private:
   H5std_string hdf5_name_;
@@ -67,8 +93,21 @@ class Hdf5Lib {
   std::vector<H5::DataSpace> dataspace_;
   std::vector<std::unique_ptr<H5::DataSet>> datasets_;
   std::vector<std::array<hsize_t, kDsDimsNum>> dims_;
-  hsize_t target_prim_dim_size;
-  hsize_t max_prim_dim_size;
+  // Raw data chunk cache per dataset, 0 for the library default
+  std::vector<size_t> chunk_cache_;
+  Hdf5Codec codec_ = kCodecNone;
+  int codec_level_ = 0;
+  hsize_t max_prim_dim_size = 0;
+  // Frames up to the highest one extendDataset() was asked for
+  hsize_t frames_written_ = 0;
+  bool open_ = false;
+
+  herr_t writeHyperslab(const std::string& dataset_name,
+                        const std::array<hsize_t, kDsDimsNum>& target_id,
+                        const std::array<hsize_t, kDsDimsNum>& wrt_dim,
+                        const void* wrt_data, const H5::PredType& mem_type);
+  std::chrono::milliseconds flush_interval_{0};
+  std::chrono::steady_clock::time_point next_flush_;
 
   std::map<std::string, size_t> ds_name_id;
 };
@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ POSIX shared-memory ring of the most recently recorded packets, for
+ live readers outside the sounder (PYTHON/IrisUtils/live_tap.py)
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_LIVE_TAP_H_
+#define SOUNDER_LIVE_TAP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+#include "frame_buffer.h"
+#include "spsc_ring.h"
+
+/// Layout of the shared memory object, little endian, all offsets fixed:
+///
+///   0  LiveTapHeader, 128 bytes
+///   header_bytes + i * record_bytes  record i, i < record_count
+///
+/// A record is a LiveTapRecord (64 bytes) followed by payload_bytes of
+/// interleaved int16 I/Q samples. Packet n goes to record n % record_count
+/// (record_count is a power of two). Its lock is 2n+1 while it is written
+/// and 2n+2 once it is complete, 0 for a record never written. A reader of
+/// packet n loads the lock, copies the record and loads the lock again:
+/// the copy is packet n if both loads were 2n+2. A larger lock means the
+/// packet was overwritten, i.e. the reader was too slow and dropped it.
+/// next_seq is one past the newest packet a writer has started on.
+///
+/// Readers map the object read-only, so nothing they do reaches the
+/// writers: those never wait and a slow reader just sees gaps.
+struct LiveTapHeader {
+  char magic[8];  // "SNDRTAP"
+  uint32_t version;
+  uint32_t header_bytes;
+  uint32_t record_count;
+  uint32_t record_bytes;
+  uint32_t payload_bytes;
+  uint32_t samps_per_slot;
+  uint32_t slot_per_frame;
+  uint32_t num_cells;
+  uint32_t num_antennas;  // of the base station, client antennas follow
+  uint32_t reserved[5];
+  alignas(kCacheLineSize) std::atomic<uint64_t> next_seq;
+};
+
+struct LiveTapRecord {
+  std::atomic<uint64_t> lock;
+  uint32_t frame_id;
+  uint32_t slot_id;
+  uint32_t cell_id;
+  uint32_t ant_id;
+  uint32_t node_type;  // NodeType
+  uint32_t reserved[9];
+};
+
+static_assert(sizeof(LiveTapHeader) == 2 * kCacheLineSize,
+              "LiveTapHeader is read by other processes");
+static_assert(sizeof(LiveTapRecord) == kCacheLineSize,
+              "LiveTapRecord is read by other processes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The live tap needs lock-free 64 bit atomics");
+
+/// Any number of threads may Publish() at once: each claims the next
+/// sequence number with a fetch_add. A writer that finds its record still
+/// locked by a writer of an older lap, or already taken by a newer one,
+/// drops its packet instead of waiting.
+class LiveTap {
+ public:
+  /* Creates the "live_tap" object of "live_tap_mb" */
+  explicit LiveTap(Config* cfg);
+  ~LiveTap();
+  LiveTap(const LiveTap&) = delete;
+  LiveTap& operator=(const LiveTap&) = delete;
+
+  void Publish(const PacketHeader& header, const short* data,
+               NodeType node_type);
+
+  inline size_t record_count(void) const { return this->record_count_; }
+  inline uint64_t published(void) const {
+    return this->header_->next_seq.load(std::memory_order_relaxed);
+  }
+  inline uint64_t dropped(void) const {
+    return this->dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const std::string name_;
+  size_t bytes_;
+  size_t record_count_;
+  size_t record_bytes_;
+  size_t payload_bytes_;
+  LiveTapHeader* header_;
+  char* records_;
+  std::atomic<uint64_t> dropped_;
+};
+
+#endif /* SOUNDER_LIVE_TAP_H_ */
@@ -4,6 +4,9 @@
 #include <atomic>
 #include <vector>
 
+#include "buffer_memory.h"
+#include "slot_ring.h"
+
 #ifdef USE_SOAPYUHD
 static constexpr bool kUseSoapyUHD = true;
 #else
@@ -49,10 +52,34 @@ enum SchedulerEventType {
 
 enum NodeType { kBS = 0, kClient = 1 };
 
+// What an rx thread does when its SampleBuffer has no free slot
+enum OverloadPolicy {
+  kOverloadAbort = 0,          // stop the capture (default)
+  kOverloadDropNewest = 1,     // discard the packet being received
+  kOverloadDropOldest = 2,     // revoke the oldest packet not yet recorded
+  kOverloadDecimateFrames = 3  // also drop every odd frame for a while
+};
+// How the BS rx packets are laid out in memory
+enum BufferLayout {
+  kLayoutPacket = 0,  // per rx thread, packets in arrival order (default)
+  kLayoutFrame = 1    // shared FrameBuffer, one contiguous block per frame
+};
+
+// Compression of the recorded sample datasets, see ChunkCompressor
+enum Hdf5Codec {
+  kCodecNone = 0,
+  kCodecDeflate = 1,  // shuffle + deflate, readable by any HDF5 build
+  kCodecZstd = 2      // shuffle + zstd (filter 32015), needs the zstd plugin
+};
+
+// Frames decimate_frames keeps dropping odd frames after the last overload
+static constexpr size_t kDecimateHoldFrames = 2 * BEACON_INTERVAL;
+
 // each thread has a SampleBuffer
 struct SampleBuffer {
-  std::vector<char> buffer;
-  std::atomic_int* pkt_buf_inuse;
+  BufferMemory buffer;
+  std::atomic_int* pkt_buf_inuse;  // tx buffers, one flag per frame
+  SlotRing* slots;                 // rx buffers, packet slot ownership
 };
 
 struct Packet {
@@ -74,6 +101,14 @@ struct Event_data {
   size_t buff_size;
   int offset;
   SampleBuffer* buffer;
+  size_t seq;  // rx slot reservation number, see SlotRing::Claim()
+};
+
+// Record work handed from an rx thread straight to a recorder (direct_record)
+struct RecordDescriptor {
+  int offset;  // packet index across all rx SampleBuffers
+  NodeType node_type;
+  size_t seq;
 };
 
 #endif
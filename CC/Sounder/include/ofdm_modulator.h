@@ -0,0 +1,74 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ OFDM modulation of whole slots, from QAM values to CS16 samples
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_OFDM_MODULATOR_H_
+#define SOUNDER_OFDM_MODULATOR_H_
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Modulates the symbols of a slot in one pass: QAM lookup, data and pilot
+ * subcarrier mapping, one batched IFFT, cyclic prefix, tx scaling and
+ * saturating conversion to CS16, with the zero prefix and postfix around
+ * the symbols. The output is the same as CommsLib::modulate(), IFFT(..,
+ * 1 / fft_size, false, true) and Utils::cfloat_to_cint16() per symbol,
+ * except that samples out of the CS16 range saturate instead of wrapping.
+ * All buffers are allocated up front; one object per thread. */
+class OfdmModulator {
+ public:
+  OfdmModulator(size_t fft_size, size_t cp_size, size_t symbols,
+                size_t prefix, size_t postfix,
+                const std::vector<size_t>& data_sc,
+                const std::vector<size_t>& pilot_sc_ind,
+                const std::vector<std::complex<float>>& pilot_sc,
+                int mod_type, float tx_scale);
+  ~OfdmModulator();
+  OfdmModulator(const OfdmModulator&) = delete;
+  OfdmModulator& operator=(const OfdmModulator&) = delete;
+
+  /* The data_per_symbol() values of symbol s, below the modulation order,
+   * start at bits + s * bits_stride. freq gets the symbols() * fft_size()
+   * subcarrier values, in subcarrier order, time the slot_samples()
+   * samples. Returns the number of samples that saturated. */
+  size_t Modulate(const uint8_t* bits, size_t bits_stride,
+                  std::complex<float>* freq, std::complex<int16_t>* time);
+
+  inline size_t fft_size(void) const { return this->fft_size_; }
+  inline size_t symbols(void) const { return this->symbols_; }
+  inline size_t data_per_symbol(void) const {
+    return this->data_sc_.size();
+  }
+  inline size_t slot_samples(void) const {
+    return this->prefix_ +
+           this->symbols_ * (this->fft_size_ + this->cp_size_) +
+           this->postfix_;
+  }
+
+ private:
+  const size_t fft_size_;
+  const size_t cp_size_;
+  const size_t symbols_;
+  const size_t prefix_;
+  const size_t postfix_;
+  const std::vector<size_t> data_sc_;
+  const std::vector<size_t> pilot_sc_ind_;
+  const std::vector<std::complex<float>> pilot_sc_;
+  // IFFT input bin of each subcarrier, the halves of the spectrum swapped
+  std::vector<size_t> data_bin_;
+  std::vector<size_t> pilot_bin_;
+  std::vector<std::complex<float>> constellation_;
+  // 1 / fft_size * tx_scale * 32768, exact as fft_size is a power of two
+  float sample_scale_;
+  // symbols_ transforms, aligned for muFFT
+  std::complex<float>* bins_;
+  std::complex<float>* time_;
+};
+
+#endif /* SOUNDER_OFDM_MODULATOR_H_ */
@@ -0,0 +1,86 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Record of the packets dropped under the rx overload policy
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_OVERLOAD_LOG_H_
+#define SOUNDER_OVERLOAD_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+
+namespace Sounder {
+
+/// Drop() is called by the rx threads, the readers run once they have been
+/// joined. Drops only happen under overload, so the frame bitmap simply
+/// sits behind a mutex.
+class OverloadLog {
+ public:
+  explicit OverloadLog(size_t num_antennas)
+      : num_antennas_(num_antennas),
+        per_antenna_(new std::atomic<size_t>[num_antennas]) {
+    for (size_t i = 0; i < num_antennas; i++) per_antenna_[i] = 0;
+  }
+
+  void Drop(size_t ant_id, size_t frame_id) {
+    if (ant_id < num_antennas_) {
+      per_antenna_[ant_id].fetch_add(1, std::memory_order_relaxed);
+    }
+    total_.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frames_.size() <= frame_id / 8) frames_.resize(frame_id / 8 + 1, 0);
+    frames_.at(frame_id / 8) |= 1 << (frame_id % 8);
+  }
+
+  inline size_t total(void) const { return total_.load(); }
+
+  std::vector<size_t> DroppedPackets(size_t ant_offset,
+                                     size_t num_antennas) const {
+    std::vector<size_t> dropped(num_antennas, 0);
+    for (size_t i = 0; i < num_antennas; i++) {
+      if (ant_offset + i < num_antennas_) {
+        dropped.at(i) = per_antenna_[ant_offset + i].load();
+      }
+    }
+    return dropped;
+  }
+
+  /// Bit (frame_id % 8) of byte (frame_id / 8) is set if any packet of that
+  /// frame was dropped, i.e. numpy.unpackbits(..., bitorder="little")
+  std::vector<uint8_t> DroppedFrames(void) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_;
+  }
+
+  static std::string PolicyName(OverloadPolicy policy) {
+    switch (policy) {
+      case kOverloadDropNewest:
+        return "drop_newest";
+      case kOverloadDropOldest:
+        return "drop_oldest_unrecorded";
+      case kOverloadDecimateFrames:
+        return "decimate_frames";
+      default:
+        return "abort";
+    }
+  }
+
+ private:
+  const size_t num_antennas_;
+  std::unique_ptr<std::atomic<size_t>[]> per_antenna_;
+  std::atomic<size_t> total_{0};
+  mutable std::mutex mutex_;
+  std::vector<uint8_t> frames_;
+};
+};  // namespace Sounder
+
+#endif /* SOUNDER_OVERLOAD_LOG_H_ */
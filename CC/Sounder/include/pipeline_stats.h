@@ -0,0 +1,84 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Counters shared by the receive, dispatch and record stages
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_PIPELINE_STATS_H_
+#define SOUNDER_PIPELINE_STATS_H_
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace Sounder {
+
+/// Lock-free counters updated from the hot paths with relaxed atomics.
+/// Totals are exact once all threads are joined; live reads are approximate.
+struct PipelineStats {
+  std::atomic<size_t> rx_packets{0};
+  std::atomic<size_t> recorded_packets{0};
+  std::atomic<size_t> buffer_full_events{0};
+  std::atomic<size_t> revoked_packets{0};  // published, then dropped
+  std::atomic<size_t> filtered_packets{0};  // left out by RecordFilter
+  std::atomic<size_t> max_message_queue_depth{0};
+  std::atomic<size_t> max_record_queue_depth{0};
+  // Recorder staging arenas: total size, fullest arena, waits on a full one
+  std::atomic<size_t> staging_bytes{0};
+  std::atomic<size_t> max_staging_bytes{0};
+  std::atomic<size_t> staging_full_events{0};
+  std::atomic<uint64_t> rx_cpu_ns{0};
+  std::atomic<uint64_t> dispatch_cpu_ns{0};
+  std::atomic<uint64_t> record_cpu_ns{0};
+  std::atomic<size_t> rx_threads_done{0};
+  std::chrono::steady_clock::time_point start{
+      std::chrono::steady_clock::now()};
+
+  static inline uint64_t ThreadCpuNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+
+  static inline void UpdateMax(std::atomic<size_t>& max, size_t value) {
+    size_t cur = max.load(std::memory_order_relaxed);
+    while (value > cur &&
+           !max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  inline double ElapsedSec(void) const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+
+  void Print(size_t packet_length) const {
+    const double sec = std::max(ElapsedSec(), 1e-9);
+    const size_t recorded = recorded_packets.load();
+    std::printf(
+        "Pipeline: %.2f s, rx %zu pkts, recorded %zu pkts (%.0f pkts/s, "
+        "%.3f GB/s)\n"
+        "  buffer full events %zu, revoked %zu, filtered %zu, max queue "
+        "depth: dispatch %zu, record %zu\n"
+        "  staging: %.1f of %.1f MB used at most, %zu full waits\n"
+        "  cpu time (s): rx %.3f, dispatch %.3f, record %.3f\n",
+        sec, rx_packets.load(), recorded, recorded / sec,
+        recorded * packet_length / sec / 1e9, buffer_full_events.load(),
+        revoked_packets.load(), filtered_packets.load(),
+        max_message_queue_depth.load(),
+        max_record_queue_depth.load(), max_staging_bytes.load() / 1e6,
+        staging_bytes.load() / 1e6, staging_full_events.load(),
+        rx_cpu_ns.load() / 1e9,
+        dispatch_cpu_ns.load() / 1e9, record_cpu_ns.load() / 1e9);
+  }
+};
+};  // namespace Sounder
+
+#endif /* SOUNDER_PIPELINE_STATS_H_ */
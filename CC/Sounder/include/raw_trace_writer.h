@@ -0,0 +1,170 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Append-only capture files of the "raw" record_format: packet payloads,
+ a fixed-size index entry per packet and a JSON sidecar holding what the
+ HDF5 file would get as attributes. sounder-convert turns them into the
+ regular HDF5 layout.
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_RAW_TRACE_WRITER_H_
+#define SOUNDER_RAW_TRACE_WRITER_H_
+
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "H5public.h"
+#include "buffer_memory.h"
+#include "macros.h"
+#include "nlohmann/json.hpp"
+
+namespace Sounder {
+/* Where one packet went and where its payload is in the data file */
+struct RawIndexEntry {
+  uint32_t frame_id;
+  uint16_t cell_id;
+  uint16_t slot_id;
+  uint16_t ant_id;
+  uint8_t dataset;  // RecorderWorker::RecordedDataset
+  uint8_t node_type;
+  uint16_t slot_index;     // of the dataset
+  uint16_t antenna_index;  // within the recorder
+  uint64_t offset;
+};
+static_assert(sizeof(RawIndexEntry) == 24, "RawIndexEntry is on disk");
+
+/* Collects attributes with the Hdf5Lib::write_attribute overloads, each
+ * value tagged with its type so the converter writes the same HDF5 type */
+class RawAttributes {
+ public:
+  void write_attribute(const char name[], double val);
+  void write_attribute(const char name[], const std::vector<double>& val);
+  void write_attribute(const char name[],
+                       const std::vector<std::complex<int16_t>>& val);
+  void write_attribute(const char name[],
+                       const std::vector<std::complex<float>>& val);
+  void write_attribute(const char name[], size_t val);
+  void write_attribute(const char name[], int val);
+  void write_attribute(const char name[], const std::vector<size_t>& val);
+  void write_attribute(const char name[], const std::string& val);
+  void write_attribute(const char name[], const std::vector<std::string>& val);
+  void write_dataset(const char name[], const std::vector<uint8_t>& val);
+
+  /* Writes what was collected to sink, an Hdf5Lib */
+  template <typename Sink>
+  static void Replay(const nlohmann::json& attributes,
+                     const nlohmann::json& datasets, Sink& sink);
+
+  inline const nlohmann::json& attributes(void) const { return attributes_; }
+  inline const nlohmann::json& datasets(void) const { return datasets_; }
+
+ private:
+  nlohmann::json attributes_ = nlohmann::json::object();
+  nlohmann::json datasets_ = nlohmann::json::object();
+};
+
+class RawTraceWriter {
+ public:
+  /* Writes base.raw, base.idx and base.json; hdf5_name is the file
+   * sounder-convert creates. The data file grows by prealloc_bytes. */
+  RawTraceWriter(const std::string& base, const std::string& hdf5_name,
+                 size_t packet_bytes, size_t prealloc_bytes);
+  ~RawTraceWriter();
+
+  RawAttributes& attributes(void) { return attributes_; }
+  /* Filters sounder-convert applies, see Hdf5Lib::setCompression() */
+  void SetCompression(Hdf5Codec codec, int level, size_t threads);
+  /* A dataset of the HDF5 layout as Hdf5Lib::createDataset() takes it */
+  void AddDataset(const std::string& name, size_t id,
+                  const std::array<hsize_t, kDsDimsNum>& dims,
+                  const std::array<hsize_t, kDsDimsNum>& chunk,
+                  size_t chunk_cache_bytes);
+
+  /* Appends the payload and its index entry, whose offset is filled in */
+  void Append(RawIndexEntry entry, const void* payload);
+  /* Writes what is buffered, trims the data file and the sidecar */
+  void Close(void);
+
+ private:
+  void WriteBuffer(void);
+  void WriteSidecar(void);
+
+  const std::string base_;
+  const std::string hdf5_name_;
+  const size_t packet_bytes_;
+  const size_t prealloc_bytes_;
+  int data_fd_;
+  bool direct_;
+  std::FILE* index_;
+  // Aligned staging of the data file, written out whole
+  BufferMemory buffer_;
+  size_t buffered_;
+  size_t written_;
+  size_t allocated_;
+  size_t packets_;
+  uint32_t max_frame_;
+  RawAttributes attributes_;
+  nlohmann::json datasets_ = nlohmann::json::object();
+  nlohmann::json compression_;
+};
+
+template <typename Sink>
+void RawAttributes::Replay(const nlohmann::json& attributes,
+                           const nlohmann::json& datasets, Sink& sink) {
+  for (const auto& item : attributes.items()) {
+    const char* name = item.key().c_str();
+    const std::string& type = item.value().at("type").get_ref<
+        const std::string&>();
+    const nlohmann::json& value = item.value().at("value");
+    if (type == "double") {
+      sink.write_attribute(name, value.get<double>());
+    } else if (type == "double[]") {
+      sink.write_attribute(name, value.get<std::vector<double>>());
+    } else if (type == "cint16[]" || type == "cfloat[]") {
+      // Stored as re, im pairs
+      const auto flat = value.get<std::vector<double>>();
+      if (type == "cint16[]") {
+        std::vector<std::complex<int16_t>> vals(flat.size() / 2);
+        for (size_t i = 0; i < vals.size(); i++) {
+          vals[i] = {static_cast<int16_t>(flat[2 * i]),
+                     static_cast<int16_t>(flat[2 * i + 1])};
+        }
+        sink.write_attribute(name, vals);
+      } else {
+        std::vector<std::complex<float>> vals(flat.size() / 2);
+        for (size_t i = 0; i < vals.size(); i++) {
+          vals[i] = {static_cast<float>(flat[2 * i]),
+                     static_cast<float>(flat[2 * i + 1])};
+        }
+        sink.write_attribute(name, vals);
+      }
+    } else if (type == "uint64") {
+      sink.write_attribute(name, value.get<size_t>());
+    } else if (type == "int") {
+      sink.write_attribute(name, value.get<int>());
+    } else if (type == "uint64[]") {
+      sink.write_attribute(name, value.get<std::vector<size_t>>());
+    } else if (type == "string") {
+      sink.write_attribute(name, value.get<std::string>());
+    } else if (type == "string[]") {
+      sink.write_attribute(name, value.get<std::vector<std::string>>());
+    } else {
+      throw std::invalid_argument("Unknown attribute type " + type + " of " +
+                                  item.key());
+    }
+  }
+  for (const auto& item : datasets.items()) {
+    sink.write_dataset(item.key().c_str(),
+                       item.value().get<std::vector<uint8_t>>());
+  }
+}
+};  // namespace Sounder
+
+#endif /* SOUNDER_RAW_TRACE_WRITER_H_ */
@@ -12,6 +12,7 @@
 #include <pthread.h>
 
 #include <complex>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -23,9 +24,20 @@
 #include "BaseRadioSet.h"
 #include "ClientRadioSet.h"
 #endif
+#include "beacon_detector.h"
 #include "concurrentqueue.h"
 #include "config.h"
+#include "frame_buffer.h"
 #include "macros.h"
+#include "overload_log.h"
+#include "pipeline_stats.h"
+#include "record_filter.h"
+#include "spsc_ring.h"
+
+#if defined(PIPELINE_BENCH)
+// Set by the bench before the scheduler starts: loopSynth ignores the rate
+extern bool synth_unpaced;
+#endif
 
 class ReceiverException : public std::runtime_error {
  public:
@@ -50,7 +62,9 @@ class Receiver {
            std::vector<moodycamel::ConcurrentQueue<Event_data>*> tx_queue,
            std::vector<moodycamel::ProducerToken*> tx_ptoks,
            std::vector<moodycamel::ConcurrentQueue<Event_data>*> cl_tx_queue,
-           std::vector<moodycamel::ProducerToken*> cl_tx_ptoks);
+           std::vector<moodycamel::ProducerToken*> cl_tx_ptoks,
+           Sounder::PipelineStats* stats = nullptr,
+           Sounder::OverloadLog* overload = nullptr);
   ~Receiver();
 
   std::vector<pthread_t> startRecvThreads(SampleBuffer* rx_buffer,
@@ -64,22 +78,49 @@ class Receiver {
   void go();
   static void* loopRecv_launch(void* in_context);
   void loopRecv(int tid, int core_id, SampleBuffer* rx_buffer);
+#if defined(PIPELINE_BENCH)
+  void loopSynth(int tid, int core_id, SampleBuffer* rx_buffer);
+#endif
   void baseTxBeacon(int radio_id, int cell, int frame_id, long long base_time);
   int baseTxData(int radio_id, int cell, int frame_id, long long base_time);
-  void notifyPacket(NodeType node_type, int frame_id, int slot_id, int ant_id,
-                    int buff_size, int offset = 0);
+  static Event_data rxEvent(NodeType node_type, int frame_id, int slot_id,
+                            int ant_id, int buff_size, int offset = 0,
+                            size_t seq = 0);
+  bool reserveRxSlot(int tid, SampleBuffer& rx_buffer, size_t frame_id,
+                     size_t& decimate_until, size_t& slot);
+  bool reserveFramePacket(size_t frame_id, size_t& decimate_until);
+  void logDrop(size_t ant_id, size_t frame_id);
+  /* True if the record filter leaves the packet out. The transmissions of
+   * a frame are scheduled at slot 0 whether or not it is recorded. */
+  inline bool filtered(size_t frame_id, size_t slot_id, size_t cell,
+                       size_t ant_id) const {
+    return record_filter_ != nullptr &&
+           record_filter_->Keep(frame_id, slot_id, cell, ant_id) == false;
+  }
+  void notifyPacket(moodycamel::ProducerToken& ptok, NodeType node_type,
+                    int frame_id, int slot_id, int ant_id, int buff_size,
+                    int offset = 0);
+  void notifyPackets(moodycamel::ProducerToken& ptok, const Event_data* events,
+                     size_t count);
+  // record_rings[producer][recorder], producer being the rx buffer id
+  void setRecordRings(
+      std::vector<std::vector<SpscRing<RecordDescriptor>*>> record_rings,
+      size_t thread_antennas);
+  // buffer_layout "frame": BS rx threads write here instead of rx_buffer
+  void setFrameBuffer(FrameBuffer* frames) { frame_buffer_ = frames; }
+  void publishRxEvents(moodycamel::ProducerToken& ptok, size_t producer,
+                       const Event_data* events, size_t count);
   static void* clientTxRx_launch(void* in_context);
   void clientTxRx(int tid);
   void clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer);
-  ssize_t syncSearch(const std::complex<int16_t>* check_data,
-                     size_t search_window, float corr_scale);
-
   float estimateCFO(const std::vector<std::complex<int16_t>>& sync_buff,
                     int sync_index);
   void initBuffers();
   void clientTxPilots(size_t user_id, long long base_time);
   int clientTxData(int tid, int frame_id, long long base_time);
-  ssize_t clientSyncBeacon(size_t radio_id, size_t sample_window);
+  ssize_t clientSyncBeacon(size_t radio_id, BeaconDetector& detector,
+                           const std::vector<void*>& rx_buffs,
+                           size_t sample_window);
   void clientAdjustRx(size_t radio_id, size_t discard_samples);
 
  private:
@@ -109,6 +150,16 @@ class Receiver {
   std::vector<void*> zeros_;
   size_t txTimeDelta_;
   size_t txFrameDelta_;
+
+  // Empty unless direct_record, then rx events bypass message_queue_
+  std::vector<std::vector<SpscRing<RecordDescriptor>*>> record_rings_;
+  size_t record_thread_antennas_;
+  FrameBuffer* frame_buffer_;
+  // Empty unless a record_* filter is set
+  std::unique_ptr<RecordFilter> record_filter_;
+
+  Sounder::PipelineStats* stats_;
+  Sounder::OverloadLog* overload_;
 };
 
 #endif  // DATARECEIVER_H_
@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Selects the base station packets that are recorded at all
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_RECORD_FILTER_H_
+#define SOUNDER_RECORD_FILTER_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+
+/* Built from the record_* settings of the config. The rx threads ask it
+ * about every packet as soon as its frame, slot and antenna are known and
+ * hand the buffer slot of a rejected packet straight back, so it is never
+ * dispatched to a recorder. */
+class RecordFilter {
+ public:
+  explicit RecordFilter(Config* cfg);
+
+  /* ant_id is the antenna within its cell */
+  inline bool Keep(size_t frame_id, size_t slot_id, size_t cell,
+                   size_t ant_id) const {
+    if (frame_id % frame_interval_ != 0) return false;
+    if (windows_.empty() == false && InWindow(frame_id) == false) {
+      return false;
+    }
+    if (ant_id >= antennas_.size() || antennas_[ant_id] == false) {
+      return false;
+    }
+    const size_t radio_id = ant_id / num_channels_;
+    if (cell >= frames_.size() || radio_id >= frames_[cell].size() ||
+        slot_id >= frames_[cell][radio_id].size()) {
+      return false;
+    }
+    return slot_types_.find(frames_[cell][radio_id][slot_id]) !=
+           std::string::npos;
+  }
+
+ private:
+  inline bool InWindow(size_t frame_id) const {
+    for (const auto& window : windows_) {
+      if (frame_id < window.first) return false;
+      if (frame_id <= window.second) return true;
+    }
+    return false;
+  }
+
+  const size_t frame_interval_;
+  const std::vector<std::pair<size_t, size_t>> windows_;  // sorted
+  const std::string slot_types_;
+  const size_t num_channels_;
+  const std::vector<std::vector<std::string>>& frames_;
+  std::vector<bool> antennas_;
+};
+
+#endif /* SOUNDER_RECORD_FILTER_H_ */
@@ -10,9 +10,17 @@ Event based message queue thread class for the recorder worker
 #define SOUNDER_RECORDER_THREAD_H_
 
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <vector>
 
+#include "frame_buffer.h"
+#include "live_tap.h"
+#include "overload_log.h"
+#include "pipeline_stats.h"
 #include "recorder_worker.h"
+#include "spsc_ring.h"
+#include "staging_arena.h"
 
 namespace Sounder {
 class RecorderThread {
@@ -28,24 +36,73 @@ class RecorderThread {
 
   RecorderThread(Config* in_cfg, size_t thread_id, int core, size_t queue_size,
                  size_t antenna_offset, size_t num_antennas,
-                 bool wait_signal = true);
+                 bool wait_signal = true, PipelineStats* stats = nullptr,
+                 const OverloadLog* overload = nullptr);
   ~RecorderThread();
 
   void Start(void);
   void Stop(void);
   bool DispatchWork(Event_data event);
+  size_t QueueDepth(void) const;
+  /* Bytes of packets staged but not yet written */
+  size_t StagedBytes(void) const;
+
+  /* Creates one ring per rx thread (producer), ring_sizes[i] descriptors
+   * for producer i, must precede Start() */
+  void AttachDirectRings(SampleBuffer* buffer, size_t buff_size,
+                         const std::vector<size_t>& ring_sizes);
+  inline SpscRing<RecordDescriptor>* DirectRing(size_t producer) {
+    return this->direct_rings_.at(producer).get();
+  }
+  /* buffer_layout "frame": BS packet offsets index this buffer */
+  inline void AttachFrameBuffer(FrameBuffer* frames) {
+    this->frame_buffer_ = frames;
+  }
+  /* live_tap: recorded packets are also published there */
+  inline void AttachLiveTap(LiveTap* tap) { this->live_tap_ = tap; }
+  /* record_staging_mb: cores the I/O thread may run on, must precede
+   * Start(). Without them it is not pinned. */
+  inline void SetIoCores(int first_core, size_t num_cores) {
+    this->io_core_start_ = first_core;
+    this->io_core_num_ = num_cores;
+  }
 
  private:
   /*Main threading loop */
   void DoRecording(void);
   void HandleEvent(Event_data event);
+  void RecordPacket(SampleBuffer* buffer, size_t buff_size, int offset,
+                    size_t seq, NodeType node_type);
+  size_t DrainDirectRings(void);
   void Finalize();
+  /* record_staging_mb: copies the packet so its rx slot is freed now */
+  void StagePacket(const PacketHeader& header, const short* data,
+                   NodeType node_type);
+  /* The thread writing the staged packets through worker_ */
+  void DoWriting(void);
+  /* csi_extraction: hands a pilot to csi_, true if it is not recorded */
+  bool ExtractCsi(const PacketHeader& header, const short* data,
+                  NodeType node_type);
+  /* Records the finished channel estimates, from the thread owning worker_ */
+  size_t WriteCsi(void);
 
   //1 - Producer (dispatcher), 1 - Consumer
   moodycamel::ConcurrentQueue<Event_data> event_queue_;
   moodycamel::ProducerToken producer_token_;
+  // 1 - Producer (rx thread), 1 - Consumer per ring, empty unless direct_record
+  std::vector<std::unique_ptr<SpscRing<RecordDescriptor>>> direct_rings_;
+  SampleBuffer* direct_buffer_;
+  size_t direct_buff_size_;
+  FrameBuffer* frame_buffer_;
+  LiveTap* live_tap_;
   RecorderWorker worker_;
   std::thread thread_;
+  // Empty without record_staging_mb, else only io_thread_ uses worker_
+  std::unique_ptr<StagingArena> staging_;
+  std::thread io_thread_;
+  std::atomic<bool> staging_done_;
+  // Empty without csi_extraction
+  std::unique_ptr<CsiExtractor> csi_;
 
   size_t id_;
   size_t packet_data_length_;
@@ -53,6 +110,9 @@ class RecorderThread {
   /* >= 0 to assign a core to the thread
          * <0   to disable thread core assignment */
   int core_alloc_;
+  // The I/O thread shares the cores of all recorder threads
+  int io_core_start_;
+  size_t io_core_num_;
 
   /* Synchronization for startup and sleeping */
   /* Setting wait signal to false will disable the thread waiting on new message
@@ -64,6 +124,9 @@ class RecorderThread {
   std::mutex sync_;
   std::condition_variable condition_;
   bool running_;
+
+  PipelineStats* stats_;
+  const OverloadLog* overload_;
 };
 };  // namespace Sounder
 
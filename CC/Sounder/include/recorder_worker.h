@@ -9,9 +9,19 @@
 #ifndef SOUNDER_RECORDER_WORKER_H_
 #define SOUNDER_RECORDER_WORKER_H_
 
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+
+#include "chunk_compressor.h"
 #include "config.h"
+#include "csi_extractor.h"
 #include "hdf5_lib.h"
+#include "overload_log.h"
+#include "raw_trace_writer.h"
 #include "receiver.h"
+#include "write_combiner.h"
 
 namespace Sounder {
 class RecorderWorker {
@@ -21,21 +31,165 @@ class RecorderWorker {
 
   void init(void);
   void finalize(void);
-  void record(int tid, Packet* pkt, NodeType node_type);
+  void record(int tid, const PacketHeader& header, short* data,
+              NodeType node_type);
+  inline void record(int tid, Packet* pkt, NodeType node_type) {
+    record(tid,
+           PacketHeader{pkt->frame_id, pkt->slot_id, pkt->cell_id, pkt->ant_id},
+           pkt->data, node_type);
+  }
+  /* Channel estimates of one pilot packet, see CsiExtractor */
+  void recordCsi(const CsiExtractor::Job& job);
+  /* Client of a pilot packet; false for all other packets */
+  inline bool isPilot(const PacketHeader& header, NodeType node_type,
+                      hsize_t& client) const {
+    return this->classify(header, node_type, client) == kPilotDs;
+  }
+  /* record_pilot_samples: false if pilots only go into the CSI */
+  inline bool recordsPilots(void) const {
+    return this->cfg_->record_pilot_samples();
+  }
+  void writeOverloadLog(const OverloadLog& overload);
+  /* Writes frames the combiner has been holding for too long and flushes
+   * the files whose flush interval passed */
+  inline void flushExpired(void) {
+    for (Segment* seg : {this->segment_.get(), this->previous_.get()}) {
+      if (seg == nullptr) continue;
+      if (seg->combiner != nullptr) seg->combiner->FlushExpired();
+      if (seg->compressor != nullptr) seg->compressor->Collect(false);
+      if (seg->csi_frames.empty() == false) this->flushCsi(*seg, false);
+      seg->hdf5->flushIfDue();
+    }
+  }
+  inline bool pending(void) const {
+    for (const Segment* seg : {this->segment_.get(), this->previous_.get()}) {
+      if (seg == nullptr) continue;
+      if ((seg->combiner != nullptr && seg->combiner->pending()) ||
+          (seg->compressor != nullptr && seg->compressor->pending()) ||
+          seg->csi_frames.empty() == false) {
+        return true;
+      }
+    }
+    return false;
+  }
+  inline std::chrono::milliseconds flushTimeout(void) const {
+    return this->cfg_->write_combiner_timeout();
+  }
 
   inline size_t num_antennas(void) { return num_antennas_; }
   inline size_t antenna_offset(void) { return antenna_offset_; }
 
  private:
+  enum RecordedDataset {
+    kPilotDs = 0,
+    kNoiseDs,
+    kUplinkDs,
+    kDownlinkDs,
+    kNumRecordedDs
+  };
+  static const char* const kDatasetNames[kNumRecordedDs];
+  static constexpr hsize_t kNotRecorded = ~hsize_t{0};
+
+  /* Channel estimates of one frame until all its pilots are in */
+  struct CsiFrame {
+    hsize_t frame_index;
+    size_t packets;
+    std::chrono::steady_clock::time_point first;
+    std::vector<float> values;
+  };
+
+  /* One output file and its writers. Without segmentation there is a
+   * single segment holding the whole recording; with it, dataset index 0
+   * of a segment is frame first_frame. */
+  struct Segment {
+    size_t index;
+    std::string name;
+    std::unique_ptr<Hdf5Lib> hdf5;
+    std::unique_ptr<ChunkCompressor> compressor;
+    std::unique_ptr<WriteCombiner> combiner;
+    std::array<size_t, kNumRecordedDs> combiner_ids;
+    hsize_t first_frame;
+    hsize_t last_frame;
+    bool has_frames;
+    size_t bytes;
+    std::chrono::steady_clock::time_point started;
+    // csi_extraction: CSI dataset shape of one frame and its open frames
+    std::array<hsize_t, kDsDimsNum> csi_dims;
+    std::vector<CsiFrame> csi_frames;
+    hsize_t csi_written_end;
+  };
+
+  /* Creates the file of a segment with all attributes and datasets */
+  std::unique_ptr<Segment> openSegment(size_t index);
+  /* Sink is an Hdf5Lib, or the RawAttributes of a raw recording */
+  template <typename Sink>
+  void writeAttributes(Sink* hdf5);
+  template <typename Sink>
+  void writeOverloadLog(const OverloadLog& overload, Sink* hdf5);
+  /* Shape of dataset ds, false if this recording has none */
+  bool datasetDims(RecordedDataset ds,
+                   std::array<hsize_t, kDsDimsNum>& dims) const;
+  /* Dataset of a packet and its slot in there, kNumRecordedDs for slots
+   * that are not recorded */
+  RecordedDataset classify(const PacketHeader& header, NodeType node_type,
+                           hsize_t& slot_index) const;
+  void createDataset(Segment& seg, RecordedDataset ds,
+                     const std::array<hsize_t, kDsDimsNum>& dims);
+  void createCsiDataset(Segment& seg);
+  /* Writes the CSI frames of seg that are complete or expired, all of
+   * them with all set */
+  void flushCsi(Segment& seg, bool all);
+  static void writeCsiFrame(Segment& seg, const CsiFrame& frame);
+  /* Writes every staged frame and chunk of seg before its file is closed */
+  void flushWrites(Segment& seg);
+  /* The segment frame_id goes to, after rotating if it starts a new one.
+   * nullptr for frames of a segment that is closed already. */
+  Segment* segmentOf(hsize_t frame_id);
+  /* record_frame_interval: the recording only has every n-th frame, so
+   * frame ids are divided by n before they index the datasets */
+  inline size_t recordedFrame(size_t frame_id) const {
+    return frame_id / this->cfg_->record_frame_interval();
+  }
+  void rotate(hsize_t first_frame);
+  /* Closes the previous segment in the background */
+  void retirePrevious(void);
+  /* Writes out and closes seg, then marks it complete in the manifest */
+  void closeSegment(std::unique_ptr<Segment> seg);
+  void writeManifest(void);
+  /* record_format "raw": no segments, packets go to raw_ */
+  void openRaw(void);
+
   Config* cfg_;
   H5std_string hdf5_name_;
-  Hdf5Lib* hdf5_;
   std::vector<std::string> datasets;
+  std::unique_ptr<Segment> segment_;
+  // The segment before segment_, open for late packets of its frames
+  std::unique_ptr<Segment> previous_;
+  // Pre-created while segment_ records, and the close of a retired one
+  std::future<std::unique_ptr<Segment>> next_segment_;
+  std::future<void> closing_;
+  bool segmented_;
+  bool rotate_due_;
+  size_t late_packets_;
 
-  size_t max_frame_number_;
+  struct ManifestEntry {
+    std::string file;
+    hsize_t first_frame;
+    hsize_t last_frame;
+    bool complete;
+  };
+  std::mutex manifest_mutex_;
+  std::vector<ManifestEntry> manifest_;
+  std::unique_ptr<RawTraceWriter> raw_;
 
   size_t antenna_offset_;
   size_t num_antennas_;
+  // record_antennas: the BS datasets have a column per kept antenna, this
+  // is the column of each antenna of the recorder or kNotRecorded
+  std::vector<hsize_t> antenna_columns_;
+  size_t recorded_antennas_;
+  // datasetDims() has a shape for the dataset
+  std::array<bool, kNumRecordedDs> has_dataset_;
 };
 }; /* End namespace Sounder */
 
@@ -10,6 +10,8 @@
 #define SOUNDER_SCHEDULER_H_
 
 #include "hdf5_reader.h"
+#include "overload_log.h"
+#include "pipeline_stats.h"
 #include "receiver.h"
 #include "recorder_thread.h"
 
@@ -23,6 +25,7 @@ class Scheduler {
   void do_it();
   int getRecordedFrameNum();
   std::string getTraceFileName() { return this->cfg_->trace_file(); }
+  inline const PipelineStats& stats(void) const { return this->stats_; }
 
  private:
   void gc(void);
@@ -33,6 +36,10 @@ class Scheduler {
   Config* cfg_;
   std::unique_ptr<Receiver> receiver_;
   SampleBuffer* rx_buffer_;
+  // buffer_layout "frame" only, replaces the BS threads' rx_buffer_ entries
+  std::unique_ptr<FrameBuffer> frame_buffer_;
+  // Recorded packets for live readers, live_tap only
+  std::unique_ptr<LiveTap> live_tap_;
   size_t rx_thread_buff_size_;
   SampleBuffer* bs_tx_buffer_;
   size_t bs_tx_thread_buff_size_;
@@ -50,6 +57,9 @@ class Scheduler {
   std::vector<moodycamel::ConcurrentQueue<Event_data>*> cl_tx_queue_;
   std::vector<moodycamel::ProducerToken*> cl_tx_ptoks_ptr_;
 
+  PipelineStats stats_;
+  OverloadLog overload_;
+
   /* Core assignment start variables */
   const unsigned int kMainDispatchCore;
   const unsigned int kSchedulerCore;
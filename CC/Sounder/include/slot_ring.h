@@ -0,0 +1,146 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Packet slot ownership for an rx SampleBuffer: one producer (the rx
+ thread) reserves slots in order, any number of consumers release them
+ in any order, one packet or one contiguous range (e.g. a frame) at once.
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_SLOT_RING_H_
+#define SOUNDER_SLOT_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/* Every reservation gets a monotonically increasing position; the slot is
+ * position % capacity. Slot s may be reused for position p once
+ * stamp_[s] == p. A release of positions [p, p + n) starting at slot s
+ * writes span_[s] = n and then stamp_[s] = p + capacity (release), so the
+ * producer only needs to load the stamp of the first slot of each released
+ * range (acquire), and every consumer release is one store.
+ *
+ * Memory ordering:
+ * - The consumer's reads of the packet and its span_ write happen before
+ *   its release store of the stamp; the producer's acquire load of that
+ *   stamp orders them before it overwrites the packet.
+ * - pos_ is written by the producer before it publishes the packet through
+ *   a queue (release/acquire), which orders it before the consumer reads it.
+ * - Released ranges must partition the reserved positions: each position is
+ *   released exactly once and a range never spans two reservations that were
+ *   not contiguous. The producer itself may Cancel() its newest reservations
+ *   before publishing them.
+ *
+ * A revocable ring additionally lets the producer take back the oldest
+ * packet while it is still queued (overload policy drop_oldest_unrecorded).
+ * claim_[s] holds (position << 2 | state); consumers must Claim() a packet
+ * by its position before reading it, a compare-exchange that loses against
+ * RevokeOldest() and cannot match a later reuse of the slot. Revocable
+ * rings only support single packet releases. */
+class SlotRing {
+ public:
+  explicit SlotRing(size_t capacity, bool revocable = false)
+      : capacity_(capacity),
+        stamp_(new std::atomic<size_t>[capacity]),
+        span_(new size_t[capacity]),
+        pos_(new size_t[capacity]),
+        claim_(revocable ? new std::atomic<size_t>[capacity] : nullptr) {
+    for (size_t i = 0; i < capacity; i++) {
+      stamp_[i].store(i, std::memory_order_relaxed);
+      span_[i] = 1;
+      pos_[i] = i;
+      if (claim_ != nullptr) {
+        claim_[i].store(kClaimed, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /* Producer only: reserves the next slot in order, false if the oldest
+   * slot is still owned by a consumer */
+  inline bool Reserve(size_t& slot) {
+    if (head_ >= free_until_) {
+      if (stamp_[next_slot_].load(std::memory_order_acquire) != head_) {
+        return false;
+      }
+      free_until_ = head_ + span_[next_slot_];
+    }
+    slot = next_slot_;
+    pos_[slot] = head_;
+    if (claim_ != nullptr) {
+      claim_[slot].store(head_ << 2 | kQueued, std::memory_order_relaxed);
+    }
+    head_++;
+    next_slot_ = (next_slot_ + 1 == capacity_) ? 0 : next_slot_ + 1;
+    return true;
+  }
+
+  /* Producer only: gives back its newest count reservations, which must not
+   * have been handed to a consumer */
+  inline void Cancel(size_t count) {
+    head_ -= count;
+    next_slot_ = (next_slot_ + capacity_ - (count % capacity_)) % capacity_;
+  }
+
+  /* Producer only, revocable rings: after a failed Reserve(), takes back
+   * the oldest slot unless its consumer already claimed it. On success the
+   * old packet is still intact in victim_slot and the next Reserve()
+   * returns that slot. */
+  inline bool RevokeOldest(size_t& victim_slot) {
+    const size_t slot = next_slot_;
+    const size_t pos = pos_[slot];
+    size_t expected = pos << 2 | kQueued;
+    if (claim_ == nullptr ||
+        claim_[slot].compare_exchange_strong(
+            expected, pos << 2 | kRevoked, std::memory_order_acq_rel) ==
+            false) {
+      return false;
+    }
+    span_[slot] = 1;
+    stamp_[slot].store(pos + capacity_, std::memory_order_relaxed);
+    victim_slot = slot;
+    return true;
+  }
+
+  /* Producer only: reservation position of a slot it reserved */
+  inline size_t seq(size_t slot) const { return pos_[slot]; }
+
+  /* Consumers, revocable rings: false if the producer revoked the packet,
+   * which then must be neither read nor released */
+  inline bool Claim(size_t slot, size_t seq) {
+    size_t expected = seq << 2 | kQueued;
+    return claim_[slot].compare_exchange_strong(expected, seq << 2 | kClaimed,
+                                                std::memory_order_acq_rel);
+  }
+
+  /* Consumers: releases the packet reserved in slot */
+  inline void Release(size_t slot) { ReleaseRange(slot, 1); }
+
+  /* Consumers: releases count packets reserved back to back starting with
+   * the one in first_slot, wrapping around the end of the buffer */
+  inline void ReleaseRange(size_t first_slot, size_t count) {
+    const size_t pos = pos_[first_slot];
+    span_[first_slot] = count;
+    stamp_[first_slot].store(pos + capacity_, std::memory_order_release);
+  }
+
+  inline size_t capacity(void) const { return capacity_; }
+  inline bool revocable(void) const { return claim_ != nullptr; }
+
+ private:
+  enum ClaimState : size_t { kQueued = 0, kClaimed = 1, kRevoked = 2 };
+
+  const size_t capacity_;
+  std::unique_ptr<std::atomic<size_t>[]> stamp_;
+  std::unique_ptr<size_t[]> span_;
+  std::unique_ptr<size_t[]> pos_;
+  std::unique_ptr<std::atomic<size_t>[]> claim_;
+
+  // Producer state, kept off the consumers' cache lines
+  alignas(64) size_t head_ = 0;
+  size_t next_slot_ = 0;
+  size_t free_until_ = 0;
+};
+
+#endif /* SOUNDER_SLOT_RING_H_ */
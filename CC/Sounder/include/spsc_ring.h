@@ -0,0 +1,71 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Bounded single-producer / single-consumer ring
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_SPSC_RING_H_
+#define SOUNDER_SPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+static constexpr size_t kCacheLineSize = 64;
+
+/// Exactly one thread may call TryPush and exactly one (other) thread may
+/// call TryPop. The producer publishes an element with a release store of
+/// head_, which the consumer reads with acquire; the consumer hands the slot
+/// back with a release store of tail_, read by the producer with acquire.
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t min_capacity) {
+    size_t capacity = 1;
+    while (capacity < min_capacity) capacity <<= 1;
+    mask_ = capacity - 1;
+    slots_.resize(capacity);
+  }
+
+  inline bool TryPush(const T& item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_cache_ > mask_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head - tail_cache_ > mask_) return false;  // full
+    }
+    slots_[head & mask_] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline bool TryPop(T& item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_cache_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail == head_cache_) return false;  // empty
+    }
+    item = slots_[tail & mask_];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline size_t SizeApprox(void) const {
+    return head_.load(std::memory_order_relaxed) -
+           tail_.load(std::memory_order_relaxed);
+  }
+  inline size_t Capacity(void) const { return mask_ + 1; }
+
+ private:
+  std::vector<T> slots_;
+  size_t mask_;
+  // Producer side: head_ and a cached copy of tail_
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t tail_cache_{0};
+  // Consumer side: tail_ and a cached copy of head_
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t head_cache_{0};
+};
+
+#endif /* SOUNDER_SPSC_RING_H_ */
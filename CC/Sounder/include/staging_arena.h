@@ -0,0 +1,149 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Single-producer / single-consumer arena of staged packets between a
+ recorder thread and its HDF5 I/O thread
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_STAGING_ARENA_H_
+#define SOUNDER_STAGING_ARENA_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+
+#include "buffer_memory.h"
+#include "frame_buffer.h"
+#include "spsc_ring.h"
+
+/// Fixed size records of a packet header, its node type and payload, the
+/// payload 64-byte aligned. The recorder Acquire()s a record, fills it and
+/// Commit()s it (release store of head_); the I/O thread reads Readable()
+/// records from Record(0) on (acquire) and frees them with Pop(). An idle
+/// I/O thread sleeps in WaitReadable() until the next Commit().
+class StagingArena {
+ public:
+  struct Staged {
+    PacketHeader header;
+    uint32_t node_type;
+  };
+  static constexpr size_t kPayloadOffset = kCacheLineSize;
+  static_assert(sizeof(Staged) <= kPayloadOffset, "Staged header too big");
+
+  StagingArena(size_t payload_bytes, size_t arena_bytes, HugePageMode hugepages,
+               int numa_node)
+      : stride_(kPayloadOffset + (payload_bytes + kCacheLineSize - 1) /
+                                     kCacheLineSize * kCacheLineSize) {
+    if (arena_bytes < stride_) {
+      throw std::invalid_argument("StagingArena: smaller than one packet");
+    }
+    records_ = arena_bytes / stride_;
+    memory_.Allocate(records_ * stride_, hugepages, numa_node);
+  }
+
+  /* Producer: next free record, nullptr if the arena is full */
+  inline Staged* Acquire(void) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_cache_ >= records_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head - tail_cache_ >= records_) return nullptr;
+    }
+    return reinterpret_cast<Staged*>(memory_.data() +
+                                     (head % records_) * stride_);
+  }
+  inline void Commit(void) {
+    const size_t head = head_.load(std::memory_order_relaxed) + 1;
+    head_.store(head, std::memory_order_release);
+    const size_t used = head - tail_.load(std::memory_order_relaxed);
+    if (used > high_water_.load(std::memory_order_relaxed)) {
+      high_water_.store(used, std::memory_order_relaxed);
+    }
+    // Pairs with the fence in WaitReadable(): either the consumer sees the
+    // record before it sleeps or this sees it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed) == true) {
+      { std::lock_guard<std::mutex> lock(wait_mutex_); }
+      wait_cond_.notify_one();
+    }
+  }
+
+  /* Consumer: records ready to be read, at most max */
+  inline size_t Readable(size_t max) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail + max > head_cache_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+    }
+    return std::min(head_cache_ - tail, max);
+  }
+  inline const Staged* Record(size_t i) const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    return reinterpret_cast<const Staged*>(memory_.data() +
+                                           ((tail + i) % records_) * stride_);
+  }
+  inline void Pop(size_t count) {
+    tail_.fetch_add(count, std::memory_order_release);
+  }
+  /* Consumer: sleeps until a record is readable, Wake() is called or the
+   * timeout passes */
+  inline void WaitReadable(std::chrono::microseconds timeout) {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wait_cond_.wait_for(lock, timeout, [this] {
+      return woken_ || head_.load(std::memory_order_acquire) !=
+                           tail_.load(std::memory_order_relaxed);
+    });
+    waiting_.store(false, std::memory_order_relaxed);
+    woken_ = false;
+  }
+  /* Any thread: ends the consumer's current or next WaitReadable() */
+  inline void Wake(void) {
+    {
+      std::lock_guard<std::mutex> lock(wait_mutex_);
+      woken_ = true;
+    }
+    wait_cond_.notify_one();
+  }
+
+  static inline short* Payload(const Staged* staged) {
+    return reinterpret_cast<short*>(
+        const_cast<char*>(reinterpret_cast<const char*>(staged)) +
+        kPayloadOffset);
+  }
+
+  inline size_t records(void) const { return records_; }
+  inline size_t stride(void) const { return stride_; }
+  inline size_t bytes(void) const { return records_ * stride_; }
+  inline size_t high_water(void) const {
+    return high_water_.load(std::memory_order_relaxed);
+  }
+  inline size_t SizeApprox(void) const {
+    return head_.load(std::memory_order_relaxed) -
+           tail_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const size_t stride_;
+  size_t records_;
+  BufferMemory memory_;
+  std::atomic<size_t> high_water_{0};
+  // Producer side: head_ and a cached copy of tail_
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t tail_cache_{0};
+  // Consumer side: tail_ and a cached copy of head_
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t head_cache_{0};
+  // Consumer sleeping in WaitReadable(), read by Commit()
+  alignas(kCacheLineSize) std::atomic<bool> waiting_{false};
+  bool woken_{false};
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cond_;
+};
+
+#endif /* SOUNDER_STAGING_ARENA_H_ */
@@ -32,6 +32,9 @@
 #include <vector>
 
 int pin_thread_to_core(int core_id, pthread_t& thread_to_pin);
+/* Lets the thread run on any of num_cores cores from first_core on */
+int pin_thread_to_cores(int first_core, int num_cores,
+                        pthread_t& thread_to_pin);
 int pin_to_core(int core_id);
 
 class Utils {
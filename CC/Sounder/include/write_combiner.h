@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Stages the packets of one recorder into whole frames per dataset and
+ writes each frame with a single hyperslab
+---------------------------------------------------------------------
+*/
+#ifndef SOUNDER_WRITE_COMBINER_H_
+#define SOUNDER_WRITE_COMBINER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chunk_compressor.h"
+#include "hdf5_lib.h"
+
+namespace Sounder {
+class WriteCombiner {
+ public:
+  static constexpr size_t kUncompressed = SIZE_MAX;
+
+  /* Blocks of datasets registered with the compressor go to it instead of
+   * being written here */
+  WriteCombiner(Hdf5Lib* hdf5, std::chrono::milliseconds timeout,
+                size_t max_open_frames, ChunkCompressor* compressor = nullptr);
+
+  /* Registers a dataset created with dims and returns its id for Stage().
+   * A frame is complete after expected_packets packets. compressor_id is
+   * the dataset's id in the compressor. */
+  size_t AddDataset(const std::string& name,
+                    const std::array<hsize_t, kDsDimsNum>& dims,
+                    size_t expected_packets,
+                    size_t compressor_id = kUncompressed);
+
+  /* Copies one packet into the block of its frame. Packets of frames that
+   * were already written, or outside the dataset, are written directly. */
+  void Stage(size_t ds_id, hsize_t frame_id, hsize_t cell_id, hsize_t slot,
+             hsize_t antenna, short* data);
+
+  /* Writes the blocks whose first packet is older than the timeout */
+  void FlushExpired(void);
+  void FlushAll(void);
+
+  inline bool pending(void) const { return this->open_blocks_ > 0; }
+  inline std::chrono::milliseconds timeout(void) const {
+    return this->timeout_;
+  }
+
+ private:
+  struct Block {
+    hsize_t frame_id;
+    size_t packets;
+    std::chrono::steady_clock::time_point first;
+    std::vector<short> samples;
+  };
+  struct Dataset {
+    std::string name;
+    std::array<hsize_t, kDsDimsNum> dims;
+    size_t expected_packets;
+    size_t compressor_id;
+    std::vector<Block> open;
+    // Highest frame written as a block, later packets up to it go direct
+    hsize_t written_until;
+    bool written_any;
+  };
+
+  void Flush(Dataset& ds, size_t block);
+  void WriteDirect(Dataset& ds, hsize_t frame_id, hsize_t cell_id,
+                   hsize_t slot, hsize_t antenna, short* data);
+
+  Hdf5Lib* hdf5_;
+  ChunkCompressor* compressor_;
+  const std::chrono::milliseconds timeout_;
+  const size_t max_open_frames_;
+  std::vector<Dataset> datasets_;
+  // Sample vectors of written blocks, reused for new frames
+  std::vector<std::vector<short>> spare_;
+  size_t open_blocks_;
+  size_t blocks_written_;
+  size_t direct_writes_;
+};
+};  // namespace Sounder
+
+#endif /* SOUNDER_WRITE_COMBINER_H_ */
@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ POSIX shared-memory ring of the most recently recorded packets
+---------------------------------------------------------------------
+*/
+
+#include "include/live_tap.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "include/logger.h"
+
+static constexpr char kLiveTapMagic[8] = "SNDRTAP";
+static constexpr uint32_t kLiveTapVersion = 1;
+
+LiveTap::LiveTap(Config* cfg)
+    : name_(cfg->live_tap()),
+      payload_bytes_(cfg->getPacketDataLength()),
+      dropped_(0) {
+  this->record_bytes_ =
+      sizeof(LiveTapRecord) + (this->payload_bytes_ + kCacheLineSize - 1) /
+                                  kCacheLineSize * kCacheLineSize;
+  const size_t records =
+      ((cfg->live_tap_mb() << 20) - sizeof(LiveTapHeader)) /
+      this->record_bytes_;
+  if ((cfg->live_tap_mb() << 20) <= sizeof(LiveTapHeader) || records < 2) {
+    throw std::invalid_argument("LiveTap: live_tap_mb holds no packets");
+  }
+  this->record_count_ = 1;
+  while (this->record_count_ * 2 <= records) this->record_count_ *= 2;
+  this->bytes_ =
+      sizeof(LiveTapHeader) + this->record_count_ * this->record_bytes_;
+
+  // A stale object of a crashed run is replaced, readers reattach
+  shm_unlink(this->name_.c_str());
+  const int fd =
+      shm_open(this->name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("LiveTap: cannot create " + this->name_ + ": " +
+                             std::strerror(errno));
+  }
+  if (ftruncate(fd, this->bytes_) != 0) {
+    const int err = errno;
+    close(fd);
+    shm_unlink(this->name_.c_str());
+    throw std::runtime_error("LiveTap: cannot size " + this->name_ + ": " +
+                             std::strerror(err));
+  }
+  void* mem = mmap(nullptr, this->bytes_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    shm_unlink(this->name_.c_str());
+    throw std::runtime_error("LiveTap: cannot map " + this->name_ + ": " +
+                             std::strerror(errno));
+  }
+  // ftruncate() zeroed everything, so every record reads as never written
+  this->header_ = new (mem) LiveTapHeader();
+  this->records_ = static_cast<char*>(mem) + sizeof(LiveTapHeader);
+  std::memcpy(this->header_->magic, kLiveTapMagic, sizeof(kLiveTapMagic));
+  this->header_->header_bytes = sizeof(LiveTapHeader);
+  this->header_->record_count = this->record_count_;
+  this->header_->record_bytes = this->record_bytes_;
+  this->header_->payload_bytes = this->payload_bytes_;
+  this->header_->samps_per_slot = cfg->samps_per_slot();
+  this->header_->slot_per_frame = cfg->slot_per_frame();
+  this->header_->num_cells = cfg->num_cells();
+  this->header_->num_antennas = cfg->getTotNumAntennas();
+  this->header_->next_seq.store(0, std::memory_order_relaxed);
+  // Readers check the version first: once it is set the header is valid
+  std::atomic_thread_fence(std::memory_order_release);
+  this->header_->version = kLiveTapVersion;
+  MLPD_INFO("Live tap %s: %zu packets of %zu bytes\n", this->name_.c_str(),
+            this->record_count_, this->payload_bytes_);
+}
+
+LiveTap::~LiveTap() {
+  MLPD_INFO("Live tap %s: %zu packets published, %zu dropped by writers\n",
+            this->name_.c_str(), static_cast<size_t>(this->published()),
+            static_cast<size_t>(this->dropped()));
+  munmap(this->header_, this->bytes_);
+  // Attached readers keep their mapping until they let go of it
+  shm_unlink(this->name_.c_str());
+}
+
+void LiveTap::Publish(const PacketHeader& header, const short* data,
+                      NodeType node_type) {
+  const uint64_t seq =
+      this->header_->next_seq.fetch_add(1, std::memory_order_relaxed);
+  LiveTapRecord* record = reinterpret_cast<LiveTapRecord*>(
+      this->records_ + (seq & (this->record_count_ - 1)) * this->record_bytes_);
+  const uint64_t writing = 2 * seq + 1;
+  // Take the record over from the packet a lap earlier, unless a writer of
+  // that lap is still on it or a later lap got here first
+  uint64_t lock = record->lock.load(std::memory_order_relaxed);
+  do {
+    if ((lock & 1) != 0 || lock > writing) {
+      this->dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  } while (record->lock.compare_exchange_weak(
+               lock, writing, std::memory_order_relaxed) == false);
+  // Readers that see the odd lock must not see any of the new data before
+  std::atomic_thread_fence(std::memory_order_release);
+  record->frame_id = header.frame_id;
+  record->slot_id = header.slot_id;
+  record->cell_id = header.cell_id;
+  record->ant_id = header.ant_id;
+  record->node_type = node_type;
+  std::memcpy(reinterpret_cast<char*>(record) + sizeof(LiveTapRecord), data,
+              this->payload_bytes_);
+  record->lock.store(writing + 1, std::memory_order_release);
+}
@@ -0,0 +1,142 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ OFDM modulation of whole slots, from QAM values to CS16 samples
+---------------------------------------------------------------------
+*/
+
+#include "include/ofdm_modulator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "include/comms-lib.h"
+
+static constexpr float kCs16Scale = 32768.f;
+
+static std::complex<float>* AllocSamples(size_t count) {
+  auto* samples = static_cast<std::complex<float>*>(
+      mufft_alloc(count * sizeof(std::complex<float>)));
+  if (samples == nullptr) throw std::bad_alloc();
+  return samples;
+}
+
+// in * scale truncated to int16 like Utils::cfloat_to_cint16(), clamped to
+// the int16 range. Returns the number of samples clamped.
+static size_t ScaleToCs16(const std::complex<float>* in, size_t count,
+                          float scale, std::complex<int16_t>* out) {
+  const float* x = reinterpret_cast<const float*>(in);
+  int16_t* y = reinterpret_cast<int16_t*>(out);
+  size_t saturated = 0;
+  for (size_t i = 0; i < 2 * count; i += 2) {
+    const float re = x[i] * scale;
+    const float im = x[i + 1] * scale;
+    saturated += (re >= 32768.f || re <= -32769.f || im >= 32768.f ||
+                  im <= -32769.f);
+    y[i] = static_cast<int16_t>(std::clamp(re, -32768.f, 32767.f));
+    y[i + 1] = static_cast<int16_t>(std::clamp(im, -32768.f, 32767.f));
+  }
+  return saturated;
+}
+
+OfdmModulator::OfdmModulator(size_t fft_size, size_t cp_size, size_t symbols,
+                             size_t prefix, size_t postfix,
+                             const std::vector<size_t>& data_sc,
+                             const std::vector<size_t>& pilot_sc_ind,
+                             const std::vector<std::complex<float>>& pilot_sc,
+                             int mod_type, float tx_scale)
+    : fft_size_(fft_size),
+      cp_size_(cp_size),
+      symbols_(symbols),
+      prefix_(prefix),
+      postfix_(postfix),
+      data_sc_(data_sc),
+      pilot_sc_ind_(pilot_sc_ind),
+      pilot_sc_(pilot_sc),
+      constellation_(CommsLib::getConstellation(mod_type)) {
+  if (fft_size == 0 || (fft_size & (fft_size - 1)) != 0) {
+    throw std::invalid_argument("OfdmModulator: FFT size " +
+                                std::to_string(fft_size) +
+                                " is not a power of two");
+  }
+  if (cp_size > fft_size) {
+    throw std::invalid_argument("OfdmModulator: CP longer than a symbol");
+  }
+  if (this->constellation_.empty() == true) {
+    throw std::invalid_argument("OfdmModulator: unsupported modulation " +
+                                std::to_string(mod_type));
+  }
+  if (pilot_sc_ind.size() > pilot_sc.size()) {
+    throw std::invalid_argument("OfdmModulator: missing pilot values");
+  }
+  // IFFT(.., fft_shift) takes subcarrier half + k as bin k
+  const size_t half = fft_size / 2;
+  auto to_bin = [fft_size, half](size_t sc) {
+    if (sc >= fft_size) {
+      throw std::invalid_argument("OfdmModulator: subcarrier " +
+                                  std::to_string(sc) + " out of range");
+    }
+    return sc >= half ? sc - half : sc + fft_size - half;
+  };
+  for (size_t sc : data_sc) this->data_bin_.push_back(to_bin(sc));
+  for (size_t sc : pilot_sc_ind) this->pilot_bin_.push_back(to_bin(sc));
+  this->sample_scale_ = 1.f / fft_size * tx_scale * kCs16Scale;
+
+  this->bins_ = AllocSamples(std::max<size_t>(symbols, 1) * fft_size);
+  this->time_ = AllocSamples(std::max<size_t>(symbols, 1) * fft_size);
+  // Get the plan now rather than on the first slot
+  CommsLib::getFftPlan(fft_size, MUFFT_INVERSE);
+}
+
+OfdmModulator::~OfdmModulator() {
+  mufft_free(this->bins_);
+  mufft_free(this->time_);
+}
+
+size_t OfdmModulator::Modulate(const uint8_t* bits, size_t bits_stride,
+                               std::complex<float>* freq,
+                               std::complex<int16_t>* time) {
+  const size_t n = this->fft_size_;
+  const size_t data_num = this->data_sc_.size();
+  const size_t mask = this->constellation_.size() - 1;
+  const std::complex<float>* table = this->constellation_.data();
+
+  std::fill(this->bins_, this->bins_ + this->symbols_ * n, 0);
+  std::fill(freq, freq + this->symbols_ * n, 0);
+  for (size_t s = 0; s < this->symbols_; s++) {
+    std::complex<float>* bins = this->bins_ + s * n;
+    std::complex<float>* sym = freq + s * n;
+    const uint8_t* sym_bits = bits + s * bits_stride;
+    for (size_t c = 0; c < data_num; c++) {
+      const std::complex<float> value = table[sym_bits[c] & mask];
+      bins[this->data_bin_[c]] = value;
+      sym[this->data_sc_[c]] = value;
+    }
+    // Pilots win if a subcarrier is in both lists
+    for (size_t c = 0; c < this->pilot_sc_ind_.size(); c++) {
+      bins[this->pilot_bin_[c]] = this->pilot_sc_[c];
+      sym[this->pilot_sc_ind_[c]] = this->pilot_sc_[c];
+    }
+  }
+  CommsLib::IFFT(this->bins_, this->time_, n, this->symbols_);
+
+  size_t saturated = 0;
+  std::complex<int16_t>* out = time;
+  std::fill(out, out + this->prefix_, 0);
+  out += this->prefix_;
+  for (size_t s = 0; s < this->symbols_; s++) {
+    const std::complex<float>* sym = this->time_ + s * n;
+    saturated += ScaleToCs16(sym + n - this->cp_size_, this->cp_size_,
+                             this->sample_scale_, out);
+    saturated +=
+        ScaleToCs16(sym, n, this->sample_scale_, out + this->cp_size_);
+    out += n + this->cp_size_;
+  }
+  std::fill(out, out + this->postfix_, 0);
+  return saturated;
+}
@@ -0,0 +1,259 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Append-only capture files of the "raw" record_format
+---------------------------------------------------------------------
+*/
+
+#include "include/raw_trace_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "include/logger.h"
+
+using json = nlohmann::json;
+
+// Data file writes, a multiple of any O_DIRECT alignment
+static constexpr size_t kRawWriteBytes = 4 << 20;
+static constexpr size_t kRawAlignBytes = 4096;
+static constexpr size_t kRawIndexBufferBytes = 1 << 20;
+
+namespace Sounder {
+static json Tagged(const char* type, json value) {
+  return {{"type", type}, {"value", std::move(value)}};
+}
+
+void RawAttributes::write_attribute(const char name[], double val) {
+  this->attributes_[name] = Tagged("double", val);
+}
+
+void RawAttributes::write_attribute(const char name[],
+                                    const std::vector<double>& val) {
+  this->attributes_[name] = Tagged("double[]", val);
+}
+
+void RawAttributes::write_attribute(
+    const char name[], const std::vector<std::complex<int16_t>>& val) {
+  json flat = json::array();
+  for (const auto& v : val) {
+    flat.push_back(v.real());
+    flat.push_back(v.imag());
+  }
+  this->attributes_[name] = Tagged("cint16[]", std::move(flat));
+}
+
+void RawAttributes::write_attribute(
+    const char name[], const std::vector<std::complex<float>>& val) {
+  json flat = json::array();
+  for (const auto& v : val) {
+    flat.push_back(v.real());
+    flat.push_back(v.imag());
+  }
+  this->attributes_[name] = Tagged("cfloat[]", std::move(flat));
+}
+
+void RawAttributes::write_attribute(const char name[], size_t val) {
+  this->attributes_[name] = Tagged("uint64", val);
+}
+
+void RawAttributes::write_attribute(const char name[], int val) {
+  this->attributes_[name] = Tagged("int", val);
+}
+
+void RawAttributes::write_attribute(const char name[],
+                                    const std::vector<size_t>& val) {
+  this->attributes_[name] = Tagged("uint64[]", val);
+}
+
+void RawAttributes::write_attribute(const char name[],
+                                    const std::string& val) {
+  this->attributes_[name] = Tagged("string", val);
+}
+
+void RawAttributes::write_attribute(const char name[],
+                                    const std::vector<std::string>& val) {
+  this->attributes_[name] = Tagged("string[]", val);
+}
+
+void RawAttributes::write_dataset(const char name[],
+                                  const std::vector<uint8_t>& val) {
+  this->datasets_[name] = val;
+}
+
+static std::string BaseName(const std::string& path) {
+  const size_t dir = path.find_last_of('/');
+  return dir == std::string::npos ? path : path.substr(dir + 1);
+}
+
+RawTraceWriter::RawTraceWriter(const std::string& base,
+                               const std::string& hdf5_name,
+                               size_t packet_bytes, size_t prealloc_bytes)
+    : base_(base),
+      hdf5_name_(hdf5_name),
+      packet_bytes_(packet_bytes),
+      prealloc_bytes_(prealloc_bytes),
+      buffered_(0),
+      written_(0),
+      allocated_(0),
+      packets_(0),
+      max_frame_(0) {
+  const std::string data_name = base + ".raw";
+  this->direct_ = true;
+  this->data_fd_ = open(data_name.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  if (this->data_fd_ < 0 && errno == EINVAL) {
+    // tmpfs and some network file systems
+    MLPD_WARN("%s: no O_DIRECT, writing through the page cache\n",
+              data_name.c_str());
+    this->direct_ = false;
+    this->data_fd_ = open(data_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                          0644);
+  }
+  if (this->data_fd_ < 0) {
+    throw std::runtime_error("Cannot create " + data_name + ": " +
+                             std::strerror(errno));
+  }
+  const std::string index_name = base + ".idx";
+  this->index_ = std::fopen(index_name.c_str(), "wb");
+  if (this->index_ == nullptr) {
+    close(this->data_fd_);
+    throw std::runtime_error("Cannot create " + index_name + ": " +
+                             std::strerror(errno));
+  }
+  std::setvbuf(this->index_, nullptr, _IOFBF, kRawIndexBufferBytes);
+  this->buffer_.Allocate(kRawWriteBytes, kHugePageNone, -1);
+  this->compression_ = {{"codec", kCodecNone}, {"level", 0}, {"threads", 0}};
+  this->WriteSidecar();
+}
+
+RawTraceWriter::~RawTraceWriter() { this->Close(); }
+
+void RawTraceWriter::SetCompression(Hdf5Codec codec, int level,
+                                    size_t threads) {
+  this->compression_ = {
+      {"codec", codec}, {"level", level}, {"threads", threads}};
+}
+
+void RawTraceWriter::AddDataset(const std::string& name, size_t id,
+                                const std::array<hsize_t, kDsDimsNum>& dims,
+                                const std::array<hsize_t, kDsDimsNum>& chunk,
+                                size_t chunk_cache_bytes) {
+  this->datasets_[name] = {{"id", id},
+                           {"dims", dims},
+                           {"chunk", chunk},
+                           {"chunk_cache_bytes", chunk_cache_bytes}};
+  this->WriteSidecar();
+}
+
+void RawTraceWriter::Append(RawIndexEntry entry, const void* payload) {
+  entry.offset = this->written_ + this->buffered_;
+  const char* src = static_cast<const char*>(payload);
+  size_t left = this->packet_bytes_;
+  while (left > 0) {
+    const size_t n = std::min(left, kRawWriteBytes - this->buffered_);
+    std::memcpy(this->buffer_.data() + this->buffered_, src, n);
+    this->buffered_ += n;
+    src += n;
+    left -= n;
+    if (this->buffered_ == kRawWriteBytes) this->WriteBuffer();
+  }
+  if (std::fwrite(&entry, sizeof(entry), 1, this->index_) != 1) {
+    throw std::runtime_error("Cannot write " + this->base_ + ".idx: " +
+                             std::strerror(errno));
+  }
+  if (this->packets_ == 0 || entry.frame_id > this->max_frame_) {
+    this->max_frame_ = entry.frame_id;
+  }
+  this->packets_++;
+}
+
+/* Writes the whole buffer, padded to the O_DIRECT alignment. The file is
+ * grown in prealloc_bytes_ steps ahead of the writes, so the file system
+ * hands out large extents and never allocates on the write path. */
+void RawTraceWriter::WriteBuffer(void) {
+  const size_t bytes =
+      (this->buffered_ + kRawAlignBytes - 1) / kRawAlignBytes * kRawAlignBytes;
+  if (bytes == 0) return;
+  if (this->prealloc_bytes_ > 0 && this->written_ + bytes > this->allocated_) {
+    const size_t grow = std::max(this->prealloc_bytes_, bytes);
+    if (fallocate(this->data_fd_, 0, this->allocated_, grow) == 0) {
+      this->allocated_ += grow;
+    } else {
+      MLPD_WARN("%s.raw: no preallocation: %s\n", this->base_.c_str(),
+                std::strerror(errno));
+      this->allocated_ = SIZE_MAX;
+    }
+  }
+  std::memset(this->buffer_.data() + this->buffered_, 0,
+              bytes - this->buffered_);
+  size_t done = 0;
+  while (done < bytes) {
+    const ssize_t n = pwrite(this->data_fd_, this->buffer_.data() + done,
+                             bytes - done, this->written_ + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      throw std::runtime_error("Cannot write " + this->base_ + ".raw: " +
+                               std::strerror(errno));
+    }
+    done += n;
+  }
+  this->written_ += this->buffered_;
+  this->buffered_ = 0;
+}
+
+void RawTraceWriter::Close(void) {
+  if (this->index_ == nullptr) return;
+  // The last write is padded; it is never followed by another one
+  this->WriteBuffer();
+  if (ftruncate(this->data_fd_, this->written_) != 0) {
+    MLPD_WARN("%s.raw: cannot trim to %zu bytes: %s\n", this->base_.c_str(),
+              this->written_, std::strerror(errno));
+  }
+  close(this->data_fd_);
+  this->data_fd_ = -1;
+  std::fclose(this->index_);
+  this->index_ = nullptr;
+  this->WriteSidecar();
+  this->buffer_.Free();
+  MLPD_INFO("%s.raw: %zu packets, %zu MB%s\n", this->base_.c_str(),
+            this->packets_, this->written_ >> 20,
+            this->direct_ ? " (O_DIRECT)" : "");
+}
+
+/* Everything sounder-convert needs besides the data and index files. It is
+ * written when the recording starts, so a crashed run can still be
+ * converted up to its last index entry, and replaced when it is closed. */
+void RawTraceWriter::WriteSidecar(void) {
+  const bool complete = this->index_ == nullptr;
+  const json sidecar = {
+      {"format", "sounder-raw"},
+      {"version", 1},
+      {"hdf5_file", BaseName(this->hdf5_name_)},
+      {"data_file", BaseName(this->base_ + ".raw")},
+      {"index_file", BaseName(this->base_ + ".idx")},
+      {"packet_bytes", this->packet_bytes_},
+      {"packets", this->packets_},
+      {"frames", this->packets_ == 0 ? 0 : size_t{this->max_frame_} + 1},
+      {"complete", complete},
+      {"compression", this->compression_},
+      {"datasets", this->datasets_},
+      {"attributes", this->attributes_.attributes()},
+      {"attribute_datasets", this->attributes_.datasets()}};
+  const std::string name = this->base_ + ".json";
+  {
+    std::ofstream out(name + ".tmp");
+    out << sidecar.dump(2) << std::endl;
+  }
+  if (std::rename((name + ".tmp").c_str(), name.c_str()) != 0) {
+    MLPD_WARN("Cannot write %s\n", name.c_str());
+  }
+}
+};  // namespace Sounder
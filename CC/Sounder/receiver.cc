@@ -29,7 +29,6 @@
 
 //Default to detect the beacon on first channel
 static constexpr size_t kSyncDetectChannel = 0;
-static constexpr float kBeaconDetectWindowScaler = 2.33f;
 static constexpr bool kEnableCfo = false;
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -40,18 +39,31 @@ Receiver::Receiver(
     std::vector<moodycamel::ConcurrentQueue<Event_data>*> tx_queue,
     std::vector<moodycamel::ProducerToken*> tx_ptoks,
     std::vector<moodycamel::ConcurrentQueue<Event_data>*> cl_tx_queue,
-    std::vector<moodycamel::ProducerToken*> cl_tx_ptoks)
+    std::vector<moodycamel::ProducerToken*> cl_tx_ptoks,
+    Sounder::PipelineStats* stats, Sounder::OverloadLog* overload)
     : config_(config),
       message_queue_(in_queue),
       tx_queue_(tx_queue),
       tx_ptoks_(tx_ptoks),
       cl_tx_queue_(cl_tx_queue),
-      cl_tx_ptoks_(cl_tx_ptoks) {
+      cl_tx_ptoks_(cl_tx_ptoks),
+      record_thread_antennas_(1),
+      frame_buffer_(nullptr),
+      stats_(stats),
+      overload_(overload) {
   /* initialize random seed: */
   srand(time(NULL));
+  if (config_->record_filtered() == true) {
+    this->record_filter_ = std::make_unique<RecordFilter>(config_);
+  }
 
   MLPD_TRACE("Receiver Construction - CL present: %d, BS Present: %d\n",
              config_->client_present(), config_->bs_present());
+#if defined(PIPELINE_BENCH)
+  // Synthetic producers stand in for the radios, see loopSynth()
+  this->client_radio_set_ = nullptr;
+  this->base_radio_set_ = nullptr;
+#else
   try {
 #if defined(USE_UHD)
     this->client_radio_set_ =
@@ -67,6 +79,7 @@ Receiver::Receiver(
   } catch (std::exception& e) {
     throw ReceiverException(e.what());
   }
+#endif
 
   MLPD_TRACE("Receiver Construction -- number radios %zu\n",
              config_->num_bs_sdrs_all());
@@ -170,7 +183,7 @@ std::vector<pthread_t> Receiver::startRecvThreads(SampleBuffer* rx_buffer,
                                                   size_t n_rx_threads,
                                                   SampleBuffer* tx_buffer,
                                                   unsigned in_core_id) {
-  assert(rx_buffer[0].buffer.size() != 0);
+  assert(rx_buffer[0].buffer.size() != 0 || frame_buffer_ != nullptr);
   thread_num_ = n_rx_threads;
   bs_tx_buffer_ = tx_buffer;
   std::vector<pthread_t> created_threads;
@@ -298,9 +311,9 @@ int Receiver::baseTxData(int radio_id, int cell, int frame_id,
   return -1;
 }
 
-void Receiver::notifyPacket(NodeType node_type, int frame_id, int slot_id,
-                            int ant_id, int buff_size, int offset) {
-  moodycamel::ProducerToken local_ptok(*message_queue_);
+Event_data Receiver::rxEvent(NodeType node_type, int frame_id, int slot_id,
+                             int ant_id, int buff_size, int offset,
+                             size_t seq) {
   Event_data new_frame;
   new_frame.event_type = kEventRxSymbol;
   new_frame.frame_id = frame_id;
@@ -309,12 +322,137 @@ void Receiver::notifyPacket(NodeType node_type, int frame_id, int slot_id,
   new_frame.node_type = node_type;
   new_frame.buff_size = buff_size;
   new_frame.offset = offset;
-  if (message_queue_->enqueue(local_ptok, new_frame) == false) {
+  new_frame.seq = seq;
+  return new_frame;
+}
+
+// Reserves an rx buffer slot for a packet of frame_id. Returns false when the
+// overload policy drops the packet instead, the caller then receives it into
+// a scratch buffer and logs the drop once antenna and frame are known.
+bool Receiver::reserveRxSlot(int tid, SampleBuffer& rx_buffer,
+                             size_t frame_id, size_t& decimate_until,
+                             size_t& slot) {
+  const OverloadPolicy policy = config_->overload_policy();
+  if (policy == kOverloadDecimateFrames && frame_id < decimate_until &&
+      (frame_id % 2) == 1) {
+    return false;
+  }
+  if (rx_buffer.slots->Reserve(slot) == true) {
+    return true;
+  }
+
+  if (stats_ != nullptr) stats_->buffer_full_events++;
+  switch (policy) {
+    case kOverloadAbort:
+      MLPD_ERROR("rx buffer full at frame %zu, tid %d\n", frame_id, tid);
+      throw std::runtime_error("Thread " + std::to_string(tid) +
+                               " buffer full");
+    case kOverloadDropOldest: {
+      size_t victim;
+      if (rx_buffer.slots->RevokeOldest(victim) == true) {
+        const size_t packet_length =
+            sizeof(Packet) + config_->getPacketDataLength();
+        const Packet* old = reinterpret_cast<const Packet*>(
+            rx_buffer.buffer.data() + victim * packet_length);
+        this->logDrop(old->ant_id, old->frame_id);
+        if (stats_ != nullptr) stats_->revoked_packets++;
+      }
+      // Also succeeds if the recorder caught up in the meantime
+      return rx_buffer.slots->Reserve(slot);
+    }
+    case kOverloadDecimateFrames:
+      decimate_until = frame_id + kDecimateHoldFrames;
+      return false;
+    default:
+      return false;
+  }
+}
+
+// Frame layout counterpart of reserveRxSlot(), for one packet of frame_id
+bool Receiver::reserveFramePacket(size_t frame_id, size_t& decimate_until) {
+  const OverloadPolicy policy = config_->overload_policy();
+  if (policy == kOverloadDecimateFrames && frame_id < decimate_until &&
+      (frame_id % 2) == 1) {
+    return false;
+  }
+  if (frame_buffer_->Reserve(frame_id) == true) {
+    return true;
+  }
+
+  if (stats_ != nullptr) stats_->buffer_full_events++;
+  if (policy == kOverloadAbort) {
+    MLPD_ERROR("rx frame buffer full at frame %zu\n", frame_id);
+    throw std::runtime_error("Rx frame buffer full");
+  } else if (policy == kOverloadDecimateFrames) {
+    decimate_until = frame_id + kDecimateHoldFrames;
+  }
+  return false;
+}
+
+void Receiver::logDrop(size_t ant_id, size_t frame_id) {
+  if (overload_ != nullptr) overload_->Drop(ant_id, frame_id);
+}
+
+// ptok must be the calling thread's own token on message_queue_
+void Receiver::notifyPacket(moodycamel::ProducerToken& ptok,
+                            NodeType node_type, int frame_id, int slot_id,
+                            int ant_id, int buff_size, int offset) {
+  if (message_queue_->enqueue(ptok, rxEvent(node_type, frame_id, slot_id,
+                                            ant_id, buff_size, offset)) ==
+      false) {
+    MLPD_ERROR("New frame message enqueue failed\n");
+    throw std::runtime_error("New frame message enqueue failed");
+  }
+}
+
+// Publishes a batch (e.g. every channel of a radio-slot) in one operation
+void Receiver::notifyPackets(moodycamel::ProducerToken& ptok,
+                             const Event_data* events, size_t count) {
+  if (count == 0) return;
+  if (message_queue_->enqueue_bulk(ptok, events, count) == false) {
     MLPD_ERROR("New frame message enqueue failed\n");
     throw std::runtime_error("New frame message enqueue failed");
   }
 }
 
+void Receiver::setRecordRings(
+    std::vector<std::vector<SpscRing<RecordDescriptor>*>> record_rings,
+    size_t thread_antennas) {
+  record_rings_ = std::move(record_rings);
+  record_thread_antennas_ = thread_antennas;
+}
+
+// Packets to record go to the owning recorder's ring when rings are set,
+// beacon events still need the scheduler to schedule the next read
+void Receiver::publishRxEvents(moodycamel::ProducerToken& ptok,
+                               size_t producer, const Event_data* events,
+                               size_t count) {
+  if (record_rings_.empty() == true) {
+    this->notifyPackets(ptok, events, count);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const Event_data& event = events[i];
+    if (config_->internal_measurement() == false && event.slot_id == 0) {
+      if (message_queue_->enqueue(ptok, event) == false) {
+        MLPD_ERROR("New frame message enqueue failed\n");
+        throw std::runtime_error("New frame message enqueue failed");
+      }
+      continue;
+    }
+    RecordDescriptor desc;
+    desc.offset = event.offset;
+    desc.node_type = event.node_type;
+    desc.seq = event.seq;
+    if (record_rings_.at(producer)
+            .at(event.ant_id / record_thread_antennas_)
+            ->TryPush(desc) == false) {
+      MLPD_ERROR("Record ring of rx thread %zu full\n", producer);
+      throw std::runtime_error("Record ring full");
+    }
+  }
+}
+
 void* Receiver::loopRecv_launch(void* in_context) {
   ReceiverContext* context = (ReceiverContext*)in_context;
   auto me = context->ptr;
@@ -322,7 +460,11 @@ void* Receiver::loopRecv_launch(void* in_context) {
   auto core_id = context->core_id;
   auto buffer = context->buffer;
   delete context;
+#if defined(PIPELINE_BENCH)
+  me->loopSynth(tid, core_id, buffer);
+#else
   me->loopRecv(tid, core_id, buffer);
+#endif
   return 0;
 }
 
@@ -349,13 +491,23 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
 
   const size_t num_channels = config_->bs_channel().length();
   size_t packetLength = sizeof(Packet) + config_->getPacketDataLength();
-  int buffer_chunk_size = rx_buffer[0].buffer.size() / packetLength;
+  // Every rx thread has a ring of buffer_chunk_size packet slots. In the
+  // frame layout the BS threads have no packet buffer, and their events
+  // index the FrameBuffer instead.
+  SlotRing* slots = rx_buffer[tid].slots;
+  int buffer_chunk_size = slots->capacity();
   int bs_tx_buff_size = kSampleBufferFrameNum * config_->slot_per_frame();
 
   // handle two channels at each radio
   // this is assuming buffer_chunk_size is at least 2
-  std::atomic_int* pkt_buf_inuse = rx_buffer[tid].pkt_buf_inuse;
   char* buffer = rx_buffer[tid].buffer.data();
+  // packets dropped by the overload policy are received here, as are all
+  // packets of the frame layout whose frame is only known after the receive
+  std::vector<char> drop_buffer(num_channels * packetLength);
+  size_t decimate_until = 0;
+  FrameBuffer* frames = this->frame_buffer_;
+  const bool host_framed = kUseSoapyUHD == true || kUsePureUHD == true ||
+                           config_->bs_hw_framer() == false;
 
   size_t num_radios = config_->num_bs_sdrs_all();  //config_->n_bs_sdrs()[0]
   std::vector<size_t> radio_ids_in_thread;
@@ -430,11 +582,13 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
     }
   }
 
-  int cursor = 0;
   size_t frame_id = 0;
   size_t slot_id = 0;
   size_t ant_id = 0;
   cell = 0;
+  // rx events of one pass over this thread's radios, published together
+  std::vector<Event_data> rx_events;
+  rx_events.reserve(radio_ids_in_thread.size() * num_channels);
   MLPD_INFO("Start BS main recv loop in thread %d\n", tid);
   while (config_->running() == true) {
     // Global updates of frame and slot IDs for USRPs
@@ -447,9 +601,13 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
     }
 
     // Receive data
+    rx_events.clear();
     for (auto& it : radio_ids_in_thread) {
       Packet* pkt[num_channels];
       void* samp[num_channels];
+      size_t pkt_slot[num_channels];
+      bool pkt_kept[num_channels];
+      bool pkt_filtered[num_channels];
 
       // Find cell this board belongs to...
       for (size_t i = 0; i <= config_->num_cells(); i++) {
@@ -460,6 +618,9 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
       }
 
       size_t radio_id = it - config_->n_bs_sdrs_agg().at(cell);
+      // Antennas are numbered per cell, the frame buffer holds all cells
+      const size_t cell_ant_offset =
+          config_->n_bs_sdrs_agg().at(cell) * num_channels;
 
       size_t num_packets =
           config_->internal_measurement() &&
@@ -468,22 +629,49 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
               ? 1
               : num_channels;  // receive only on one channel at the ref antenna
 
-      // Set buffer status(es) to full; fail if full already
+      // Reserve the next buffer slot(s), the overload policy decides what
+      // happens if they are still in use
       for (size_t ch = 0; ch < num_packets; ++ch) {
-        int bit = 1 << (cursor + ch) % sizeof(std::atomic_int);
-        int offs = (cursor + ch) / sizeof(std::atomic_int);
-        int old = std::atomic_fetch_or(&pkt_buf_inuse[offs], bit);  // now full
-        // if buffer was full, exit
-        if ((old & bit) != 0) {
-          MLPD_ERROR("thread %d buffer full\n", tid);
-          throw std::runtime_error("Thread %d buffer full\n");
+        // Without a host framer frame and slot are only known after receive
+        pkt_filtered[ch] = host_framed == true &&
+                           this->filtered(frame_id, slot_id, cell,
+                                          radio_id * num_channels + ch);
+      }
+      // Only pilot and UL data slots are recorded, with a host framer that
+      // is known before the receive
+      const bool recorded_slot = config_->isPilot(cell, radio_id, slot_id) ||
+                                 config_->isUlData(cell, radio_id, slot_id);
+      if (frames == nullptr) {
+        const bool recorded = host_framed == false || recorded_slot == true;
+        for (size_t ch = 0; ch < num_packets; ++ch) {
+          pkt_kept[ch] = recorded == true && pkt_filtered[ch] == false &&
+                         this->reserveRxSlot(tid, rx_buffer[tid], frame_id,
+                                             decimate_until, pkt_slot[ch]);
+          // Reserved until released by consumer
+        }
+      } else {
+        // Frame layout: receive in place if the slot is known up front
+        const bool recorded = host_framed == true && recorded_slot == true;
+        for (size_t ch = 0; ch < num_packets; ++ch) {
+          pkt_kept[ch] = recorded == true && pkt_filtered[ch] == false &&
+                         this->reserveFramePacket(frame_id, decimate_until);
+          pkt_slot[ch] =
+              frames->index(frame_id, slot_id,
+                            cell_ant_offset + radio_id * num_channels + ch);
         }
-        // Reserved until marked empty by consumer
       }
 
       // Receive data into buffers
       for (size_t ch = 0; ch < num_packets; ++ch) {
-        pkt[ch] = (Packet*)(buffer + (cursor + ch) * packetLength);
+        if (frames != nullptr) {
+          pkt[ch] = (Packet*)(drop_buffer.data() + ch * packetLength);
+          samp[ch] = pkt_kept[ch] ? frames->payload(pkt_slot[ch])
+                                  : pkt[ch]->data;
+          continue;
+        }
+        pkt[ch] = pkt_kept[ch]
+                      ? (Packet*)(buffer + pkt_slot[ch] * packetLength)
+                      : (Packet*)(drop_buffer.data() + ch * packetLength);
         samp[ch] = pkt[ch]->data;
       }
       if (num_packets != num_channels)
@@ -522,27 +710,16 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
           if (config_->dl_data_slot_present() == true) {
             while (-1 != baseTxData(radio_id, cell, frame_id, rxTimeBs))
               ;
-            this->notifyPacket(kBS, frame_id + this->txFrameDelta_, 0, radio_id,
+            this->notifyPacket(local_ptok, kBS, frame_id + this->txFrameDelta_,
+                               0, radio_id,
                                bs_tx_buff_size);  // Notify new frame
           } else {
             this->baseTxBeacon(radio_id, cell, frame_id,
                                rxTimeBs + txTimeDelta_);
           }  // end if config_->dul_data_slot_present()
         }
-        if (!config_->isPilot(cell, radio_id, slot_id) &&
-            !config_->isUlData(cell, radio_id, slot_id)) {
-          for (size_t ch = 0; ch < num_packets; ++ch) {
-            const int bit = 1 << (cursor + ch) % sizeof(std::atomic_int);
-            const int offs = (cursor + ch) / sizeof(std::atomic_int);
-            const int old =
-                std::atomic_fetch_and(&pkt_buf_inuse[offs], ~bit);  // now empty
-            // if buffer was empty, exit
-            if ((old & bit) != bit) {
-              MLPD_ERROR("thread %d freed buffer when already free\n", tid);
-              throw std::runtime_error("buffer empty during free\n");
-            }
-            // Reserved until marked empty by consumer
-          }
+        if (recorded_slot == false) {
+          // Nothing to record, no slot was reserved for it
           continue;
         }
 
@@ -575,7 +752,8 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
           if (config_->dl_data_slot_present() == true) {
             while (-1 != baseTxData(radio_id, cell, frame_id, frameTime))
               ;
-            this->notifyPacket(kBS, frame_id + this->txFrameDelta_, 0, radio_id,
+            this->notifyPacket(local_ptok, kBS, frame_id + this->txFrameDelta_,
+                               0, radio_id,
                                bs_tx_buff_size);  // Notify new frame
           }
         }
@@ -594,15 +772,62 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
 #endif
 
       for (size_t ch = 0; ch < num_packets; ++ch) {
+        if (host_framed == false &&
+            this->filtered(frame_id, slot_id, cell, ant_id + ch) == true) {
+          // Hand the slot reserved for the receive straight back
+          if (frames == nullptr && pkt_kept[ch] == true) {
+            slots->Release(pkt_slot[ch]);
+          }
+          pkt_filtered[ch] = true;
+        }
+        if (pkt_filtered[ch] == true) {
+          if (stats_ != nullptr) {
+            stats_->filtered_packets.fetch_add(1, std::memory_order_relaxed);
+          }
+          continue;
+        }
+        if (frames != nullptr) {
+          if (host_framed == false) {
+            // Hardware framer: place the packet now that its slot is known
+            pkt_kept[ch] =
+                frames->contains(slot_id, cell_ant_offset + ant_id + ch) &&
+                this->reserveFramePacket(frame_id, decimate_until);
+            if (pkt_kept[ch] == true) {
+              pkt_slot[ch] = frames->index(frame_id, slot_id,
+                                           cell_ant_offset + ant_id + ch);
+              std::memcpy(frames->payload(pkt_slot[ch]), samp[ch],
+                          config_->getPacketDataLength());
+            }
+          }
+          if (pkt_kept[ch] == false) {
+            this->logDrop(ant_id + ch, frame_id);
+            continue;
+          }
+          frames->header(pkt_slot[ch]) = {(uint32_t)frame_id,
+                                          (uint32_t)slot_id, (uint32_t)cell,
+                                          (uint32_t)(ant_id + ch)};
+          rx_events.push_back(rxEvent(kBS, frame_id, slot_id, ant_id + ch,
+                                      frames->size(), pkt_slot[ch]));
+          continue;
+        }
+        if (pkt_kept[ch] == false) {
+          this->logDrop(ant_id + ch, frame_id);
+          continue;
+        }
         // new (pkt[ch]) Packet(frame_id, slot_id, 0, ant_id + ch);
         new (pkt[ch]) Packet(frame_id, slot_id, cell, ant_id + ch);
-        // push kEventRxSymbol event into the queue
-        this->notifyPacket(kBS, frame_id, slot_id, ant_id + ch,
-                           buffer_chunk_size, cursor + tid * buffer_chunk_size);
-        cursor++;
-        cursor %= buffer_chunk_size;
+        // kEventRxSymbol events are pushed after the pass over all radios
+        rx_events.push_back(rxEvent(kBS, frame_id, slot_id, ant_id + ch,
+                                    buffer_chunk_size,
+                                    pkt_slot[ch] + tid * buffer_chunk_size,
+                                    slots->seq(pkt_slot[ch])));
       }
     }
+    this->publishRxEvents(local_ptok, tid, rx_events.data(),
+                          rx_events.size());
+    if (stats_ != nullptr) {
+      stats_->rx_packets.fetch_add(rx_events.size(), std::memory_order_relaxed);
+    }
 
     // for UHD device update slot_id on host
     if (kUseSoapyUHD == true || kUsePureUHD == true ||
@@ -613,7 +838,131 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer) {
   MLPD_SYMBOL("Process %d -- Loop Rx Freed memory at: %p\n", tid,
               zeroes_memory);
   free(zeroes_memory);
+  if (stats_ != nullptr) {
+    stats_->rx_cpu_ns += Sounder::PipelineStats::ThreadCpuNs();
+    stats_->rx_threads_done++;
+  }
+}
+
+#if defined(PIPELINE_BENCH)
+bool synth_unpaced = false;
+
+// Stand-in for loopRecv: produces the pilot and uplink packets of this
+// thread's radios at the configured sample rate (or unpaced) and
+// hands them to the scheduler exactly like the hardware framer path does.
+// A full buffer slot is handled like in loopRecv, by the overload policy.
+void Receiver::loopSynth(int tid, int core_id, SampleBuffer* rx_buffer) {
+  if (config_->core_alloc() == true) {
+    MLPD_INFO("Pinning synthetic rx thread %d to core %d\n", tid,
+              core_id + tid);
+    if (pin_to_core(core_id + tid) != 0) {
+      MLPD_ERROR("Pin rx thread %d to core %d failed\n", tid, core_id + tid);
+      throw std::runtime_error("Pin rx thread to core failed");
+    }
+  }
+
+  const size_t num_channels = config_->bs_channel().length();
+  const size_t packetLength = sizeof(Packet) + config_->getPacketDataLength();
+  SlotRing* slots = rx_buffer[tid].slots;
+  const int buffer_chunk_size = slots->capacity();
+  char* buffer = rx_buffer[tid].buffer.data();
+  size_t decimate_until = 0;
+  FrameBuffer* frames = this->frame_buffer_;
+
+  const size_t num_radios = config_->num_bs_sdrs_all();
+  const size_t radio_start = (tid * num_radios) / thread_num_;
+  const size_t radio_end = ((tid + 1) * num_radios) / thread_num_;
+  const size_t max_frame =
+      config_->max_frame() > 0 ? config_->max_frame() : SIZE_MAX;
+
+  // Sample payload copied into every packet to load memory like a DMA would
+  std::vector<short> pattern(config_->getPacketDataLength() / sizeof(short));
+  for (size_t i = 0; i < pattern.size(); i++) pattern[i] = (i * 7919) & 0xFFF;
+
+  const double frame_sec = synth_unpaced ? 0 : config_->getFrameDurationSec();
+  const auto start = std::chrono::steady_clock::now();
+
+  moodycamel::ProducerToken local_ptok(*message_queue_);
+  std::vector<Event_data> rx_events;
+  rx_events.reserve((radio_end - radio_start) * num_channels);
+  size_t dropped = 0;
+  for (size_t frame_id = 0;
+       frame_id < max_frame && config_->running() == true; frame_id++) {
+    for (size_t slot_id = 0; slot_id < config_->slot_per_frame(); slot_id++) {
+      if (frame_sec > 0) {
+        std::this_thread::sleep_until(
+            start + std::chrono::duration<double>(
+                        frame_sec * (frame_id + (slot_id + 1.0) /
+                                                    config_->slot_per_frame())));
+      }
+      rx_events.clear();
+      for (size_t it = radio_start; it < radio_end; it++) {
+        // Radio and antenna ids within the cell, as the framer reports them
+        size_t cell = 0;
+        while (it >= config_->n_bs_sdrs_agg().at(cell + 1)) cell++;
+        const size_t radio_id = it - config_->n_bs_sdrs_agg().at(cell);
+        if (!config_->isPilot(cell, radio_id, slot_id) &&
+            !config_->isUlData(cell, radio_id, slot_id)) {
+          continue;
+        }
+        for (size_t ch = 0; ch < num_channels; ++ch) {
+          const size_t ant_id = radio_id * num_channels + ch;
+          if (this->filtered(frame_id, slot_id, cell, ant_id) == true) {
+            if (stats_ != nullptr) {
+              stats_->filtered_packets.fetch_add(1,
+                                                 std::memory_order_relaxed);
+            }
+            continue;
+          }
+          if (frames != nullptr) {
+            if (this->reserveFramePacket(frame_id, decimate_until) == false) {
+              this->logDrop(ant_id, frame_id);
+              dropped++;
+              continue;
+            }
+            const size_t index =
+                frames->index(frame_id, slot_id, it * num_channels + ch);
+            std::memcpy(frames->payload(index), pattern.data(),
+                        pattern.size() * sizeof(short));
+            frames->header(index) = {(uint32_t)frame_id, (uint32_t)slot_id,
+                                     (uint32_t)cell, (uint32_t)ant_id};
+            rx_events.push_back(rxEvent(kBS, frame_id, slot_id, ant_id,
+                                        frames->size(), index));
+            continue;
+          }
+          size_t pkt_slot;
+          if (this->reserveRxSlot(tid, rx_buffer[tid], frame_id,
+                                  decimate_until, pkt_slot) == false) {
+            this->logDrop(ant_id, frame_id);
+            dropped++;
+            continue;
+          }
+          Packet* pkt = (Packet*)(buffer + pkt_slot * packetLength);
+          std::memcpy(pkt->data, pattern.data(),
+                      pattern.size() * sizeof(short));
+          new (pkt) Packet(frame_id, slot_id, cell, ant_id);
+          rx_events.push_back(rxEvent(kBS, frame_id, slot_id, ant_id,
+                                      buffer_chunk_size,
+                                      pkt_slot + tid * buffer_chunk_size,
+                                      slots->seq(pkt_slot)));
+        }
+      }
+      this->publishRxEvents(local_ptok, tid, rx_events.data(),
+                            rx_events.size());
+      if (stats_ != nullptr) {
+        stats_->rx_packets.fetch_add(rx_events.size(),
+                                     std::memory_order_relaxed);
+      }
+    }
+  }
+  MLPD_INFO("Synthetic rx thread %d done, %zu packets dropped\n", tid,
+            dropped);
+  if (stats_ != nullptr) {
+    stats_->rx_cpu_ns += Sounder::PipelineStats::ThreadCpuNs();
+    stats_->rx_threads_done++;
+  }
 }
+#endif
 
 void* Receiver::clientTxRx_launch(void* in_context) {
   ReceiverContext* context = (ReceiverContext*)in_context;
@@ -806,19 +1155,6 @@ int Receiver::clientTxData(int tid, int frame_id, long long base_time) {
   return -1;
 }
 
-ssize_t Receiver::syncSearch(const std::complex<int16_t>* check_data,
-                             size_t search_window, float corr_scale) {
-  ssize_t sync_index(-1);
-  assert(search_window <= config_->samps_per_frame());
-#if defined(__x86_64__)
-  sync_index = CommsLib::find_beacon_avx(check_data, config_->gold_cf32(),
-                                         search_window, corr_scale);
-#else
-  sync_index = CommsLib::find_beacon(check_data, search_window);
-#endif
-  return sync_index;
-}
-
 float Receiver::estimateCFO(const std::vector<std::complex<int16_t>>& sync_buff,
                             int sync_index) {
   float cfo_phase_est = 0;
@@ -891,7 +1227,7 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
   moodycamel::ProducerToken local_ptok(*message_queue_);
 
   char* buffer = nullptr;
-  std::atomic_int* pkt_buf_inuse = nullptr;
+  SlotRing* slots = nullptr;
   int buffer_chunk_size = 0;
   int buffer_id = tid + config_->bs_rx_thread_num();
   size_t packetLength = sizeof(Packet) + config_->getPacketDataLength();
@@ -899,7 +1235,7 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
     buffer_chunk_size = rx_buffer[buffer_id].buffer.size() / packetLength;
     // handle two channels at each radio
     // this is assuming buffer_chunk_size is at least 2
-    pkt_buf_inuse = rx_buffer[buffer_id].pkt_buf_inuse;
+    slots = rx_buffer[buffer_id].slots;
     buffer = rx_buffer[buffer_id].buffer.data();
   }
 
@@ -925,24 +1261,25 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
   }
 
   //-------------------- New sync
-  const size_t beacon_detect_window =
-      static_cast<size_t>(static_cast<float>(config_->samps_per_slot()) *
-                          kBeaconDetectWindowScaler);
+  // Searches slot sized reads, a beacon split between two is still found
+  BeaconDetector beacon_detector(config_->gold_cf32(), samples_per_slot,
+                                 config_->beacon_fixed_point());
   size_t sync_count = 0;
   constexpr size_t kTargetSyncCount = 2;
-  assert(config_->samps_per_frame() >= beacon_detect_window);
+  assert(config_->samps_per_frame() > samples_per_slot);
   while ((sync_count < kTargetSyncCount) && config_->running()) {
-    const ssize_t sync_index = clientSyncBeacon(tid, beacon_detect_window);
+    const ssize_t sync_index =
+        clientSyncBeacon(tid, beacon_detector, rxbuff, samples_per_slot);
     if (sync_index >= 0) {
       const ssize_t adjust =
           sync_index - (config_->beacon_size() + config_->prefix());
       const size_t alignment_samples =
-          config_->samps_per_frame() - beacon_detect_window;
+          config_->samps_per_frame() - samples_per_slot;
       MLPD_INFO(
           "clientSyncTxRx [%d]: Beacon detected sync_index: %ld, rx sample "
           "offset: %ld, window %zu, samples in frame %zu, alignment removal "
           "%zu\n",
-          tid, sync_index, adjust, beacon_detect_window,
+          tid, sync_index, adjust, samples_per_slot,
           config_->samps_per_frame(), alignment_samples);
 
       //By definition alignment_samples + adjust must be > 0;
@@ -950,6 +1287,7 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
         throw std::runtime_error("Unexpected alignment");
       }
       clientAdjustRx(tid, alignment_samples + adjust);
+      beacon_detector.Reset();
       sync_count++;
     } else if (config_->running()) {
       MLPD_WARN(
@@ -961,7 +1299,11 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
 
   // Main client read/write loop.
   size_t frame_id = 0;
-  size_t buffer_offset = 0;
+  std::vector<size_t> pkt_slots(config_->cl_sdr_ch());
+  std::vector<bool> pkt_kept(config_->cl_sdr_ch());
+  // packets dropped by the overload policy are received here
+  std::vector<char> drop_buffer(config_->cl_sdr_ch() * packetLength);
+  size_t decimate_until = 0;
   //sync on the first beacon after initial detection
   bool resync = true;
   bool resync_enable = (config_->frame_mode() == "continuous_resync");
@@ -981,6 +1323,10 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
   long long rx_beacon_time(0);
   //Always decreases the requested rx samples
   size_t beacon_adjust = 0;
+  // Beacon end found in the tail of the previous frame, relative to the
+  // beacon slot read
+  ssize_t early_sync_index = -1;
+  bool early_sync = false;
 
   while (config_->running() == true) {
     if (config_->max_frame() > 0 && frame_id >= config_->max_frame()) {
@@ -999,8 +1345,8 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
     }
     if (config_->ul_data_slot_present() == true) {
       // Notify new frame
-      this->notifyPacket(kClient, frame_id + this->txFrameDelta_, 0, tid,
-                         tx_buffer_size);
+      this->notifyPacket(local_ptok, kClient, frame_id + this->txFrameDelta_, 0,
+                         tid, tx_buffer_size);
     }
 
     if ((frame_id - last_resync) >= resync_period) {
@@ -1009,11 +1355,17 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
       MLPD_TRACE("Enable resyncing at frame %zu\n", frame_id);
     }
     if (resync == true) {
-      ssize_t sync_index = this->syncSearch(
-          reinterpret_cast<std::complex<int16_t>*>(
-              rxbuff.at(kSyncDetectChannel)),
-          request_samples, config_->corr_scale(tid) + resync_retry_cnt);
-      if (sync_index >= 0) {
+      // A beacon found early ends before this read, sync_index < 0
+      ssize_t sync_index = early_sync_index;
+      const bool found_early = early_sync;
+      if (early_sync == false) {
+        sync_index = beacon_detector.Push(
+            reinterpret_cast<std::complex<int16_t>*>(
+                rxbuff.at(kSyncDetectChannel)),
+            request_samples, config_->corr_scale(tid) + resync_retry_cnt);
+      }
+      early_sync = false;
+      if (found_early || sync_index >= 0) {
         const int new_rx_offset =
             sync_index - (config_->beacon_size() + config_->prefix());
         //Adjust tx time
@@ -1026,7 +1378,8 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
             "index: %ld, tid %d\n",
             frame_id, new_rx_offset, resync_retry_cnt + 1, sync_index, tid);
 
-        if (kEnableCfo && (sync_index >= 0)) {
+        if (kEnableCfo &&
+            (sync_index >= static_cast<ssize_t>(config_->beacon_size()))) {
           [[maybe_unused]] const auto cfo_phase_est =
               estimateCFO(samplemem.at(kSyncDetectChannel), sync_index);
           MLPD_INFO("Client %d Estimated CFO (Hz): %f\n", tid,
@@ -1041,6 +1394,7 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
           //throw away samples to get back in alignment, could combine with the next beacon but would need bigger buffers
           clientAdjustRx(tid, discard_samples);
         }
+        beacon_detector.Reset();
       } else {
         resync_retry_cnt++;
 
@@ -1073,19 +1427,15 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
     for (size_t slot_id = 1; slot_id < config_->slot_per_frame(); slot_id++) {
       int rx_data_status;
       long long rx_data_time;
+      const void* sync_samples = rxbuff.at(kSyncDetectChannel);
       if (config_->isDlData(tid, slot_id)) {
-        // Set buffer status(es) to full; fail if full already
+        // Reserve the next buffer slot(s), the overload policy decides
+        // what happens if they are still in use
         for (size_t ch = 0; ch < config_->cl_sdr_ch(); ++ch) {
-          const int bit = 1 << (buffer_offset + ch) % sizeof(std::atomic_int);
-          const int offs = (buffer_offset + ch) / sizeof(std::atomic_int);
-          const int old =
-              std::atomic_fetch_or(&pkt_buf_inuse[offs], bit);  // now full
-          // if buffer was full, exit
-          if ((old & bit) != 0) {
-            MLPD_ERROR("thread %d buffer full\n", tid);
-            throw std::runtime_error("Thread %d buffer full\n");
-          }
-          // Reserved until marked empty by consumer
+          pkt_kept.at(ch) =
+              this->reserveRxSlot(tid, rx_buffer[buffer_id], frame_id,
+                                  decimate_until, pkt_slots.at(ch));
+          // Reserved until released by consumer
         }
 
         // Receive data into buffers
@@ -1093,21 +1443,30 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
         std::vector<void*> dl_slot_samp(config_->cl_sdr_ch());
         for (size_t ch = 0; ch < config_->cl_sdr_ch(); ++ch) {
           pkts.at(ch) = reinterpret_cast<Packet*>(
-              buffer + (buffer_offset + ch) * packetLength);
+              pkt_kept.at(ch) ? buffer + pkt_slots.at(ch) * packetLength
+                              : drop_buffer.data() + ch * packetLength);
           dl_slot_samp.at(ch) = pkts.at(ch)->data;
         }
+        sync_samples = dl_slot_samp.at(kSyncDetectChannel);
 
         rx_data_status = this->client_radio_set_->radioRx(
             tid, dl_slot_samp.data(), samples_per_slot, rx_data_time);
+        Event_data rx_events[config_->cl_sdr_ch()];
+        size_t num_events = 0;
         for (size_t ch = 0; ch < config_->cl_sdr_ch(); ++ch) {
+          if (pkt_kept.at(ch) == false) {
+            this->logDrop(ant_id + ch, frame_id);
+            continue;
+          }
           new (pkts.at(ch)) Packet(frame_id, slot_id, 0, ant_id + ch);
-          // push kEventRxSymbol event into the queue
-          this->notifyPacket(kClient, frame_id, slot_id, ant_id + ch,
-                             buffer_chunk_size,
-                             buffer_offset + buffer_id * buffer_chunk_size);
-          buffer_offset++;
-          buffer_offset %= buffer_chunk_size;
+          rx_events[num_events++] =
+              rxEvent(kClient, frame_id, slot_id, ant_id + ch,
+                      buffer_chunk_size,
+                      pkt_slots.at(ch) + buffer_id * buffer_chunk_size,
+                      slots->seq(pkt_slots.at(ch)));
         }
+        // push the kEventRxSymbol events of all channels at once
+        this->publishRxEvents(local_ptok, buffer_id, rx_events, num_events);
       } else {
         //Not dl data so we throw it away
         rx_data_status = this->client_radio_set_->radioRx(
@@ -1124,33 +1483,44 @@ void Receiver::clientSyncTxRx(int tid, int core_id, SampleBuffer* rx_buffer) {
         MLPD_WARN("BAD Receive(%d/%zu) at Time %lld, frame count %zu\n",
                   rx_data_status, samples_per_slot, rx_data_time, frame_id);
       }
+      // A beacon that drifted early starts in the last slot
+      const bool search_next =
+          resync || (resync_enable && (frame_id + 1 - last_resync) >=
+                                          resync_period);
+      if (search_next && slot_id + 1 == config_->slot_per_frame()) {
+        const size_t tail =
+            std::min(samples_per_slot, beacon_detector.history());
+        beacon_detector.Reset();
+        early_sync_index = beacon_detector.Push(
+            static_cast<const std::complex<int16_t>*>(sync_samples) +
+                samples_per_slot - tail,
+            tail, config_->corr_scale(tid) + resync_retry_cnt);
+        early_sync = early_sync_index >= 0;
+        if (early_sync == true) {
+          early_sync_index -= static_cast<ssize_t>(tail);
+        }
+      }
     }  // end for
     frame_id++;
   }  // end while
 }
 
 //Blocking function for beacon detected or exit()
-ssize_t Receiver::clientSyncBeacon(size_t radio_id, size_t sample_window) {
+ssize_t Receiver::clientSyncBeacon(size_t radio_id, BeaconDetector& detector,
+                                   const std::vector<void*>& rx_buffs,
+                                   size_t sample_window) {
   ssize_t sync_index = -1;
   long long rx_time = 0;
   assert(sample_window <= config_->samps_per_frame());
-  const size_t num_rx_buffs = config_->cl_sdr_ch();
-  std::vector<std::vector<std::complex<int16_t>>> syncbuffmem(
-      num_rx_buffs, std::vector<std::complex<int16_t>>(
-                        sample_window, std::complex<int16_t>(0, 0)));
-
-  std::vector<void*> syncrxbuffs;
-  for (size_t ch = 0; ch < num_rx_buffs; ch++) {
-    syncrxbuffs.push_back(syncbuffmem.at(ch).data());
-  }
-
+  // The beacon ends in the last read, it may have begun in the one before
   while (config_->running() && (sync_index < 0)) {
     const int rx_status = client_radio_set_->radioRx(
-        radio_id, syncrxbuffs.data(), sample_window, rx_time);
+        radio_id, rx_buffs.data(), sample_window, rx_time);
 
     if (rx_status < 0) {
       MLPD_ERROR("clientSyncBeacon [%zu]: BAD SYNC Received (%d/%zu) %lld\n",
                  radio_id, rx_status, sample_window, rx_time);
+      detector.Reset();
     } else {
       const size_t new_samples = static_cast<size_t>(rx_status);
       if (new_samples == sample_window) {
@@ -1158,13 +1528,16 @@ ssize_t Receiver::clientSyncBeacon(size_t radio_id, size_t sample_window) {
             "clientSyncBeacon - Samples %zu - Window %zu - Check Beacon %ld\n",
             new_samples, sample_window);
 
-        sync_index = syncSearch(syncbuffmem.at(kSyncDetectChannel).data(),
-                                sample_window, config_->corr_scale(radio_id));
+        sync_index = detector.Push(
+            static_cast<const std::complex<int16_t>*>(
+                rx_buffs.at(kSyncDetectChannel)),
+            sample_window, config_->corr_scale(radio_id));
       } else {
         MLPD_ERROR(
             "clientSyncBeacon [%zu]: BAD SYNC - Rx samples not requested size "
             "(%zu/%zu) %lld\n",
             radio_id, new_samples, sample_window, rx_time);
+        detector.Reset();
       }
     }
   }  // end while sync_index < 0
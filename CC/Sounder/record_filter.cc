@@ -0,0 +1,36 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Selects the base station packets that are recorded at all
+---------------------------------------------------------------------
+*/
+
+#include "include/record_filter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "include/logger.h"
+
+RecordFilter::RecordFilter(Config* cfg)
+    : frame_interval_(cfg->record_frame_interval()),
+      windows_(cfg->record_frame_windows()),
+      slot_types_(cfg->record_slots()),
+      num_channels_(cfg->bs_channel().size()),
+      frames_(cfg->bs_array_frames()),
+      antennas_(cfg->getMaxNumAntennas(), cfg->record_antennas().empty()) {
+  for (size_t ant_id : cfg->record_antennas()) {
+    if (ant_id >= this->antennas_.size()) {
+      throw std::invalid_argument("RecordFilter: no antenna " +
+                                  std::to_string(ant_id) + " in a cell");
+    }
+    this->antennas_.at(ant_id) = true;
+  }
+  MLPD_INFO("Recording slots %s of %zu antennas per cell, every %zu. frame\n",
+            this->slot_types_.c_str(),
+            static_cast<size_t>(std::count(this->antennas_.begin(),
+                                           this->antennas_.end(), true)),
+            this->frame_interval_);
+}
@@ -9,24 +9,58 @@
 
 #include "include/recorder_thread.h"
 
+#include <cstring>
+#include <thread>
+
 #include "include/logger.h"
 #include "include/macros.h"
 #include "include/utils.h"
 
 namespace Sounder {
+// Idle poll period while rx threads may be filling the direct rings
+static constexpr std::chrono::microseconds kDirectPollInterval(100);
+// Staged packets the I/O thread writes before it frees their records
+static constexpr size_t kStagingBatch = 256;
+// Pilots the CSI threads may hold at once, and take back per call
+static constexpr size_t kCsiJobs = 1024;
+static constexpr size_t kCsiBatch = 64;
+
 RecorderThread::RecorderThread(Config* in_cfg, size_t thread_id, int core,
                                size_t queue_size, size_t antenna_offset,
-                               size_t num_antennas, bool wait_signal)
+                               size_t num_antennas, bool wait_signal,
+                               PipelineStats* stats,
+                               const OverloadLog* overload)
     : event_queue_(queue_size),
       producer_token_(event_queue_),
+      direct_buffer_(nullptr),
+      direct_buff_size_(0),
+      frame_buffer_(nullptr),
+      live_tap_(nullptr),
       worker_(in_cfg, antenna_offset, num_antennas),
       thread_(),
+      staging_done_(false),
       id_(thread_id),
       core_alloc_(core),
-      wait_signal_(wait_signal) {
+      io_core_start_(-1),
+      io_core_num_(0),
+      wait_signal_(wait_signal),
+      stats_(stats),
+      overload_(overload) {
   packet_data_length_ = in_cfg->getPacketDataLength();
   worker_.init();
   running_ = false;
+  if (in_cfg->record_staging_mb() > 0) {
+    this->staging_ = std::make_unique<StagingArena>(
+        packet_data_length_, in_cfg->record_staging_mb() << 20,
+        in_cfg->buffer_hugepages(), BufferMemory::NumaNodeOfCore(core));
+    if (this->stats_ != nullptr) {
+      this->stats_->staging_bytes += this->staging_->bytes();
+    }
+  }
+  if (in_cfg->csi_extraction() == true) {
+    this->csi_ = std::make_unique<CsiExtractor>(
+        in_cfg, in_cfg->csi_thread_num(), kCsiJobs);
+  }
 }
 
 RecorderThread::~RecorderThread() { Finalize(); }
@@ -39,6 +73,9 @@ void RecorderThread::Start(void) {
   {
     std::lock_guard<std::mutex> thread_lock(this->sync_);
     this->thread_ = std::thread(&RecorderThread::DoRecording, this);
+    if (this->staging_ != nullptr) {
+      this->io_thread_ = std::thread(&RecorderThread::DoWriting, this);
+    }
     this->running_ = true;
   }
   this->condition_.notify_all();
@@ -60,6 +97,33 @@ void RecorderThread::Finalize(void) {
   }
 }
 
+size_t RecorderThread::StagedBytes(void) const {
+  return this->staging_ == nullptr
+             ? 0
+             : this->staging_->SizeApprox() * this->staging_->stride();
+}
+
+size_t RecorderThread::QueueDepth(void) const {
+  size_t depth = this->event_queue_.size_approx();
+  for (const auto& ring : this->direct_rings_) {
+    depth += ring->SizeApprox();
+  }
+  return depth;
+}
+
+// A ring holds as many descriptors as its producer can have packets in use,
+// so it cannot overflow while every descriptor in it still holds one
+void RecorderThread::AttachDirectRings(SampleBuffer* buffer, size_t buff_size,
+                                       const std::vector<size_t>& ring_sizes) {
+  this->direct_buffer_ = buffer;
+  this->direct_buff_size_ = buff_size;
+  this->direct_rings_.clear();
+  for (size_t ring_size : ring_sizes) {
+    this->direct_rings_.emplace_back(
+        std::make_unique<SpscRing<RecordDescriptor>>(ring_size));
+  }
+}
+
 /* TODO:  handle producer token better */
 //Returns true for success, false otherwise
 bool RecorderThread::DispatchWork(Event_data event) {
@@ -111,46 +175,261 @@ void RecorderThread::DoRecording(void) {
   while (this->running_ == true) {
     ret = this->event_queue_.try_dequeue(ctok, event);
 
-    if (ret == false) /* Queue empty */
+    if (this->direct_rings_.empty() == false) {
+      size_t drained = this->DrainDirectRings();
+      if (ret == false && drained == 0 && this->wait_signal_ == true) {
+        /* rx threads do not signal, so only sleep for one poll interval */
+        std::unique_lock<std::mutex> thread_wait(this->sync_);
+        ret = this->condition_.wait_for(
+            thread_wait, kDirectPollInterval, [this, &ctok, &event] {
+              return this->event_queue_.try_dequeue(ctok, event);
+            });
+      }
+    } else if (ret == false) /* Queue empty */
     {
       if (this->wait_signal_ == true) {
         std::unique_lock<std::mutex> thread_wait(this->sync_);
-        /* Wait until a new message exists, should eliminate the CPU polling */
-        this->condition_.wait(thread_wait, [this, &ctok, &event] {
+        auto has_event = [this, &ctok, &event] {
           return this->event_queue_.try_dequeue(ctok, event);
-        });
-        /* return from here with a valid event to process */
-        ret = true;
+        };
+        if (this->staging_ == nullptr && this->csi_ != nullptr &&
+            this->csi_->in_flight() > 0) {
+          /* Channel estimates come back without an event */
+          ret = this->condition_.wait_for(thread_wait, kDirectPollInterval,
+                                          has_event);
+        } else if (this->staging_ == nullptr &&
+                   this->worker_.pending() == true) {
+          /* Wake up in time to write out partial frames */
+          ret = this->condition_.wait_for(
+              thread_wait, this->worker_.flushTimeout(), has_event);
+        } else {
+          /* Wait until a new message exists, no CPU polling */
+          this->condition_.wait(thread_wait, has_event);
+          /* return from here with a valid event to process */
+          ret = true;
+        }
       }
     }
 
     if (ret == true) {
       this->HandleEvent(event);
+    } else if (this->staging_ == nullptr) {
+      this->worker_.flushExpired();
     }
+    if (this->csi_ != nullptr && this->staging_ == nullptr) this->WriteCsi();
+  }
+  // rx threads are joined before Stop(), pick up what they left behind
+  this->DrainDirectRings();
+  if (this->io_thread_.joinable() == true) {
+    this->staging_done_.store(true, std::memory_order_release);
+    this->staging_->Wake();
+    this->io_thread_.join();
+  }
+  // Every pilot is submitted by now, wait for the last estimates
+  while (this->csi_ != nullptr && this->csi_->in_flight() > 0) {
+    if (this->WriteCsi() == 0) std::this_thread::sleep_for(kDirectPollInterval);
+  }
+  if (this->overload_ != nullptr) {
+    this->worker_.writeOverloadLog(*this->overload_);
   }
   this->worker_.finalize();
+  if (this->stats_ != nullptr) {
+    this->stats_->record_cpu_ns += PipelineStats::ThreadCpuNs();
+  }
 }
 
 void RecorderThread::HandleEvent(Event_data event) {
   if (event.event_type == kThreadTermination) {
     this->running_ = false;
-  } else {
-    size_t buffer_id = (event.offset / event.buff_size);
-    size_t buffer_offset = event.offset - (buffer_id * event.buff_size);
-    if (event.event_type == kTaskRecord) {
-      // read info
-      size_t packet_length = sizeof(Packet) + this->packet_data_length_;
-      char* cur_ptr_buffer = event.buffer[buffer_id].buffer.data() +
-                             (buffer_offset * packet_length);
-
-      this->worker_.record(this->id_, reinterpret_cast<Packet*>(cur_ptr_buffer),
-                           event.node_type);
-      /* Free up the buffer memory */
-      int bit = 1 << (buffer_offset % sizeof(std::atomic_int));
-      int offs = (buffer_offset / sizeof(std::atomic_int));
-      std::atomic_fetch_and(&event.buffer[buffer_id].pkt_buf_inuse[offs],
-                            ~bit);  // now empty
+  } else if (event.event_type == kTaskRecord) {
+    this->RecordPacket(event.buffer, event.buff_size, event.offset, event.seq,
+                       event.node_type);
+  }
+}
+
+size_t RecorderThread::DrainDirectRings(void) {
+  size_t drained = 0;
+  RecordDescriptor desc;
+  for (auto& ring : this->direct_rings_) {
+    while (ring->TryPop(desc) == true) {
+      this->RecordPacket(this->direct_buffer_, this->direct_buff_size_,
+                         desc.offset, desc.seq, desc.node_type);
+      drained++;
+    }
+  }
+  return drained;
+}
+
+void RecorderThread::RecordPacket(SampleBuffer* buffer, size_t buff_size,
+                                  int offset, size_t seq, NodeType node_type) {
+  if (node_type == kBS && this->frame_buffer_ != nullptr) {
+    // The header copy keeps the frame id valid once the packet is released
+    const PacketHeader header = this->frame_buffer_->header(offset);
+    if (this->live_tap_ != nullptr) {
+      this->live_tap_->Publish(header, this->frame_buffer_->payload(offset),
+                               node_type);
+    }
+    if (this->csi_ != nullptr &&
+        this->ExtractCsi(header, this->frame_buffer_->payload(offset),
+                         node_type) == true) {
+      this->frame_buffer_->Release(header.frame_id);
+      return;
+    }
+    if (this->staging_ != nullptr) {
+      this->StagePacket(header, this->frame_buffer_->payload(offset),
+                        node_type);
+      this->frame_buffer_->Release(header.frame_id);
+      return;
     }
+    this->worker_.record(this->id_, header,
+                         this->frame_buffer_->payload(offset), node_type);
+    this->frame_buffer_->Release(header.frame_id);
+    if (this->stats_ != nullptr) {
+      this->stats_->recorded_packets.fetch_add(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+  size_t buffer_id = (offset / buff_size);
+  size_t buffer_offset = offset - (buffer_id * buff_size);
+  SlotRing* slots = buffer[buffer_id].slots;
+  // drop_oldest_unrecorded: the rx thread may have taken the packet back
+  if (slots->revocable() == true && slots->Claim(buffer_offset, seq) == false) {
+    return;
+  }
+  // read info
+  size_t packet_length = sizeof(Packet) + this->packet_data_length_;
+  char* cur_ptr_buffer =
+      buffer[buffer_id].buffer.data() + (buffer_offset * packet_length);
+
+  Packet* pkt = reinterpret_cast<Packet*>(cur_ptr_buffer);
+  if (this->live_tap_ != nullptr) {
+    this->live_tap_->Publish(
+        PacketHeader{pkt->frame_id, pkt->slot_id, pkt->cell_id, pkt->ant_id},
+        pkt->data, node_type);
+  }
+  if (this->csi_ != nullptr &&
+      this->ExtractCsi(
+          PacketHeader{pkt->frame_id, pkt->slot_id, pkt->cell_id, pkt->ant_id},
+          pkt->data, node_type) == true) {
+    slots->Release(buffer_offset);
+    return;
+  }
+  if (this->staging_ != nullptr) {
+    this->StagePacket(
+        PacketHeader{pkt->frame_id, pkt->slot_id, pkt->cell_id, pkt->ant_id},
+        pkt->data, node_type);
+    slots->Release(buffer_offset);
+    return;
+  }
+  this->worker_.record(this->id_, pkt, node_type);
+  /* Free up the buffer memory */
+  slots->Release(buffer_offset);
+  if (this->stats_ != nullptr) {
+    this->stats_->recorded_packets.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void RecorderThread::StagePacket(const PacketHeader& header, const short* data,
+                                 NodeType node_type) {
+  StagingArena::Staged* staged = this->staging_->Acquire();
+  if (staged == nullptr) {
+    // The disk fell behind by a whole arena: hold the rx slot until the
+    // I/O thread frees a record, as recording without staging would
+    if (this->stats_ != nullptr) {
+      this->stats_->staging_full_events.fetch_add(1,
+                                                  std::memory_order_relaxed);
+    }
+    while ((staged = this->staging_->Acquire()) == nullptr) {
+      std::this_thread::sleep_for(kDirectPollInterval);
+    }
+  }
+  staged->header = header;
+  staged->node_type = node_type;
+  std::memcpy(StagingArena::Payload(staged), data, this->packet_data_length_);
+  this->staging_->Commit();
+}
+
+bool RecorderThread::ExtractCsi(const PacketHeader& header, const short* data,
+                                NodeType node_type) {
+  hsize_t client = 0;
+  if (this->worker_.isPilot(header, node_type, client) == false) return false;
+  CsiExtractor::Job* job;
+  // Like a full staging arena, CSI threads falling behind hold the rx slot.
+  // Without staging this thread is the one releasing the finished jobs.
+  while ((job = this->csi_->Acquire()) == nullptr) {
+    if (this->staging_ != nullptr || this->WriteCsi() == 0) {
+      std::this_thread::sleep_for(kDirectPollInterval);
+    }
+  }
+  job->header = header;
+  job->client = client;
+  job->antenna = header.ant_id - this->worker_.antenna_offset();
+  std::memcpy(job->samples.data(), data, this->packet_data_length_);
+  this->csi_->Submit(job);
+  return this->worker_.recordsPilots() == false;
+}
+
+size_t RecorderThread::WriteCsi(void) {
+  CsiExtractor::Job* jobs[kCsiBatch];
+  const size_t count = this->csi_->Collect(jobs, kCsiBatch);
+  for (size_t i = 0; i < count; i++) {
+    this->worker_.recordCsi(*jobs[i]);
+    this->csi_->Release(jobs[i]);
+  }
+  return count;
+}
+
+void RecorderThread::DoWriting(void) {
+  if (this->io_core_start_ >= 0) {
+    MLPD_INFO("Pinning recorder %zu I/O thread to cores %d-%zu\n", this->id_,
+              this->io_core_start_,
+              this->io_core_start_ + this->io_core_num_ - 1);
+    // io_thread_ may not be assigned yet, it is this thread
+    pthread_t this_thread = pthread_self();
+    if (pin_thread_to_cores(this->io_core_start_,
+                            static_cast<int>(this->io_core_num_),
+                            this_thread) != 0) {
+      MLPD_ERROR("Pin recorder %zu I/O thread to cores failed\n", this->id_);
+      throw std::runtime_error("Pin recorder I/O thread to cores failed");
+    }
+  }
+  MLPD_INFO("Recorder %zu writes through a %zu MB staging arena\n", this->id_,
+            this->staging_->bytes() >> 20);
+  while (true) {
+    // Read the flag first: records committed before it was set are visible
+    const bool done = this->staging_done_.load(std::memory_order_acquire);
+    if (this->csi_ != nullptr) this->WriteCsi();
+    const size_t count = this->staging_->Readable(kStagingBatch);
+    for (size_t i = 0; i < count; i++) {
+      const StagingArena::Staged* staged = this->staging_->Record(i);
+      this->worker_.record(this->id_, staged->header,
+                           StagingArena::Payload(staged),
+                           static_cast<NodeType>(staged->node_type));
+    }
+    if (count > 0) {
+      this->staging_->Pop(count);
+      if (this->stats_ != nullptr) {
+        this->stats_->recorded_packets.fetch_add(count,
+                                                 std::memory_order_relaxed);
+      }
+      continue;
+    }
+    if (done == true) break;
+    this->worker_.flushExpired();
+    // Commit() and Wake() end the wait; channel estimates come back without
+    // a signal, and partial frames are due after the combiner timeout
+    this->staging_->WaitReadable(
+        this->csi_ != nullptr && this->csi_->in_flight() > 0
+            ? kDirectPollInterval
+            : std::chrono::microseconds(this->worker_.flushTimeout()));
+  }
+  const size_t high_water = this->staging_->high_water() *
+                            this->staging_->stride();
+  MLPD_INFO("Recorder %zu staging arena: %zu of %zu kB used at most\n",
+            this->id_, high_water >> 10, this->staging_->bytes() >> 10);
+  if (this->stats_ != nullptr) {
+    PipelineStats::UpdateMax(this->stats_->max_staging_bytes, high_water);
+    this->stats_->record_cpu_ns += PipelineStats::ThreadCpuNs();
   }
 }
 };  //End namespace Sounder
@@ -9,15 +9,34 @@
 
 #include "include/recorder_worker.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
 #include "include/logger.h"
 #include "include/macros.h"
 #include "include/utils.h"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// Frames a recorder may be collecting at once per dataset
+static constexpr size_t kCombinerOpenFrames = 4;
+// Size of the chunks of "hdf5_chunk": "auto" and "auto_read"
+static constexpr size_t kAutoChunkBytes = 1 << 20;
+static constexpr size_t kMaxAutoCacheBytes = 256 << 20;
+static const char kCsiDatasetName[] = "CSI";
+// Frames into a new segment after which the previous one is closed; its
+// packets that arrive later are dropped
+static constexpr hsize_t kSegmentCloseLag = 16;
 
 namespace Sounder {
+const char* const RecorderWorker::kDatasetNames[kNumRecordedDs] = {
+    "Pilot_Samples", "Noise_Samples", "UplinkData", "DownlinkData"};
 
 RecorderWorker::RecorderWorker(Config* in_cfg, size_t antenna_offset,
                                size_t num_antennas)
-    : cfg_(in_cfg) {
+    : cfg_(in_cfg), segmented_(false), rotate_due_(false), late_packets_(0) {
   antenna_offset_ = antenna_offset;
   num_antennas_ = num_antennas;
   unsigned int end_antenna = (this->antenna_offset_ + this->num_antennas_) - 1;
@@ -27,51 +46,88 @@ RecorderWorker::RecorderWorker(Config* in_cfg, size_t antenna_offset,
   std::string append = "_" + std::to_string(this->antenna_offset_) + "_" +
                        std::to_string(end_antenna);
   this->hdf5_name_.insert(found_index, append);
+
+  const std::vector<size_t>& keep = this->cfg_->record_antennas();
+  this->recorded_antennas_ = 0;
+  for (size_t i = 0; i < this->num_antennas_; i++) {
+    const bool kept =
+        keep.empty() == true ||
+        std::find(keep.begin(), keep.end(), this->antenna_offset_ + i) !=
+            keep.end();
+    this->antenna_columns_.push_back(kept ? this->recorded_antennas_++
+                                          : kNotRecorded);
+  }
+  for (size_t ds = 0; ds < kNumRecordedDs; ds++) {
+    std::array<hsize_t, kDsDimsNum> dims;
+    this->has_dataset_.at(ds) =
+        this->datasetDims(static_cast<RecordedDataset>(ds), dims);
+  }
 }
 
 RecorderWorker::~RecorderWorker() { this->finalize(); }
 
 void RecorderWorker::init(void) {
-  this->hdf5_ = new Hdf5Lib(this->hdf5_name_, "Data");
+  if (this->cfg_->record_raw() == true) {
+    this->openRaw();
+    return;
+  }
+  this->segmented_ = this->cfg_->trace_segment_frames() > 0 ||
+                     this->cfg_->trace_segment_mb() > 0 ||
+                     this->cfg_->trace_segment_seconds() > 0;
+  this->segment_ = this->openSegment(0);
+  if (this->segmented_ == true) {
+    this->segment_->hdf5->write_attribute("FIRST_FRAME", size_t{0});
+    {
+      std::lock_guard<std::mutex> lock(this->manifest_mutex_);
+      this->manifest_.push_back({this->segment_->name, 0, 0, false});
+    }
+    this->writeManifest();
+    this->next_segment_ = std::async(
+        std::launch::async, &RecorderWorker::openSegment, this, size_t{1});
+  }
+}
+
+template <typename Sink>
+void RecorderWorker::writeAttributes(Sink* hdf5) {
   // Write Atrributes
   // ******* COMMON ******** //
   // TX/RX Frequencyfile
-  this->hdf5_->write_attribute("FREQ", this->cfg_->freq());
+  hdf5->write_attribute("FREQ", this->cfg_->freq());
 
   // BW
-  this->hdf5_->write_attribute("RATE", this->cfg_->rate());
+  hdf5->write_attribute("RATE", this->cfg_->rate());
 
   // Number of samples for prefix (padding)
-  this->hdf5_->write_attribute("PREFIX_LEN", this->cfg_->prefix());
+  hdf5->write_attribute("PREFIX_LEN", this->cfg_->prefix());
 
   // Number of samples for postfix (padding)
-  this->hdf5_->write_attribute("POSTFIX_LEN", this->cfg_->postfix());
+  hdf5->write_attribute("POSTFIX_LEN", this->cfg_->postfix());
 
   // Number of samples on each symbol including prefix and postfix
-  this->hdf5_->write_attribute("SLOT_SAMP_LEN", this->cfg_->samps_per_slot());
+  hdf5->write_attribute("SLOT_SAMP_LEN", this->cfg_->samps_per_slot());
 
   // Size of FFT
-  this->hdf5_->write_attribute("FFT_SIZE", this->cfg_->fft_size());
+  hdf5->write_attribute("FFT_SIZE", this->cfg_->fft_size());
 
   // Number of data subcarriers in ofdm symbols
-  this->hdf5_->write_attribute("DATA_SUBCARRIER_NUM",
-                               this->cfg_->symbol_data_subcarrier_num());
+  hdf5->write_attribute("DATA_SUBCARRIER_NUM",
+                        this->cfg_->symbol_data_subcarrier_num());
 
   // Length of cyclic prefix
-  this->hdf5_->write_attribute("CP_LEN", this->cfg_->cp_size());
+  hdf5->write_attribute("CP_LEN", this->cfg_->cp_size());
 
   // Downlink Pilots Enabled Flag
-  this->hdf5_->write_attribute("DL_PILOTS_EN", this->cfg_->dl_pilots_en());
+  hdf5->write_attribute("DL_PILOTS_EN", this->cfg_->dl_pilots_en());
 
   // Beacon sequence type (string)
-  this->hdf5_->write_attribute("BEACON_SEQ_TYPE", this->cfg_->beacon_seq());
+  hdf5->write_attribute("BEACON_SEQ_TYPE", this->cfg_->beacon_seq());
 
   // Pilot sequence type (string)
-  this->hdf5_->write_attribute("PILOT_SEQ_TYPE", this->cfg_->pilot_seq());
+  hdf5->write_attribute("PILOT_SEQ_TYPE", this->cfg_->pilot_seq());
 
   // ******* Base Station ******** //
   // Hub IDs (vec of strings)
-  this->hdf5_->write_attribute("BS_HUB_ID", this->cfg_->hub_ids());
+  hdf5->write_attribute("BS_HUB_ID", this->cfg_->hub_ids());
 
   // BS SDR IDs
   // *** first, how many boards in each cell? ***
@@ -80,45 +136,42 @@ void RecorderWorker::init(void) {
     bs_sdr_num_per_cell[i] =
         std::to_string(this->cfg_->bs_sdr_ids().at(i).size());
   }
-  this->hdf5_->write_attribute("BS_SDR_NUM_PER_CELL", bs_sdr_num_per_cell);
+  hdf5->write_attribute("BS_SDR_NUM_PER_CELL", bs_sdr_num_per_cell);
 
   // *** second, reshape matrix into vector ***
   std::vector<std::string> bs_sdr_id;
   for (auto&& v : this->cfg_->bs_sdr_ids()) {
     bs_sdr_id.insert(bs_sdr_id.end(), v.begin(), v.end());
   }
-  this->hdf5_->write_attribute("BS_SDR_ID", bs_sdr_id);
+  hdf5->write_attribute("BS_SDR_ID", bs_sdr_id);
 
   // Number of Base Station Cells
-  this->hdf5_->write_attribute("BS_NUM_CELLS", this->cfg_->num_cells());
+  hdf5->write_attribute("BS_NUM_CELLS", this->cfg_->num_cells());
 
   // How many RF channels per Iris board are enabled ("single" or "dual")
-  this->hdf5_->write_attribute("BS_CH_PER_RADIO",
-                               this->cfg_->bs_channel().length());
+  hdf5->write_attribute("BS_CH_PER_RADIO", this->cfg_->bs_channel().length());
 
   // Frame schedule (string vector)
   // TODO: This should change to matrix when we go to multi-cell
-  this->hdf5_->write_attribute("BS_FRAME_SCHED",
-                               this->cfg_->bs_array_frames().at(0));
+  hdf5->write_attribute("BS_FRAME_SCHED", this->cfg_->bs_array_frames().at(0));
 
   // RX Gain RF channel A
-  this->hdf5_->write_attribute("BS_RX_GAIN_A", this->cfg_->rx_gain().at(0));
+  hdf5->write_attribute("BS_RX_GAIN_A", this->cfg_->rx_gain().at(0));
 
   // TX Gain RF channel A
-  this->hdf5_->write_attribute("BS_TX_GAIN_A", this->cfg_->tx_gain().at(0));
+  hdf5->write_attribute("BS_TX_GAIN_A", this->cfg_->tx_gain().at(0));
 
   // RX Gain RF channel B
-  this->hdf5_->write_attribute("BS_RX_GAIN_B", this->cfg_->rx_gain().at(1));
+  hdf5->write_attribute("BS_RX_GAIN_B", this->cfg_->rx_gain().at(1));
 
   // TX Gain RF channel B
-  this->hdf5_->write_attribute("BS_TX_GAIN_B", this->cfg_->tx_gain().at(1));
+  hdf5->write_attribute("BS_TX_GAIN_B", this->cfg_->tx_gain().at(1));
 
   // Beamsweep (true or false)
-  this->hdf5_->write_attribute("BS_BEAMSWEEP",
-                               this->cfg_->beam_sweep() ? 1 : 0);
+  hdf5->write_attribute("BS_BEAMSWEEP", this->cfg_->beam_sweep() ? 1 : 0);
 
   // Beacon Antenna
-  this->hdf5_->write_attribute("BS_BEACON_ANT", this->cfg_->beacon_ant());
+  hdf5->write_attribute("BS_BEACON_ANT", this->cfg_->beacon_ant());
 
   // Number of antennas on Base Station (per cell)
   std::vector<std::string> bs_ant_num_per_cell(this->cfg_->bs_sdr_ids().size());
@@ -127,28 +180,44 @@ void RecorderWorker::init(void) {
         std::to_string(this->cfg_->bs_sdr_ids().at(i).size() *
                        this->cfg_->bs_channel().length());
   }
-  this->hdf5_->write_attribute("BS_ANT_NUM_PER_CELL", bs_ant_num_per_cell);
+  hdf5->write_attribute("BS_ANT_NUM_PER_CELL", bs_ant_num_per_cell);
 
   //If the antennas are non consective this will be an issue.
-  this->hdf5_->write_attribute("ANT_OFFSET", this->antenna_offset_);
-  this->hdf5_->write_attribute("ANT_NUM", this->num_antennas_);
-  this->hdf5_->write_attribute("ANT_TOTAL", this->cfg_->getTotNumAntennas());
+  hdf5->write_attribute("ANT_OFFSET", this->antenna_offset_);
+  hdf5->write_attribute("ANT_NUM", this->num_antennas_);
+  if (this->cfg_->record_antennas().empty() == false) {
+    // The BS datasets only have these antennas, in this order
+    std::vector<size_t> recorded;
+    for (size_t i = 0; i < this->num_antennas_; i++) {
+      if (this->antenna_columns_.at(i) != kNotRecorded) {
+        recorded.push_back(this->antenna_offset_ + i);
+      }
+    }
+    if (recorded.empty() == false) {
+      hdf5->write_attribute("RECORD_ANTENNAS", recorded);
+    }
+  }
+  hdf5->write_attribute("ANT_TOTAL", this->cfg_->getTotNumAntennas());
 
   // Number of symbols in a frame
-  this->hdf5_->write_attribute("BS_FRAME_LEN", this->cfg_->slot_per_frame());
+  hdf5->write_attribute("BS_FRAME_LEN", this->cfg_->slot_per_frame());
+
+  // Frame i of the datasets is frame i * RECORD_FRAME_INTERVAL on the air
+  hdf5->write_attribute("RECORD_FRAME_INTERVAL",
+                        this->cfg_->record_frame_interval());
 
   // Number of uplink symbols per frame
-  this->hdf5_->write_attribute("UL_SLOTS", this->cfg_->ul_slot_per_frame());
+  hdf5->write_attribute("UL_SLOTS", this->cfg_->ul_slot_per_frame());
 
   // Reciprocal Calibration Mode
   bool reciprocity_cal =
       this->cfg_->internal_measurement() && this->cfg_->ref_node_enable();
-  this->hdf5_->write_attribute("RECIPROCAL_CALIB", reciprocity_cal ? 1 : 0);
+  hdf5->write_attribute("RECIPROCAL_CALIB", reciprocity_cal ? 1 : 0);
 
   // All combinations of TX/RX boards in the base station
   bool full_matrix_meas =
       this->cfg_->internal_measurement() && !this->cfg_->ref_node_enable();
-  this->hdf5_->write_attribute("FULL_MATRIX_MEAS", full_matrix_meas ? 1 : 0);
+  hdf5->write_attribute("FULL_MATRIX_MEAS", full_matrix_meas ? 1 : 0);
 
   // ******* Clients ******** //
   // Freq. Domain Pilot symbols
@@ -158,7 +227,7 @@ void RecorderWorker::init(void) {
     split_vec_pilot_f[2 * i + 0] = this->cfg_->pilot_sym_f().at(0).at(i);
     split_vec_pilot_f[2 * i + 1] = this->cfg_->pilot_sym_f().at(1).at(i);
   }
-  this->hdf5_->write_attribute("OFDM_PILOT_F", split_vec_pilot_f);
+  hdf5->write_attribute("OFDM_PILOT_F", split_vec_pilot_f);
 
   // Time Domain Pilot symbols
   std::vector<double> split_vec_pilot(2 *
@@ -167,209 +236,676 @@ void RecorderWorker::init(void) {
     split_vec_pilot[2 * i + 0] = this->cfg_->pilot_sym_t().at(0).at(i);
     split_vec_pilot[2 * i + 1] = this->cfg_->pilot_sym_t().at(1).at(i);
   }
-  this->hdf5_->write_attribute("OFDM_PILOT", split_vec_pilot);
+  hdf5->write_attribute("OFDM_PILOT", split_vec_pilot);
 
   // Number of Pilots
-  this->hdf5_->write_attribute("PILOT_NUM", this->cfg_->pilot_slot_per_frame());
+  hdf5->write_attribute("PILOT_NUM", this->cfg_->pilot_slot_per_frame());
 
   // Data subcarriers
   if (this->cfg_->data_ind().size() > 0)
-    this->hdf5_->write_attribute("OFDM_DATA_SC", this->cfg_->data_ind());
+    hdf5->write_attribute("OFDM_DATA_SC", this->cfg_->data_ind());
 
   // Pilot subcarriers (indexes)
   if (this->cfg_->pilot_sc_ind().size() > 0)
-    this->hdf5_->write_attribute("OFDM_PILOT_SC", this->cfg_->pilot_sc_ind());
+    hdf5->write_attribute("OFDM_PILOT_SC", this->cfg_->pilot_sc_ind());
   if (this->cfg_->pilot_sc().size() > 0)
-    this->hdf5_->write_attribute("OFDM_PILOT_SC_VALS", this->cfg_->pilot_sc());
+    hdf5->write_attribute("OFDM_PILOT_SC_VALS", this->cfg_->pilot_sc());
 
   // Number of Client Antennas
-  this->hdf5_->write_attribute("CL_NUM", this->cfg_->num_cl_antennas());
+  hdf5->write_attribute("CL_NUM", this->cfg_->num_cl_antennas());
 
   // Data modulation
-  this->hdf5_->write_attribute("CL_MODULATION", this->cfg_->cl_data_mod());
+  hdf5->write_attribute("CL_MODULATION", this->cfg_->cl_data_mod());
 
   if (this->cfg_->internal_measurement() == false ||
       this->cfg_->num_cl_antennas() > 0) {
     // Client antenna polarization
-    this->hdf5_->write_attribute("CL_CH_PER_RADIO", this->cfg_->cl_sdr_ch());
+    hdf5->write_attribute("CL_CH_PER_RADIO", this->cfg_->cl_sdr_ch());
 
     // Client AGC enable flag
-    this->hdf5_->write_attribute("CL_AGC_EN", this->cfg_->cl_agc_en() ? 1 : 0);
+    hdf5->write_attribute("CL_AGC_EN", this->cfg_->cl_agc_en() ? 1 : 0);
 
     // RX Gain RF channel A
-    this->hdf5_->write_attribute("CL_RX_GAIN_A",
-                                 this->cfg_->cl_rxgain_vec().at(0));
+    hdf5->write_attribute("CL_RX_GAIN_A", this->cfg_->cl_rxgain_vec().at(0));
 
     // TX Gain RF channel A
-    this->hdf5_->write_attribute("CL_TX_GAIN_A",
-                                 this->cfg_->cl_txgain_vec().at(0));
+    hdf5->write_attribute("CL_TX_GAIN_A", this->cfg_->cl_txgain_vec().at(0));
 
     // RX Gain RF channel B
-    this->hdf5_->write_attribute("CL_RX_GAIN_B",
-                                 this->cfg_->cl_rxgain_vec().at(1));
+    hdf5->write_attribute("CL_RX_GAIN_B", this->cfg_->cl_rxgain_vec().at(1));
 
     // TX Gain RF channel B
-    this->hdf5_->write_attribute("CL_TX_GAIN_B",
-                                 this->cfg_->cl_txgain_vec().at(1));
+    hdf5->write_attribute("CL_TX_GAIN_B", this->cfg_->cl_txgain_vec().at(1));
 
     // Client frame schedule (vec of strings)
-    this->hdf5_->write_attribute("CL_FRAME_SCHED", this->cfg_->cl_frames());
+    hdf5->write_attribute("CL_FRAME_SCHED", this->cfg_->cl_frames());
 
     // Set of client SDR IDs (vec of strings)
-    this->hdf5_->write_attribute("CL_SDR_ID", this->cfg_->cl_sdr_ids());
+    hdf5->write_attribute("CL_SDR_ID", this->cfg_->cl_sdr_ids());
   }
 
   if (this->cfg_->ul_data_slot_present()) {
     // Number of frames for UL data recorded in bit source files
-    this->hdf5_->write_attribute("UL_DATA_FRAME_NUM",
-                                 this->cfg_->ul_data_frame_num());
+    hdf5->write_attribute("UL_DATA_FRAME_NUM", this->cfg_->ul_data_frame_num());
 
     // Names of Files including uplink tx frequency-domain data
     if (this->cfg_->ul_tx_fd_data_files().size() > 0) {
-      this->hdf5_->write_attribute("TX_FD_DATA_FILENAMES",
-                                   this->cfg_->ul_tx_fd_data_files());
+      hdf5->write_attribute("TX_FD_DATA_FILENAMES",
+                            this->cfg_->ul_tx_fd_data_files());
     }
   }
   // ********************* //
+}
 
-  // dataset dimension
-  hsize_t IQ = 2 * this->cfg_->samps_per_slot();
-  std::array<hsize_t, kDsDimsNum> cdims = {
-      1, 1, 1, 1, IQ};  // recording chunk size, TODO: optimize size
-
-  if (this->cfg_->bs_rx_thread_num() > 0 &&
-      this->cfg_->pilot_slot_per_frame() > 0) {
-    // pilots
-    datasets.push_back("Pilot_Samples");
-    std::array<hsize_t, kDsDimsNum> dims_pilot = {
-        MAX_FRAME_INC, this->cfg_->num_cells(),
-        this->cfg_->pilot_slot_per_frame(), this->num_antennas_, IQ};
-    this->hdf5_->createDataset(datasets.back(), dims_pilot, cdims);
-  }
-  if (this->cfg_->noise_slot_per_frame() > 0) {
-    // noise
-    datasets.push_back("Noise_Samples");
-    std::array<hsize_t, kDsDimsNum> dims_noise = {
-        MAX_FRAME_INC, this->cfg_->num_cells(),
-        this->cfg_->noise_slot_per_frame(), this->num_antennas_, IQ};
-    this->hdf5_->createDataset(datasets.back(), dims_noise, cdims);
-  }
-
-  if (this->cfg_->bs_rx_thread_num() > 0 &&
-      this->cfg_->ul_slot_per_frame() > 0) {
-    // UL data
-    datasets.push_back("UplinkData");
-    std::array<hsize_t, kDsDimsNum> dims_ul_data = {
-        MAX_FRAME_INC, this->cfg_->num_cells(), this->cfg_->ul_slot_per_frame(),
-        this->num_antennas_, IQ};
-    this->hdf5_->createDataset(datasets.back(), dims_ul_data, cdims);
-  }
-
-  if (this->cfg_->cl_rx_thread_num() > 0 &&
-      cfg_->cl_dl_slots().at(0).empty() == false) {
-    // DL
-    datasets.push_back("DownlinkData");
-    std::array<hsize_t, kDsDimsNum> dims_dl_data = {
-        MAX_FRAME_INC, this->cfg_->num_cells(),
-        this->cfg_->cl_dl_slots().at(0).size(), this->cfg_->num_cl_antennas(),
-        IQ};
-    this->hdf5_->createDataset(datasets.back(), dims_dl_data, cdims);
-  }
-
-  this->hdf5_->setTargetPrimaryDimSize(MAX_FRAME_INC);
-  this->hdf5_->setMaxPrimaryDimSize(cfg_->max_frame());
-  this->hdf5_->openDataset();
+std::unique_ptr<RecorderWorker::Segment> RecorderWorker::openSegment(
+    size_t index) {
+  auto seg = std::make_unique<Segment>();
+  seg->index = index;
+  seg->name = this->hdf5_name_;
+  if (this->segmented_ == true) {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "_seg%04zu", index);
+    seg->name.insert(seg->name.find_last_of('.'), suffix);
+  }
+  seg->first_frame = 0;
+  seg->last_frame = 0;
+  seg->has_frames = false;
+  seg->bytes = 0;
+  seg->started = std::chrono::steady_clock::now();
+  seg->hdf5 = std::make_unique<Hdf5Lib>(seg->name, "Data");
+  this->writeAttributes(seg->hdf5.get());
+
+  if (this->cfg_->hdf5_compression() != kCodecNone) {
+    ChunkCompressor::RegisterFilters();
+    seg->hdf5->setCompression(this->cfg_->hdf5_compression(),
+                              this->cfg_->hdf5_compression_level());
+    seg->compressor = std::make_unique<ChunkCompressor>(
+        seg->hdf5.get(), this->cfg_->hdf5_compression(),
+        this->cfg_->hdf5_compression_level(),
+        this->cfg_->hdf5_compression_threads());
+  }
+  if (this->cfg_->write_combiner() == true) {
+    seg->combiner = std::make_unique<WriteCombiner>(
+        seg->hdf5.get(), this->cfg_->write_combiner_timeout(),
+        kCombinerOpenFrames, seg->compressor.get());
+  }
+
+  // Known recording length: datasets are allocated for it when created.
+  // Segments cut by size or time have no known length.
+  size_t max_frame = this->recordedFrame(this->cfg_->max_frame());
+  const size_t segment_frames = this->cfg_->trace_segment_frames();
+  if (segment_frames > 0) {
+    max_frame = max_frame == 0 ? segment_frames - 1
+                               : std::min(max_frame, segment_frames - 1);
+  } else if (this->segmented_ == true) {
+    max_frame = 0;
+  }
+  seg->hdf5->setMaxPrimaryDimSize(max_frame);
+
+  for (size_t ds = 0; ds < kNumRecordedDs; ds++) {
+    std::array<hsize_t, kDsDimsNum> dims;
+    if (this->datasetDims(static_cast<RecordedDataset>(ds), dims) == true) {
+      this->createDataset(*seg, static_cast<RecordedDataset>(ds), dims);
+    }
+  }
+
+  if (this->cfg_->csi_extraction() == true && this->recorded_antennas_ > 0) {
+    this->createCsiDataset(*seg);
+  }
+
+  seg->hdf5->openDataset();
+  seg->hdf5->setFlushInterval(this->cfg_->hdf5_flush_interval());
+  return seg;
+}
+
+bool RecorderWorker::datasetDims(RecordedDataset ds,
+                                 std::array<hsize_t, kDsDimsNum>& dims) const {
+  const hsize_t IQ = 2 * this->cfg_->samps_per_slot();
+  // record_slots: the slot types the rx threads let through
+  const std::string& slot_types = this->cfg_->record_slots();
+  size_t slots = 0;
+  size_t antennas = this->recorded_antennas_;
+  switch (ds) {
+    case kPilotDs:
+      if (this->cfg_->bs_rx_thread_num() > 0 &&
+          this->cfg_->record_pilot_samples() == true &&
+          slot_types.find('P') != std::string::npos) {
+        slots = this->cfg_->pilot_slot_per_frame();
+      }
+      break;
+    case kNoiseDs:
+      if (slot_types.find('N') != std::string::npos) {
+        slots = this->cfg_->noise_slot_per_frame();
+      }
+      break;
+    case kUplinkDs:
+      if (this->cfg_->bs_rx_thread_num() > 0 &&
+          slot_types.find('U') != std::string::npos) {
+        slots = this->cfg_->ul_slot_per_frame();
+      }
+      break;
+    case kDownlinkDs:
+      if (this->cfg_->cl_rx_thread_num() > 0) {
+        slots = this->cfg_->cl_dl_slots().at(0).size();
+      }
+      antennas = this->cfg_->num_cl_antennas();
+      break;
+    default:
+      break;
+  }
+  if (slots == 0 || antennas == 0) return false;
+  dims = {MAX_FRAME_INC, this->cfg_->num_cells(), slots, antennas, IQ};
+  return true;
+}
+
+// Which packets of this file's antennas are missing due to rx overload
+void RecorderWorker::writeOverloadLog(const OverloadLog& overload) {
+  if (this->raw_ != nullptr) {
+    this->writeOverloadLog(overload, &this->raw_->attributes());
+  } else {
+    this->writeOverloadLog(overload, this->segment_->hdf5.get());
+  }
+  if (overload.total() > 0) {
+    MLPD_WARN("Recorder for antennas %zu:%zu: %zu packets dropped overall\n",
+              this->antenna_offset_,
+              this->antenna_offset_ + this->num_antennas_ - 1,
+              overload.total());
+  }
+}
+
+template <typename Sink>
+void RecorderWorker::writeOverloadLog(const OverloadLog& overload,
+                                      Sink* hdf5) {
+  hdf5->write_attribute(
+      "OVERLOAD_POLICY",
+      OverloadLog::PolicyName(this->cfg_->overload_policy()));
+  hdf5->write_attribute(
+      "DROPPED_PACKETS",
+      overload.DroppedPackets(this->antenna_offset_, this->num_antennas_));
+  hdf5->write_dataset("Dropped_Frames", overload.DroppedFrames());
+}
+
+// Chunk shape of a dataset with dims, and the chunk cache it gets. The
+// compressor buffers chunk[0] whole frames, so automatic chunks of
+// compressed datasets keep those rows within its budget.
+static std::array<hsize_t, kDsDimsNum> ChunkDims(
+    const Hdf5ChunkConf& conf, const std::array<hsize_t, kDsDimsNum>& dims,
+    bool compressed, size_t& cache_bytes) {
+  const hsize_t iq = dims[kDsDimsNum - 1];
+  const size_t packet_bytes = iq * sizeof(short);
+  std::array<hsize_t, kDsDimsNum> chunk = {1, 1, 1, 1, iq};
+  switch (conf.mode) {
+    case Hdf5ChunkConf::kChunkPacket:
+      break;
+    case Hdf5ChunkConf::kChunkExplicit:
+      for (size_t i = 0; i < kDsDimsNum; i++) {
+        chunk[i] = i == 0 ? conf.dims[i] : std::min<hsize_t>(conf.dims[i],
+                                                             dims[i]);
+      }
+      break;
+    case Hdf5ChunkConf::kChunkAutoRead:
+      // One slot of one antenna over consecutive frames
+      chunk[0] = std::max<size_t>(kAutoChunkBytes / packet_bytes, 1);
+      break;
+    case Hdf5ChunkConf::kChunkAuto: {
+      // Whole frames, split across antennas only if one frame is too big
+      const size_t slot_bytes = dims[1] * dims[2] * packet_bytes;
+      chunk[1] = dims[1];
+      chunk[2] = dims[2];
+      chunk[3] = std::clamp<hsize_t>(kAutoChunkBytes / slot_bytes, 1, dims[3]);
+      chunk[0] = std::max<size_t>(kAutoChunkBytes / (slot_bytes * chunk[3]), 1);
+      break;
+    }
+  }
+  if (compressed == true && conf.mode != Hdf5ChunkConf::kChunkExplicit) {
+    const size_t frame_bytes = dims[1] * dims[2] * dims[3] * packet_bytes;
+    chunk[0] = std::min<hsize_t>(
+        chunk[0],
+        std::max<size_t>(ChunkCompressor::kMaxRowBytes / frame_bytes, 1));
+  }
+
+  size_t chunk_bytes = sizeof(short);
+  size_t chunks_per_frame = 1;
+  for (size_t i = 0; i < kDsDimsNum; i++) {
+    chunk_bytes *= chunk[i];
+    if (i > 0) chunks_per_frame *= (dims[i] + chunk[i] - 1) / chunk[i];
+  }
+  cache_bytes = conf.cache_bytes;
+  if (cache_bytes == 0) {
+    // Every chunk one frame touches, twice so that a chunk is complete
+    // before it is evicted even with frames arriving out of order
+    cache_bytes = std::max(2 * chunks_per_frame * chunk_bytes, kAutoChunkBytes);
+    if (cache_bytes > kMaxAutoCacheBytes) {
+      MLPD_WARN(
+          "HDF5 chunk cache limited to %zu MB, %zu MB would keep all "
+          "chunks of a frame cached\n",
+          kMaxAutoCacheBytes >> 20, cache_bytes >> 20);
+      cache_bytes = kMaxAutoCacheBytes;
+    }
+  }
+  return chunk;
+}
+
+void RecorderWorker::createDataset(
+    Segment& seg, RecordedDataset ds,
+    const std::array<hsize_t, kDsDimsNum>& dims) {
+  size_t cache_bytes;
+  const std::array<hsize_t, kDsDimsNum> chunk =
+      ChunkDims(this->cfg_->hdf5_chunk(kDatasetNames[ds]), dims,
+                seg.compressor != nullptr, cache_bytes);
+  MLPD_INFO("%s: chunk %llux%llux%llux%llux%llu, chunk cache %zu kB\n",
+            kDatasetNames[ds], chunk[0], chunk[1], chunk[2], chunk[3],
+            chunk[4], cache_bytes >> 10);
+  seg.hdf5->createDataset(kDatasetNames[ds], dims, chunk, cache_bytes);
+  if (seg.index == 0) this->datasets.push_back(kDatasetNames[ds]);
+  // Each antenna delivers every slot of the dataset once per frame and cell
+  if (seg.combiner != nullptr) {
+    size_t compressor_id = WriteCombiner::kUncompressed;
+    if (seg.compressor != nullptr) {
+      compressor_id =
+          seg.compressor->AddDataset(kDatasetNames[ds], dims, chunk);
+    }
+    seg.combiner_ids.at(ds) = seg.combiner->AddDataset(
+        kDatasetNames[ds], dims, dims[1] * dims[2] * dims[3], compressor_id);
+  }
+}
+
+void RecorderWorker::openRaw(void) {
+  const std::string base =
+      this->hdf5_name_.substr(0, this->hdf5_name_.find_last_of('.'));
+  this->raw_ = std::make_unique<RawTraceWriter>(
+      base, this->hdf5_name_, this->cfg_->getPacketDataLength(),
+      this->cfg_->raw_prealloc_mb() << 20);
+  this->writeAttributes(&this->raw_->attributes());
+  this->raw_->SetCompression(this->cfg_->hdf5_compression(),
+                             this->cfg_->hdf5_compression_level(),
+                             this->cfg_->hdf5_compression_threads());
+  // sounder-convert creates the datasets this recording would have had
+  for (size_t ds = 0; ds < kNumRecordedDs; ds++) {
+    std::array<hsize_t, kDsDimsNum> dims;
+    if (this->datasetDims(static_cast<RecordedDataset>(ds), dims) == false) {
+      continue;
+    }
+    size_t cache_bytes;
+    // sounder-convert compresses with the chunk compressor
+    const std::array<hsize_t, kDsDimsNum> chunk = ChunkDims(
+        this->cfg_->hdf5_chunk(kDatasetNames[ds]), dims,
+        this->cfg_->hdf5_compression() != kCodecNone, cache_bytes);
+    this->raw_->AddDataset(kDatasetNames[ds], ds, dims, chunk, cache_bytes);
+    this->datasets.push_back(kDatasetNames[ds]);
+  }
+  MLPD_INFO("Recording raw packets to %s.raw\n", base.c_str());
+}
+
+void RecorderWorker::createCsiDataset(Segment& seg) {
+  const hsize_t subcarriers = this->cfg_->data_ind().size();
+  seg.csi_dims = {1, this->cfg_->num_cells(),
+                  this->cfg_->pilot_slot_per_frame(), this->recorded_antennas_,
+                  2 * subcarriers};
+  std::array<hsize_t, kDsDimsNum> dims = seg.csi_dims;
+  dims[0] = MAX_FRAME_INC;
+  // Whole frames, as they are written
+  const size_t frame_bytes = seg.csi_dims[1] * seg.csi_dims[2] *
+                             seg.csi_dims[3] * seg.csi_dims[4] * sizeof(float);
+  std::array<hsize_t, kDsDimsNum> chunk = seg.csi_dims;
+  chunk[0] = std::max<size_t>(kAutoChunkBytes / frame_bytes, 1);
+  seg.hdf5->createDataset(kCsiDatasetName, dims, chunk, 0,
+                          H5::PredType::IEEE_F32LE);
+  if (seg.index == 0) this->datasets.push_back(kCsiDatasetName);
+  seg.csi_written_end = 0;
+}
+
+void RecorderWorker::recordCsi(const CsiExtractor::Job& job) {
+  const PacketHeader& header = job.header;
+  if (this->cfg_->max_frame() != 0 &&
+      header.frame_id > this->cfg_->max_frame()) {
+    return;
+  }
+  // Only every record_frame_interval-th frame has a row, as in record()
+  if (header.frame_id % this->cfg_->record_frame_interval() != 0) return;
+  const hsize_t antenna = this->antenna_columns_.at(job.antenna);
+  if (antenna == kNotRecorded) return;
+  const size_t frame_id = this->recordedFrame(header.frame_id);
+  Segment* seg = this->segmentOf(frame_id);
+  if (seg == nullptr) {
+    this->late_packets_++;
+    return;
+  }
+  if (seg->has_frames == false || frame_id > seg->last_frame) {
+    seg->last_frame = frame_id;
+  }
+  seg->has_frames = true;
+  const hsize_t frame_index = frame_id - seg->first_frame;
+  const std::array<hsize_t, kDsDimsNum>& dims = seg->csi_dims;
+  auto frame = std::find_if(seg->csi_frames.begin(), seg->csi_frames.end(),
+                            [frame_index](const CsiFrame& f) {
+                              return f.frame_index == frame_index;
+                            });
+  if (frame == seg->csi_frames.end() && frame_index < seg->csi_written_end) {
+    // Its frame may have been written already, write this packet alone
+    std::array<hsize_t, kDsDimsNum> offset = {frame_index, header.cell_id,
+                                               job.client, antenna, 0};
+    std::array<hsize_t, kDsDimsNum> count = {1, 1, 1, 1, dims[4]};
+    seg->hdf5->extendDataset(kCsiDatasetName, frame_index);
+    seg->hdf5->writeDataset(kCsiDatasetName, offset, count, job.csi.data());
+    return;
+  }
+  if (frame == seg->csi_frames.end()) {
+    if (seg->csi_frames.size() >= kCombinerOpenFrames) {
+      // The oldest frame will not be completed any more
+      auto oldest = std::min_element(
+          seg->csi_frames.begin(), seg->csi_frames.end(),
+          [](const CsiFrame& a, const CsiFrame& b) {
+            return a.frame_index < b.frame_index;
+          });
+      writeCsiFrame(*seg, *oldest);
+      seg->csi_frames.erase(oldest);
+    }
+    seg->csi_frames.push_back({frame_index, 0,
+                               std::chrono::steady_clock::now(),
+                               std::vector<float>(dims[1] * dims[2] *
+                                                  dims[3] * dims[4])});
+    frame = seg->csi_frames.end() - 1;
+  }
+  const size_t row =
+      (header.cell_id * dims[2] + job.client) * dims[3] + antenna;
+  std::copy(job.csi.begin(), job.csi.end(),
+            frame->values.begin() + row * dims[4]);
+  if (++frame->packets == dims[2] * dims[3]) {
+    writeCsiFrame(*seg, *frame);
+    seg->csi_frames.erase(frame);
+  }
+}
+
+void RecorderWorker::flushCsi(Segment& seg, bool all) {
+  const auto expired =
+      std::chrono::steady_clock::now() - this->cfg_->write_combiner_timeout();
+  for (auto frame = seg.csi_frames.begin(); frame != seg.csi_frames.end();) {
+    if (all == true || frame->first < expired) {
+      writeCsiFrame(seg, *frame);
+      frame = seg.csi_frames.erase(frame);
+    } else {
+      ++frame;
+    }
+  }
+}
+
+void RecorderWorker::writeCsiFrame(Segment& seg, const CsiFrame& frame) {
+  std::array<hsize_t, kDsDimsNum> offset = {frame.frame_index, 0, 0, 0, 0};
+  seg.hdf5->extendDataset(kCsiDatasetName, frame.frame_index);
+  seg.hdf5->writeDataset(kCsiDatasetName, offset, seg.csi_dims,
+                         frame.values.data());
+  seg.csi_written_end = std::max(seg.csi_written_end, frame.frame_index + 1);
+}
+
+void RecorderWorker::flushWrites(Segment& seg) {
+  if (seg.csi_frames.empty() == false) this->flushCsi(seg, true);
+  if (seg.combiner != nullptr) seg.combiner->FlushAll();
+  if (seg.compressor != nullptr) seg.compressor->FlushAll();
+}
+
+RecorderWorker::Segment* RecorderWorker::segmentOf(hsize_t frame_id) {
+  Segment* cur = this->segment_.get();
+  if (frame_id < cur->first_frame) {
+    if (this->previous_ != nullptr &&
+        frame_id >= this->previous_->first_frame) {
+      return this->previous_.get();
+    }
+    return nullptr;
+  }
+  if (this->segmented_ == false) return cur;
+
+  const size_t segment_frames = this->cfg_->trace_segment_frames();
+  if (segment_frames > 0 && frame_id - cur->first_frame >= segment_frames) {
+    this->rotate(frame_id - (frame_id - cur->first_frame) % segment_frames);
+  } else if (this->rotate_due_ == true && frame_id > cur->last_frame) {
+    // Size and time limits cut at the first frame not recorded yet
+    this->rotate(frame_id);
+  } else if (this->previous_ != nullptr &&
+             frame_id >= cur->first_frame + kSegmentCloseLag) {
+    this->retirePrevious();
+  }
+  return this->segment_.get();
+}
+
+void RecorderWorker::rotate(hsize_t first_frame) {
+  this->retirePrevious();
+  // Created in the background while the current segment was recording
+  std::unique_ptr<Segment> next = this->next_segment_.get();
+  next->first_frame = first_frame;
+  next->started = std::chrono::steady_clock::now();
+  next->hdf5->write_attribute("FIRST_FRAME", static_cast<size_t>(first_frame));
+  {
+    std::lock_guard<std::mutex> lock(this->manifest_mutex_);
+    this->manifest_.at(this->segment_->index).last_frame =
+        this->segment_->last_frame;
+    this->manifest_.push_back({next->name, first_frame, first_frame, false});
+  }
+  MLPD_INFO("Recording frames from %llu to %s\n", first_frame,
+            next->name.c_str());
+  this->previous_ = std::move(this->segment_);
+  this->segment_ = std::move(next);
+  this->rotate_due_ = false;
+  this->writeManifest();
+  this->next_segment_ =
+      std::async(std::launch::async, &RecorderWorker::openSegment, this,
+                 this->segment_->index + 1);
+}
+
+void RecorderWorker::retirePrevious(void) {
+  if (this->previous_ == nullptr) return;
+  // One close at a time, a segment takes far longer to fill than to close
+  if (this->closing_.valid() == true) this->closing_.get();
+  this->closing_ = std::async(
+      std::launch::async, [this, seg = std::move(this->previous_)]() mutable {
+        this->closeSegment(std::move(seg));
+      });
+}
+
+/* Segment -> frame range -> antenna range of this recorder, rewritten
+ * whole on every change so readers never see a partial manifest */
+void RecorderWorker::writeManifest(void) {
+  std::lock_guard<std::mutex> lock(this->manifest_mutex_);
+  const std::string base =
+      this->hdf5_name_.substr(0, this->hdf5_name_.find_last_of('.'));
+  const std::string name = base + "_manifest.json";
+  json segments = json::array();
+  for (const auto& entry : this->manifest_) {
+    const size_t dir = entry.file.find_last_of('/');
+    segments.push_back(
+        {{"file", dir == std::string::npos ? entry.file
+                                           : entry.file.substr(dir + 1)},
+         {"first_frame", entry.first_frame},
+         {"last_frame", entry.last_frame},
+         {"complete", entry.complete}});
+  }
+  const json manifest = {{"antenna_offset", this->antenna_offset_},
+                         {"antenna_num", this->num_antennas_},
+                         {"segments", segments}};
+  {
+    std::ofstream out(name + ".tmp");
+    out << manifest.dump(2) << std::endl;
+  }
+  if (std::rename((name + ".tmp").c_str(), name.c_str()) != 0) {
+    MLPD_WARN("Cannot write manifest %s\n", name.c_str());
+  }
+}
+
+void RecorderWorker::closeSegment(std::unique_ptr<Segment> seg) {
+  flushWrites(*seg);
+  seg->hdf5->closeDataset();
+  const size_t index = seg->index;
+  const hsize_t last_frame = seg->last_frame;
+  // Only the Hdf5Lib destructor releases the file for good
+  seg.reset();
+  if (this->segmented_ == true) {
+    {
+      std::lock_guard<std::mutex> lock(this->manifest_mutex_);
+      ManifestEntry& entry = this->manifest_.at(index);
+      entry.last_frame = last_frame;
+      entry.complete = true;
+    }
+    this->writeManifest();
+  }
 }
 
 void RecorderWorker::finalize(void) {
-  this->hdf5_->closeDataset();
-  this->hdf5_->closeFile();
+  if (this->raw_ != nullptr) {
+    this->raw_->Close();
+    this->raw_.reset();
+    return;
+  }
+  if (this->segment_ == nullptr) return;
+  this->retirePrevious();
+  if (this->closing_.valid() == true) this->closing_.get();
+  this->closeSegment(std::move(this->segment_));
+  if (this->segmented_ == true) {
+    // The pre-created segment was never used
+    std::unique_ptr<Segment> unused = this->next_segment_.get();
+    const std::string unused_name = unused->name;
+    unused.reset();
+    std::remove(unused_name.c_str());
+  }
+  if (this->late_packets_ > 0) {
+    MLPD_WARN("%zu packets arrived after their segment was closed\n",
+              this->late_packets_);
+  }
 }
 
-void RecorderWorker::record(int tid, Packet* pkt, NodeType node_type) {
+RecorderWorker::RecordedDataset RecorderWorker::classify(
+    const PacketHeader& header, NodeType node_type,
+    hsize_t& slot_index) const {
+  const size_t num_channels = this->cfg_->bs_channel().size();
+  const size_t radio_id = header.ant_id / num_channels;
+  const size_t cell_id = header.cell_id;
+  const size_t slot_id = header.slot_id;
+  RecordedDataset ds = kNumRecordedDs;
+  slot_index = 0;
+  if (this->cfg_->internal_measurement() == true) {
+    if (node_type == kClient) {
+      ds = kDownlinkDs;
+      slot_index = this->cfg_->getDlSlotIndex(radio_id, slot_id);
+    } else {
+      ds = kPilotDs;
+      slot_index = slot_id;
+    }
+  } else if (this->cfg_->isPilot(cell_id, radio_id, slot_id) == true) {
+    ds = kPilotDs;
+    slot_index = this->cfg_->getClientId(radio_id, slot_id);
+  } else if (this->cfg_->isUlData(cell_id, radio_id, slot_id) == true) {
+    ds = kUplinkDs;
+    slot_index = this->cfg_->getUlSlotIndex(radio_id, slot_id);
+  } else if (this->cfg_->isDlData(radio_id, slot_id) == true) {
+    ds = kDownlinkDs;
+    slot_index = this->cfg_->getDlSlotIndex(radio_id, slot_id);
+  } else if (this->cfg_->isNoise(cell_id, radio_id, slot_id) == true) {
+    ds = kNoiseDs;
+    slot_index = this->cfg_->getNoiseSlotIndex(radio_id, slot_id);
+  }
+  return ds;
+}
+
+void RecorderWorker::record(int tid, const PacketHeader& header, short* data,
+                            NodeType node_type) {
   (void)tid;
   /* TODO: remove TEMP check */
   size_t end_antenna = (this->antenna_offset_ + this->num_antennas_) - 1;
-  size_t num_channels = this->cfg_->bs_channel().size();
 
-  if ((pkt->ant_id < this->antenna_offset_) || (pkt->ant_id > end_antenna)) {
+  if ((header.ant_id < this->antenna_offset_) ||
+      (header.ant_id > end_antenna)) {
     MLPD_ERROR("Antenna id is not within range of this recorder %d, %zu:%zu",
-               pkt->ant_id, this->antenna_offset_, end_antenna);
+               header.ant_id, this->antenna_offset_, end_antenna);
   }
-  assert((pkt->ant_id >= this->antenna_offset_) &&
-         (pkt->ant_id <= end_antenna));
+  assert((header.ant_id >= this->antenna_offset_) &&
+         (header.ant_id <= end_antenna));
 
   //Generates a ton of messages
-  //MLPD_TRACE( "Tid: %d -- frame_id %u, antenna: %u\n", tid, pkt->frame_id, pkt->ant_id);
+  //MLPD_TRACE( "Tid: %d -- frame_id %u, antenna: %u\n", tid, header.frame_id, header.ant_id);
 
   if (kDebugPrint) {
     std::printf(
         "record            frame %d, symbol %d, cell %d, ant %d "
         "samples: %d "
         "%d %d %d %d %d %d %d ....\n",
-        pkt->frame_id, pkt->slot_id, pkt->cell_id, pkt->ant_id, pkt->data[1],
-        pkt->data[2], pkt->data[3], pkt->data[4], pkt->data[5], pkt->data[6],
-        pkt->data[7], pkt->data[8]);
+        header.frame_id, header.slot_id, header.cell_id, header.ant_id,
+        data[1], data[2], data[3], data[4], data[5], data[6], data[7],
+        data[8]);
   }
   hsize_t IQ = 2 * this->cfg_->samps_per_slot();
   if ((this->cfg_->max_frame()) != 0 &&
-      (pkt->frame_id > this->cfg_->max_frame())) {
-    this->hdf5_->closeDataset();
-    MLPD_TRACE("Closing file due to frame id %d : %zu max\n", pkt->frame_id,
+      (header.frame_id > this->cfg_->max_frame())) {
+    if (this->raw_ != nullptr) return;
+    this->retirePrevious();
+    flushWrites(*this->segment_);
+    this->segment_->hdf5->closeDataset();
+    MLPD_TRACE("Closing file due to frame id %d : %zu max\n", header.frame_id,
                this->cfg_->max_frame());
   } else {
-    // Update the max frame number.
-    // Note that the 'frame_id' might be out of order.
-    this->max_frame_number_ = this->hdf5_->getTargetPrimaryDimSize();
-    if (pkt->frame_id >= this->max_frame_number_) {
-      // Open the hdf5 file if we haven't.
-      this->hdf5_->closeDataset();
-      this->hdf5_->openDataset();
-      this->hdf5_->setTargetPrimaryDimSize(this->max_frame_number_ +
-                                           MAX_FRAME_INC);
+    // The datasets grow on write, see Hdf5Lib::extendDataset()
+    uint32_t antenna_index = header.ant_id - this->antenna_offset_;
+    // Client packets skip the RecordFilter, but their frames would collide
+    if (header.frame_id % this->cfg_->record_frame_interval() != 0) return;
+    const size_t frame_id = this->recordedFrame(header.frame_id);
+    const size_t cell_id = header.cell_id;
+    hsize_t slot_index = 0;
+    const RecordedDataset ds = this->classify(header, node_type, slot_index);
+    if (ds == kNumRecordedDs || this->has_dataset_.at(ds) == false) {
+      return;
+    }
+    if (ds != kDownlinkDs) {
+      // record_antennas: BS datasets only have columns for kept antennas
+      if (this->antenna_columns_.at(antenna_index) == kNotRecorded) return;
+      antenna_index = this->antenna_columns_.at(antenna_index);
     }
 
-    uint32_t antenna_index = pkt->ant_id - this->antenna_offset_;
-    const size_t radio_id = pkt->ant_id / num_channels;
-    const size_t cell_id = pkt->cell_id;
-    const size_t slot_id = pkt->slot_id;
-    std::array<hsize_t, kDsDimsNum> hdfoffset = {pkt->frame_id, cell_id, 0,
-                                                 antenna_index, 0};
-    std::array<hsize_t, kDsDimsNum> count = {1, 1, 1, 1, IQ};
-    if (this->cfg_->internal_measurement() == true) {
-      if (node_type == kClient) {
-        this->hdf5_->extendDataset(std::string("DownlinkData"), pkt->frame_id);
-        hdfoffset[kDsDimSymbol] = this->cfg_->getDlSlotIndex(radio_id, slot_id);
-        this->hdf5_->writeDataset(std::string("DownlinkData"), hdfoffset, count,
-                                  pkt->data);
-      } else {
-        this->hdf5_->extendDataset(std::string("Pilot_Samples"), pkt->frame_id);
-        hdfoffset[kDsDimSymbol] = slot_id;
-        this->hdf5_->writeDataset(std::string("Pilot_Samples"), hdfoffset,
-                                  count, pkt->data);
-      }
-    } else if (this->cfg_->isPilot(cell_id, radio_id, slot_id) == true) {
-      this->hdf5_->extendDataset(std::string("Pilot_Samples"), pkt->frame_id);
-      hdfoffset[kDsDimSymbol] = this->cfg_->getClientId(radio_id, slot_id);
-      this->hdf5_->writeDataset(std::string("Pilot_Samples"), hdfoffset, count,
-                                pkt->data);
-    } else if (this->cfg_->isUlData(cell_id, radio_id, slot_id) == true) {
-      this->hdf5_->extendDataset(std::string("UplinkData"), pkt->frame_id);
-      hdfoffset[kDsDimSymbol] = this->cfg_->getUlSlotIndex(radio_id, slot_id);
-      this->hdf5_->writeDataset(std::string("UplinkData"), hdfoffset, count,
-                                pkt->data);
-
-    } else if (this->cfg_->isDlData(radio_id, slot_id) == true) {
-      this->hdf5_->extendDataset(std::string("DownlinkData"), pkt->frame_id);
-      hdfoffset[kDsDimSymbol] = this->cfg_->getDlSlotIndex(radio_id, slot_id);
-      this->hdf5_->writeDataset(std::string("DownlinkData"), hdfoffset, count,
-                                pkt->data);
-    } else if (this->cfg_->isNoise(cell_id, radio_id, slot_id) == true) {
-      this->hdf5_->extendDataset(std::string("Noise_Samples"), pkt->frame_id);
-      hdfoffset[kDsDimSymbol] =
-          this->cfg_->getNoiseSlotIndex(radio_id, slot_id);
-      this->hdf5_->writeDataset(std::string("Noise_Samples"), hdfoffset, count,
-                                pkt->data);
+    if (this->raw_ != nullptr) {
+      RawIndexEntry entry;
+      entry.frame_id = frame_id;
+      entry.cell_id = header.cell_id;
+      entry.slot_id = header.slot_id;
+      entry.ant_id = header.ant_id;
+      entry.dataset = ds;
+      entry.node_type = node_type;
+      entry.slot_index = slot_index;
+      entry.antenna_index = antenna_index;
+      this->raw_->Append(entry, data);
+      return;
+    }
+
+    Segment* seg = this->segmentOf(frame_id);
+    if (seg == nullptr) {
+      this->late_packets_++;
+      return;
+    }
+    const hsize_t frame_index = frame_id - seg->first_frame;
+    if (seg->has_frames == true && frame_id > seg->last_frame) {
+      seg->hdf5->flushIfDue();
+    }
+    if (seg->combiner != nullptr) {
+      seg->combiner->Stage(seg->combiner_ids.at(ds), frame_index, cell_id,
+                           slot_index, antenna_index, data);
+      if (seg->compressor != nullptr) seg->compressor->Collect(false);
+    } else {
+      std::array<hsize_t, kDsDimsNum> hdfoffset = {
+          frame_index, cell_id, slot_index, antenna_index, 0};
+      std::array<hsize_t, kDsDimsNum> count = {1, 1, 1, 1, IQ};
+      seg->hdf5->extendDataset(kDatasetNames[ds], frame_index);
+      seg->hdf5->writeDataset(kDatasetNames[ds], hdfoffset, count, data);
+    }
+
+    if (seg->has_frames == false || frame_id > seg->last_frame) {
+      seg->last_frame = frame_id;
+    }
+    seg->has_frames = true;
+    seg->bytes += IQ * sizeof(short);
+    if (this->segmented_ == true && this->rotate_due_ == false &&
+        seg == this->segment_.get()) {
+      const size_t segment_mb = this->cfg_->trace_segment_mb();
+      const size_t segment_sec = this->cfg_->trace_segment_seconds();
+      this->rotate_due_ =
+          (segment_mb > 0 && seg->bytes >= (segment_mb << 20)) ||
+          (segment_sec > 0 && std::chrono::steady_clock::now() - seg->started >=
+                                  std::chrono::seconds(segment_sec));
     }
   } /* End else */
 }
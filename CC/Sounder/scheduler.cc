@@ -8,6 +8,8 @@
 */
 #include "include/scheduler.h"
 
+#include <algorithm>
+
 #include "include/logger.h"
 #include "include/macros.h"
 #include "include/signalHandler.hpp"
@@ -16,6 +18,8 @@
 namespace Sounder {
 // dequeue bulk size, used to reduce the overhead of dequeue in main thread
 const int Scheduler::KDequeueBulkSize = 5;
+// queue depths are sampled once every this many dispatch passes
+static constexpr size_t kQueueDepthSampleInterval = 64;
 
 #if (DEBUG_PRINT)
 const int kDsSim = 5;
@@ -23,6 +27,7 @@ const int kDsSim = 5;
 
 Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
     : cfg_(in_cfg),
+      overload_(in_cfg->getNumRecordedSdrs() * in_cfg->bs_sdr_ch()),
       kMainDispatchCore(core_start),
       kSchedulerCore(kMainDispatchCore + 1),
       kRecvCore(kSchedulerCore + in_cfg->recorder_thread_num() +
@@ -48,13 +53,31 @@ Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
   if (total_rx_thread_num > 0) {
     // initialize rx buffers
     rx_buffer_ = new SampleBuffer[total_rx_thread_num];
-    size_t intsize = sizeof(std::atomic_int);
-    size_t arraysize = (rx_thread_buff_size_ + intsize - 1) / intsize;
     size_t packetLength = sizeof(Packet) + cfg_->getPacketDataLength();
+    const bool frame_layout = cfg_->buffer_layout() == kLayoutFrame &&
+                              bs_rx_thread_num > 0;
+    if (frame_layout == true) {
+      // All BS rx threads write into one frame-major buffer
+      frame_buffer_.reset(new FrameBuffer(
+          kSampleBufferFrameNum, cfg_->slot_per_frame(),
+          cfg_->num_bs_antennas_all(), cfg_->getPacketDataLength(),
+          cfg_->buffer_hugepages(),
+          cfg_->core_alloc() == true ? BufferMemory::NumaNodeOfCore(kRecvCore)
+                                     : -1));
+    }
     for (size_t i = 0; i < total_rx_thread_num; i++) {
-      rx_buffer_[i].buffer.resize(rx_thread_buff_size_ * packetLength);
-      rx_buffer_[i].pkt_buf_inuse = new std::atomic_int[arraysize];
-      std::fill_n(rx_buffer_[i].pkt_buf_inuse, arraysize, 0);
+      // rx thread i runs on kRecvCore + i, keep its packets on that node
+      const int node = cfg_->core_alloc() == true
+                           ? BufferMemory::NumaNodeOfCore(kRecvCore + i)
+                           : -1;
+      if (frame_layout == false || i >= bs_rx_thread_num) {
+        rx_buffer_[i].buffer.Allocate(rx_thread_buff_size_ * packetLength,
+                                      cfg_->buffer_hugepages(), node);
+      }
+      rx_buffer_[i].pkt_buf_inuse = nullptr;
+      rx_buffer_[i].slots = new SlotRing(
+          rx_thread_buff_size_,
+          cfg_->overload_policy() == kOverloadDropOldest);
     }
   }
 
@@ -65,10 +88,12 @@ Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
         kSampleBufferFrameNum * cfg_->slot_per_frame();
     size_t packetLength = sizeof(Packet) + cfg_->getPacketDataLength();
     for (size_t i = 0; i < cfg_->num_cl_sdrs(); i++) {
-      cl_tx_buffer_[i].buffer.resize(cl_tx_thread_buff_size_ * packetLength);
+      cl_tx_buffer_[i].buffer.Allocate(cl_tx_thread_buff_size_ * packetLength,
+                                       cfg_->buffer_hugepages(), -1);
       cl_tx_buffer_[i].pkt_buf_inuse =
           new std::atomic_int[kSampleBufferFrameNum];
       std::fill_n(cl_tx_buffer_[i].pkt_buf_inuse, kSampleBufferFrameNum, 0);
+      cl_tx_buffer_[i].slots = nullptr;
       cl_tx_queue_.push_back(new moodycamel::ConcurrentQueue<Event_data>(
           cl_tx_thread_buff_size_ * kQueueSize));
       cl_tx_ptoks_ptr_.push_back(
@@ -85,9 +110,11 @@ Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
     size_t arraysize = (bs_tx_thread_buff_size_ + intsize - 1) / intsize;
     size_t packetLength = sizeof(Packet) + cfg_->getPacketDataLength();
     for (size_t i = 0; i < cfg_->num_bs_sdrs_all(); i++) {
-      bs_tx_buffer_[i].buffer.resize(bs_tx_thread_buff_size_ * packetLength);
+      bs_tx_buffer_[i].buffer.Allocate(bs_tx_thread_buff_size_ * packetLength,
+                                       cfg_->buffer_hugepages(), -1);
       bs_tx_buffer_[i].pkt_buf_inuse = new std::atomic_int[arraysize];
       std::fill_n(bs_tx_buffer_[i].pkt_buf_inuse, arraysize, 0);
+      bs_tx_buffer_[i].slots = nullptr;
       tx_queue_.push_back(new moodycamel::ConcurrentQueue<Event_data>(
           bs_tx_thread_buff_size_ * kQueueSize));
       tx_ptoks_ptr_.push_back(new moodycamel::ProducerToken(*tx_queue_.back()));
@@ -98,7 +125,7 @@ Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
   try {
     receiver_.reset(new Receiver(cfg_, &message_queue_, tx_queue_,
                                  tx_ptoks_ptr_, cl_tx_queue_,
-                                 cl_tx_ptoks_ptr_));
+                                 cl_tx_ptoks_ptr_, &stats_, &overload_));
   } catch (ReceiverException& re) {
     std::cout << re.what() << '\n';
     gc();
@@ -109,9 +136,11 @@ Scheduler::Scheduler(Config* in_cfg, unsigned int core_start)
 void Scheduler::gc(void) {
   MLPD_TRACE("Garbage collect\n");
   this->receiver_.reset();
-  if (this->cfg_->bs_rx_thread_num() > 0) {
-    for (size_t i = 0; i < this->cfg_->bs_rx_thread_num(); i++) {
-      delete[] this->rx_buffer_[i].pkt_buf_inuse;
+  size_t total_rx_thread_num =
+      this->cfg_->bs_rx_thread_num() + this->cfg_->cl_rx_thread_num();
+  if (total_rx_thread_num > 0) {
+    for (size_t i = 0; i < total_rx_thread_num; i++) {
+      delete this->rx_buffer_[i].slots;
     }
     delete[] this->rx_buffer_;
   }
@@ -139,12 +168,6 @@ void Scheduler::do_it() {
     }
   }
 
-  if (this->cfg_->client_present() == true) {
-    auto client_threads = this->receiver_->startClientThreads(
-        this->rx_buffer_, this->cl_tx_buffer_,
-        kRecvCore + cfg_->bs_rx_thread_num());
-  }
-
   if (cfg_->reader_thread_num() > 0) {
     int reader_thread_index = 0;
     this->readers_.resize(2);
@@ -174,6 +197,10 @@ void Scheduler::do_it() {
     }
   }
 
+  if (total_rx_thread_num > 0 && this->cfg_->live_tap().empty() == false) {
+    this->live_tap_ = std::make_unique<LiveTap>(this->cfg_);
+  }
+
   if (total_rx_thread_num > 0) {
     thread_antennas = (total_antennas / recorder_threads);
     // If antennas are left, distribute them over the threads. This may assign antennas that don't
@@ -182,6 +209,21 @@ void Scheduler::do_it() {
       thread_antennas = (thread_antennas + 1);
     }
 
+    // Packets a producer can have in use at once: a BS rx thread of the
+    // frame layout may hold its radios' share of the frame buffer, which
+    // has a packet per antenna rather than per radio
+    std::vector<size_t> ring_sizes(total_rx_thread_num,
+                                   this->rx_thread_buff_size_);
+    if (this->frame_buffer_ != nullptr) {
+      const size_t bs_rx_thread_num = cfg_->bs_rx_thread_num();
+      const size_t radio_packets =
+          this->frame_buffer_->size() / cfg_->num_bs_sdrs_all();
+      const size_t thread_radios =
+          (cfg_->num_bs_sdrs_all() + bs_rx_thread_num - 1) / bs_rx_thread_num;
+      std::fill_n(ring_sizes.begin(), bs_rx_thread_num,
+                  radio_packets * thread_radios);
+    }
+
     for (unsigned int i = 0u; i < recorder_threads; i++) {
       int thread_core = -1;
       if (this->cfg_->core_alloc() == true) {
@@ -195,10 +237,45 @@ void Scheduler::do_it() {
           thread_antennas);
       Sounder::RecorderThread* new_recorder = new Sounder::RecorderThread(
           this->cfg_, i, thread_core, (this->rx_thread_buff_size_ * kQueueSize),
-          (i * thread_antennas), thread_antennas, true);
+          (i * thread_antennas), thread_antennas, true, &this->stats_,
+          &this->overload_);
+      if (this->cfg_->direct_record() == true) {
+        new_recorder->AttachDirectRings(
+            this->rx_buffer_, this->rx_thread_buff_size_, ring_sizes);
+      }
+      new_recorder->AttachFrameBuffer(this->frame_buffer_.get());
+      new_recorder->AttachLiveTap(this->live_tap_.get());
+      if (this->cfg_->core_alloc() == true) {
+        new_recorder->SetIoCores(kSchedulerCore, recorder_threads);
+      }
       new_recorder->Start();
       this->recorders_.push_back(new_recorder);
     }
+
+    // Rx threads push record work straight into the recorder rings, the
+    // dispatch loop below then only sees beacon and read events
+    if (this->cfg_->direct_record() == true) {
+      std::vector<std::vector<SpscRing<RecordDescriptor>*>> record_rings(
+          total_rx_thread_num);
+      for (size_t producer = 0; producer < total_rx_thread_num; producer++) {
+        for (auto recorder : this->recorders_) {
+          record_rings.at(producer).push_back(recorder->DirectRing(producer));
+        }
+      }
+      this->receiver_->setRecordRings(std::move(record_rings),
+                                      thread_antennas);
+    }
+  }
+
+  this->receiver_->setFrameBuffer(this->frame_buffer_.get());
+  if (this->cfg_->client_present() == true) {
+    auto client_threads = this->receiver_->startClientThreads(
+        this->rx_buffer_, this->cl_tx_buffer_,
+        kRecvCore + cfg_->bs_rx_thread_num());
+  }
+
+  if (total_rx_thread_num > 0) {
+    this->stats_.start = std::chrono::steady_clock::now();
     if (cfg_->bs_rx_thread_num() > 0) {
       // create socket buffer and socket threads
       recv_threads = this->receiver_->startRecvThreads(
@@ -212,6 +289,7 @@ void Scheduler::do_it() {
 
   Event_data events_list[KDequeueBulkSize];
   int ret = 0;
+  size_t dispatch_pass = 0;
 
   /* TODO : we can probably remove the dispatch function and pass directly to the recievers */
   while ((this->cfg_->running() == true) &&
@@ -219,6 +297,18 @@ void Scheduler::do_it() {
     // get a bulk of events from the receivers
     ret = this->message_queue_.try_dequeue_bulk(ctok, events_list,
                                                 KDequeueBulkSize);
+    // with direct_record the recorder rings fill without any dispatch here
+    if ((ret > 0 || this->cfg_->direct_record() == true) &&
+        (++dispatch_pass % kQueueDepthSampleInterval) == 0) {
+      PipelineStats::UpdateMax(this->stats_.max_message_queue_depth,
+                               this->message_queue_.size_approx());
+      for (auto recorder : this->recorders_) {
+        PipelineStats::UpdateMax(this->stats_.max_record_queue_depth,
+                                 recorder->QueueDepth());
+        PipelineStats::UpdateMax(this->stats_.max_staging_bytes,
+                                 recorder->StagedBytes());
+      }
+    }
     // handle each event
     for (int bulk_count = 0; bulk_count < ret; bulk_count++) {
       Event_data& event = events_list[bulk_count];
@@ -246,6 +336,7 @@ void Scheduler::do_it() {
           do_record_task.event_type = kTaskRecord;
           do_record_task.node_type = event.node_type;
           do_record_task.offset = event.offset;
+          do_record_task.seq = event.seq;
           do_record_task.buffer = this->rx_buffer_;
           do_record_task.buff_size = this->rx_thread_buff_size_;
           if (this->recorders_.at(thread_index)->DispatchWork(do_record_task) ==
@@ -291,6 +382,7 @@ void Scheduler::do_it() {
     }
   }
   this->cfg_->running(false);
+  this->stats_.dispatch_cpu_ns += PipelineStats::ThreadCpuNs();
   this->receiver_->completeRecvThreads(recv_threads);
   this->receiver_.reset();
 
@@ -303,6 +395,9 @@ void Scheduler::do_it() {
     delete recorder;
   }
   this->recorders_.clear();
+  if (total_rx_thread_num > 0) {
+    this->stats_.Print(sizeof(Packet) + cfg_->getPacketDataLength());
+  }
 }
 
 int Scheduler::getRecordedFrameNum() { return this->max_frame_number_; }
@@ -0,0 +1,242 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ sounder-convert: turns raw recordings (record_format "raw") into the
+ HDF5 files the recorder would have written, one capture per process
+---------------------------------------------------------------------
+*/
+
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "include/chunk_compressor.h"
+#include "include/hdf5_lib.h"
+#include "include/logger.h"
+#include "include/raw_trace_writer.h"
+#include "include/version_config.h"
+#include "include/write_combiner.h"
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+DEFINE_uint64(jobs, 0, "Captures converted at once, 0 for one per core");
+DEFINE_bool(remove_raw, false,
+            "Delete the raw files of a capture once it is converted");
+
+// Packets read from the index and the data file at a time
+static constexpr size_t kConvertBlockPackets = 4096;
+// Frames being gathered per dataset; the capture is in arrival order
+static constexpr size_t kConvertOpenFrames = 8;
+// Offline there is no latency bound: frames are written when complete, when
+// kConvertOpenFrames newer ones are open, or at the end. Far below
+// milliseconds::max(), which overflows against steady_clock durations.
+static constexpr std::chrono::hours kConvertFrameTimeout(24 * 365);
+
+namespace Sounder {
+static void Convert(const std::string& sidecar_name) {
+  json sidecar;
+  {
+    std::ifstream in(sidecar_name);
+    if (in.good() == false) {
+      throw std::runtime_error("Cannot open " + sidecar_name);
+    }
+    sidecar = json::parse(in);
+  }
+  if (sidecar.value("format", "") != "sounder-raw") {
+    throw std::invalid_argument(sidecar_name + " is no raw recording");
+  }
+  const size_t dir_end = sidecar_name.find_last_of('/');
+  const std::string dir = dir_end == std::string::npos
+                              ? std::string()
+                              : sidecar_name.substr(0, dir_end + 1);
+  const std::string hdf5_name =
+      dir + sidecar.at("hdf5_file").get<std::string>();
+  const std::string data_name =
+      dir + sidecar.at("data_file").get<std::string>();
+  const std::string index_name =
+      dir + sidecar.at("index_file").get<std::string>();
+  const size_t packet_bytes = sidecar.at("packet_bytes").get<size_t>();
+  const size_t frames = sidecar.at("frames").get<size_t>();
+  if (sidecar.at("complete").get<bool>() == false) {
+    MLPD_WARN("%s was not closed, converting the packets it indexed\n",
+              sidecar_name.c_str());
+  }
+
+  Hdf5Lib hdf5(hdf5_name, "Data");
+  RawAttributes::Replay(sidecar.at("attributes"),
+                        sidecar.at("attribute_datasets"), hdf5);
+
+  const json& compression = sidecar.at("compression");
+  const auto codec = static_cast<Hdf5Codec>(compression.at("codec").get<int>());
+  std::unique_ptr<ChunkCompressor> compressor;
+  if (codec != kCodecNone) {
+    ChunkCompressor::RegisterFilters();
+    hdf5.setCompression(codec, compression.at("level").get<int>());
+    compressor = std::make_unique<ChunkCompressor>(
+        &hdf5, codec, compression.at("level").get<int>(),
+        compression.at("threads").get<size_t>());
+  }
+  WriteCombiner combiner(&hdf5, kConvertFrameTimeout, kConvertOpenFrames,
+                         compressor.get());
+  hdf5.setMaxPrimaryDimSize(frames > 0 ? frames - 1 : 0);
+
+  // Dataset id of the index -> combiner id
+  std::map<size_t, size_t> combiner_ids;
+  for (const auto& item : sidecar.at("datasets").items()) {
+    const auto dims =
+        item.value().at("dims").get<std::array<hsize_t, kDsDimsNum>>();
+    const auto chunk =
+        item.value().at("chunk").get<std::array<hsize_t, kDsDimsNum>>();
+    hdf5.createDataset(item.key(), dims, chunk,
+                       item.value().at("chunk_cache_bytes").get<size_t>());
+    size_t compressor_id = WriteCombiner::kUncompressed;
+    if (compressor != nullptr) {
+      compressor_id = compressor->AddDataset(item.key(), dims, chunk);
+    }
+    combiner_ids[item.value().at("id").get<size_t>()] = combiner.AddDataset(
+        item.key(), dims, dims[1] * dims[2] * dims[3], compressor_id);
+  }
+  hdf5.openDataset();
+
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> index(
+      std::fopen(index_name.c_str(), "rb"), &std::fclose);
+  if (index == nullptr) {
+    throw std::runtime_error("Cannot open " + index_name + ": " +
+                             std::strerror(errno));
+  }
+  const int data_fd = open(data_name.c_str(), O_RDONLY);
+  if (data_fd < 0) {
+    throw std::runtime_error("Cannot open " + data_name + ": " +
+                             std::strerror(errno));
+  }
+  posix_fadvise(data_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::vector<RawIndexEntry> entries(kConvertBlockPackets);
+  std::vector<short> samples;
+  size_t packets = 0;
+  size_t missing = 0;
+  size_t n;
+  while ((n = std::fread(entries.data(), sizeof(RawIndexEntry),
+                         entries.size(), index.get())) > 0) {
+    // Appended one after the other, so a block is one contiguous read
+    const uint64_t first = entries[0].offset;
+    const uint64_t end = entries[n - 1].offset + packet_bytes;
+    samples.resize((end - first) / sizeof(short));
+    size_t done = 0;
+    while (done < end - first) {
+      const ssize_t r =
+          pread(data_fd, reinterpret_cast<char*>(samples.data()) + done,
+                end - first - done, first + done);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) {
+        close(data_fd);
+        throw std::runtime_error("Cannot read " + data_name + ": " +
+                                 std::strerror(errno));
+      }
+      if (r == 0) break;
+      done += r;
+    }
+    for (size_t i = 0; i < n; i++) {
+      const RawIndexEntry& entry = entries[i];
+      // Indexed but never written, the recorder did not finish
+      if (entry.offset - first + packet_bytes > done) {
+        missing++;
+        continue;
+      }
+      const auto ds = combiner_ids.find(entry.dataset);
+      if (ds == combiner_ids.end()) {
+        close(data_fd);
+        throw std::runtime_error(index_name + ": packet of unknown dataset " +
+                                 std::to_string(entry.dataset));
+      }
+      combiner.Stage(ds->second, entry.frame_id, entry.cell_id,
+                     entry.slot_index, entry.antenna_index,
+                     samples.data() + (entry.offset - first) / sizeof(short));
+      if (compressor != nullptr) compressor->Collect(false);
+      packets++;
+    }
+  }
+  close(data_fd);
+  combiner.FlushAll();
+  if (compressor != nullptr) compressor->FlushAll();
+  hdf5.closeDataset();
+  if (missing > 0) {
+    MLPD_WARN("%s: %zu indexed packets missing in %s\n",
+              sidecar_name.c_str(), missing, data_name.c_str());
+  }
+  MLPD_INFO("%s: %zu packets written to %s\n", sidecar_name.c_str(), packets,
+            hdf5_name.c_str());
+
+  if (FLAGS_remove_raw == true) {
+    for (const std::string& name : {data_name, index_name, sidecar_name}) {
+      std::remove(name.c_str());
+    }
+  }
+}
+};  // namespace Sounder
+
+int main(int argc, char* argv[]) {
+  gflags::SetVersionString(GetSounderProjectVersion());
+  gflags::SetUsageMessage(
+      "sounder-convert Options: -jobs -remove_raw <capture.json>...");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc < 2) {
+    std::cerr << gflags::ProgramUsage() << std::endl;
+    return EXIT_FAILURE;
+  }
+  size_t jobs = FLAGS_jobs;
+  if (jobs == 0) jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+  // Processes rather than threads: the thread-safe HDF5 library serializes
+  // all calls, so only separate processes write files in parallel
+  std::map<pid_t, std::string> running;
+  int ret = EXIT_SUCCESS;
+  int next = 1;
+  while (next < argc || running.empty() == false) {
+    if (next < argc && running.size() < jobs) {
+      const pid_t pid = fork();
+      if (pid == 0) {
+        int status = EXIT_SUCCESS;
+        try {
+          Sounder::Convert(argv[next]);
+        } catch (const std::exception& exc) {
+          std::cerr << argv[next] << ": " << exc.what() << std::endl;
+          status = EXIT_FAILURE;
+        }
+        std::fflush(nullptr);
+        std::_Exit(status);
+      } else if (pid < 0) {
+        std::cerr << "Cannot start a conversion: " << std::strerror(errno)
+                  << std::endl;
+        ret = EXIT_FAILURE;
+        break;
+      }
+      running[pid] = argv[next++];
+      continue;
+    }
+    int status;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) break;
+    if (WIFEXITED(status) == false || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      std::cerr << "Conversion of " << running[pid] << " failed" << std::endl;
+      ret = EXIT_FAILURE;
+    }
+    running.erase(pid);
+  }
+  while (running.empty() == false && waitpid(-1, nullptr, 0) > 0) {
+    running.erase(running.begin());
+  }
+  gflags::ShutDownCommandLineFlags();
+  return ret;
+}
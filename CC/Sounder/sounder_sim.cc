@@ -0,0 +1,565 @@
+/** @file sounder_sim.cc
+  * @brief SoapySDR module emulating an Iris board for hardware-free runs.
+  *
+  * Copyright (c) 2018-2022, Rice University
+  * RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+  * ----------------------------------------------------------
+  * Registers the "sounder_sim" driver. Each device emulates the Iris TDD
+  * framer: after TDD_CONFIG and TRIGGER_GEN, readStream returns one slot per
+  * 'R' entry in the frame schedule, paced at the sample rate, with the
+  * hardware frame time encoding (frame << 32 | slot << 16 | sample).
+  *
+  * Usage: point SOAPY_SDR_PLUGIN_PATH at the build folder and set
+  *   "sdr_driver" : "sounder_sim"
+  * in the sounder config. Device args may be passed with "sdr_args":
+  *   sim_rate=<sps>    pacing rate, overrides setSampleRate (0 = unpaced)
+  *   sim_rx_buffer=<n> rx samples buffered before slots are dropped
+  * ----------------------------------------------------------
+*/
+#include <SoapySDR/Device.hpp>
+#include <SoapySDR/Formats.hpp>
+#include <SoapySDR/Logger.hpp>
+#include <SoapySDR/Registry.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+static constexpr size_t kSimNumChannels = 2;
+static constexpr size_t kSimNoiseTableSize = 8192;
+static constexpr long long kSimDefaultRxBuffer = 1 << 20;  // samples
+
+// A single trigger fans out to every simulated board in the process, which
+// is what the hub (or the daisy-chained trigger line) does for real Irises.
+static std::atomic<long long> g_trigger_time_ns(0);
+static std::atomic<int> g_trigger_count(0);
+
+static long long simNowNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct SimTdd {
+  std::vector<std::string> frames;
+  size_t symbol_size;
+  size_t max_frame;
+};
+
+struct SimStream {
+  int direction;
+  std::vector<size_t> channels;
+  bool active;
+  // rx cursor, in frame/slot/sample units of the TDD schedule
+  int trigger_seen;
+  long long frame;
+  size_t slot;
+  size_t offset;
+  // continuous (non-TDD) rx position in ticks
+  long long tick;
+};
+
+class SounderSimDevice : public SoapySDR::Device {
+ public:
+  SounderSimDevice(const SoapySDR::Kwargs& args)
+      : serial_(args.count("serial") ? args.at("serial") : "SIM0000000"),
+        rate_(5e6),
+        rate_override_(args.count("sim_rate") ? std::stod(args.at("sim_rate"))
+                                              : -1.0),
+        rx_buffer_(args.count("sim_rx_buffer")
+                       ? std::stoll(args.at("sim_rx_buffer"))
+                       : kSimDefaultRxBuffer),
+        overflow_count_(0),
+        late_count_(0),
+        tx_count_(0),
+        time_error_(false) {
+    // Low-level noise so that recorded traces are not all zeros
+    std::mt19937 gen(std::hash<std::string>{}(serial_));
+    std::normal_distribution<float> dist(0.0f, 16.0f);
+    noise_.resize(kSimNoiseTableSize);
+    for (auto& s : noise_) {
+      s = std::complex<int16_t>(static_cast<int16_t>(dist(gen)),
+                                static_cast<int16_t>(dist(gen)));
+    }
+  }
+
+  std::string getDriverKey(void) const override { return "sounder_sim"; }
+  std::string getHardwareKey(void) const override { return "sounder_sim"; }
+  SoapySDR::Kwargs getHardwareInfo(void) const override {
+    SoapySDR::Kwargs info;
+    info["serial"] = serial_;
+    info["frontend"] = "SIM";
+    return info;
+  }
+
+  size_t getNumChannels(const int) const override { return kSimNumChannels; }
+  bool getFullDuplex(const int, const size_t) const override { return true; }
+
+  /*******************************************************************
+   * Streaming
+   ******************************************************************/
+  std::vector<std::string> getStreamFormats(const int,
+                                            const size_t) const override {
+    return {SOAPY_SDR_CS16};
+  }
+  std::string getNativeStreamFormat(const int, const size_t,
+                                    double& fullScale) const override {
+    fullScale = 32768;
+    return SOAPY_SDR_CS16;
+  }
+
+  SoapySDR::Stream* setupStream(const int direction, const std::string& format,
+                                const std::vector<size_t>& channels,
+                                const SoapySDR::Kwargs&) override {
+    if (format != SOAPY_SDR_CS16) {
+      throw std::runtime_error("sounder_sim: only CS16 is supported");
+    }
+    auto* stream = new SimStream();
+    stream->direction = direction;
+    stream->channels = channels.empty() ? std::vector<size_t>{0} : channels;
+    for (auto ch : stream->channels) {
+      if (ch >= kSimNumChannels) {
+        delete stream;
+        throw std::runtime_error("sounder_sim: invalid channel");
+      }
+    }
+    stream->active = false;
+    stream->trigger_seen = 0;
+    stream->frame = 0;
+    stream->slot = 0;
+    stream->offset = 0;
+    stream->tick = 0;
+    return reinterpret_cast<SoapySDR::Stream*>(stream);
+  }
+
+  void closeStream(SoapySDR::Stream* stream) override {
+    delete reinterpret_cast<SimStream*>(stream);
+  }
+
+  size_t getStreamMTU(SoapySDR::Stream*) const override {
+    const auto tdd = std::atomic_load(&tdd_);
+    return tdd != nullptr ? tdd->symbol_size : 4096;
+  }
+
+  int activateStream(SoapySDR::Stream* stream, const int, const long long,
+                     const size_t) override {
+    auto* s = reinterpret_cast<SimStream*>(stream);
+    s->active = true;
+    s->tick = hardwareTicks();
+    return 0;
+  }
+
+  int deactivateStream(SoapySDR::Stream* stream, const int,
+                       const long long) override {
+    reinterpret_cast<SimStream*>(stream)->active = false;
+    return 0;
+  }
+
+  int readStream(SoapySDR::Stream* stream, void* const* buffs,
+                 const size_t numElems, int& flags, long long& timeNs,
+                 const long timeoutUs) override {
+    auto* s = reinterpret_cast<SimStream*>(stream);
+    const long long deadline_ns = simNowNs() + timeoutUs * 1000LL;
+    flags = 0;
+    if (s->active == false) {
+      return waitTimeout(deadline_ns);
+    }
+
+    // Snapshot of the schedule; TDD_CONFIG swaps it without stalling readers
+    const auto tdd = std::atomic_load(&tdd_);
+    if (tdd == nullptr) {
+      return readContinuous(s, buffs, numElems, flags, timeNs, deadline_ns);
+    }
+    const std::vector<std::string>& frames = tdd->frames;
+    const size_t symbol_size = tdd->symbol_size;
+    const size_t max_frame = tdd->max_frame;
+
+    const int trigger_count = g_trigger_count.load();
+    if (trigger_count == 0) {
+      return waitTimeout(deadline_ns);
+    }
+    if (s->trigger_seen != trigger_count) {
+      s->trigger_seen = trigger_count;
+      s->frame = 0;
+      s->slot = 0;
+      s->offset = 0;
+    }
+
+    const size_t slots = frames.at(0).size();
+    while (true) {
+      // Skip to the next slot the framer streams to the host
+      size_t skipped = 0;
+      while (frames.at(s->frame % frames.size()).at(s->slot) != 'R') {
+        s->offset = 0;
+        if (++s->slot == slots) {
+          s->slot = 0;
+          s->frame++;
+        }
+        if (++skipped > slots) {
+          return waitTimeout(deadline_ns);  // no rx slots in the schedule
+        }
+      }
+      if (max_frame > 0 && static_cast<size_t>(s->frame) >= max_frame) {
+        return waitTimeout(deadline_ns);
+      }
+
+      const size_t n = std::min(numElems, symbol_size - s->offset);
+      const long long end_tick =
+          (s->frame * slots + s->slot) * symbol_size + s->offset + n;
+      if (waitForTick(end_tick, deadline_ns) == false) {
+        return SOAPY_SDR_TIMEOUT;
+      }
+
+      // Host fell behind: drop what the FIFO could not hold, like the board
+      const long long now_tick = hardwareTicks();
+      if (pacingRate() > 0 && now_tick - end_tick > rx_buffer_) {
+        const long long slot_index = now_tick / symbol_size;
+        s->frame = slot_index / slots;
+        s->slot = slot_index % slots;
+        s->offset = 0;
+        if (overflow_count_.fetch_add(1) == 0) {
+          SoapySDR::logf(SOAPY_SDR_WARNING,
+                         "sounder_sim %s: rx overflow, skipping to frame %lld",
+                         serial_.c_str(), s->frame);
+        }
+        flags |= SOAPY_SDR_END_ABRUPT;
+        continue;
+      }
+
+      fillSamples(s, buffs, n, end_tick - n);
+      timeNs = (s->frame << 32) | (static_cast<long long>(s->slot) << 16) |
+               static_cast<long long>(s->offset);
+      flags |= SOAPY_SDR_HAS_TIME;
+      s->offset += n;
+      if (s->offset == symbol_size) {
+        flags |= SOAPY_SDR_END_BURST;
+        s->offset = 0;
+        if (++s->slot == slots) {
+          s->slot = 0;
+          s->frame++;
+        }
+      }
+      return static_cast<int>(n);
+    }
+  }
+
+  int writeStream(SoapySDR::Stream*, const void* const*, const size_t numElems,
+                  int& flags, const long long timeNs, const long) override {
+    tx_count_++;
+    if ((flags & SOAPY_SDR_HAS_TIME) != 0 && isLate(timeNs)) {
+      late_count_++;
+      time_error_ = true;
+    }
+    return static_cast<int>(numElems);
+  }
+
+  int readStreamStatus(SoapySDR::Stream*, size_t&, int& flags, long long&,
+                       const long timeoutUs) override {
+    flags = 0;
+    if (time_error_.exchange(false)) {
+      return SOAPY_SDR_TIME_ERROR;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(timeoutUs));
+    return SOAPY_SDR_TIMEOUT;
+  }
+
+  /*******************************************************************
+   * Settings
+   ******************************************************************/
+  void writeSetting(const std::string& key, const std::string& value) override {
+    if (key == "TDD_CONFIG") {
+      const auto conf = json::parse(value);
+      if (conf.value("tdd_enabled", false) == false) {
+        std::atomic_store(&tdd_, std::shared_ptr<const SimTdd>());
+        return;
+      }
+      auto tdd = std::make_shared<SimTdd>();
+      tdd->symbol_size = conf.value("symbol_size", 0);
+      tdd->max_frame = conf.value("max_frame", 0);
+      auto frames = conf.value("frames", json::array());
+      tdd->frames.assign(frames.begin(), frames.end());
+      if (tdd->symbol_size == 0 || tdd->frames.empty() ||
+          tdd->frames.at(0).empty()) {
+        throw std::invalid_argument("sounder_sim: incomplete TDD_CONFIG");
+      }
+      for (const auto& f : tdd->frames) {
+        if (f.size() != tdd->frames.at(0).size()) {
+          throw std::invalid_argument("sounder_sim: frame length mismatch");
+        }
+      }
+      std::atomic_store(&tdd_, std::shared_ptr<const SimTdd>(tdd));
+    } else if (key == "TRIGGER_GEN") {
+      g_trigger_time_ns.store(simNowNs());
+      g_trigger_count.fetch_add(1);
+    } else {
+      // RESET_DATA_LOGIC, TDD_MODE, TX_SW_DELAY, BEACON_START, ... are
+      // accepted and only remembered for readSetting.
+      std::lock_guard<std::mutex> lock(mutex_);
+      settings_[key] = value;
+    }
+  }
+
+  std::string readSetting(const std::string& key) const override {
+    if (key == "TRIGGER_COUNT") {
+      return std::to_string(g_trigger_count.load());
+    } else if (key == "RX_OVERFLOW_COUNT") {
+      return std::to_string(overflow_count_.load());
+    } else if (key == "TX_LATE_COUNT") {
+      return std::to_string(late_count_.load());
+    } else if (key == "TX_COUNT") {
+      return std::to_string(tx_count_.load());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = settings_.find(key);
+    return it == settings_.end() ? "" : it->second;
+  }
+
+  void writeRegisters(const std::string& name, const unsigned addr,
+                      const std::vector<unsigned>& value) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& ram = registers_[name];
+    if (ram.size() < addr + value.size()) ram.resize(addr + value.size());
+    std::copy(value.begin(), value.end(), ram.begin() + addr);
+  }
+
+  std::vector<unsigned> readRegisters(const std::string& name,
+                                      const unsigned addr,
+                                      const size_t length) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<unsigned> out(length, 0);
+    auto it = registers_.find(name);
+    for (size_t i = 0; it != registers_.end() && i < length &&
+                       addr + i < it->second.size();
+         i++) {
+      out.at(i) = it->second.at(addr + i);
+    }
+    return out;
+  }
+
+  /*******************************************************************
+   * RF front end: values are stored and read back, nothing else
+   ******************************************************************/
+  void setSampleRate(const int, const size_t, const double rate) override {
+    rate_ = rate;
+  }
+  double getSampleRate(const int, const size_t) const override {
+    return rate_;
+  }
+  void setFrequency(const int direction, const size_t channel,
+                    const std::string& name, const double frequency,
+                    const SoapySDR::Kwargs&) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    values_[valueKey("freq", direction, channel, name)] = frequency;
+  }
+  double getFrequency(const int direction, const size_t channel,
+                      const std::string& name) const override {
+    return getValue(valueKey("freq", direction, channel, name));
+  }
+  double getFrequency(const int direction,
+                      const size_t channel) const override {
+    return getFrequency(direction, channel, "RF") +
+           getFrequency(direction, channel, "BB");
+  }
+  std::vector<std::string> listFrequencies(const int,
+                                           const size_t) const override {
+    return {"RF", "BB"};
+  }
+  void setGain(const int direction, const size_t channel,
+               const double value) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    values_[valueKey("gain", direction, channel, "")] = value;
+  }
+  void setGain(const int direction, const size_t channel,
+               const std::string& name, const double value) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    values_[valueKey("gain", direction, channel, name)] = value;
+  }
+  double getGain(const int direction, const size_t channel) const override {
+    return getValue(valueKey("gain", direction, channel, ""));
+  }
+  double getGain(const int direction, const size_t channel,
+                 const std::string& name) const override {
+    return getValue(valueKey("gain", direction, channel, name));
+  }
+  void setBandwidth(const int direction, const size_t channel,
+                    const double bw) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    values_[valueKey("bw", direction, channel, "")] = bw;
+  }
+  double getBandwidth(const int direction, const size_t channel) const override {
+    return getValue(valueKey("bw", direction, channel, ""));
+  }
+  void setAntenna(const int direction, const size_t channel,
+                  const std::string& name) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    antennas_[valueKey("ant", direction, channel, "")] = name;
+  }
+  std::string getAntenna(const int direction,
+                         const size_t channel) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = antennas_.find(valueKey("ant", direction, channel, ""));
+    return it == antennas_.end() ? "TRX" : it->second;
+  }
+  void setDCOffsetMode(const int, const size_t, const bool) override {}
+
+  /*******************************************************************
+   * Time
+   ******************************************************************/
+  bool hasHardwareTime(const std::string&) const override { return true; }
+  long long getHardwareTime(const std::string&) const override {
+    return hardwareTicks();
+  }
+  void setHardwareTime(const long long, const std::string&) override {}
+  std::vector<std::string> listTimeSources(void) const override {
+    return {"internal", "external"};
+  }
+  void setTimeSource(const std::string&) override {}
+  void setClockSource(const std::string&) override {}
+
+ private:
+  double pacingRate(void) const {
+    return rate_override_ >= 0 ? rate_override_ : rate_;
+  }
+
+  // Ticks elapsed since the last trigger (or since process start)
+  long long hardwareTicks(void) const {
+    const double rate = pacingRate();
+    if (rate <= 0) {
+      return std::numeric_limits<long long>::max() / 2;
+    }
+    const long long elapsed_ns = simNowNs() - g_trigger_time_ns.load();
+    return static_cast<long long>(elapsed_ns * 1e-9 * rate);
+  }
+
+  // Sleep until the framer clock reaches tick, giving up at deadline_ns
+  bool waitForTick(long long tick, long long deadline_ns) const {
+    const double rate = pacingRate();
+    if (rate <= 0) return true;
+    const long long due_ns =
+        g_trigger_time_ns.load() + static_cast<long long>(tick * 1e9 / rate);
+    const long long wake_ns = std::min(due_ns, deadline_ns);
+    const long long now_ns = simNowNs();
+    if (wake_ns > now_ns) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(wake_ns - now_ns));
+    }
+    return due_ns <= deadline_ns;
+  }
+
+  int waitTimeout(long long deadline_ns) const {
+    const long long now_ns = simNowNs();
+    if (deadline_ns > now_ns) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - now_ns));
+    }
+    return SOAPY_SDR_TIMEOUT;
+  }
+
+  int readContinuous(SimStream* s, void* const* buffs, const size_t numElems,
+                     int& flags, long long& timeNs, long long deadline_ns) {
+    if (waitForTick(s->tick + numElems, deadline_ns) == false) {
+      return SOAPY_SDR_TIMEOUT;
+    }
+    fillSamples(s, buffs, numElems, s->tick);
+    timeNs = s->tick;
+    flags |= SOAPY_SDR_HAS_TIME;
+    s->tick += numElems;
+    return static_cast<int>(numElems);
+  }
+
+  void fillSamples(const SimStream* s, void* const* buffs, size_t n,
+                   long long tick) const {
+    for (size_t i = 0; i < s->channels.size(); i++) {
+      auto* out = static_cast<std::complex<int16_t>*>(buffs[i]);
+      size_t done = 0;
+      size_t pos = (tick + i * (kSimNoiseTableSize / 2)) % kSimNoiseTableSize;
+      while (done < n) {
+        const size_t len = std::min(n - done, kSimNoiseTableSize - pos);
+        std::memcpy(out + done, noise_.data() + pos, len * sizeof(*out));
+        done += len;
+        pos = 0;
+      }
+    }
+  }
+
+  // A timed tx request is late if its slot has already passed on the framer
+  bool isLate(long long frameTime) const {
+    const auto tdd = std::atomic_load(&tdd_);
+    if (tdd == nullptr || pacingRate() <= 0 || g_trigger_count.load() == 0) {
+      return false;
+    }
+    const long long frame = frameTime >> 32;
+    const long long slot = (frameTime >> 16) & 0xFFFF;
+    const long long start_tick =
+        (frame * tdd->frames.at(0).size() + slot) * tdd->symbol_size;
+    return start_tick < hardwareTicks();
+  }
+
+  static std::string valueKey(const char* what, const int direction,
+                              const size_t channel, const std::string& name) {
+    return std::string(what) + "/" + std::to_string(direction) + "/" +
+           std::to_string(channel) + "/" + name;
+  }
+
+  double getValue(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = values_.find(key);
+    return it == values_.end() ? 0.0 : it->second;
+  }
+
+  const std::string serial_;
+  double rate_;
+  const double rate_override_;
+  const long long rx_buffer_;
+
+  std::shared_ptr<const SimTdd> tdd_;  // nullptr while TDD is disabled
+  mutable std::mutex mutex_;
+  std::map<std::string, std::string> settings_;
+  std::map<std::string, std::vector<unsigned>> registers_;
+  std::map<std::string, double> values_;
+  std::map<std::string, std::string> antennas_;
+
+  std::atomic<size_t> overflow_count_;
+  std::atomic<size_t> late_count_;
+  std::atomic<size_t> tx_count_;
+  std::atomic<bool> time_error_;
+
+  std::vector<std::complex<int16_t>> noise_;
+};
+
+/***********************************************************************
+ * Registration
+ **********************************************************************/
+static SoapySDR::KwargsList findSounderSim(const SoapySDR::Kwargs& args) {
+  SoapySDR::KwargsList results;
+  // Only match on request, so real Iris discovery is never polluted
+  if (args.count("driver") == 0 || args.at("driver") != "sounder_sim") {
+    return results;
+  }
+  SoapySDR::Kwargs dev;
+  dev["driver"] = "sounder_sim";
+  dev["serial"] = args.count("serial") ? args.at("serial") : "SIM0000000";
+  dev["label"] = "Sounder sim " + dev["serial"];
+  results.push_back(dev);
+  return results;
+}
+
+static SoapySDR::Device* makeSounderSim(const SoapySDR::Kwargs& args) {
+  return new SounderSimDevice(args);
+}
+
+static SoapySDR::Registry registerSounderSim("sounder_sim", &findSounderSim,
+                                             &makeSounderSim,
+                                             SOAPY_SDR_ABI_VERSION);
@@ -1,11 +1,181 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <climits>
 #include <random>
 
+#include "beacon_detector.h"
+#include "comms-kernels.h"
 #include "comms-lib.h"
 #include "macros.h"
+#include "ofdm_modulator.h"
 #include "utils.h"
+
+// Inputs hold an edge value every fifth entry so they also land in tails
+static std::vector<int16_t> KernelInput(size_t size, std::mt19937& gen) {
+  static const int16_t kEdges[] = {INT16_MIN, INT16_MAX, -1, 0, 1};
+  std::uniform_int_distribution<int> dist(INT16_MIN, INT16_MAX);
+  std::vector<int16_t> data(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i % 5 == 0) ? kEdges[(i / 5) % 5]
+                           : static_cast<int16_t>(dist(gen));
+  }
+  return data;
+}
+
+static std::vector<float> KernelInputF(size_t size, std::mt19937& gen) {
+  static const float kEdges[] = {-1000.f, 1000.f, 1e-20f, -0.f, 0.f};
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  std::vector<float> data(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i % 5 == 0) ? kEdges[(i / 5) % 5] : dist(gen);
+  }
+  return data;
+}
+
+// Integer kernels are bit exact, float ones may round differently (FMA)
+static bool SameOutput(const std::vector<float>& out,
+                       const std::vector<float>& ref) {
+  float scale = 1.f;
+  for (float value : ref) scale = std::max(scale, std::abs(value));
+  for (size_t i = 0; i < ref.size(); i++) {
+    if (std::abs(out[i] - ref[i]) > 1e-5f * scale) return false;
+  }
+  return true;
+}
+
+/* Every kernel of a level against the scalar table, for all counts up to
+ * two AVX-512 vectors of cs16 plus a tail and a few correlator lengths */
+static bool CompareKernels(const CommsKernels& kernels) {
+  static constexpr size_t kMaxCount = 257;
+  static constexpr size_t kTaps[] = {1, 3, 16, 17};
+  const CommsKernels& ref = kScalarCommsKernels;
+  std::mt19937 gen(42);
+  bool pass = true;
+  auto check = [&pass, &kernels](bool same, const char* name, size_t count) {
+    if (same == false && pass == true) {
+      std::cout << CommsKernels::Name(kernels.level) << " " << name
+                << " differs from scalar, count " << count << std::endl;
+    }
+    pass = pass && same;
+  };
+  for (size_t count = 0; count <= kMaxCount; count++) {
+    const std::vector<int16_t> f16 = KernelInput(2 * count, gen);
+    const std::vector<int16_t> g16 = KernelInput(2 * count, gen);
+    const std::vector<float> f32 = KernelInputF(2 * count, gen);
+    const std::vector<float> g32 = KernelInputF(2 * count, gen);
+    for (bool conj : {false, true}) {
+      std::vector<int16_t> out16(2 * count), ref16(2 * count);
+      kernels.complex_mult_cs16(f16.data(), g16.data(), out16.data(), count,
+                                conj);
+      ref.complex_mult_cs16(f16.data(), g16.data(), ref16.data(), count, conj);
+      check(out16 == ref16, "complex_mult_cs16", count);
+      std::vector<float> out32(2 * count), ref32(2 * count);
+      kernels.complex_mult_cf32(f32.data(), g32.data(), out32.data(), count,
+                                conj);
+      ref.complex_mult_cf32(f32.data(), g32.data(), ref32.data(), count, conj);
+      check(SameOutput(out32, ref32), "complex_mult_cf32", count);
+    }
+    std::vector<int32_t> abs32(count), abs_ref32(count);
+    kernels.abs2_cs16(f16.data(), abs32.data(), count);
+    ref.abs2_cs16(f16.data(), abs_ref32.data(), count);
+    check(abs32 == abs_ref32, "abs2_cs16", count);
+    std::vector<float> absf(count), absf_ref(count);
+    kernels.abs2_cf32(f32.data(), absf.data(), count);
+    ref.abs2_cf32(f32.data(), absf_ref.data(), count);
+    check(SameOutput(absf, absf_ref), "abs2_cf32", count);
+
+    for (size_t taps : kTaps) {
+      const size_t in_size = count + taps - 1;
+      const std::vector<int16_t> in16 = KernelInput(2 * in_size, gen);
+      const std::vector<int16_t> seq16 = KernelInput(2 * taps, gen);
+      const std::vector<float> in32 = KernelInputF(2 * in_size, gen);
+      const std::vector<float> seq32 = KernelInputF(2 * taps, gen);
+      std::vector<int16_t> out16(2 * count), ref16(2 * count);
+      kernels.correlate_cs16(in16.data(), seq16.data(), taps, out16.data(),
+                             count);
+      ref.correlate_cs16(in16.data(), seq16.data(), taps, ref16.data(), count);
+      check(out16 == ref16, "correlate_cs16", count);
+      out16.resize(count);
+      ref16.resize(count);
+      kernels.correlate_s16(in16.data(), seq16.data(), taps, out16.data(),
+                            count);
+      ref.correlate_s16(in16.data(), seq16.data(), taps, ref16.data(), count);
+      check(out16 == ref16, "correlate_s16", count);
+      std::vector<float> out32(2 * count), ref32(2 * count);
+      kernels.correlate_cf32(in32.data(), seq32.data(), taps, out32.data(),
+                             count);
+      ref.correlate_cf32(in32.data(), seq32.data(), taps, ref32.data(), count);
+      check(SameOutput(out32, ref32), "correlate_cf32", count);
+      out32.resize(count);
+      ref32.resize(count);
+      kernels.correlate_f32(in32.data(), seq32.data(), taps, out32.data(),
+                            count);
+      ref.correlate_f32(in32.data(), seq32.data(), taps, ref32.data(), count);
+      check(SameOutput(out32, ref32), "correlate_f32", count);
+    }
+  }
+  return pass;
+}
+
+/* OfdmModulator against the per symbol pipeline it replaced in the data
+ * generator: CommsLib::modulate(), IFFT() and Utils::cfloat_to_cint16() */
+static bool CompareOfdmModulator(size_t fft_size, int mod_type) {
+  static constexpr size_t kSymbols = 3;
+  static constexpr size_t kPrefix = 7;
+  static constexpr size_t kPostfix = 5;
+  static constexpr float kTxScale = 0.25f;
+  const size_t cp_size = fft_size / 4;
+  const size_t data_sc_num = fft_size * 3 / 4;
+  const std::vector<size_t> data_sc =
+      CommsLib::getDataSc(fft_size, data_sc_num);
+  const std::vector<size_t> pilot_sc_ind =
+      CommsLib::getPilotScIndex(fft_size, data_sc_num);
+  const std::vector<std::complex<float>> pilot_sc =
+      CommsLib::getPilotScValue(fft_size, data_sc_num);
+  OfdmModulator modulator(fft_size, cp_size, kSymbols, kPrefix, kPostfix,
+                          data_sc, pilot_sc_ind, pilot_sc, mod_type, kTxScale);
+
+  // A stride past the values of a symbol, as the caller may have
+  const size_t bits_stride = data_sc.size() + 3;
+  std::vector<uint8_t> bits(kSymbols * bits_stride);
+  std::mt19937 gen(static_cast<unsigned>(fft_size * 10 + mod_type));
+  for (auto& value : bits) value = gen() % (1u << mod_type);
+  std::vector<std::complex<float>> freq(kSymbols * fft_size);
+  std::vector<std::complex<int16_t>> time(modulator.slot_samples());
+  const size_t saturated =
+      modulator.Modulate(bits.data(), bits_stride, freq.data(), time.data());
+
+  std::vector<std::complex<float>> ref_freq;
+  std::vector<std::complex<float>> ref_time(kPrefix, 0);
+  for (size_t s = 0; s < kSymbols; s++) {
+    const std::vector<uint8_t> sym_bits(
+        bits.begin() + s * bits_stride,
+        bits.begin() + s * bits_stride + data_sc.size());
+    const std::vector<std::complex<float>> mod_data =
+        CommsLib::modulate(sym_bits, mod_type);
+    std::vector<std::complex<float>> ofdm_sym(fft_size, 0);
+    for (size_t c = 0; c < data_sc.size(); c++) {
+      ofdm_sym[data_sc[c]] = mod_data[c];
+    }
+    for (size_t c = 0; c < pilot_sc_ind.size(); c++) {
+      ofdm_sym[pilot_sc_ind[c]] = pilot_sc[c];
+    }
+    auto tx_sym =
+        CommsLib::IFFT(ofdm_sym, fft_size, 1.f / fft_size, false, true);
+    tx_sym.insert(tx_sym.begin(), tx_sym.end() - cp_size, tx_sym.end());
+    ref_time.insert(ref_time.end(), tx_sym.begin(), tx_sym.end());
+    ref_freq.insert(ref_freq.end(), ofdm_sym.begin(), ofdm_sym.end());
+  }
+  ref_time.insert(ref_time.end(), kPostfix, 0);
+  for (auto& sample : ref_time) sample *= kTxScale;
+  const std::vector<std::complex<int16_t>> ref_cs16 =
+      Utils::cfloat_to_cint16(ref_time);
+
+  // Both scale by powers of two and tx_scale, so the samples are bit exact
+  return saturated == 0 && freq == ref_freq && time == ref_cs16;
+}
+
 int main() {
 #ifdef UNIT_TEST
   /*
@@ -196,6 +366,9 @@ int main() {
 
   auto testCorrResCF32 = CommsLib::correlate_avx(testDataCF32, testCorrSeqCF32);
   auto testCorrResCS16 = CommsLib::correlate_avx(testDataCS16, testCorrSeqCS16);
+  auto testCorrResFft = CommsLib::correlate(
+      testDataCF32, testCorrSeqCF32,
+      testDataCF32.size() + testCorrSeqCF32.size() - 1);
 
   //std::vector<std::complex<double>> testCorrSeq2;
   //std::vector<std::complex<double>> iq;
@@ -225,7 +398,8 @@ int main() {
     std::cout << "Float Op Result: " << testCorrResCF32[i]
               << ", INT Op Result: (" << testCorrResCS16[i].real() / 32768.0
               << "," << testCorrResCS16[i].imag() / 32768.0
-              << "), GT:" << testCorrRef[i] << std::endl;
+              << "), Engine Result: " << testCorrResFft[i]
+              << ", GT:" << testCorrRef[i] << std::endl;
   }
 
   std::cout << "\nTesting Real Correlate:\n";
@@ -256,6 +430,33 @@ int main() {
               << "), GT:" << testCorrRefReal[i] << std::endl;
   }
 #else
+  std::cout << "Testing the comms kernels against the scalar ones:\n";
+  for (SimdLevel level : {SimdLevel::kAvx2, SimdLevel::kAvx512}) {
+    const CommsKernels* kernels = CommsKernels::ForLevel(level);
+    if (kernels == nullptr) {
+      std::cout << CommsKernels::Name(level) << " not available" << std::endl;
+      continue;
+    }
+    const bool kernels_pass = CompareKernels(*kernels);
+    std::cout << CommsKernels::Name(level) << " TEST "
+              << (kernels_pass ? "PASSED" : "FAILED") << std::endl;
+  }
+
+  std::cout << "Testing OfdmModulator against modulate, IFFT and "
+               "cfloat_to_cint16:\n";
+  bool ofdm_pass = true;
+  for (size_t fft_size : {64, 128, 256, 512, 1024, 2048}) {
+    for (int mod_type :
+         {CommsLib::QPSK, CommsLib::QAM16, CommsLib::QAM64}) {
+      if (CompareOfdmModulator(fft_size, mod_type) == false) {
+        std::cout << "FFT size " << fft_size << ", modulation " << mod_type
+                  << " differs" << std::endl;
+        ofdm_pass = false;
+      }
+    }
+  }
+  std::cout << "TEST " << (ofdm_pass ? "PASSED" : "FAILED") << std::endl;
+
   /*
      * test findBeacon
      */
@@ -320,6 +521,47 @@ int main() {
                                                              : "FAILED")
             << std::endl;
   std::cout << "Correlation took " << diff << " usec" << std::endl;
+
+  std::cout << "Testing fixed point BeaconDetector:\n";
+  std::vector<std::complex<int16_t>> buffs_ci16(buffs.size());
+  for (size_t i = 0; i < buffs.size(); i++) {
+    buffs_ci16[i] = std::complex<int16_t>(
+        static_cast<int16_t>(buffs[i].real() * SHRT_MAX),
+        static_cast<int16_t>(buffs[i].imag() * SHRT_MAX));
+  }
+  BeaconDetector float_detector(gold_sym_orig, buffs.size(), false);
+  BeaconDetector fixed_detector(gold_sym_orig, buffs.size(), true);
+  const ssize_t float_index =
+      float_detector.Push(buffs_ci16.data(), buffs_ci16.size(), 1.f);
+  const ssize_t fixed_index =
+      fixed_detector.Push(buffs_ci16.data(), buffs_ci16.size(), 1.f);
+  std::cout << "Float index " << float_index << ", fixed point index "
+            << fixed_index << std::endl;
+  std::cout << "TEST "
+            << ((float_index == sync_index && fixed_index == sync_index)
+                    ? "PASSED"
+                    : "FAILED")
+            << std::endl;
+
+  std::cout << "Testing BeaconDetector with the beacon split over two "
+               "pushes:\n";
+  // Split in the middle of the beacon, which is then found in the second
+  const size_t split = prefix + beaconSize / 2;
+  bool split_passed = true;
+  for (bool fixed_point : {false, true}) {
+    BeaconDetector split_detector(gold_sym_orig, buffs.size(), fixed_point);
+    const ssize_t first_index =
+        split_detector.Push(buffs_ci16.data(), split, 1.f);
+    const ssize_t second_index = split_detector.Push(
+        buffs_ci16.data() + split, buffs_ci16.size() - split, 1.f);
+    std::cout << (fixed_point ? "Fixed point" : "Float") << " indices "
+              << first_index << ", " << second_index << std::endl;
+    if (first_index != -1 ||
+        second_index + static_cast<ssize_t>(split) != sync_index) {
+      split_passed = false;
+    }
+  }
+  std::cout << "TEST " << (split_passed ? "PASSED" : "FAILED") << std::endl;
 #else
   size_t symbolsPerFrame = 5;
   size_t sampsPerSymbol = 790;
@@ -329,6 +571,11 @@ int main() {
   std::string filename = "beacon.bin";
   FILE* fp = fopen(filename.c_str(), "rb");
   std::vector<int> index(samps_per_frame);
+  // Both stream detectors run on the trace as cs16 and must agree
+  std::vector<std::complex<int16_t>> buff0_ci16(samps_per_frame);
+  BeaconDetector float_detector(gold_sym_orig, samps_per_frame, false);
+  BeaconDetector fixed_detector(gold_sym_orig, samps_per_frame, true);
+  size_t detector_mismatch = 0;
   for (size_t i = 0; i < num_frames; i++) {
     size_t bytes = fread(buff0.data(), sizeof(float) * 2, samps_per_frame, fp);
     if (bytes < samps_per_frame) {
@@ -337,12 +584,23 @@ int main() {
     }
     int sync_index = CommsLib::find_beacon_avx(buff0, gold_sym_orig, 1.f);
     if (sync_index >= 0 && sync_index < samps_per_frame) index[sync_index]++;
+    for (size_t s = 0; s < samps_per_frame; s++) {
+      buff0_ci16[s] = std::complex<int16_t>(
+          static_cast<int16_t>(buff0[s].real() * SHRT_MAX),
+          static_cast<int16_t>(buff0[s].imag() * SHRT_MAX));
+    }
+    if (float_detector.Push(buff0_ci16.data(), samps_per_frame, 1.f) !=
+        fixed_detector.Push(buff0_ci16.data(), samps_per_frame, 1.f)) {
+      detector_mismatch++;
+    }
     printf("Frame: %zu, sync_idx: %zu, total_idx: %d\n", i, sync_index,
            (sync_index + i * samps_per_frame));
   }
   for (size_t i = 0; i < samps_per_frame; i++) {
     if (index[i] > 0) printf("SYNC_INDEX %d: %zu times\n", index[i], i);
   }
+  printf("Fixed point detector differs from float in %zu frames\n",
+         detector_mismatch);
   fclose(fp);
 #endif
 #endif
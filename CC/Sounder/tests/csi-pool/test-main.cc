@@ -0,0 +1,119 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ CSI job pool test: without a staging arena the recorder thread both
+ submits pilots to the CSI threads and releases their finished jobs. A
+ direct ring holding far more pilots than the pool has jobs is drained
+ in one pass, which must not wait forever for a free job.
+ Build: cmake -S . -B build && cmake --build build && ./build/csi-pool-test
+---------------------------------------------------------------------
+*/
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "include/config.h"
+#include "include/recorder_thread.h"
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+// Several times the jobs of the recorder's CSI pool
+static constexpr size_t kPilots = 4096;
+static constexpr size_t kPilotSlots = 2;
+static constexpr std::chrono::seconds kTimeout(60);
+
+static std::string WriteTestConfig(const std::string& dir) {
+  json topology;
+  topology["BaseStations"]["BS0"]["sdr"] = {"TEST0"};
+  topology["Clients"]["sdr"] = {"TESTCL0"};
+  const std::string topology_file = dir + "/csi-pool-topology.json";
+  std::ofstream(topology_file) << topology.dump(2);
+
+  json conf;
+  conf["serial_file"] = topology_file;
+  conf["channel"] = "A";
+  conf["frame_schedule"] = {"BG" + std::string(kPilotSlots, 'P') + "G"};
+  conf["ue_channel"] = "A";
+  conf["ue_rx_gain_a"] = {65};
+  conf["ue_tx_gain_a"] = {81};
+  conf["ue_rx_gain_b"] = {65};
+  conf["ue_tx_gain_b"] = {81};
+  conf["ue_frame_schedule"] = {"GG" + std::string(kPilotSlots, 'P') + "G"};
+  conf["max_frame"] = 0;
+  conf["ofdm_symbol_per_slot"] = 10;
+  conf["fft_size"] = 64;
+  conf["cp_size"] = 16;
+  conf["csi_extraction"] = true;
+  conf["csi_thread_num"] = 1;
+  conf["record_staging_mb"] = 0;
+  conf["trace_file"] = dir + "/csi-pool-trace.hdf5";
+  const std::string conf_file = dir + "/csi-pool-conf.json";
+  std::ofstream(conf_file) << conf.dump(2);
+  return conf_file;
+}
+
+int main(int argc, char* argv[]) {
+  const std::string dir = argc > 1 ? argv[1] : ".";
+  Config cfg(WriteTestConfig(dir), dir, true, false, false);
+
+  const size_t packet_length = sizeof(Packet) + cfg.getPacketDataLength();
+  SampleBuffer buffer;
+  buffer.buffer.Allocate(kPilots * packet_length, kHugePageNone, -1);
+  buffer.pkt_buf_inuse = nullptr;
+  buffer.slots = new SlotRing(kPilots);
+
+  auto recorder = std::make_unique<Sounder::RecorderThread>(
+      &cfg, 0, -1, kPilots, 0, cfg.bs_sdr_ch());
+  recorder->AttachDirectRings(&buffer, kPilots, {kPilots});
+  // All pilots are queued before the recorder starts draining the ring
+  for (size_t i = 0; i < kPilots; i++) {
+    size_t slot;
+    if (buffer.slots->Reserve(slot) == false) {
+      std::printf("FAIL: cannot reserve packet %zu\n", i);
+      return EXIT_FAILURE;
+    }
+    const size_t frame_id = i / kPilotSlots;
+    const size_t slot_id = 2 + i % kPilotSlots;
+    new (buffer.buffer.data() + slot * packet_length)
+        Packet(frame_id, slot_id, 0, 0);
+    RecordDescriptor desc;
+    desc.offset = slot;
+    desc.node_type = kBS;
+    desc.seq = buffer.slots->seq(slot);
+    if (recorder->DirectRing(0)->TryPush(desc) == false) {
+      std::printf("FAIL: direct ring full at packet %zu\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::atomic<bool> done(false);
+  std::thread watchdog([&done]() {
+    const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (done.load() == false) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        std::printf("FAIL: recorder still waiting for a CSI job after %lld s\n",
+                    static_cast<long long>(kTimeout.count()));
+        std::fflush(stdout);
+        _exit(EXIT_FAILURE);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+  recorder->Start();
+  recorder.reset();  // Stop() and join once the ring and the CSI are done
+  done.store(true);
+  watchdog.join();
+  delete buffer.slots;
+  std::printf("PASS: %zu pilots through the CSI pool\n", kPilots);
+  return EXIT_SUCCESS;
+}
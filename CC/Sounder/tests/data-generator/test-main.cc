@@ -0,0 +1,145 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ DataGenerator test: the UL and DL data files of a fixed data_gen_seed
+ have to be the same whether one thread or several write them. A file
+ that cannot be created has to fail the generation without leaving the
+ files opened before it open.
+ Build: cmake -S . -B build && cmake --build build &&
+        ./build/data-generator-test
+---------------------------------------------------------------------
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "include/config.h"
+#include "include/data_generator.h"
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+static constexpr size_t kThreads = 4;
+static constexpr size_t kFrames = 37;
+
+static size_t g_errors = 0;
+
+static void Fail(const std::string& what) {
+  if (g_errors++ < 10) std::printf("FAIL: %s\n", what.c_str());
+}
+
+static std::string WriteTestConfig(const std::string& dir, size_t threads) {
+  json topology;
+  topology["BaseStations"]["BS0"]["sdr"] = {"TEST0", "TEST1"};
+  topology["Clients"]["sdr"] = {"TESTCL0"};
+  const std::string topology_file = dir + "/data-generator-topology.json";
+  std::ofstream(topology_file) << topology.dump(2);
+
+  json conf;
+  conf["serial_file"] = topology_file;
+  conf["channel"] = "AB";
+  conf["frame_schedule"] = {"BGPGUGDG"};
+  conf["ue_channel"] = "A";
+  conf["ue_rx_gain_a"] = {65};
+  conf["ue_tx_gain_a"] = {81};
+  conf["ue_rx_gain_b"] = {65};
+  conf["ue_tx_gain_b"] = {81};
+  conf["ue_frame_schedule"] = {"GGPGUGDG"};
+  conf["ofdm_symbol_per_slot"] = 10;
+  conf["fft_size"] = 64;
+  conf["cp_size"] = 16;
+  conf["ue_modulation"] = "16QAM";
+  conf["modulation"] = "64QAM";
+  conf["ul_data_frame_num"] = kFrames;
+  conf["dl_data_frame_num"] = kFrames;
+  conf["data_gen_seed"] = 7;
+  conf["data_gen_threads"] = threads;
+  const std::string conf_file =
+      dir + "/data-generator-conf-" + std::to_string(threads) + ".json";
+  std::ofstream(conf_file) << conf.dump(2);
+  return conf_file;
+}
+
+static std::vector<std::string> ListFiles(const std::string& path) {
+  std::vector<std::string> names;
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) return names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  return names;
+}
+
+static std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+static std::string Generate(const std::string& dir, size_t threads) {
+  const std::string out = dir + "/data-generator-" + std::to_string(threads);
+  mkdir(out.c_str(), 0755);
+  Config cfg(WriteTestConfig(dir, threads), out, false, false, false);
+  DataGenerator(&cfg).GenerateData(out);
+  return out;
+}
+
+int main(int argc, char* argv[]) {
+  const std::string dir = argc > 1 ? argv[1] : ".";
+
+  // The same files from one and from several threads
+  const std::string single = Generate(dir, 1);
+  const std::string multi = Generate(dir, kThreads);
+  std::vector<std::string> names = ListFiles(single);
+  // 3 UL files of the client and 3 DL files of each of the two radios
+  if (names.size() != 9) {
+    Fail("expected 9 files, got " + std::to_string(names.size()));
+  }
+  std::string ul_time_file;
+  for (const auto& name : names) {
+    if (name.find(".bin") == std::string::npos) continue;
+    if (name.compare(0, 10, "ul_data_t_") == 0) ul_time_file = name;
+    const std::string one = ReadFile(single + "/" + name);
+    if (one.empty() == true) Fail(name + " is empty");
+    if (ReadFile(multi + "/" + name) != one) {
+      Fail(name + " differs with " + std::to_string(kThreads) + " threads");
+    }
+  }
+
+  // A directory in the way of the UL time-domain file, which is opened
+  // after the UL bits and frequency-domain files
+  const std::string blocked = dir + "/data-generator-blocked";
+  mkdir(blocked.c_str(), 0755);
+  mkdir((blocked + "/" + ul_time_file).c_str(), 0755);
+  const size_t open_fds = ListFiles("/proc/self/fd").size();
+  bool thrown = false;
+  try {
+    Config cfg(WriteTestConfig(dir, 1), blocked, false, false, false);
+    DataGenerator(&cfg).GenerateData(blocked);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  if (thrown == false) Fail("blocked file did not fail the generation");
+  if (ListFiles("/proc/self/fd").size() != open_fds) {
+    Fail("files left open after the failure");
+  }
+
+  if (g_errors > 0) {
+    std::printf("FAIL: %zu errors\n", g_errors);
+    return EXIT_FAILURE;
+  }
+  std::printf("PASS: %zu files the same with 1 and %zu threads\n",
+              names.size(), kThreads);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Pipeline throughput bench: synthetic rx packets -> Scheduler dispatch
+ -> RecorderThreads -> Hdf5Lib, without any radios.
+ Build: make sounder_pipeline_bench
+ Run:   ./sounder_pipeline_bench -antennas 64 -pilot_slots 8 -rate 5e6
+---------------------------------------------------------------------
+*/
+
+#include <gflags/gflags.h>
+
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "include/config.h"
+#include "include/scheduler.h"
+#include "include/signalHandler.hpp"
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+DEFINE_uint64(antennas, 64, "Number of BS antennas (2 per synthetic radio)");
+DEFINE_uint64(pilot_slots, 8, "Pilot slots per frame");
+DEFINE_uint64(ul_slots, 0, "Uplink data slots per frame");
+DEFINE_uint64(guard_slots, 8, "Guard slots per frame (not recorded)");
+DEFINE_uint64(symbols_per_slot, 1, "OFDM symbols per slot");
+DEFINE_uint64(fft_size, 64, "FFT size");
+DEFINE_uint64(cp_size, 16, "Cyclic prefix length");
+DEFINE_double(rate, 5e6, "Sample rate used to pace producers, 0 = unpaced");
+DEFINE_uint64(frames, 2000, "Number of frames to produce");
+DEFINE_uint64(recorder_threads, 1, "Number of recorder threads");
+DEFINE_string(overload_policy, "drop_newest",
+              "abort, drop_newest, drop_oldest_unrecorded or decimate_frames");
+DEFINE_bool(direct_record, false,
+            "Rx threads feed the recorder rings, bypassing the dispatcher");
+DEFINE_string(buffer_layout, "packet", "Rx buffer layout: packet or frame");
+DEFINE_uint64(report_ms, 1000, "Progress report interval in ms");
+DEFINE_string(storepath, "logs", "Dataset store path");
+
+static std::string WriteBenchConfig(void) {
+  json topology;
+  json sdrs = json::array();
+  for (size_t i = 0; i < (FLAGS_antennas + 1) / 2; i++) {
+    sdrs.push_back("BENCH" + std::to_string(i));
+  }
+  topology["BaseStations"]["BS0"]["sdr"] = sdrs;
+  const std::string topology_file = FLAGS_storepath + "/bench-topology.json";
+  std::ofstream(topology_file) << topology.dump(2);
+
+  json conf;
+  conf["serial_file"] = topology_file;
+  conf["channel"] = "AB";
+  conf["sample_rate"] = FLAGS_rate > 0 ? FLAGS_rate : 5e6;
+  conf["frame_schedule"] = {"BG" + std::string(FLAGS_pilot_slots, 'P') +
+                            std::string(FLAGS_ul_slots, 'U') +
+                            std::string(FLAGS_guard_slots, 'G')};
+  conf["max_frame"] = FLAGS_frames;
+  conf["ofdm_symbol_per_slot"] = FLAGS_symbols_per_slot;
+  conf["fft_size"] = FLAGS_fft_size;
+  conf["cp_size"] = FLAGS_cp_size;
+  conf["recorder_thread"] = FLAGS_recorder_threads;
+  conf["direct_record"] = FLAGS_direct_record;
+  conf["overload_policy"] = FLAGS_overload_policy;
+  conf["buffer_layout"] = FLAGS_buffer_layout;
+  conf["trace_file"] = FLAGS_storepath + "/bench-trace.hdf5";
+  const std::string conf_file = FLAGS_storepath + "/bench-conf.json";
+  std::ofstream(conf_file) << conf.dump(2);
+  return conf_file;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage(
+      "sounder_pipeline_bench Options: -antennas -pilot_slots -ul_slots "
+      "-rate -frames -recorder_threads -direct_record -overload_policy "
+      "-storepath");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = std::make_unique<Config>(WriteBenchConfig(), FLAGS_storepath,
+                                         true, false, false);
+  synth_unpaced = (FLAGS_rate <= 0);
+  SignalHandler signalHandler;
+  signalHandler.setupSignalHandlers();
+
+  auto scheduler = std::make_unique<Sounder::Scheduler>(config.get());
+  const Sounder::PipelineStats& stats = scheduler->stats();
+  const size_t packet_length =
+      sizeof(Packet) + config->getPacketDataLength();
+
+  // Stop the scheduler once every produced packet has been recorded
+  std::thread monitor([&]() {
+    size_t last_recorded = 0;
+    auto last = std::chrono::steady_clock::now();
+    while (config->running() == true &&
+           SignalHandler::gotExitSignal() == false) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_report_ms));
+      const auto now = std::chrono::steady_clock::now();
+      const double sec = std::chrono::duration<double>(now - last).count();
+      const size_t recorded = stats.recorded_packets.load();
+      std::printf(
+          "[%7.1f s] %.0f pkts/s, %.3f GB/s, buffer full %zu, queue depth "
+          "max: dispatch %zu record %zu\n",
+          stats.ElapsedSec(), (recorded - last_recorded) / sec,
+          (recorded - last_recorded) * packet_length / sec / 1e9,
+          stats.buffer_full_events.load(),
+          stats.max_message_queue_depth.load(),
+          stats.max_record_queue_depth.load());
+      last_recorded = recorded;
+      last = now;
+      if (stats.rx_threads_done.load() == config->bs_rx_thread_num() &&
+          recorded + stats.revoked_packets.load() >=
+              stats.rx_packets.load()) {
+        config->running(false);
+      }
+    }
+  });
+
+  int ret = EXIT_SUCCESS;
+  try {
+    scheduler->do_it();
+  } catch (const std::exception& exc) {
+    std::cerr << "Bench terminated due to " << exc.what() << std::endl;
+    config->running(false);
+    ret = EXIT_FAILURE;
+  }
+  monitor.join();
+  gflags::ShutDownCommandLineFlags();
+  return ret;
+}
@@ -0,0 +1,229 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ SlotRing stress test: one producer, several consumers releasing single
+ packets and whole frames out of order, then a revocable ring where the
+ producer takes back queued packets instead of waiting. Fails on any
+ overwrite of an unreleased slot, double release or lost packet.
+ Build: cmake -S . -B build && cmake --build build && ./build/slot-ring-test
+---------------------------------------------------------------------
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "slot_ring.h"
+#include "spsc_ring.h"
+
+static constexpr size_t kCapacity = 37;  // deliberately not a power of two
+static constexpr size_t kConsumers = 3;
+static constexpr size_t kFramePackets = 8;
+
+struct Message {
+  size_t slot;   // first slot
+  size_t pos;    // reservation sequence number of the first slot
+  size_t count;  // packets released together
+};
+
+static std::atomic<size_t> g_errors(0);
+
+static void Fail(const char* what, size_t slot, size_t pos) {
+  if (g_errors++ < 10) {
+    std::printf("FAIL: %s, slot %zu position %zu\n", what, slot, pos);
+  }
+}
+
+static void ReleaseTest(size_t frames) {
+  SlotRing ring(kCapacity);
+  std::vector<size_t> payload(kCapacity);
+  std::vector<std::atomic<int>> owned(kCapacity);
+  for (auto& o : owned) o = 0;
+  std::vector<std::unique_ptr<SpscRing<Message>>> queues;
+  for (size_t i = 0; i < kConsumers; i++) {
+    queues.emplace_back(std::make_unique<SpscRing<Message>>(kCapacity));
+  }
+  std::atomic<bool> done(false);
+  std::atomic<size_t> released(0);
+
+  std::vector<std::thread> consumers;
+  for (size_t c = 0; c < kConsumers; c++) {
+    consumers.emplace_back([&, c]() {
+      std::mt19937 rng(c);
+      Message msg;
+      while (true) {
+        if (queues[c]->TryPop(msg) == false) {
+          if (done.load() == true && queues[c]->SizeApprox() == 0) break;
+          std::this_thread::yield();
+          continue;
+        }
+        // Hold on to the packets for a while so releases interleave
+        if ((rng() & 7) == 0) std::this_thread::yield();
+        for (size_t i = 0; i < msg.count; i++) {
+          const size_t slot = (msg.slot + i) % kCapacity;
+          if (payload[slot] != msg.pos + i) {
+            Fail("slot overwritten before release", slot, msg.pos + i);
+          }
+          if (owned[slot].exchange(0) != 1) {
+            Fail("slot released twice", slot, msg.pos + i);
+          }
+        }
+        if (msg.count == 1) {
+          ring.Release(msg.slot);
+        } else {
+          ring.ReleaseRange(msg.slot, msg.count);
+        }
+        released += msg.count;
+      }
+    });
+  }
+
+  size_t pos = 0;
+  size_t full = 0;
+  for (size_t frame = 0; frame < frames && g_errors == 0; frame++) {
+    // Every fifth frame the producer reserves and cancels a few slots first
+    if (frame % 5 == 1) {
+      size_t reserved = 0;
+      size_t slot;
+      while (reserved < 2 && ring.Reserve(slot) == true) {
+        if (owned[slot].exchange(1) != 0) Fail("reserved a used slot", slot, 0);
+        owned[slot] = 0;
+        reserved++;
+      }
+      ring.Cancel(reserved);
+    }
+
+    size_t first_slot = 0;
+    for (size_t p = 0; p < kFramePackets; p++) {
+      size_t slot;
+      while (ring.Reserve(slot) == false) {
+        full++;
+        std::this_thread::yield();
+      }
+      if (p == 0) {
+        first_slot = slot;
+      } else if (slot != (first_slot + p) % kCapacity) {
+        Fail("reservations not contiguous", slot, pos + p);
+      }
+      if (owned[slot].exchange(1) != 0) Fail("reserved a used slot", slot, pos);
+      payload[slot] = pos + p;
+    }
+
+    // Every third frame is released whole by one consumer, the others one
+    // packet at a time by the consumer owning that "antenna"
+    if (frame % 3 == 0) {
+      Message msg{first_slot, pos, kFramePackets};
+      while (queues[frame % kConsumers]->TryPush(msg) == false) {
+        std::this_thread::yield();
+      }
+    } else {
+      for (size_t p = 0; p < kFramePackets; p++) {
+        Message msg{(first_slot + p) % kCapacity, pos + p, 1};
+        while (queues[p % kConsumers]->TryPush(msg) == false) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    pos += kFramePackets;
+  }
+  done = true;
+  for (auto& t : consumers) t.join();
+
+  if (released != pos) {
+    std::printf("FAIL: released %zu of %zu packets\n", released.load(), pos);
+    g_errors++;
+  }
+  // Everything is free again: a whole lap must be reservable
+  for (size_t i = 0; i < kCapacity; i++) {
+    size_t slot;
+    if (ring.Reserve(slot) == false) {
+      std::printf("FAIL: slot %zu not free after all releases\n", i);
+      g_errors++;
+      break;
+    }
+  }
+
+  std::printf("release: %zu packets in %zu frames, ring full %zu times\n",
+              pos, frames, full);
+}
+
+// Every packet must end up either recorded or revoked, never both
+static void RevokeTest(size_t packets) {
+  SlotRing ring(kCapacity, true);
+  std::vector<size_t> payload(kCapacity);
+  std::vector<std::atomic<int>> fate(packets);
+  for (auto& f : fate) f = 0;  // 1 recorded, 2 revoked
+  std::vector<std::unique_ptr<SpscRing<Message>>> queues;
+  for (size_t i = 0; i < kConsumers; i++) {
+    queues.emplace_back(std::make_unique<SpscRing<Message>>(kCapacity));
+  }
+  std::atomic<bool> done(false);
+
+  std::vector<std::thread> consumers;
+  for (size_t c = 0; c < kConsumers; c++) {
+    consumers.emplace_back([&, c]() {
+      std::mt19937 rng(c);
+      Message msg;
+      while (true) {
+        if (queues[c]->TryPop(msg) == false) {
+          if (done.load() == true && queues[c]->SizeApprox() == 0) break;
+          std::this_thread::yield();
+          continue;
+        }
+        // Fall behind now and then so the producer starts revoking
+        if ((rng() & 3) == 0) std::this_thread::yield();
+        if (ring.Claim(msg.slot, msg.pos) == false) continue;
+        if (payload[msg.slot] != msg.pos) {
+          Fail("claimed slot overwritten", msg.slot, msg.pos);
+        }
+        if (fate[msg.pos].exchange(1) != 0) {
+          Fail("revoked packet recorded", msg.slot, msg.pos);
+        }
+        ring.Release(msg.slot);
+      }
+    });
+  }
+
+  size_t revoked = 0;
+  for (size_t p = 0; p < packets && g_errors == 0; p++) {
+    size_t slot;
+    while (ring.Reserve(slot) == false) {
+      size_t victim;
+      if (ring.RevokeOldest(victim) == true) {
+        if (fate[payload[victim]].exchange(2) != 0) {
+          Fail("recorded packet revoked", victim, payload[victim]);
+        }
+        revoked++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    if (ring.seq(slot) != p) Fail("unexpected sequence", slot, p);
+    payload[slot] = p;
+    Message msg{slot, p, 1};
+    while (queues[p % kConsumers]->TryPush(msg) == false) {
+      std::this_thread::yield();
+    }
+  }
+  done = true;
+  for (auto& t : consumers) t.join();
+
+  for (size_t p = 0; p < packets; p++) {
+    if (fate[p] == 0) Fail("packet lost", p % kCapacity, p);
+  }
+  std::printf("revoke: %zu packets, %zu revoked\n", packets, revoked);
+}
+
+int main(int argc, char* argv[]) {
+  const size_t frames = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000;
+  ReleaseTest(frames);
+  RevokeTest(frames * kFramePackets);
+  std::printf("%s\n", g_errors == 0 ? "PASSED" : "FAILED");
+  return g_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
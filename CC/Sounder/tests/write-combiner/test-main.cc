@@ -0,0 +1,142 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ WriteCombiner test: stages the packets of a two cell dataset into an
+ HDF5 file. A frame has to be written as soon as its last packet of every
+ cell arrives and not before, packets of frames on disk already have to
+ be written on their own, and an incomplete frame has to be written after
+ the timeout with its missing packets left zero. The file is read back
+ and every sample compared.
+ Build: cmake -S . -B build && cmake --build build &&
+        ./build/write-combiner-test
+---------------------------------------------------------------------
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "H5Cpp.h"
+#include "hdf5_lib.h"
+#include "write_combiner.h"
+
+static constexpr hsize_t kFrames = 4;
+static constexpr hsize_t kCells = 2;
+static constexpr hsize_t kSlots = 2;
+static constexpr hsize_t kAntennas = 3;
+static constexpr hsize_t kIq = 8;
+static constexpr size_t kFramePackets = kCells * kSlots * kAntennas;
+static constexpr std::chrono::milliseconds kTimeout(200);
+static const char kDataset[] = "Pilot_Samples";
+
+static size_t g_errors = 0;
+
+static void Fail(const char* what, hsize_t frame) {
+  if (g_errors++ < 10) std::printf("FAIL: %s, frame %llu\n", what, frame);
+}
+
+// First sample of a packet tells where it belongs, the rest its index
+static std::vector<short> Packet(hsize_t frame, hsize_t cell, hsize_t slot,
+                                 hsize_t ant) {
+  std::vector<short> packet(kIq);
+  for (size_t i = 0; i < kIq; i++) {
+    packet[i] = static_cast<short>(
+        i == 0 ? 1000 * frame + 100 * cell + 10 * slot + ant + 1 : i);
+  }
+  return packet;
+}
+
+// Stages the packets of a frame with an index in [begin, end) in order
+static void StageFrame(Sounder::WriteCombiner& combiner, size_t ds_id,
+                       hsize_t frame, size_t begin, size_t end) {
+  for (hsize_t cell = 0; cell < kCells; cell++) {
+    for (hsize_t slot = 0; slot < kSlots; slot++) {
+      for (hsize_t ant = 0; ant < kAntennas; ant++) {
+        const size_t index = (cell * kSlots + slot) * kAntennas + ant;
+        if (index < begin || index >= end) continue;
+        std::vector<short> packet = Packet(frame, cell, slot, ant);
+        combiner.Stage(ds_id, frame, cell, slot, ant, packet.data());
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  const std::string file =
+      std::string(argc > 1 ? argv[1] : ".") + "/write-combiner-test.hdf5";
+  const std::array<hsize_t, kDsDimsNum> dims = {
+      kFrames, kCells, kSlots, kAntennas, kIq};
+  {
+    Sounder::Hdf5Lib hdf5(file, "Data");
+    hdf5.createDataset(kDataset, dims, {1, 1, 1, 1, kIq});
+    hdf5.openDataset();
+    Sounder::WriteCombiner combiner(&hdf5, kTimeout, 2);
+    // As the recorder and sounder-convert register their datasets
+    const size_t ds_id =
+        combiner.AddDataset(kDataset, dims, dims[1] * dims[2] * dims[3]);
+
+    // Complete frames go out with their last packet, not earlier
+    for (hsize_t frame = 0; frame < 2; frame++) {
+      StageFrame(combiner, ds_id, frame, 0, kFramePackets - 1);
+      if (combiner.pending() == false) Fail("frame written early", frame);
+      StageFrame(combiner, ds_id, frame, kFramePackets - 1, kFramePackets);
+      if (combiner.pending() == true) Fail("complete frame pending", frame);
+    }
+
+    // A late packet of frame 0 is written on its own, over the same value
+    std::vector<short> late = Packet(0, 1, 1, 2);
+    combiner.Stage(ds_id, 0, 1, 1, 2, late.data());
+    if (combiner.pending() == true) Fail("late packet opened a frame", 0);
+
+    // Frame 2 misses its last packet and is only written after the timeout
+    const auto start = std::chrono::steady_clock::now();
+    StageFrame(combiner, ds_id, 2, 0, kFramePackets - 1);
+    combiner.FlushExpired();
+    if (std::chrono::steady_clock::now() - start < kTimeout &&
+        combiner.pending() == false) {
+      Fail("incomplete frame written before the timeout", 2);
+    }
+    std::this_thread::sleep_for(kTimeout);
+    combiner.FlushExpired();
+    if (combiner.pending() == true) Fail("expired frame still pending", 2);
+    combiner.FlushAll();
+    hdf5.closeDataset();
+  }
+
+  H5::H5File h5(file, H5F_ACC_RDONLY);
+  H5::DataSet ds = h5.openDataSet(std::string("/Data/") + kDataset);
+  hsize_t file_dims[kDsDimsNum];
+  ds.getSpace().getSimpleExtentDims(file_dims);
+  if (file_dims[0] != 3) Fail("wrong number of frames", file_dims[0]);
+  std::vector<short> samples(3 * kFramePackets * kIq);
+  ds.read(samples.data(), H5::PredType::NATIVE_INT16);
+  for (hsize_t frame = 0; frame < 3; frame++) {
+    for (size_t index = 0; index < kFramePackets; index++) {
+      const hsize_t ant = index % kAntennas;
+      const hsize_t slot = index / kAntennas % kSlots;
+      const hsize_t cell = index / (kAntennas * kSlots);
+      const short* got = samples.data() + (frame * kFramePackets + index) * kIq;
+      const bool missing = frame == 2 && index == kFramePackets - 1;
+      const std::vector<short> want = Packet(frame, cell, slot, ant);
+      for (size_t i = 0; i < kIq; i++) {
+        if (got[i] != (missing ? 0 : want[i])) {
+          Fail("wrong sample in the file", frame);
+          break;
+        }
+      }
+    }
+  }
+  std::remove(file.c_str());
+
+  if (g_errors > 0) {
+    std::printf("FAIL: %zu errors\n", g_errors);
+    return EXIT_FAILURE;
+  }
+  std::printf("PASS: complete, late and timed out frames\n");
+  return EXIT_SUCCESS;
+}
@@ -26,6 +26,23 @@ int pin_thread_to_core(int core_id, pthread_t& thread_to_pin) {
   return pthread_setaffinity_np(thread_to_pin, sizeof(cpu_set_t), &cpuset);
 }
 
+int pin_thread_to_cores(int first_core, int num_cores,
+                        pthread_t& thread_to_pin) {
+  int online_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (first_core < 0 || num_cores <= 0 ||
+      first_core + num_cores > online_cores) {
+    return -1;
+  }
+
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int core_id = first_core; core_id < first_core + num_cores; core_id++) {
+    CPU_SET(core_id, &cpuset);
+  }
+
+  return pthread_setaffinity_np(thread_to_pin, sizeof(cpu_set_t), &cpuset);
+}
+
 std::vector<size_t> Utils::strToChannels(const std::string& channel) {
   std::vector<size_t> channels;
   if (channel == "A")
@@ -0,0 +1,166 @@
+/*
+ Copyright (c) 2018-2022, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Implementation of the recorder frame write combiner
+---------------------------------------------------------------------
+*/
+
+#include "include/write_combiner.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "include/logger.h"
+
+namespace Sounder {
+
+WriteCombiner::WriteCombiner(Hdf5Lib* hdf5, std::chrono::milliseconds timeout,
+                             size_t max_open_frames,
+                             ChunkCompressor* compressor)
+    : hdf5_(hdf5),
+      compressor_(compressor),
+      timeout_(timeout),
+      max_open_frames_(std::max<size_t>(max_open_frames, 1)),
+      open_blocks_(0),
+      blocks_written_(0),
+      direct_writes_(0) {}
+
+size_t WriteCombiner::AddDataset(const std::string& name,
+                                 const std::array<hsize_t, kDsDimsNum>& dims,
+                                 size_t expected_packets,
+                                 size_t compressor_id) {
+  Dataset ds;
+  ds.name = name;
+  ds.dims = dims;
+  ds.expected_packets = expected_packets;
+  ds.compressor_id = this->compressor_ != nullptr ? compressor_id
+                                                  : kUncompressed;
+  ds.written_until = 0;
+  ds.written_any = false;
+  this->datasets_.push_back(std::move(ds));
+  return this->datasets_.size() - 1;
+}
+
+void WriteCombiner::Stage(size_t ds_id, hsize_t frame_id, hsize_t cell_id,
+                          hsize_t slot, hsize_t antenna, short* data) {
+  Dataset& ds = this->datasets_.at(ds_id);
+  if (cell_id >= ds.dims[1] || slot >= ds.dims[2] || antenna >= ds.dims[3]) {
+    this->WriteDirect(ds, frame_id, cell_id, slot, antenna, data);
+    return;
+  }
+
+  size_t block = 0;
+  while (block < ds.open.size() && ds.open[block].frame_id != frame_id) {
+    block++;
+  }
+  if (block == ds.open.size()) {
+    if (ds.written_any == true && frame_id <= ds.written_until) {
+      // Late packet of a frame that is on disk already
+      this->WriteDirect(ds, frame_id, cell_id, slot, antenna, data);
+      return;
+    }
+    // A new frame starts: make room and retire timed out frames first
+    this->FlushExpired();
+    if (ds.open.size() >= this->max_open_frames_) {
+      size_t oldest = 0;
+      for (size_t i = 1; i < ds.open.size(); i++) {
+        if (ds.open[i].frame_id < ds.open[oldest].frame_id) oldest = i;
+      }
+      this->Flush(ds, oldest);
+    }
+    const size_t block_samples = ds.dims[1] * ds.dims[2] * ds.dims[3] *
+                                 ds.dims[4];
+    Block new_block;
+    new_block.frame_id = frame_id;
+    new_block.packets = 0;
+    new_block.first = std::chrono::steady_clock::now();
+    if (this->spare_.empty() == false) {
+      new_block.samples = std::move(this->spare_.back());
+      this->spare_.pop_back();
+    }
+    // Packets that never arrive stay zero, the dataset fill value
+    new_block.samples.assign(block_samples, 0);
+    ds.open.push_back(std::move(new_block));
+    this->open_blocks_++;
+    block = ds.open.size() - 1;
+  }
+
+  Block& cur = ds.open[block];
+  const size_t iq = ds.dims[4];
+  const size_t packet_index = (cell_id * ds.dims[2] + slot) * ds.dims[3] +
+                              antenna;
+  std::memcpy(cur.samples.data() + packet_index * iq, data,
+              iq * sizeof(short));
+  if (++cur.packets >= ds.expected_packets) {
+    this->Flush(ds, block);
+  }
+}
+
+void WriteCombiner::FlushExpired(void) {
+  if (this->open_blocks_ == 0) return;
+  const auto now = std::chrono::steady_clock::now();
+  for (auto& ds : this->datasets_) {
+    for (size_t block = 0; block < ds.open.size();) {
+      if (now - ds.open[block].first >= this->timeout_) {
+        this->Flush(ds, block);  // moves the last block into this index
+      } else {
+        block++;
+      }
+    }
+  }
+}
+
+void WriteCombiner::FlushAll(void) {
+  for (auto& ds : this->datasets_) {
+    while (ds.open.empty() == false) {
+      this->Flush(ds, ds.open.size() - 1);
+    }
+  }
+  if (this->blocks_written_ > 0) {
+    MLPD_INFO("Write combiner: %zu frame blocks, %zu single packet writes\n",
+              this->blocks_written_, this->direct_writes_);
+  }
+}
+
+void WriteCombiner::Flush(Dataset& ds, size_t block) {
+  Block& cur = ds.open[block];
+  if (ds.compressor_id == kUncompressed ||
+      this->compressor_->AddFrame(ds.compressor_id, cur.frame_id,
+                                  cur.samples.data()) == false) {
+    std::array<hsize_t, kDsDimsNum> offset = {cur.frame_id, 0, 0, 0, 0};
+    std::array<hsize_t, kDsDimsNum> count = ds.dims;
+    count[0] = 1;
+    this->hdf5_->extendDataset(ds.name, cur.frame_id);
+    this->hdf5_->writeDataset(ds.name, offset, count, cur.samples.data());
+  }
+  if (ds.written_any == false || cur.frame_id > ds.written_until) {
+    ds.written_until = cur.frame_id;
+  }
+  ds.written_any = true;
+  this->blocks_written_++;
+
+  this->spare_.push_back(std::move(cur.samples));
+  if (block != ds.open.size() - 1) {
+    ds.open[block] = std::move(ds.open.back());
+  }
+  ds.open.pop_back();
+  this->open_blocks_--;
+}
+
+void WriteCombiner::WriteDirect(Dataset& ds, hsize_t frame_id, hsize_t cell_id,
+                                hsize_t slot, hsize_t antenna, short* data) {
+  this->direct_writes_++;
+  if (ds.compressor_id != kUncompressed &&
+      this->compressor_->AddPacket(ds.compressor_id, frame_id, cell_id, slot,
+                                   antenna, data) == true) {
+    return;
+  }
+  std::array<hsize_t, kDsDimsNum> offset = {frame_id, cell_id, slot, antenna,
+                                            0};
+  std::array<hsize_t, kDsDimsNum> count = {1, 1, 1, 1, ds.dims[4]};
+  this->hdf5_->extendDataset(ds.name, frame_id);
+  this->hdf5_->writeDataset(ds.name, offset, count, data);
+}
+};  // namespace Sounder
@@ -0,0 +1,127 @@
+#!/usr/bin/python3
+"""
+ live_tap.py
+
+ Reader of the Sounder live tap: the shared memory ring of recently
+ recorded packets the sounder publishes with "live_tap" in its config.
+ The layout is documented in CC/Sounder/include/live_tap.h.
+ Usage format is:
+    ./live_tap.py [--name=/sounder_tap]
+
+ Example (prints packet rate and the packets this reader was too slow for):
+    ./live_tap.py --name=/sounder_tap
+
+ From other tools:
+    tap = LiveTap("/sounder_tap")
+    for hdr, iq in tap.packets():
+        ...
+
+---------------------------------------------------------------------
+ Copyright © 2018-2022. Rice University.
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+---------------------------------------------------------------------
+"""
+
+import mmap
+import os
+import struct
+import time
+from optparse import OptionParser
+import numpy as np
+
+HEADER_FMT = "<8s14I"
+NEXT_SEQ_OFFSET = 64
+RECORD_FMT = "<Q5I"
+RECORD_HEADER_BYTES = 64
+VERSION = 1
+
+
+class LiveTap:
+    """Read-only view of a live tap; never slows the sounder down."""
+
+    def __init__(self, name="/sounder_tap"):
+        fd = os.open("/dev/shm/" + name.lstrip("/"), os.O_RDONLY)
+        try:
+            self.mem = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        fields = struct.unpack_from(HEADER_FMT, self.mem, 0)
+        if fields[0].rstrip(b"\0") != b"SNDRTAP" or fields[1] != VERSION:
+            raise ValueError("%s is no live tap of version %d" %
+                             (name, VERSION))
+        (self.header_bytes, self.record_count, self.record_bytes,
+         self.payload_bytes, self.samps_per_slot, self.slot_per_frame,
+         self.num_cells, self.num_antennas) = fields[2:10]
+        # Start with the newest packet, not with what is left in the ring
+        self.next = self.next_seq()
+        self.dropped = 0
+
+    def next_seq(self):
+        return struct.unpack_from("<Q", self.mem, NEXT_SEQ_OFFSET)[0]
+
+    def read(self, seq):
+        """Packet seq as (header dict, complex64 samples).
+
+        None if it is not complete yet, "dropped" if it was overwritten or
+        its writer had to skip it.
+        """
+        offset = self.header_bytes + \
+            (seq % self.record_count) * self.record_bytes
+        lock = struct.unpack_from("<Q", self.mem, offset)[0]
+        if lock < 2 * seq + 2:
+            # Still written, or a writer skipped it and no one will
+            return "dropped" if seq + self.record_count <= self.next_seq() \
+                else None
+        if lock > 2 * seq + 2:
+            return "dropped"
+        fields = struct.unpack_from(RECORD_FMT, self.mem, offset)
+        start = offset + RECORD_HEADER_BYTES
+        iq = np.frombuffer(self.mem, dtype=np.int16,
+                           count=self.payload_bytes // 2, offset=start).copy()
+        if struct.unpack_from("<Q", self.mem, offset)[0] != lock:
+            return "dropped"
+        header = {"seq": seq, "frame_id": fields[1], "slot_id": fields[2],
+                  "cell_id": fields[3], "ant_id": fields[4],
+                  "node_type": fields[5]}
+        samples = (iq[0::2] + 1j * iq[1::2]).astype(np.complex64) / 32768
+        return header, samples
+
+    def packets(self, poll=0.001):
+        """Yields the packets from now on, skipping the ones missed."""
+        while True:
+            if self.next >= self.next_seq():
+                time.sleep(poll)
+                continue
+            pkt = self.read(self.next)
+            if pkt is None:
+                time.sleep(poll)
+                continue
+            if isinstance(pkt, str):
+                self.dropped += 1
+            else:
+                yield pkt
+            self.next += 1
+
+
+def main():
+    parser = OptionParser()
+    parser.add_option("--name", type="string", dest="name",
+                      default="/sounder_tap", help="live_tap of the sounder")
+    (options, args) = parser.parse_args()
+    tap = LiveTap(options.name)
+    print("%d packets of %d samples in the ring" %
+          (tap.record_count, tap.samps_per_slot))
+    count = 0
+    last = time.time()
+    for hdr, _ in tap.packets():
+        count += 1
+        now = time.time()
+        if now - last >= 1:
+            print("frame %d: %d packets/s, %d dropped so far" %
+                  (hdr["frame_id"], count / (now - last), tap.dropped))
+            count = 0
+            last = now
+
+
+if __name__ == '__main__':
+    main()